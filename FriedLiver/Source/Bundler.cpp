@@ -1,9 +1,14 @@
 #include "stdafx.h"
 #include "Bundler.h"
 #include "SiftGPU/SiftGPU.h"
+#include "SiftGPU/SiftCPU.h"
 #include "SiftGPU/SiftMatch.h"
+#include "SiftGPU/SiftMatchCPU.h"
+#include "SiftGPU/SIFTVocabularyTree.h"
+#include "SiftGPU/SIFTDescriptorIndex.h"
 #include "SiftGPU/MatrixConversion.h"
 #include "SiftGPU/SIFTMatchFilter.h"
+#include "SiftGPU/SIFTMatchFilterCPU.h"
 #include "CUDAImageManager.h"
 #include "CUDACache.h"
 
@@ -20,7 +25,7 @@ Bundler::Bundler(unsigned int maxNumImages, unsigned int maxNumKeysPerImage,
 	const mat4f& siftIntrinsicsInv, const CUDAImageManager* manager, bool isLocal)
 {
 	//initialize sift
-	initSift(GlobalBundlingState::get().s_widthSIFT, GlobalBundlingState::get().s_heightSIFT, isLocal);
+	initSift(GlobalBundlingState::get().s_widthSIFT, GlobalBundlingState::get().s_heightSIFT, manager, isLocal);
 	m_siftIntrinsicsInv = MatrixConversion::toCUDA(siftIntrinsicsInv);
 	m_siftIntrinsics = m_siftIntrinsicsInv.getInverse();
 	m_bIsLocal = isLocal;
@@ -54,24 +59,60 @@ Bundler::Bundler(unsigned int maxNumImages, unsigned int maxNumKeysPerImage,
 }
 
 
-void Bundler::initSift(unsigned int widthSift, unsigned int heightSift, bool isLocal)
+void Bundler::initSift(unsigned int widthSift, unsigned int heightSift, const CUDAImageManager* manager, bool isLocal)
 {
-	if (isLocal) {
+	m_sift = NULL;
+	m_siftCPU = NULL;
+	if (isLocal && GlobalBundlingState::get().s_useCPUSift) {
+		m_siftCPU = new SiftCPU;
+		m_siftCPU->SetParams(widthSift, heightSift, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax,
+			GlobalBundlingState::get().s_siftPyramidWorkers, GlobalBundlingState::get().s_useBinaryDescriptors);
+		m_siftCPU->SetCameraParams(manager->getSIFTDepthWidth(), manager->getSIFTDepthHeight(), GlobalBundlingState::get().s_minKeyScale);
+		m_siftCPU->InitSiftCPU();
+	}
+	else if (isLocal) {
 		m_sift = new SiftGPU;
-		m_sift->SetParams(widthSift, heightSift, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax);
+		m_sift->SetParams(widthSift, heightSift, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax,
+			GlobalBundlingState::get().s_siftPyramidWorkers, GlobalBundlingState::get().s_useBinaryDescriptors);
 		m_sift->InitSiftGPU();
 	}
+	//don't need detection for global
+	m_siftMatcher = NULL;
+	m_siftMatcherCPU = NULL;
+	if (GlobalBundlingState::get().s_useCPUSiftMatch || (!isLocal && GlobalBundlingState::get().s_guidedMatchRadius > 0.0f)) {
+		m_siftMatcherCPU = new SiftMatchCPU(GlobalBundlingState::get().s_maxNumKeysPerImage, GlobalBundlingState::get().s_useBinaryDescriptors);
+	}
 	else {
-		m_sift = NULL; //don't need detection for global
+		m_siftMatcher = new SiftMatchGPU(GlobalBundlingState::get().s_maxNumKeysPerImage, GlobalBundlingState::get().s_useBinaryDescriptors);
+		m_siftMatcher->InitSiftMatch();
+	}
+	m_vocabularyTree = NULL;
+	if (!isLocal && GlobalBundlingState::get().s_placeRecognitionTopK > 0) {
+		m_vocabularyTree = new SIFTVocabularyTree(GlobalBundlingState::get().s_placeRecognitionTrainFrames, GlobalBundlingState::get().s_useBinaryDescriptors);
 	}
-	m_siftMatcher = new SiftMatchGPU(GlobalBundlingState::get().s_maxNumKeysPerImage);
-	m_siftMatcher->InitSiftMatch();
+	m_descriptorIndex = NULL;
+	if (!isLocal && GlobalBundlingState::get().s_useDescriptorIndex) {
+		m_descriptorIndex = new SIFTDescriptorIndex(GlobalBundlingState::get().s_descriptorIndexTrainFrames, GlobalBundlingState::get().s_useBinaryDescriptors);
+	}
+	m_matchFilterCPU = NULL;
+	if (GlobalBundlingState::get().s_useCPUMatchFilter) {
+		m_matchFilterCPU = new SIFTMatchFilterCPU;
+		if (!GlobalBundlingState::get().s_matchFilterBenchmark) std::cout << "warning: s_useCPUMatchFilter is experimental, check it against the gpu filter with s_matchFilterBenchmark" << std::endl;
+	}
+	m_matchFilterCheckPairs = 0;
+	m_matchFilterCheckAcceptDiff = 0;
+	m_matchFilterCheckMatchDiff = 0;
 }
 
 Bundler::~Bundler()
 {
 	SAFE_DELETE(m_sift);
+	SAFE_DELETE(m_siftCPU);
 	SAFE_DELETE(m_siftMatcher);
+	SAFE_DELETE(m_siftMatcherCPU);
+	SAFE_DELETE(m_vocabularyTree);
+	SAFE_DELETE(m_descriptorIndex);
+	SAFE_DELETE(m_matchFilterCPU);
 
 	SAFE_DELETE(m_siftManager);
 	SAFE_DELETE(m_cudaCache);
@@ -91,15 +132,188 @@ void Bundler::getCacheIntrinsics(float4x4& intrinsics, float4x4& intrinsicsInv)
 void Bundler::detectFeatures(float* d_intensitySift, const float* d_inputDepthFilt)
 {
 	SIFTImageGPU& cur = m_siftManager->createSIFTImageGPU();
-	int success = m_sift->RunSIFT(d_intensitySift, d_inputDepthFilt);
+	int success = m_siftCPU ? m_siftCPU->RunSIFTCUDA(d_intensitySift, d_inputDepthFilt) : m_sift->RunSIFT(d_intensitySift, d_inputDepthFilt);
 	if (!success) throw MLIB_EXCEPTION("Error running SIFT detection");
-	unsigned int numKeypoints = m_sift->GetKeyPointsAndDescriptorsCUDA(cur, d_inputDepthFilt, m_siftManager->getMaxNumKeyPointsPerImage());
+	unsigned int numKeypoints = m_siftCPU ? m_siftCPU->GetKeyPointsAndDescriptorsCUDA(cur, m_siftManager->getMaxNumKeyPointsPerImage())
+		: m_sift->GetKeyPointsAndDescriptorsCUDA(cur, d_inputDepthFilt, m_siftManager->getMaxNumKeyPointsPerImage());
 
 	if (numKeypoints > GlobalBundlingState::get().s_maxNumKeysPerImage) throw MLIB_EXCEPTION("too many keypoints"); //should never happen
 
 	m_siftManager->finalizeSIFTImageGPU(numKeypoints);
 }
 
+bool Bundler::selectMatchCandidates(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int numKeys)
+{
+	//query before adding, a retry (curFrame < numFrames - 1) has been added already
+	std::vector<unsigned int> candidates;
+	const bool trained = m_vocabularyTree->isTrained();
+	if (trained) m_vocabularyTree->query(m_queryDescriptors.data(), numKeys, startFrame, numFrames, curFrame, GlobalBundlingState::get().s_placeRecognitionTopK, candidates);
+	if (curFrame + 1 == numFrames) m_vocabularyTree->addImage(curFrame, m_queryDescriptors.data(), numKeys);
+	if (!trained) return false;
+
+	const unsigned int temporalFrames = GlobalBundlingState::get().s_placeRecognitionTemporalFrames;
+	m_matchCandidates.assign(numFrames, 0);
+	for (unsigned int i = 0; i < candidates.size(); i++) m_matchCandidates[candidates[i]] = 1;
+	for (unsigned int f = std::max(curFrame, temporalFrames) - temporalFrames; f <= std::min(curFrame + temporalFrames, numFrames - 1); f++) m_matchCandidates[f] = 1;
+	m_matchCandidates[curFrame] = 0;
+
+	//the filters run over all pairs of [startFrame, numFrames), skipped pairs have no matches
+	uint2 keyPointOffset = make_uint2(0, 0);
+	ImagePairMatch& imagePairMatch = m_siftManager->getImagePairMatch(startFrame, curFrame, keyPointOffset);
+	MLIB_CUDA_SAFE_CALL(cudaMemset(imagePairMatch.d_numMatches, 0, sizeof(int) * (numFrames - startFrame)));
+	return true;
+}
+
+void Bundler::matchDescriptorIndex(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int numKeys, bool matchCandidates, float distMax, float ratioMax)
+{
+	const std::vector<int>& validImages = m_siftManager->getValidImages();
+	std::vector<int> imageMask(numFrames);
+	for (unsigned int f = startFrame; f < numFrames; f++) imageMask[f] = validImages[f] != 0 && (!matchCandidates || m_matchCandidates[f]);
+	std::vector<SIFTDescriptorIndex::Match> matches;
+	m_descriptorIndex->match(m_queryDescriptors.data(), numKeys, startFrame, numFrames, curFrame, imageMask.data(), distMax, ratioMax, matches);
+
+	uint2 keyPointOffset = make_uint2(0, 0);
+	ImagePairMatch& firstImagePairMatch = m_siftManager->getImagePairMatch(startFrame, curFrame, keyPointOffset);
+	MLIB_CUDA_SAFE_CALL(cudaMemset(firstImagePairMatch.d_numMatches, 0, sizeof(int) * (numFrames - startFrame)));
+
+	//matches are sorted by image and distance, keep the best MAX_MATCHES_PER_IMAGE_PAIR_RAW per pair
+	std::vector<uint2> keyPointIndices;
+	std::vector<float> matchDistances;
+	for (unsigned int i = 0; i < matches.size();) {
+		const unsigned int prev = matches[i].image;
+		ImagePairMatch& imagePairMatch = m_siftManager->getImagePairMatch(prev, curFrame, keyPointOffset);
+		keyPointIndices.clear();
+		matchDistances.clear();
+		for (; i < matches.size() && matches[i].image == prev; i++) {
+			if (keyPointIndices.size() == MAX_MATCHES_PER_IMAGE_PAIR_RAW) continue;
+			keyPointIndices.push_back(make_uint2(matches[i].imageKey + keyPointOffset.x, matches[i].queryKey + keyPointOffset.y));
+			matchDistances.push_back(matches[i].distance);
+		}
+		const int numMatches = (int)keyPointIndices.size();
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_numMatches, &numMatches, sizeof(int), cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_keyPointIndices, keyPointIndices.data(), sizeof(uint2) * numMatches, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_distances, matchDistances.data(), sizeof(float) * numMatches, cudaMemcpyHostToDevice));
+	}
+}
+
+//! s_cascadeMinNumMatches > 0: the kabsch statistics decide clear pairs before the dense verify
+static MatchFilterCascade getMatchFilterCascade()
+{
+	MatchFilterCascade cascade;
+	cascade.minNumMatches = GlobalBundlingState::get().s_cascadeMinNumMatches;
+	cascade.acceptRes2 = GlobalBundlingState::get().s_cascadeAcceptResidualRatio * GlobalBundlingState::get().s_maxKabschResidual2;
+	cascade.rejectRes2 = GlobalBundlingState::get().s_cascadeRejectResidualRatio * GlobalBundlingState::get().s_maxKabschResidual2;
+	return cascade;
+}
+
+//! s_denseVerifyPyramidLevels > 1: the dense verify starts at the coarsest cache level
+static DenseVerifyPyramid getDenseVerifyPyramid(const CUDACache* cudaCache)
+{
+	DenseVerifyPyramid pyramid;
+	pyramid.numLevels = cudaCache->getNumPyramidLevels();
+	for (unsigned int level = 0; level < pyramid.numLevels; level++) {
+		pyramid.width[level] = cudaCache->getPyramidWidth(level);
+		pyramid.height[level] = cudaCache->getPyramidHeight(level);
+		pyramid.intrinsics[level] = MatrixConversion::toCUDA(cudaCache->getPyramidIntrinsics(level));
+	}
+	pyramid.margin = GlobalBundlingState::get().s_denseVerifyPyramidMargin;
+	return pyramid;
+}
+
+void Bundler::filterMatchesFused(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches)
+{
+	m_siftManager->FilterMatchesFusedCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches,
+		GlobalBundlingState::get().s_maxKabschResidual2, GlobalBundlingState::get().s_surfAreaPcaThresh,
+		m_cudaCache->getWidth(), m_cudaCache->getHeight(), MatrixConversion::toCUDA(m_cudaCache->getIntrinsics()), m_cudaCache->getCacheFramesGPU(),
+		GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
+		GlobalBundlingState::get().s_projCorrColorThresh, GlobalBundlingState::get().s_verifySiftErrThresh, GlobalBundlingState::get().s_verifySiftCorrThresh,
+		GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, getMatchFilterCascade());
+}
+
+void Bundler::benchmarkMatchFilter(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches)
+{
+	//fused first, the separate stages sort the raw matches in place
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+	Timer timer;
+	filterMatchesFused(curFrame, startFrame, numFrames, minNumMatches);
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+	timer.stop();
+	const double msFused = timer.getElapsedTimeMS();
+	std::vector<unsigned int> numFusedMatches;
+	m_siftManager->getNumFiltMatchesDEBUG(numFusedMatches);
+
+	timer.start();
+	m_siftManager->SortKeyPointMatchesCU(curFrame, startFrame, numFrames);
+	m_siftManager->FilterKeyPointMatchesCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2);
+	m_siftManager->FilterMatchesBySurfaceAreaCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, GlobalBundlingState::get().s_surfAreaPcaThresh);
+	m_siftManager->FilterMatchesByDenseVerifyCU(curFrame, startFrame, numFrames, getDenseVerifyPyramid(m_cudaCache),
+		m_cudaCache->getCacheFramesGPU(), GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
+		GlobalBundlingState::get().s_projCorrColorThresh, GlobalBundlingState::get().s_verifySiftErrThresh, GlobalBundlingState::get().s_verifySiftCorrThresh,
+		GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, m_siftIntrinsicsInv, getMatchFilterCascade());
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+	timer.stop();
+	const double msSeparate = timer.getElapsedTimeMS();
+	std::vector<unsigned int> numSeparateMatches;
+	m_siftManager->getNumFiltMatchesDEBUG(numSeparateMatches);
+
+	unsigned int numPairs = 0, numValidFused = 0, numValidSeparate = 0, numDifferent = 0;
+	for (unsigned int i = startFrame; i < std::min(numFrames, (unsigned int)numSeparateMatches.size()); i++) {
+		if (i == curFrame) continue;
+		numPairs++;
+		if (numFusedMatches[i] > 0) numValidFused++;
+		if (numSeparateMatches[i] > 0) numValidSeparate++;
+		if (numFusedMatches[i] != numSeparateMatches[i]) numDifferent++;
+	}
+	std::cout << "match filter " << (m_bIsLocal ? "local" : "global") << " frame " << curFrame << " (" << numPairs << " pairs): separate "
+		<< msSeparate << " ms, fused " << msFused << " ms; valid pairs " << numValidSeparate << " / " << numValidFused;
+	if (numDifferent > 0) std::cout << " (" << numDifferent << " pairs differ)";
+	std::cout << std::endl;
+}
+
+void Bundler::compareMatchFilterCPU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches)
+{
+	const float maxKabschRes2 = GlobalBundlingState::get().s_maxKabschResidual2;
+	m_siftManager->SortKeyPointMatchesCU(curFrame, startFrame, numFrames);
+
+	std::vector<uint2> gpuIndices, cpuIndices;
+	std::vector<unsigned int> gpuNumMatches, cpuNumMatches;
+	std::vector<float4x4> gpuTransforms(numFrames), cpuTransforms(numFrames);
+	m_siftManager->FilterKeyPointMatchesCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, maxKabschRes2);
+	m_siftManager->getCurrMatchKeyPointIndicesDEBUG(gpuIndices, gpuNumMatches, true);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(gpuTransforms.data(), m_siftManager->getFiltTransformsToWorldGPU(), sizeof(float4x4)*numFrames, cudaMemcpyDeviceToHost));
+	m_matchFilterCPU->filterKeyPointMatchesCUDA(m_siftManager, curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, maxKabschRes2);
+	m_siftManager->getCurrMatchKeyPointIndicesDEBUG(cpuIndices, cpuNumMatches, true);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(cpuTransforms.data(), m_siftManager->getFiltTransformsToWorldGPU(), sizeof(float4x4)*numFrames, cudaMemcpyDeviceToHost));
+
+	unsigned int numPairs = 0, numAcceptedGPU = 0, numAcceptedCPU = 0, numAcceptDiff = 0, numMatchDiff = 0;
+	float maxTransformDiff = 0.0f;
+	for (unsigned int i = startFrame; i < numFrames; i++) {
+		if (i == curFrame) continue;
+		numPairs++;
+		const bool acceptedGPU = gpuNumMatches[i] > 0, acceptedCPU = cpuNumMatches[i] > 0;
+		if (acceptedGPU) numAcceptedGPU++;
+		if (acceptedCPU) numAcceptedCPU++;
+		if (acceptedGPU != acceptedCPU) { numAcceptDiff++; continue; }
+		if (!acceptedGPU) continue;
+		bool same = gpuNumMatches[i] == cpuNumMatches[i];
+		for (unsigned int m = 0; same && m < gpuNumMatches[i]; m++) {
+			const uint2& g = gpuIndices[i * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + m];
+			const uint2& c = cpuIndices[i * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + m];
+			same = g.x == c.x && g.y == c.y;
+		}
+		if (!same) { numMatchDiff++; continue; }
+		for (unsigned int k = 0; k < 16; k++)
+			maxTransformDiff = std::max(maxTransformDiff, std::fabs(gpuTransforms[i].entries[k] - cpuTransforms[i].entries[k]));
+	}
+	m_matchFilterCheckPairs += numPairs;
+	m_matchFilterCheckAcceptDiff += numAcceptDiff;
+	m_matchFilterCheckMatchDiff += numMatchDiff;
+	std::cout << "cpu match filter " << (m_bIsLocal ? "local" : "global") << " frame " << curFrame << " (" << numPairs << " pairs): accepted gpu "
+		<< numAcceptedGPU << " / cpu " << numAcceptedCPU << ", accept differs " << numAcceptDiff << ", match set differs " << numMatchDiff
+		<< ", max transform diff " << maxTransformDiff << " | total " << m_matchFilterCheckAcceptDiff << " + " << m_matchFilterCheckMatchDiff
+		<< " / " << m_matchFilterCheckPairs << " pairs differ" << std::endl;
+}
+
 unsigned int Bundler::matchAndFilter()
 {
 	const unsigned int numFrames = m_siftManager->getNumImages();
@@ -113,25 +327,84 @@ unsigned int Bundler::matchAndFilter()
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
 	int num2 = (int)m_siftManager->getNumKeyPointsPerImage(curFrame);
 	if (num2 == 0) return (unsigned int)-1;
+	//the current frame is downloaded (and widened) once for all pairs
+	if (m_siftMatcherCPU) m_siftMatcherCPU->SetDescriptorsCUDA(1, num2, (unsigned char*)m_siftManager->getImageGPU(curFrame).d_keyPointDescs);
+
+	float ratioMax = m_bIsLocal ? GlobalBundlingState::get().s_siftMatchRatioMaxLocal : GlobalBundlingState::get().s_siftMatchRatioMaxGlobal; //TODO do we need two different here?
+	const float distMax = GlobalBundlingState::get().s_useBinaryDescriptors ?
+		SiftMatchGPU::HammingToDistance(GlobalBundlingState::get().s_binaryMatchMaxHamming) : GlobalBundlingState::get().s_siftMatchThresh;
+	if (m_vocabularyTree || m_descriptorIndex) {
+		m_queryDescriptors.resize(num2 * 128);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_queryDescriptors.data(), m_siftManager->getImageGPU(curFrame).d_keyPointDescs, sizeof(unsigned char) * 128 * num2, cudaMemcpyDeviceToHost));
+	}
+	//global: only the vocabulary tree candidates (once it is trained)
+	const bool matchCandidates = m_vocabularyTree && selectMatchCandidates(curFrame, startFrame, numFrames, num2);
 
-	for (unsigned int prev = startFrame; prev < numFrames; prev++) {
-		if (prev == curFrame) continue;
-		uint2 keyPointOffset = make_uint2(0, 0);
-		ImagePairMatch& imagePairMatch = m_siftManager->getImagePairMatch(prev, curFrame, keyPointOffset);
-
-		SIFTImageGPU& image_i = m_siftManager->getImageGPU(prev);
-		SIFTImageGPU& image_j = m_siftManager->getImageGPU(curFrame);
-		int num1 = (int)m_siftManager->getNumKeyPointsPerImage(prev);
-
-		if (validImages[prev] == 0 || num1 == 0 || num2 == 0) {
-			unsigned int numMatch = 0;
-			MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_numMatches, &numMatch, sizeof(unsigned int), cudaMemcpyHostToDevice));
+	const unsigned int batchImages = GlobalBundlingState::get().s_siftMatchBatchImages;
+	if (m_descriptorIndex && m_descriptorIndex->isTrained()) {
+		matchDescriptorIndex(curFrame, startFrame, numFrames, num2, matchCandidates, distMax, ratioMax);
+	}
+	else if (m_siftMatcher && batchImages > 1) {
+		//the previous frames ([startFrame, curFrame) or [curFrame + 1, numFrames)) are stored back to back, match them in passes of batchImages
+		const unsigned int endFrame = startFrame > curFrame ? numFrames : curFrame;
+		std::vector<unsigned int> numKeysPerImage(endFrame - startFrame);
+		for (unsigned int prev = startFrame; prev < endFrame; prev++) numKeysPerImage[prev - startFrame] = m_siftManager->getNumKeyPointsPerImage(prev);
+		m_siftMatcher->SetDescriptors(1, num2, (unsigned char*)m_siftManager->getImageGPU(curFrame).d_keyPointDescs);
+		for (unsigned int prev = startFrame, numImages = 0; prev < endFrame; prev += numImages) {
+			numImages = std::min(batchImages, endFrame - prev);
+			if (matchCandidates) { //runs of consecutive candidates
+				while (prev < endFrame && !m_matchCandidates[prev]) prev++;
+				if (prev == endFrame) break;
+				numImages = 0;
+				while (numImages < batchImages && prev + numImages < endFrame && m_matchCandidates[prev + numImages]) numImages++;
+			}
+			uint2 keyPointOffset = make_uint2(0, 0);
+			ImagePairMatch& imagePairMatch = m_siftManager->getImagePairMatch(prev, curFrame, keyPointOffset);
+			m_siftMatcher->GetSiftMatchBatch(numImages, numKeysPerImage.data() + prev - startFrame, validImages.data() + prev,
+				(unsigned char*)m_siftManager->getImageGPU(prev).d_keyPointDescs, imagePairMatch, keyPointOffset, distMax, ratioMax);
 		}
-		else {
-			m_siftMatcher->SetDescriptors(0, num1, (unsigned char*)image_i.d_keyPointDescs);
-			m_siftMatcher->SetDescriptors(1, num2, (unsigned char*)image_j.d_keyPointDescs);
-			float ratioMax = m_bIsLocal ? GlobalBundlingState::get().s_siftMatchRatioMaxLocal : GlobalBundlingState::get().s_siftMatchRatioMaxGlobal; //TODO do we need two different here?
-			m_siftMatcher->GetSiftMatch(num1, imagePairMatch, keyPointOffset, GlobalBundlingState::get().s_siftMatchThresh, ratioMax);
+	}
+	else {
+		//guided matching: the trajectory estimate predicts where the keys of prev are in curFrame
+		//global only: the local trajectory is the identity until the submap is solved, i.e., there is no motion prior
+		const float guidedMatchRadius = (m_siftMatcherCPU && !m_bIsLocal) ? GlobalBundlingState::get().s_guidedMatchRadius : 0.0f;
+		std::vector<float4x4> trajectory;
+		if (guidedMatchRadius > 0.0f) {
+			trajectory.resize(numFrames);
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(trajectory.data(), d_trajectory, sizeof(float4x4) * numFrames, cudaMemcpyDeviceToHost));
+			m_siftMatcherCPU->SetKeyPointsCUDA(1, num2, m_siftManager->getImageGPU(curFrame).d_keyPoints);
+		}
+		for (unsigned int prev = startFrame; prev < numFrames; prev++) {
+			if (prev == curFrame || (matchCandidates && !m_matchCandidates[prev])) continue;
+			uint2 keyPointOffset = make_uint2(0, 0);
+			ImagePairMatch& imagePairMatch = m_siftManager->getImagePairMatch(prev, curFrame, keyPointOffset);
+
+			SIFTImageGPU& image_i = m_siftManager->getImageGPU(prev);
+			SIFTImageGPU& image_j = m_siftManager->getImageGPU(curFrame);
+			int num1 = (int)m_siftManager->getNumKeyPointsPerImage(prev);
+
+			if (validImages[prev] == 0 || num1 == 0 || num2 == 0) {
+				unsigned int numMatch = 0;
+				MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_numMatches, &numMatch, sizeof(unsigned int), cudaMemcpyHostToDevice));
+			}
+			else {
+				if (m_siftMatcherCPU) {
+					m_siftMatcherCPU->SetDescriptorsCUDA(0, num1, (unsigned char*)image_i.d_keyPointDescs);
+					if (guidedMatchRadius > 0.0f) {
+						m_siftMatcherCPU->SetKeyPointsCUDA(0, num1, image_i.d_keyPoints);
+						const float4x4 transform = trajectory[curFrame].getInverse() * trajectory[prev];
+						m_siftMatcherCPU->GetSiftMatchGuidedCUDA(num1, imagePairMatch, keyPointOffset, transform, m_siftIntrinsics, m_siftIntrinsicsInv, guidedMatchRadius, distMax, ratioMax);
+					}
+					else {
+						m_siftMatcherCPU->GetSiftMatchCUDA(num1, imagePairMatch, keyPointOffset, distMax, ratioMax);
+					}
+				}
+				else {
+					m_siftMatcher->SetDescriptors(0, num1, (unsigned char*)image_i.d_keyPointDescs);
+					m_siftMatcher->SetDescriptors(1, num2, (unsigned char*)image_j.d_keyPointDescs);
+					m_siftMatcher->GetSiftMatch(num1, imagePairMatch, keyPointOffset, distMax, ratioMax);
+				}
+			}
 		}
 	}
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeSiftMatching = m_timer.getElapsedTimeMS(); }
@@ -139,76 +412,116 @@ unsigned int Bundler::matchAndFilter()
 	unsigned int lastMatchedFrame = (unsigned int)-1;
 	if (curFrame > 0) { // can have a match to another frame
 
-		// --- sort the current key point matches
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
-		m_siftManager->SortKeyPointMatchesCU(curFrame, startFrame, numFrames);
+		const unsigned int minNumMatches = m_bIsLocal ? GlobalBundlingState::get().s_minNumMatchesLocal : GlobalBundlingState::get().s_minNumMatchesGlobal;
+		if (GlobalBundlingState::get().s_matchFilterBenchmark) {
+			benchmarkMatchFilter(curFrame, startFrame, numFrames, minNumMatches);
+			if (m_matchFilterCPU) compareMatchFilterCPU(curFrame, startFrame, numFrames, minNumMatches);
+		}
+		m_siftManager->resetMatchFilterCountsCU();
+		if (GlobalBundlingState::get().s_useFusedMatchFilter) {
+			// --- sort, filter key point matches, surface area and dense verify in one pass
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
+			filterMatchesFused(curFrame, startFrame, numFrames, minNumMatches);
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterKeyPoint = m_timer.getElapsedTimeMS(); }
 #ifdef EVALUATE_SPARSE_CORRESPONDENCES
-		if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), false, true, false, "raw");
+			if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, true, "dense");
 #endif
-		////debugging
-		//const bool usedebug = true;//!m_bIsLocal;// && curFrame >= 49;
-		//std::vector<unsigned int> numMatches;
-		//if (usedebug) {
-		//	m_siftManager->getNumRawMatchesDEBUG(numMatches);
-		//	SiftVisualization::printCurrentMatches("debug/rawMatches/", m_siftManager, m_cudaCache, false);
-		//	int a = 5;
-		//}
-		////debugging
+		}
+		else {
+			// --- sort the current key point matches
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
+			m_siftManager->SortKeyPointMatchesCU(curFrame, startFrame, numFrames);
+#ifdef EVALUATE_SPARSE_CORRESPONDENCES
+			if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), false, true, false, "raw");
+#endif
+			////debugging
+			//const bool usedebug = true;//!m_bIsLocal;// && curFrame >= 49;
+			//std::vector<unsigned int> numMatches;
+			//if (usedebug) {
+			//	m_siftManager->getNumRawMatchesDEBUG(numMatches);
+			//	SiftVisualization::printCurrentMatches("debug/rawMatches/", m_siftManager, m_cudaCache, false);
+			//	int a = 5;
+			//}
+			////debugging
 
-		// --- filter matches
-		const unsigned int minNumMatches = m_bIsLocal ? GlobalBundlingState::get().s_minNumMatchesLocal : GlobalBundlingState::get().s_minNumMatchesGlobal;
-		//SIFTMatchFilter::ransacKeyPointMatches(siftManager, siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2, false);
-		//SIFTMatchFilter::filterKeyPointMatches(siftManager, siftIntrinsicsInv, minNumMatches);
-		m_siftManager->FilterKeyPointMatchesCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2);
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterKeyPoint = m_timer.getElapsedTimeMS(); }
+			// --- filter matches
+			//SIFTMatchFilter::filterKeyPointMatches(siftManager, siftIntrinsicsInv, minNumMatches);
+			if (GlobalBundlingState::get().s_useRansacMatchFilter) {
+				SIFTMatchFilter::ransacKeyPointMatches(m_siftManager, curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2, false);
+				if (GlobalBundlingState::get().s_enableGlobalTimings) {
+					const std::vector<unsigned int>& numHypotheses = SIFTMatchFilter::getNumRansacHypotheses();
+					const std::vector<uint2>& numMatches = SIFTMatchFilter::getNumRansacMatches();
+					TimingLog::FrameTiming& frameTiming = TimingLog::getFrameTiming(m_bIsLocal);
+					for (unsigned int i = 0; i < numHypotheses.size(); i++) {
+						frameTiming.numRansacHypotheses += numHypotheses[i];
+						if (numMatches[i].x == 0) continue;
+						TimingLog::RansacImagePair pair = { startFrame + i, numMatches[i].x, numMatches[i].y, numHypotheses[i] };
+						frameTiming.ransacImagePairs.push_back(pair);
+					}
+				}
+			}
+			else if (m_matchFilterCPU) m_matchFilterCPU->filterKeyPointMatchesCUDA(m_siftManager, curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2);
+			else m_siftManager->FilterKeyPointMatchesCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, minNumMatches, GlobalBundlingState::get().s_maxKabschResidual2);
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterKeyPoint = m_timer.getElapsedTimeMS(); }
 #ifdef EVALUATE_SPARSE_CORRESPONDENCES
-		if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, false, "kabsch");
+			if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, false, "kabsch");
 #endif
-		////debugging
-		//if (usedebug) {
-		//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
-		//	SiftVisualization::printCurrentMatches("debug/matchesKeyFilt/", m_siftManager, m_cudaCache, true);
-		//	int a = 5;
-		//}
-		////debugging
+			////debugging
+			//if (usedebug) {
+			//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
+			//	SiftVisualization::printCurrentMatches("debug/matchesKeyFilt/", m_siftManager, m_cudaCache, true);
+			//	int a = 5;
+			//}
+			////debugging
 
-		// --- surface area filter
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
-		//const std::vector<CUDACachedFrame>& cachedFrames = cudaCache->getCacheFrames();
-		//SIFTMatchFilter::filterBySurfaceArea(siftManager, cachedFrames);
-		m_siftManager->FilterMatchesBySurfaceAreaCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, GlobalBundlingState::get().s_surfAreaPcaThresh);
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterSurfaceArea = m_timer.getElapsedTimeMS(); }
+			// --- surface area filter
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
+			//const std::vector<CUDACachedFrame>& cachedFrames = cudaCache->getCacheFrames();
+			//SIFTMatchFilter::filterBySurfaceArea(siftManager, cachedFrames);
+			m_siftManager->FilterMatchesBySurfaceAreaCU(curFrame, startFrame, numFrames, m_siftIntrinsicsInv, GlobalBundlingState::get().s_surfAreaPcaThresh);
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterSurfaceArea = m_timer.getElapsedTimeMS(); }
 #ifdef EVALUATE_SPARSE_CORRESPONDENCES
-		if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, false, "sa");
+			if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, false, "sa");
 #endif
-		////debugging
-		//if (usedebug) {
-		//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
-		//	SiftVisualization::printCurrentMatches("debug/matchesSAFilt/", m_siftManager, m_cudaCache, true);
-		//	int a = 5;
-		//}
-		////debugging
+			////debugging
+			//if (usedebug) {
+			//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
+			//	SiftVisualization::printCurrentMatches("debug/matchesSAFilt/", m_siftManager, m_cudaCache, true);
+			//	int a = 5;
+			//}
+			////debugging
 
-		// --- dense verify filter
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
-		//SIFTMatchFilter::filterByDenseVerify(siftManager, cachedFrames);
-		const CUDACachedFrame* cachedFramesCUDA = m_cudaCache->getCacheFramesGPU();
-		m_siftManager->FilterMatchesByDenseVerifyCU(curFrame, startFrame, numFrames, m_cudaCache->getWidth(), m_cudaCache->getHeight(), MatrixConversion::toCUDA(m_cudaCache->getIntrinsics()),
-			cachedFramesCUDA, GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
-			GlobalBundlingState::get().s_projCorrColorThresh, GlobalBundlingState::get().s_verifySiftErrThresh, GlobalBundlingState::get().s_verifySiftCorrThresh,
-			GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax);
-		//0.1f, 3.0f);
-		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterDenseVerify = m_timer.getElapsedTimeMS(); }
+			// --- dense verify filter
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
+			//SIFTMatchFilter::filterByDenseVerify(siftManager, cachedFrames);
+			const CUDACachedFrame* cachedFramesCUDA = m_cudaCache->getCacheFramesGPU();
+			m_siftManager->FilterMatchesByDenseVerifyCU(curFrame, startFrame, numFrames, getDenseVerifyPyramid(m_cudaCache),
+				cachedFramesCUDA, GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
+				GlobalBundlingState::get().s_projCorrColorThresh, GlobalBundlingState::get().s_verifySiftErrThresh, GlobalBundlingState::get().s_verifySiftCorrThresh,
+				GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, m_siftIntrinsicsInv, getMatchFilterCascade());
+			//0.1f, 3.0f);
+			if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.stop(); TimingLog::getFrameTiming(m_bIsLocal).timeMatchFilterDenseVerify = m_timer.getElapsedTimeMS(); }
 #ifdef EVALUATE_SPARSE_CORRESPONDENCES
-		if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, true, "dense");
+			if (m_corrEvaluator) m_corrEvaluator->evaluate(m_siftManager, m_cudaCache, MatrixConversion::toMlib(m_siftIntrinsicsInv), true, false, true, "dense");
 #endif
-		////debugging
-		//if (usedebug) {
-		//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
-		//	SiftVisualization::printCurrentMatches("debug/filtMatches/", m_siftManager, m_cudaCache, true);
-		//	int a = 5;
-		//}
-		////debugging
+			////debugging
+			//if (usedebug) {
+			//	m_siftManager->getNumFiltMatchesDEBUG(numMatches);
+			//	SiftVisualization::printCurrentMatches("debug/filtMatches/", m_siftManager, m_cudaCache, true);
+			//	int a = 5;
+			//}
+			////debugging
+		}
+		if (GlobalBundlingState::get().s_enableGlobalTimings) {
+			std::vector<int> counts;
+			m_siftManager->getMatchFilterCounts(counts);
+			TimingLog::FrameTiming& frameTiming = TimingLog::getFrameTiming(m_bIsLocal);
+			frameTiming.numRejectedKeyPoint = counts[MATCH_FILTER_REJECTED_KEY_POINT];
+			frameTiming.numRejectedSurfaceArea = counts[MATCH_FILTER_REJECTED_SURFACE_AREA];
+			frameTiming.numRejectedCascade = counts[MATCH_FILTER_REJECTED_CASCADE];
+			frameTiming.numAcceptedCascade = counts[MATCH_FILTER_ACCEPTED_CASCADE];
+			frameTiming.numRejectedDenseVerify = counts[MATCH_FILTER_REJECTED_DENSE_VERIFY];
+		}
 
 		// --- filter frames
 		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
@@ -260,8 +573,7 @@ bool Bundler::optimize(unsigned int numNonLinIterations, unsigned int numLinIter
 		if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
 		const CUDACachedFrame* cachedFramesCUDA = m_cudaCache->getCacheFramesGPU();
 		int valid = m_siftManager->VerifyTrajectoryCU(m_siftManager->getNumImages(), d_trajectory,
-			m_cudaCache->getWidth(), m_cudaCache->getHeight(), MatrixConversion::toCUDA(m_cudaCache->getIntrinsics()),
-			cachedFramesCUDA, GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
+			getDenseVerifyPyramid(m_cudaCache), cachedFramesCUDA, GlobalBundlingState::get().s_projCorrDistThres, GlobalBundlingState::get().s_projCorrNormalThres,
 			GlobalBundlingState::get().s_projCorrColorThresh, GlobalBundlingState::get().s_verifyOptErrThresh, GlobalBundlingState::get().s_verifyOptCorrThresh,
 			//GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax); //TODO PARAMS
 			0.1f, 3.0f);
@@ -357,6 +669,8 @@ void Bundler::reset()
 	MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_trajectory, trajectory.data(), sizeof(mat4f)*trajectory.size(), cudaMemcpyHostToDevice));
 	m_siftManager->reset();
 	m_cudaCache->reset();
+	if (m_vocabularyTree) m_vocabularyTree->reset();
+	if (m_descriptorIndex) m_descriptorIndex->reset();
 }
 
 void Bundler::addInvalidFrame()
@@ -389,6 +703,13 @@ void Bundler::fuseToGlobal(Bundler* glob)
 {
 	m_siftManager->fuseToGlobal(glob->m_siftManager, m_siftIntrinsics, d_trajectory, m_siftIntrinsicsInv);	//sparse features
 	glob->m_cudaCache->copyCacheFrameFrom(m_cudaCache, 0);													//dense frames
+	if (glob->m_descriptorIndex) {	//index the new global frame
+		const unsigned int imageIdx = glob->m_siftManager->getNumImages() - 1;
+		const unsigned int numKeys = glob->m_siftManager->getNumKeyPointsPerImage(imageIdx);
+		std::vector<unsigned char> descriptors(numKeys * 128);
+		if (numKeys > 0) MLIB_CUDA_SAFE_CALL(cudaMemcpy(descriptors.data(), glob->m_siftManager->getImageGPU(imageIdx).d_keyPointDescs, sizeof(unsigned char) * 128 * numKeys, cudaMemcpyDeviceToHost));
+		glob->m_descriptorIndex->addImage(imageIdx, descriptors.data(), numKeys);
+	}
 	//fuse local depth frames for global cache //TODO TRY THIS
 	//m_cudaCache->fuseDepthFrames(glob->m_cudaCache, m_siftManager->getValidImagesGPU(), d_trajectory); //valid images have been updated in the solve
 }
@@ -6,7 +6,12 @@
 #endif
 
 class SiftGPU;
+class SiftCPU;
 class SiftMatchGPU;
+class SiftMatchCPU;
+class SIFTVocabularyTree;
+class SIFTDescriptorIndex;
+class SIFTMatchFilterCPU;
 class SIFTImageManager;
 class CUDACache;
 class CUDAImageManager;
@@ -70,7 +75,17 @@ public:
 	//TODO logging for residual information
 
 private:
-	void initSift(unsigned int widthSift, unsigned int heightSift, bool isLocal);
+	void initSift(unsigned int widthSift, unsigned int heightSift, const CUDAImageManager* manager, bool isLocal);
+	//! adds curFrame (m_queryDescriptors) to the vocabulary tree and sets m_matchCandidates for [startFrame, numFrames); false if all frames must be matched
+	bool selectMatchCandidates(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int numKeys);
+	//! raw matches of curFrame to [startFrame, numFrames) from m_descriptorIndex (instead of the matcher)
+	void matchDescriptorIndex(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int numKeys, bool matchCandidates, float distMax, float ratioMax);
+	//! all match filters of curFrame to [startFrame, numFrames) in one kernel (s_useFusedMatchFilter)
+	void filterMatchesFused(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches);
+	//! s_matchFilterBenchmark: times the fused and the separate gpu filter stages on the current matches and prints both latencies
+	void benchmarkMatchFilter(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches);
+	//! s_matchFilterBenchmark with m_matchFilterCPU: runs it and FilterKeyPointMatchesCU on the same sorted raw matches and prints where the accepted pairs and match sets differ
+	void compareMatchFilterCPU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int minNumMatches);
 
 	void initializeNextTransformUnknown() {
 		const unsigned int numFrames = m_siftManager->getNumImages();
@@ -80,7 +95,17 @@ private:
 
 	//*********** SIFT *******************
 	SiftGPU*				m_sift;
+	SiftCPU*				m_siftCPU;		//replaces m_sift with s_useCPUSift
 	SiftMatchGPU*			m_siftMatcher;
+	SiftMatchCPU*			m_siftMatcherCPU;	//replaces m_siftMatcher with s_useCPUSiftMatch or s_guidedMatchRadius (global)
+	SIFTVocabularyTree*		m_vocabularyTree;	//global only, with s_placeRecognitionTopK
+	SIFTDescriptorIndex*	m_descriptorIndex;	//global only, with s_useDescriptorIndex
+	std::vector<unsigned char>	m_queryDescriptors;	//host copy of the current frame descriptors for the above
+	std::vector<int>			m_matchCandidates;	//per frame
+	SIFTMatchFilterCPU*		m_matchFilterCPU;	//replaces FilterKeyPointMatchesCU with s_useCPUMatchFilter
+	unsigned int			m_matchFilterCheckPairs;		//compareMatchFilterCPU: pairs compared so far
+	unsigned int			m_matchFilterCheckAcceptDiff;	//one filter accepted, the other rejected
+	unsigned int			m_matchFilterCheckMatchDiff;	//both accepted, different filtered matches
 	float4x4				m_siftIntrinsics;
 	float4x4				m_siftIntrinsicsInv;
 
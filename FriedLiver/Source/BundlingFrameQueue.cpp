@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "BundlingFrameQueue.h"
+
+#include <thread>
+#include <chrono>
+
+BundlingFrameQueue::BundlingFrameQueue()
+{
+	m_head = 0;
+	m_mid = 0;
+	m_tail = 0;
+	m_bShutdown = false;
+
+	m_numPushed = 0;
+	m_numFullStalls = 0;
+	m_timeFullStallsMS = 0.0;
+	m_maxInFlight = 0;
+	m_sumInFlight = 0.0;
+	m_numEmptyWaits = 0;
+	m_timeEmptyWaitsMS = 0.0;
+}
+
+BundlingFrameQueue::~BundlingFrameQueue()
+{
+	free();
+}
+
+void BundlingFrameQueue::alloc(unsigned int numFrames, unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight)
+{
+	free();
+	if (numFrames == 0) throw MLIB_EXCEPTION("bundling queue needs at least one frame");
+
+	m_frames.resize(numFrames);
+	for (Frame& f : m_frames) {
+		f.frameIdx = (unsigned int)-1;
+		f.bEndOfSequence = false;
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&f.d_depthRaw, sizeof(float)*depthWidth*depthHeight));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&f.d_depthFilt, sizeof(float)*depthWidth*depthHeight));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&f.d_color, sizeof(uchar4)*colorWidth*colorHeight));
+		f.bValidTransform = false;
+		f.bGlobalTrackingLost = false;
+		f.transform.setZero(-std::numeric_limits<float>::infinity());
+	}
+	m_head = 0;
+	m_mid = 0;
+	m_tail = 0;
+	m_bShutdown = false;
+}
+
+void BundlingFrameQueue::free()
+{
+	for (Frame& f : m_frames) {
+		MLIB_CUDA_SAFE_FREE(f.d_depthRaw);
+		MLIB_CUDA_SAFE_FREE(f.d_depthFilt);
+		MLIB_CUDA_SAFE_FREE(f.d_color);
+	}
+	m_frames.clear();
+}
+
+BundlingFrameQueue::Frame* BundlingFrameQueue::getPushFrame()
+{
+	if (isFull()) return NULL;
+	return &m_frames[m_tail.load(std::memory_order_relaxed) % getCapacity()];
+}
+
+void BundlingFrameQueue::push()
+{
+	MLIB_ASSERT(!isFull());
+	//the bundling thread reads the slot from its own (possibly different) device
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+
+	const unsigned int numInFlight = getNumFramesInFlight() + 1;
+	m_numPushed++;
+	m_sumInFlight += numInFlight;
+	m_maxInFlight = std::max(m_maxInFlight, numInFlight);
+
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool BundlingFrameQueue::pushEndOfSequence(unsigned int lastFrameIdx)
+{
+	Frame* f = getPushFrame();
+	if (!f) return false;
+	f->frameIdx = lastFrameIdx;
+	f->bEndOfSequence = true;
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	return true;
+}
+
+BundlingFrameQueue::Frame* BundlingFrameQueue::getResult()
+{
+	const unsigned int head = m_head.load(std::memory_order_relaxed);
+	if (head == m_mid.load(std::memory_order_acquire)) return NULL;
+	return &m_frames[head % getCapacity()];
+}
+
+BundlingFrameQueue::Frame* BundlingFrameQueue::waitForResult()
+{
+	Frame* f = getResult();
+	if (f || !isFull()) return f;
+
+	Timer t;
+	m_numFullStalls++;
+	for (unsigned int iter = 0; !(f = getResult()); iter++) {
+		if (m_bShutdown) return NULL;
+		backOff(iter);
+	}
+	m_timeFullStallsMS += t.getElapsedTimeMS();
+	return f;
+}
+
+void BundlingFrameQueue::popResult()
+{
+	const unsigned int head = m_head.load(std::memory_order_relaxed);
+	MLIB_ASSERT(head != m_mid.load(std::memory_order_acquire));
+	m_frames[head % getCapacity()].bEndOfSequence = false;
+	m_head.store(head + 1, std::memory_order_release);
+}
+
+bool BundlingFrameQueue::waitForInput()
+{
+	if (getInput()) return true;
+
+	Timer t;
+	m_numEmptyWaits++;
+	for (unsigned int iter = 0; !getInput(); iter++) {
+		if (m_bShutdown) return false;
+		backOff(iter);
+	}
+	m_timeEmptyWaitsMS += t.getElapsedTimeMS();
+	return true;
+}
+
+BundlingFrameQueue::Frame* BundlingFrameQueue::getInput()
+{
+	const unsigned int mid = m_mid.load(std::memory_order_relaxed);
+	if (mid == m_tail.load(std::memory_order_acquire)) return NULL;
+	return &m_frames[mid % getCapacity()];
+}
+
+void BundlingFrameQueue::finishInput()
+{
+	const unsigned int mid = m_mid.load(std::memory_order_relaxed);
+	MLIB_ASSERT(mid != m_tail.load(std::memory_order_acquire));
+	m_mid.store(mid + 1, std::memory_order_release);
+}
+
+void BundlingFrameQueue::backOff(unsigned int iter)
+{
+	//spin briefly (sift frames are short), then stop burning the core
+	if (iter < 64) std::this_thread::yield();
+	else std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+void BundlingFrameQueue::printStats(std::ostream& out /*= std::cout*/) const
+{
+	out << "=============== BUNDLING QUEUE ===============" << std::endl;
+	out << "capacity = " << getCapacity() << std::endl;
+	out << "#frames pushed = " << m_numPushed << std::endl;
+	out << "avg #frames in flight = " << (m_numPushed > 0 ? m_sumInFlight / m_numPushed : 0.0) << " (max " << m_maxInFlight << ")" << std::endl;
+	out << "recon stalls (queue full) = " << m_numFullStalls << " [" << m_timeFullStallsMS << " ms]" << std::endl;
+	out << "bundling stalls (queue empty) = " << m_numEmptyWaits << " [" << m_timeEmptyWaitsMS << " ms]" << std::endl;
+}
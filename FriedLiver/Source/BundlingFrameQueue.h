@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <iostream>
+
+#include <cuda_runtime.h>
+
+//! bounded lock-free single-producer/single-consumer frame pipeline between depth sensing and bundling
+//! each slot passes three stages, every index is written by exactly one thread:
+//!   [head, mid): processed by bundling, waiting for integration (recon thread pops at head)
+//!   [mid, tail): filled by CUDAImageManager::process, waiting for OnlineBundler::processInput (bundling thread advances mid)
+//! recon may run up to getCapacity() frames ahead of sift detection/matching before it has to wait (back-pressure)
+class BundlingFrameQueue
+{
+public:
+	struct Frame {
+		unsigned int	frameIdx;
+		bool			bEndOfSequence;		//no input data; lets bundling keep optimizing after the last frame
+
+		//input (sensor resolution, allocated on the reconstruction gpu)
+		float*			d_depthRaw;
+		float*			d_depthFilt;
+		uchar4*			d_color;
+
+		//result of OnlineBundler::processInput
+		bool			bValidTransform;
+		bool			bGlobalTrackingLost;
+		mat4f			transform;
+	};
+
+	BundlingFrameQueue();
+	~BundlingFrameQueue();
+
+	void alloc(unsigned int numFrames, unsigned int depthWidth, unsigned int depthHeight, unsigned int colorWidth, unsigned int colorHeight);
+	void free();
+
+	unsigned int getCapacity() const {
+		return (unsigned int)m_frames.size();
+	}
+	//! frames pushed by recon but not yet integrated (inputs + results)
+	unsigned int getNumFramesInFlight() const {
+		return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire);
+	}
+	bool isFull() const {
+		return getNumFramesInFlight() >= getCapacity();
+	}
+
+	//********** recon thread **********
+	//! slot to fill for the next push; NULL if full
+	Frame* getPushFrame();
+	//! publishes the slot returned by getPushFrame to the bundling thread
+	void push();
+	//! keeps the bundling thread going after the last input frame; false if full
+	bool pushEndOfSequence(unsigned int lastFrameIdx);
+
+	//! oldest frame bundling is done with; NULL if there is none
+	Frame* getResult();
+	//! same as getResult but waits if the pipeline is full (recording the stall)
+	Frame* waitForResult();
+	//! frees the slot returned by getResult/waitForResult
+	void popResult();
+
+	//********** bundling thread **********
+	//! blocks until there is an input frame; returns false on shutdown
+	bool waitForInput();
+	//! oldest unprocessed input frame; NULL if there is none
+	Frame* getInput();
+	//! hands the input slot (with its result) back to recon
+	void finishInput();
+
+	//! wakes up and releases a waiting bundling thread
+	void shutdown() {
+		m_bShutdown = true;
+	}
+
+	void printStats(std::ostream& out = std::cout) const;
+
+private:
+	static void backOff(unsigned int iter);
+
+	std::vector<Frame>			m_frames;
+
+	//indices grow monotonically (unsigned wrap-around is fine); slot = idx % capacity
+	std::atomic<unsigned int>	m_head;		//recon: next result to integrate
+	char						m_pad0[64];
+	std::atomic<unsigned int>	m_mid;		//bundling: next input to process
+	char						m_pad1[64];
+	std::atomic<unsigned int>	m_tail;		//recon: next slot to fill
+	char						m_pad2[64];
+	std::atomic<bool>			m_bShutdown;
+
+	//back-pressure stats (recon thread)
+	unsigned int	m_numPushed;
+	unsigned int	m_numFullStalls;		//recon had to wait for bundling to free a slot
+	double			m_timeFullStallsMS;
+	unsigned int	m_maxInFlight;
+	double			m_sumInFlight;
+	//(bundling thread)
+	unsigned int	m_numEmptyWaits;		//bundling had to wait for recon to push a frame
+	double			m_timeEmptyWaitsMS;
+};
@@ -0,0 +1,969 @@
+#include "stdafx.h"
+#include "CPUImageUtil.h"
+#include "CPUParallel.h"
+#include "CPUSimd.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <algorithm>
+
+#define CPU_MINF (-std::numeric_limits<float>::infinity())
+#define CPU_IMAGE_UTIL_ROWS_PER_TASK 4	//rows per CPUParallel chunk
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scalar kernels (per pixel ports of CUDAImageUtil.cu; used for the image borders and as reference)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline float gaussD(float sigma, int x, int y)
+{
+	return std::exp(-((x*x + y*y) / (2.0f*sigma*sigma)));
+}
+
+static inline float gaussR(float sigma, float dist)
+{
+	return (float)std::exp(-(dist*dist) / (2.0*sigma*sigma));
+}
+
+static inline float convertToIntensity(const uchar4& c)
+{
+	return (0.299f*c.x + 0.587f*c.y + 0.114f*c.z) / 255.0f;
+}
+
+//! nearest neighbor source index of an output coordinate (see resample*_Kernel)
+static inline unsigned int resampleCoord(unsigned int x, unsigned int outputSize, unsigned int inputSize)
+{
+	const float scale = (float)(inputSize - 1) / (float)(outputSize - 1);
+	return (unsigned int)(x*scale + 0.5f);
+}
+
+template<class T>
+static inline void resamplePixel(T* output, unsigned int outputWidth, unsigned int outputHeight, const T* input, unsigned int inputWidth, unsigned int inputHeight, unsigned int x, unsigned int y)
+{
+	const unsigned int xInput = resampleCoord(x, outputWidth, inputWidth);
+	const unsigned int yInput = resampleCoord(y, outputHeight, inputHeight);
+	if (xInput < inputWidth && yInput < inputHeight) output[y*outputWidth + x] = input[yInput*inputWidth + xInput];
+}
+
+static inline void resampleToIntensityPixel(float* output, unsigned int outputWidth, unsigned int outputHeight, const uchar4* input, unsigned int inputWidth, unsigned int inputHeight, unsigned int x, unsigned int y)
+{
+	const unsigned int xInput = resampleCoord(x, outputWidth, inputWidth);
+	const unsigned int yInput = resampleCoord(y, outputHeight, inputHeight);
+	if (xInput < inputWidth && yInput < inputHeight) output[y*outputWidth + x] = convertToIntensity(input[yInput*inputWidth + xInput]);
+}
+
+//! unnormalized sobel responses; false at the border or if a neighbor is invalid
+static inline bool sobelPixel(const float* input, int width, int height, int x, int y, float& resU, float& resV)
+{
+	if (!(x > 0 && x < width - 1 && y > 0 && y < height - 1)) return false;
+	const float pos00 = input[(y - 1)*width + (x - 1)]; if (pos00 == CPU_MINF) return false;
+	const float pos01 = input[(y - 0)*width + (x - 1)]; if (pos01 == CPU_MINF) return false;
+	const float pos02 = input[(y + 1)*width + (x - 1)]; if (pos02 == CPU_MINF) return false;
+	const float pos10 = input[(y - 1)*width + (x - 0)]; if (pos10 == CPU_MINF) return false;
+	const float pos12 = input[(y + 1)*width + (x - 0)]; if (pos12 == CPU_MINF) return false;
+	const float pos20 = input[(y - 1)*width + (x + 1)]; if (pos20 == CPU_MINF) return false;
+	const float pos21 = input[(y - 0)*width + (x + 1)]; if (pos21 == CPU_MINF) return false;
+	const float pos22 = input[(y + 1)*width + (x + 1)]; if (pos22 == CPU_MINF) return false;
+
+	resU = (-1.0f)*pos00 + (1.0f)*pos20 +
+		(-2.0f)*pos01 + (2.0f)*pos21 +
+		(-1.0f)*pos02 + (1.0f)*pos22;
+	resV = (-1.0f)*pos00 + (-2.0f)*pos10 + (-1.0f)*pos20 +
+		(1.0f)*pos02 + (2.0f)*pos12 + (1.0f)*pos22;
+	return true;
+}
+
+static inline void computeIntensityDerivativesPixel(float2* output, const float* input, int width, int height, int x, int y)
+{
+	float2& o = output[y*width + x];
+	float resU, resV;
+	if (sobelPixel(input, width, height, x, y, resU, resV)) {
+		o.x = resU / 8.0f;
+		o.y = resV / 8.0f;
+	}
+	else {
+		o.x = o.y = CPU_MINF;
+	}
+}
+
+static inline void computeIntensityGradientMagnitudePixel(float* output, const float* input, int width, int height, int x, int y)
+{
+	float resU, resV;
+	if (sobelPixel(input, width, height, x, y, resU, resV)) output[y*width + x] = std::sqrt(resU * resU + resV * resV);
+	else output[y*width + x] = CPU_MINF;
+}
+
+static inline void setFloat4(float4& o, float x, float y, float z, float w)
+{
+	o.x = x; o.y = y; o.z = z; o.w = w;
+}
+
+static inline void convertDepthFloatToCameraSpaceFloat4Pixel(float4* output, const float* input, const float4x4& m, int width, int x, int y)
+{
+	float4& o = output[y*width + x];
+	const float depth = input[y*width + x];
+	if (depth != CPU_MINF) {
+		//intrinsicsInv*(x*depth, y*depth, depth, depth), keeping x, y, w
+		const float vx = (float)x*depth, vy = (float)y*depth, vz = depth, vw = depth;
+		setFloat4(o,
+			m.m11*vx + m.m12*vy + m.m13*vz + m.m14*vw,
+			m.m21*vx + m.m22*vy + m.m23*vz + m.m24*vw,
+			m.m41*vx + m.m42*vy + m.m43*vz + m.m44*vw,
+			1.0f);
+	}
+	else {
+		setFloat4(o, CPU_MINF, CPU_MINF, CPU_MINF, CPU_MINF);
+	}
+}
+
+//! n = a x b; false if |n| == 0
+static inline bool crossNormalized(float ax, float ay, float az, float bx, float by, float bz, float sign, float4& o)
+{
+	const float nx = ay*bz - az*by;
+	const float ny = az*bx - ax*bz;
+	const float nz = ax*by - ay*bx;
+	const float l = std::sqrt(nx*nx + ny*ny + nz*nz);
+	if (!(l > 0.0f)) return false;
+	const float s = sign*l;
+	setFloat4(o, nx / s, ny / s, nz / s, 0.0f);
+	return true;
+}
+
+static inline void computeNormalsPixel(float4* output, const float4* input, int width, int height, int x, int y)
+{
+	float4& o = output[y*width + x];
+	setFloat4(o, CPU_MINF, CPU_MINF, CPU_MINF, CPU_MINF);
+	if (x > 0 && x < width - 1 && y > 0 && y < height - 1) {
+		const float4& CC = input[(y + 0)*width + (x + 0)];
+		const float4& PC = input[(y + 1)*width + (x + 0)];
+		const float4& CP = input[(y + 0)*width + (x + 1)];
+		const float4& MC = input[(y - 1)*width + (x + 0)];
+		const float4& CM = input[(y + 0)*width + (x - 1)];
+		if (CC.x != CPU_MINF && PC.x != CPU_MINF && CP.x != CPU_MINF && MC.x != CPU_MINF && CM.x != CPU_MINF) {
+			if (!crossNormalized(PC.x - MC.x, PC.y - MC.y, PC.z - MC.z, CP.x - CM.x, CP.y - CM.y, CP.z - CM.z, -1.0f, o)) {
+				setFloat4(o, CPU_MINF, CPU_MINF, CPU_MINF, CPU_MINF);
+			}
+		}
+	}
+}
+
+static inline void computeNormalsSobelPixel(float4* output, const float4* input, int width, int height, int x, int y)
+{
+	float4& o = output[y*width + x];
+	setFloat4(o, CPU_MINF, CPU_MINF, CPU_MINF, CPU_MINF);
+	if (!(x > 0 && x < width - 1 && y > 0 && y < height - 1)) return;
+
+	const float4& pos00 = input[(y - 1)*width + (x - 1)]; if (pos00.x == CPU_MINF) return;
+	const float4& pos01 = input[(y - 0)*width + (x - 1)]; if (pos01.x == CPU_MINF) return;
+	const float4& pos02 = input[(y + 1)*width + (x - 1)]; if (pos02.x == CPU_MINF) return;
+	const float4& pos10 = input[(y - 1)*width + (x - 0)]; if (pos10.x == CPU_MINF) return;
+	const float4& pos12 = input[(y + 1)*width + (x - 0)]; if (pos12.x == CPU_MINF) return;
+	const float4& pos20 = input[(y - 1)*width + (x + 1)]; if (pos20.x == CPU_MINF) return;
+	const float4& pos21 = input[(y - 0)*width + (x + 1)]; if (pos21.x == CPU_MINF) return;
+	const float4& pos22 = input[(y + 1)*width + (x + 1)]; if (pos22.x == CPU_MINF) return;
+
+	float resU[3], resV[3];
+	for (unsigned int c = 0; c < 3; c++) {
+		const float p00 = (&pos00.x)[c], p01 = (&pos01.x)[c], p02 = (&pos02.x)[c], p10 = (&pos10.x)[c];
+		const float p12 = (&pos12.x)[c], p20 = (&pos20.x)[c], p21 = (&pos21.x)[c], p22 = (&pos22.x)[c];
+		resU[c] = (-1.0f)*p00 + (1.0f)*p20 +
+			(-2.0f)*p01 + (2.0f)*p21 +
+			(-1.0f)*p02 + (1.0f)*p22;
+		resV[c] = (-1.0f)*p00 + (-2.0f)*p10 + (-1.0f)*p20 +
+			(1.0f)*p02 + (2.0f)*p12 + (1.0f)*p22;
+	}
+	if (!crossNormalized(resU[0], resU[1], resU[2], resV[0], resV[1], resV[2], 1.0f, o)) {
+		setFloat4(o, CPU_MINF, CPU_MINF, CPU_MINF, CPU_MINF);
+	}
+}
+
+static inline void convertNormalsFloat4ToUCHAR4Pixel(uchar4* output, const float4* input, int width, int x, int y)
+{
+	uchar4& o = output[y*width + x];
+	o.x = o.y = o.z = o.w = 0;
+	const float4& p = input[y*width + x];
+	if (p.x != CPU_MINF) {
+		o.x = (uchar)std::round((p.x + 1.0f) / 2.0f * 255);
+		o.y = (uchar)std::round((p.y + 1.0f) / 2.0f * 255);
+		o.z = (uchar)std::round((p.z + 1.0f) / 2.0f * 255);
+	}
+}
+
+static inline void jointBilateralFilterColorUCHAR4Pixel(uchar4* output, const uchar4* input, const float* depth, float sigmaD, float sigmaR, int width, int height, int x, int y)
+{
+	const int kernelRadius = (int)std::ceil(2.0*sigmaD);
+	output[y*width + x] = input[y*width + x];
+
+	float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+	float sumWeight = 0.0f;
+	const float depthCenter = depth[y*width + x];
+	if (depthCenter == CPU_MINF) return;
+
+	for (int m = x - kernelRadius; m <= x + kernelRadius; m++) {
+		for (int n = y - kernelRadius; n <= y + kernelRadius; n++) {
+			if (m >= 0 && n >= 0 && m < width && n < height) {
+				const uchar4& cur = input[n*width + m];
+				const float currentDepth = depth[n*width + m];
+				if (currentDepth != CPU_MINF) {
+					const float weight = gaussD(sigmaD, m - x, n - y)*gaussR(sigmaR, currentDepth - depthCenter);
+					sumWeight += weight;
+					sumX += weight*cur.x; sumY += weight*cur.y; sumZ += weight*cur.z;
+				}
+			}
+		}
+	}
+	if (sumWeight > 0.0f) {
+		uchar4& o = output[y*width + x];
+		o.x = (uchar)(sumX / sumWeight); o.y = (uchar)(sumY / sumWeight); o.z = (uchar)(sumZ / sumWeight); o.w = 255;
+	}
+}
+
+//! shared by the gauss/bilateral float filters: weights gaussD(sigma) over the valid guide pixels (and |depth - center| < sigmaR if bRangeCheck)
+static inline void weightedFilterPixel(float* output, const float* input, const float* depth, float sigma, int kernelRadius, float sigmaR, bool bRangeCheck, int width, int height, int x, int y)
+{
+	output[y*width + x] = CPU_MINF;
+	float sum = 0.0f;
+	float sumWeight = 0.0f;
+	const float depthCenter = depth[y*width + x];
+	if (depthCenter == CPU_MINF) return;
+
+	for (int m = x - kernelRadius; m <= x + kernelRadius; m++) {
+		for (int n = y - kernelRadius; n <= y + kernelRadius; n++) {
+			if (m >= 0 && n >= 0 && m < width && n < height) {
+				const float currentDepth = depth[n*width + m];
+				if (currentDepth != CPU_MINF && (!bRangeCheck || std::fabs(depthCenter - currentDepth) < sigmaR)) {
+					const float weight = gaussD(sigma, m - x, n - y);
+					sumWeight += weight;
+					sum += weight*input[n*width + m];
+				}
+			}
+		}
+	}
+	if (sumWeight > 0.0f) output[y*width + x] = sum / sumWeight;
+}
+
+static inline void gaussFilterDepthMapPixel(float* output, const float* input, float sigmaD, float sigmaR, int width, int height, int x, int y)
+{
+	weightedFilterPixel(output, input, input, sigmaD, (int)std::ceil(2.0*sigmaD), sigmaR, true, width, height, x, y);
+}
+
+static inline void jointBilateralFilterFloatPixel(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, int width, int height, int x, int y)
+{
+	weightedFilterPixel(output, input, depth, sigmaD, (int)std::ceil(2.0*sigmaD), sigmaR, true, width, height, x, y);
+}
+
+//! depth close to 0 gives huge (or infinite) sigmas, which are treated like invalid depth (no window -> MINF)
+static inline int adaptiveKernelRadius(float curSigma, int width, int height)
+{
+	const double r = std::ceil(2.0*curSigma);
+	return r <= (double)std::max(width, height) ? (int)r : -1;
+}
+
+static inline void adaptiveBilateralFilterIntensityPixel(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, float adaptFactor, int width, int height, int x, int y)
+{
+	const float depthCenter = depth[y*width + x];
+	if (depthCenter == CPU_MINF) { output[y*width + x] = CPU_MINF; return; }
+	const float curSigma = sigmaD * adaptFactor / depthCenter;
+	weightedFilterPixel(output, input, depth, curSigma, adaptiveKernelRadius(curSigma, width, height), sigmaR, true, width, height, x, y);
+}
+
+static inline void adaptiveGaussFilterDepthMapPixel(float* output, const float* input, float sigmaD, float sigmaR, float adaptFactor, int width, int height, int x, int y)
+{
+	const float depthCenter = input[y*width + x];
+	if (depthCenter == CPU_MINF) { output[y*width + x] = CPU_MINF; return; }
+	const float curSigma = sigmaD / depthCenter * adaptFactor;
+	weightedFilterPixel(output, input, input, curSigma, adaptiveKernelRadius(curSigma, width, height), sigmaR, true, width, height, x, y);
+}
+
+static inline void adaptiveGaussFilterIntensityPixel(float* output, const float* input, const float* depth, float sigmaD, float adaptFactor, int width, int height, int x, int y)
+{
+	const float depthCenter = depth[y*width + x];
+	if (depthCenter == CPU_MINF) { output[y*width + x] = CPU_MINF; return; }
+	const float curSigma = sigmaD / depthCenter * adaptFactor;
+	weightedFilterPixel(output, input, depth, curSigma, adaptiveKernelRadius(curSigma, width, height), 0.0f, false, width, height, x, y);
+}
+
+static inline void gaussFilterIntensityPixel(float* output, const float* input, float sigmaD, int width, int height, int x, int y)
+{
+	const int kernelRadius = (int)std::ceil(2.0*sigmaD);
+	float sum = 0.0f;
+	float sumWeight = 0.0f;
+	for (int m = x - kernelRadius; m <= x + kernelRadius; m++) {
+		for (int n = y - kernelRadius; n <= y + kernelRadius; n++) {
+			if (m >= 0 && n >= 0 && m < width && n < height) {
+				const float weight = gaussD(sigmaD, m - x, n - y);
+				sumWeight += weight;
+				sum += weight*input[n*width + m];
+			}
+		}
+	}
+	if (sumWeight > 0.0f) output[y*width + x] = sum / sumWeight;
+}
+
+static inline void erodeDepthMapPixel(float* output, const float* input, int structureSize, int width, int height, float dThresh, float fracReq, int x, int y)
+{
+	unsigned int count = 0;
+	const float oldDepth = input[y*width + x];
+	for (int i = -structureSize; i <= structureSize; i++) {
+		for (int j = -structureSize; j <= structureSize; j++) {
+			if (x + j >= 0 && x + j < width && y + i >= 0 && y + i < height) {
+				const float depth = input[(y + i)*width + (x + j)];
+				if (depth == CPU_MINF || depth == 0.0f || std::fabs(depth - oldDepth) > dThresh) count++;
+			}
+		}
+	}
+	const unsigned int sum = (2 * structureSize + 1)*(2 * structureSize + 1);
+	output[y*width + x] = ((float)count / (float)sum >= fracReq) ? CPU_MINF : oldDepth;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Row drivers
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//! row(y) for all rows, in bands on the CPUParallel pool
+template<class RowFunc>
+static inline void parallelRows(unsigned int height, const RowFunc& row)
+{
+	CPUParallel::parallelFor(0, height, [&row](unsigned int b, unsigned int e) {
+		for (unsigned int y = b; y < e; y++) row((int)y);
+	}, CPU_IMAGE_UTIL_ROWS_PER_TASK);
+}
+
+//! vec(x, y) for runs of vfloat::Width pixels whose [x - radius, x + Width - 1 + radius] is inside the row, pixel(x, y) for the rest
+template<class PixelFunc, class VecFunc>
+static inline void processRow(int y, int width, int radius, const PixelFunc& pixel, const VecFunc& vec)
+{
+	const int W = (int)vfloat::Width;
+	int x = 0;
+	for (; x < std::min(radius, width); x++) pixel(x, y);
+	for (; x + W - 1 + radius < width; x += W) vec(x, y);
+	for (; x < width; x++) pixel(x, y);
+}
+
+//! gaussD(sigma, dx, dy) at [(dx + radius)*(2*radius + 1) + dy + radius] (dx major like the kernel loops)
+static void computeSpatialWeights(float sigma, int radius, std::vector<float>& weights)
+{
+	const int size = 2 * radius + 1;
+	weights.resize(size*size);
+	for (int dx = -radius; dx <= radius; dx++) {
+		for (int dy = -radius; dy <= radius; dy++) {
+			weights[(dx + radius)*size + dy + radius] = gaussD(sigma, dx, dy);
+		}
+	}
+}
+
+//! fixed sigma gauss/bilateral filters on a depth guide (see weightedFilterPixel); sums in the same order as the kernel
+static void weightedFilterFixed(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, bool bRangeCheck, int width, int height)
+{
+	const int radius = (int)std::ceil(2.0*sigmaD);
+	std::vector<float> weights;
+	computeSpatialWeights(sigmaD, radius, weights);
+	const int size = 2 * radius + 1;
+
+	parallelRows(height, [&](int y) {
+		const int n0 = std::max(0, y - radius), n1 = std::min(height - 1, y + radius);
+		processRow(y, width, radius,
+			[&](int x, int y) { weightedFilterPixel(output, input, depth, sigmaD, radius, sigmaR, bRangeCheck, width, height, x, y); },
+			[&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF), sigR = vset1(sigmaR);
+			const vfloat center = vload(depth + y*width + x);
+			vfloat sum = vzero(), sumWeight = vzero();
+			for (int dx = -radius; dx <= radius; dx++) {
+				const float* w = &weights[(dx + radius)*size + radius];
+				for (int n = n0; n <= n1; n++) {
+					const vfloat cur = vload(depth + n*width + x + dx);
+					vmask ok = vcmpneq(cur, minf);
+					if (bRangeCheck) ok = ok & vcmplt(vabs(center - cur), sigR);
+					const vfloat weight = vand(ok, vset1(w[n - y]));
+					sumWeight = sumWeight + weight;
+					sum = sum + vand(ok, weight*vload(input + n*width + x + dx));
+				}
+			}
+			vstore(output + y*width + x, vselect(vcmpneq(center, minf) & vcmpgt(sumWeight, vzero()), sum / sumWeight, minf));
+		});
+	});
+}
+
+//! curSigma of the adaptive filters from the depth center; lanes and scalar pixels use the same float operations
+struct AdaptiveSigma {
+	AdaptiveSigma(float _sigmaD, float _adaptFactor, bool _bScaleFirst) : sigmaD(_sigmaD), adaptFactor(_adaptFactor), bScaleFirst(_bScaleFirst) {}
+	float operator()(float depthCenter) const {
+		return bScaleFirst ? sigmaD * adaptFactor / depthCenter : sigmaD / depthCenter * adaptFactor;
+	}
+	vfloat operator()(const vfloat& depthCenter) const {
+		return bScaleFirst ? vset1(sigmaD * adaptFactor) / depthCenter : vset1(sigmaD) / depthCenter * vset1(adaptFactor);
+	}
+	float sigmaD, adaptFactor;
+	bool bScaleFirst;	//sigmaD * adaptFactor / depth (bilateral) vs. sigmaD / depth * adaptFactor (gauss)
+};
+
+//! adaptive variants: per pixel sigma; lanes run up to the largest radius with the others masked out
+static void weightedFilterAdaptive(float* output, const float* input, const float* depth, const AdaptiveSigma& sigmaFunc, float sigmaR, bool bRangeCheck, int width, int height)
+{
+	const int W = (int)vfloat::Width;
+	parallelRows(height, [&](int y) {
+		std::vector<float> gauss1D;
+		auto pixel = [&](int x, int y) {
+			const float depthCenter = depth[y*width + x];
+			if (depthCenter == CPU_MINF) { output[y*width + x] = CPU_MINF; return; }
+			const float curSigma = sigmaFunc(depthCenter);
+			weightedFilterPixel(output, input, depth, curSigma, adaptiveKernelRadius(curSigma, width, height), sigmaR, bRangeCheck, width, height, x, y);
+		};
+		processRow(y, width, 0, pixel, [&](int x, int y) {
+			float centers[vfloat::Width], radii[vfloat::Width];
+			const vfloat center = vload(depth + y*width + x);
+			vstore(centers, center);
+			int maxRadius = -1;
+			for (int i = 0; i < W; i++) {
+				radii[i] = -1.0f;
+				if (centers[i] == CPU_MINF) continue;
+				const int r = adaptiveKernelRadius(sigmaFunc(centers[i]), width, height);
+				radii[i] = (float)r;
+				maxRadius = std::max(maxRadius, r);
+			}
+			if (x - maxRadius < 0 || x + W - 1 + maxRadius >= width) {
+				for (int i = 0; i < W; i++) pixel(x + i, y);
+				return;
+			}
+
+			const vfloat minf = vset1(CPU_MINF), sigR = vset1(sigmaR);
+			const vfloat radius = vload(radii);
+			const vfloat sigma = sigmaFunc(center);
+			const vfloat twoSigmaSq = vset1(2.0f)*sigma*sigma;
+			//gaussD is separable: exp(-dx^2/2s^2)*exp(-dy^2/2s^2) instead of an exp per tap
+			gauss1D.resize((maxRadius + 1)*W);
+			for (int k = 0; k <= maxRadius; k++) vstore(&gauss1D[k*W], vexp(vzero() - vset1((float)(k*k)) / twoSigmaSq));
+
+			const int n0 = std::max(0, y - maxRadius), n1 = std::min(height - 1, y + maxRadius);
+			vfloat sum = vzero(), sumWeight = vzero();
+			for (int dx = -maxRadius; dx <= maxRadius; dx++) {
+				const vmask inX = vcmple(vset1((float)std::abs(dx)), radius);
+				if (!vany(inX)) continue;
+				const vfloat gaussX = vload(&gauss1D[std::abs(dx)*W]);
+				for (int n = n0; n <= n1; n++) {
+					const int dy = n - y;
+					const vfloat cur = vload(depth + n*width + x + dx);
+					vmask ok = inX & vcmple(vset1((float)std::abs(dy)), radius) & vcmpneq(cur, minf);
+					if (bRangeCheck) ok = ok & vcmplt(vabs(center - cur), sigR);
+					if (!vany(ok)) continue;
+					const vfloat weight = vand(ok, gaussX*vload(&gauss1D[std::abs(dy)*W]));
+					sumWeight = sumWeight + weight;
+					sum = sum + vand(ok, weight*vload(input + n*width + x + dx));
+				}
+			}
+			vstore(output + y*width + x, vselect(vcmpneq(center, minf) & vcmpgt(sumWeight, vzero()), sum / sumWeight, minf));
+		});
+	});
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CPUImageUtil
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//! nearest neighbor resampling with per column source indices computed once
+template<class Func>
+static void resampleRows(unsigned int outputWidth, unsigned int outputHeight, unsigned int inputWidth, unsigned int inputHeight, const Func& f)
+{
+	std::vector<unsigned int> xInput(outputWidth);
+	for (unsigned int x = 0; x < outputWidth; x++) xInput[x] = resampleCoord(x, outputWidth, inputWidth);
+	parallelRows(outputHeight, [&](int y) {
+		const unsigned int yInput = resampleCoord(y, outputHeight, inputHeight);
+		if (yInput >= inputHeight) return;
+		for (unsigned int x = 0; x < outputWidth; x++) {
+			if (xInput[x] < inputWidth) f(y*outputWidth + x, yInput*inputWidth + xInput[x]);
+		}
+	});
+}
+
+void CPUImageUtil::resampleToIntensity(float* output, unsigned int outputWidth, unsigned int outputHeight, const uchar4* input, unsigned int inputWidth, unsigned int inputHeight)
+{
+	resampleRows(outputWidth, outputHeight, inputWidth, inputHeight, [&](unsigned int o, unsigned int i) { output[o] = convertToIntensity(input[i]); });
+}
+
+void CPUImageUtil::resampleFloat4(float4* output, unsigned int outputWidth, unsigned int outputHeight, const float4* input, unsigned int inputWidth, unsigned int inputHeight)
+{
+	resampleRows(outputWidth, outputHeight, inputWidth, inputHeight, [&](unsigned int o, unsigned int i) { output[o] = input[i]; });
+}
+
+void CPUImageUtil::resampleFloat(float* output, unsigned int outputWidth, unsigned int outputHeight, const float* input, unsigned int inputWidth, unsigned int inputHeight)
+{
+	resampleRows(outputWidth, outputHeight, inputWidth, inputHeight, [&](unsigned int o, unsigned int i) { output[o] = input[i]; });
+}
+
+void CPUImageUtil::resampleUCHAR4(uchar4* output, unsigned int outputWidth, unsigned int outputHeight, const uchar4* input, unsigned int inputWidth, unsigned int inputHeight)
+{
+	resampleRows(outputWidth, outputHeight, inputWidth, inputHeight, [&](unsigned int o, unsigned int i) { output[o] = input[i]; });
+}
+
+void CPUImageUtil::convertDepthFloatToCameraSpaceFloat4(float4* output, const float* input, const float4x4& intrinsicsInv, unsigned int width, unsigned int height)
+{
+	const float4x4& m = intrinsicsInv;
+	parallelRows(height, [&](int y) {
+		processRow(y, width, 0,
+			[&](int x, int y) { convertDepthFloatToCameraSpaceFloat4Pixel(output, input, m, width, x, y); },
+			[&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF);
+			const vfloat depth = vload(input + y*width + x);
+			const vfloat vx = vramp((float)x)*depth, vy = vset1((float)y)*depth;
+			const vmask valid = vcmpneq(depth, minf);
+			const vfloat cx = vset1(m.m11)*vx + vset1(m.m12)*vy + vset1(m.m13)*depth + vset1(m.m14)*depth;
+			const vfloat cy = vset1(m.m21)*vx + vset1(m.m22)*vy + vset1(m.m23)*depth + vset1(m.m24)*depth;
+			const vfloat cw = vset1(m.m41)*vx + vset1(m.m42)*vy + vset1(m.m43)*depth + vset1(m.m44)*depth;
+			vstoreFloat4(&output[y*width + x].x, vselect(valid, cx, minf), vselect(valid, cy, minf), vselect(valid, cw, minf), vselect(valid, vset1(1.0f), minf));
+		});
+	});
+}
+
+//! components of Width float4 neighbors
+struct vfloat3 {
+	vfloat x, y, z;
+};
+
+static inline vfloat3 vloadFloat3(const float4* p)
+{
+	vfloat3 r; vfloat w;
+	vloadFloat4(&p->x, r.x, r.y, r.z, w);
+	return r;
+}
+
+//! n = a x b normalized by sign*|n|; MINF lanes where !valid or |n| == 0
+static inline void vstoreCrossNormalized(float4* p, const vmask& valid, const vfloat3& a, const vfloat3& b, float sign)
+{
+	const vfloat minf = vset1(CPU_MINF);
+	const vfloat nx = a.y*b.z - a.z*b.y;
+	const vfloat ny = a.z*b.x - a.x*b.z;
+	const vfloat nz = a.x*b.y - a.y*b.x;
+	const vfloat l = vsqrt(nx*nx + ny*ny + nz*nz);
+	const vmask ok = valid & vcmpgt(l, vzero());
+	const vfloat s = vset1(sign)*l;
+	vstoreFloat4(&p->x, vselect(ok, nx / s, minf), vselect(ok, ny / s, minf), vselect(ok, nz / s, minf), vselect(ok, vzero(), minf));
+}
+
+void CPUImageUtil::computeNormals(float4* output, const float4* input, unsigned int width, unsigned int height)
+{
+	parallelRows(height, [&](int y) {
+		auto pixel = [&](int x, int y) { computeNormalsPixel(output, input, width, height, x, y); };
+		if (y == 0 || y == (int)height - 1) { for (int x = 0; x < (int)width; x++) pixel(x, y); return; }
+		processRow(y, width, 1, pixel, [&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF);
+			const vfloat3 CC = vloadFloat3(&input[(y + 0)*width + (x + 0)]);
+			const vfloat3 PC = vloadFloat3(&input[(y + 1)*width + (x + 0)]);
+			const vfloat3 CP = vloadFloat3(&input[(y + 0)*width + (x + 1)]);
+			const vfloat3 MC = vloadFloat3(&input[(y - 1)*width + (x + 0)]);
+			const vfloat3 CM = vloadFloat3(&input[(y + 0)*width + (x - 1)]);
+			const vmask valid = vcmpneq(CC.x, minf) & vcmpneq(PC.x, minf) & vcmpneq(CP.x, minf) & vcmpneq(MC.x, minf) & vcmpneq(CM.x, minf);
+			const vfloat3 a = { PC.x - MC.x, PC.y - MC.y, PC.z - MC.z };
+			const vfloat3 b = { CP.x - CM.x, CP.y - CM.y, CP.z - CM.z };
+			vstoreCrossNormalized(&output[y*width + x], valid, a, b, -1.0f);
+		});
+	});
+}
+
+void CPUImageUtil::computeNormalsSobel(float4* output, const float4* input, unsigned int width, unsigned int height)
+{
+	parallelRows(height, [&](int y) {
+		auto pixel = [&](int x, int y) { computeNormalsSobelPixel(output, input, width, height, x, y); };
+		if (y == 0 || y == (int)height - 1) { for (int x = 0; x < (int)width; x++) pixel(x, y); return; }
+		processRow(y, width, 1, pixel, [&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF);
+			const vfloat3 pos00 = vloadFloat3(&input[(y - 1)*width + (x - 1)]);
+			const vfloat3 pos01 = vloadFloat3(&input[(y - 0)*width + (x - 1)]);
+			const vfloat3 pos02 = vloadFloat3(&input[(y + 1)*width + (x - 1)]);
+			const vfloat3 pos10 = vloadFloat3(&input[(y - 1)*width + (x - 0)]);
+			const vfloat3 pos12 = vloadFloat3(&input[(y + 1)*width + (x - 0)]);
+			const vfloat3 pos20 = vloadFloat3(&input[(y - 1)*width + (x + 1)]);
+			const vfloat3 pos21 = vloadFloat3(&input[(y - 0)*width + (x + 1)]);
+			const vfloat3 pos22 = vloadFloat3(&input[(y + 1)*width + (x + 1)]);
+			const vmask valid = vcmpneq(pos00.x, minf) & vcmpneq(pos01.x, minf) & vcmpneq(pos02.x, minf) & vcmpneq(pos10.x, minf) &
+				vcmpneq(pos12.x, minf) & vcmpneq(pos20.x, minf) & vcmpneq(pos21.x, minf) & vcmpneq(pos22.x, minf);
+
+			const vfloat m1 = vset1(-1.0f), p1 = vset1(1.0f), m2 = vset1(-2.0f), p2 = vset1(2.0f);
+			vfloat3 resU, resV;
+			resU.x = m1*pos00.x + p1*pos20.x + m2*pos01.x + p2*pos21.x + m1*pos02.x + p1*pos22.x;
+			resU.y = m1*pos00.y + p1*pos20.y + m2*pos01.y + p2*pos21.y + m1*pos02.y + p1*pos22.y;
+			resU.z = m1*pos00.z + p1*pos20.z + m2*pos01.z + p2*pos21.z + m1*pos02.z + p1*pos22.z;
+			resV.x = m1*pos00.x + m2*pos10.x + m1*pos20.x + p1*pos02.x + p2*pos12.x + p1*pos22.x;
+			resV.y = m1*pos00.y + m2*pos10.y + m1*pos20.y + p1*pos02.y + p2*pos12.y + p1*pos22.y;
+			resV.z = m1*pos00.z + m2*pos10.z + m1*pos20.z + p1*pos02.z + p2*pos12.z + p1*pos22.z;
+			vstoreCrossNormalized(&output[y*width + x], valid, resU, resV, 1.0f);
+		});
+	});
+}
+
+void CPUImageUtil::convertNormalsFloat4ToUCHAR4(uchar4* output, const float4* input, unsigned int width, unsigned int height)
+{
+	//memory bound; round() (half away from zero) has no exact sse2 counterpart
+	parallelRows(height, [&](int y) {
+		for (int x = 0; x < (int)width; x++) convertNormalsFloat4ToUCHAR4Pixel(output, input, width, x, y);
+	});
+}
+
+void CPUImageUtil::jointBilateralFilterColorUCHAR4(uchar4* output, const uchar4* input, const float* depth, float sigmaD, float sigmaR, unsigned int width, unsigned int height)
+{
+	const int W = (int)vfloat::Width;
+	const int radius = (int)std::ceil(2.0*sigmaD);
+	std::vector<float> weights;
+	computeSpatialWeights(sigmaD, radius, weights);
+	const int size = 2 * radius + 1;
+	const float twoSigmaRSq = (float)(2.0*sigmaR*sigmaR);
+
+	parallelRows(height, [&](int y) {
+		const int n0 = std::max(0, y - radius), n1 = std::min((int)height - 1, y + radius);
+		processRow(y, width, radius,
+			[&](int x, int y) { jointBilateralFilterColorUCHAR4Pixel(output, input, depth, sigmaD, sigmaR, width, height, x, y); },
+			[&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF), rangeScale = vset1(twoSigmaRSq);
+			const vfloat center = vload(depth + y*width + x);
+			const vmask centerValid = vcmpneq(center, minf);
+			vfloat sumX = vzero(), sumY = vzero(), sumZ = vzero(), sumWeight = vzero();
+			for (int dx = -radius; dx <= radius; dx++) {
+				const float* w = &weights[(dx + radius)*size + radius];
+				for (int n = n0; n <= n1; n++) {
+					const vfloat cur = vload(depth + n*width + x + dx);
+					const vmask ok = centerValid & vcmpneq(cur, minf);
+					if (!vany(ok)) continue;
+					const vfloat dist = cur - center;
+					const vfloat weight = vand(ok, vset1(w[n - y]) * vexp(vzero() - dist*dist / rangeScale));
+					vfloat cx, cy, cz, ca;
+					vloadBytes4((const unsigned char*)&input[n*width + x + dx], cx, cy, cz, ca);
+					sumWeight = sumWeight + weight;
+					sumX = sumX + weight*cx; sumY = sumY + weight*cy; sumZ = sumZ + weight*cz;
+				}
+			}
+			float resX[vfloat::Width], resY[vfloat::Width], resZ[vfloat::Width], resW[vfloat::Width];
+			vstore(resX, sumX / sumWeight); vstore(resY, sumY / sumWeight); vstore(resZ, sumZ / sumWeight);
+			vstore(resW, vand(centerValid, sumWeight));
+			for (int i = 0; i < W; i++) {
+				uchar4& o = output[y*width + x + i];
+				if (resW[i] > 0.0f) {
+					o.x = (uchar)resX[i]; o.y = (uchar)resY[i]; o.z = (uchar)resZ[i]; o.w = 255;
+				}
+				else {
+					o = input[y*width + x + i];
+				}
+			}
+		});
+	});
+}
+
+void CPUImageUtil::erodeDepthMap(float* output, const float* input, int structureSize, unsigned int width, unsigned int height, float dThresh, float fracReq)
+{
+	const float sum = (float)((2 * structureSize + 1)*(2 * structureSize + 1));
+	parallelRows(height, [&](int y) {
+		processRow(y, width, structureSize,
+			[&](int x, int y) { erodeDepthMapPixel(output, input, structureSize, width, height, dThresh, fracReq, x, y); },
+			[&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF), zero = vzero(), one = vset1(1.0f), thresh = vset1(dThresh);
+			const vfloat oldDepth = vload(input + y*width + x);
+			vfloat count = vzero();
+			for (int i = -structureSize; i <= structureSize; i++) {
+				if (y + i < 0 || y + i >= (int)height) continue;
+				for (int j = -structureSize; j <= structureSize; j++) {
+					const vfloat depth = vload(input + (y + i)*width + x + j);
+					const vmask bad = vcmpeq(depth, minf) | vcmpeq(depth, zero) | vcmpgt(vabs(depth - oldDepth), thresh);
+					count = count + vand(bad, one);
+				}
+			}
+			vstore(output + y*width + x, vselect(vcmpge(count / vset1(sum), vset1(fracReq)), minf, oldDepth));
+		});
+	});
+}
+
+void CPUImageUtil::gaussFilterDepthMap(float* output, const float* input, float sigmaD, float sigmaR, unsigned int width, unsigned int height)
+{
+	weightedFilterFixed(output, input, input, sigmaD, sigmaR, true, width, height);
+}
+
+void CPUImageUtil::gaussFilterIntensity(float* output, const float* input, float sigmaD, unsigned int width, unsigned int height)
+{
+	const int radius = (int)std::ceil(2.0*sigmaD);
+	std::vector<float> weights;
+	computeSpatialWeights(sigmaD, radius, weights);
+	const int size = 2 * radius + 1;
+
+	parallelRows(height, [&](int y) {
+		const int n0 = std::max(0, y - radius), n1 = std::min((int)height - 1, y + radius);
+		processRow(y, width, radius,
+			[&](int x, int y) { gaussFilterIntensityPixel(output, input, sigmaD, width, height, x, y); },
+			[&](int x, int y) {
+			vfloat sum = vzero(), sumWeight = vzero();
+			for (int dx = -radius; dx <= radius; dx++) {
+				const float* w = &weights[(dx + radius)*size + radius];
+				for (int n = n0; n <= n1; n++) {
+					const vfloat weight = vset1(w[n - y]);
+					sumWeight = sumWeight + weight;
+					sum = sum + weight*vload(input + n*width + x + dx);
+				}
+			}
+			vstore(output + y*width + x, vselect(vcmpgt(sumWeight, vzero()), sum / sumWeight, vload(output + y*width + x)));
+		});
+	});
+}
+
+void CPUImageUtil::convertUCHAR4ToIntensityFloat(float* output, const uchar4* input, unsigned int width, unsigned int height)
+{
+	parallelRows(height, [&](int y) {
+		processRow(y, width, 0,
+			[&](int x, int y) { output[y*width + x] = convertToIntensity(input[y*width + x]); },
+			[&](int x, int y) {
+			vfloat cx, cy, cz, cw;
+			vloadBytes4((const unsigned char*)&input[y*width + x], cx, cy, cz, cw);
+			vstore(output + y*width + x, (vset1(0.299f)*cx + vset1(0.587f)*cy + vset1(0.114f)*cz) / vset1(255.0f));
+		});
+	});
+}
+
+//! unnormalized sobel responses of Width interior pixels
+static inline vmask vsobel(const float* input, int width, int x, int y, vfloat& resU, vfloat& resV)
+{
+	const vfloat minf = vset1(CPU_MINF);
+	const vfloat pos00 = vload(input + (y - 1)*width + (x - 1));
+	const vfloat pos01 = vload(input + (y - 0)*width + (x - 1));
+	const vfloat pos02 = vload(input + (y + 1)*width + (x - 1));
+	const vfloat pos10 = vload(input + (y - 1)*width + (x - 0));
+	const vfloat pos12 = vload(input + (y + 1)*width + (x - 0));
+	const vfloat pos20 = vload(input + (y - 1)*width + (x + 1));
+	const vfloat pos21 = vload(input + (y - 0)*width + (x + 1));
+	const vfloat pos22 = vload(input + (y + 1)*width + (x + 1));
+
+	const vfloat m1 = vset1(-1.0f), p1 = vset1(1.0f), m2 = vset1(-2.0f), p2 = vset1(2.0f);
+	resU = m1*pos00 + p1*pos20 + m2*pos01 + p2*pos21 + m1*pos02 + p1*pos22;
+	resV = m1*pos00 + m2*pos10 + m1*pos20 + p1*pos02 + p2*pos12 + p1*pos22;
+	return vcmpneq(pos00, minf) & vcmpneq(pos01, minf) & vcmpneq(pos02, minf) & vcmpneq(pos10, minf) &
+		vcmpneq(pos12, minf) & vcmpneq(pos20, minf) & vcmpneq(pos21, minf) & vcmpneq(pos22, minf);
+}
+
+void CPUImageUtil::computeIntensityDerivatives(float2* output, const float* input, unsigned int width, unsigned int height)
+{
+	const int W = (int)vfloat::Width;
+	parallelRows(height, [&](int y) {
+		auto pixel = [&](int x, int y) { computeIntensityDerivativesPixel(output, input, width, height, x, y); };
+		if (y == 0 || y == (int)height - 1) { for (int x = 0; x < (int)width; x++) pixel(x, y); return; }
+		processRow(y, width, 1, pixel, [&](int x, int y) {
+			const vfloat minf = vset1(CPU_MINF), eighth = vset1(8.0f);
+			vfloat resU, resV;
+			const vmask valid = vsobel(input, width, x, y, resU, resV);
+			float u[vfloat::Width], v[vfloat::Width];
+			vstore(u, vselect(valid, resU / eighth, minf));
+			vstore(v, vselect(valid, resV / eighth, minf));
+			for (int i = 0; i < W; i++) {
+				output[y*width + x + i].x = u[i];
+				output[y*width + x + i].y = v[i];
+			}
+		});
+	});
+}
+
+void CPUImageUtil::computeIntensityGradientMagnitude(float* output, const float* input, unsigned int width, unsigned int height)
+{
+	parallelRows(height, [&](int y) {
+		auto pixel = [&](int x, int y) { computeIntensityGradientMagnitudePixel(output, input, width, height, x, y); };
+		if (y == 0 || y == (int)height - 1) { for (int x = 0; x < (int)width; x++) pixel(x, y); return; }
+		processRow(y, width, 1, pixel, [&](int x, int y) {
+			vfloat resU, resV;
+			const vmask valid = vsobel(input, width, x, y, resU, resV);
+			vstore(output + y*width + x, vselect(valid, vsqrt(resU*resU + resV*resV), vset1(CPU_MINF)));
+		});
+	});
+}
+
+void CPUImageUtil::adaptiveGaussFilterDepthMap(float* output, const float* input, float sigmaD, float sigmaR, float adaptFactor, unsigned int width, unsigned int height)
+{
+	weightedFilterAdaptive(output, input, input, AdaptiveSigma(sigmaD, adaptFactor, false), sigmaR, true, width, height);
+}
+
+void CPUImageUtil::adaptiveGaussFilterIntensity(float* output, const float* input, const float* depth, float sigmaD, float adaptFactor, unsigned int width, unsigned int height)
+{
+	weightedFilterAdaptive(output, input, depth, AdaptiveSigma(sigmaD, adaptFactor, false), 0.0f, false, width, height);
+}
+
+void CPUImageUtil::jointBilateralFilterFloat(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, unsigned int width, unsigned int height)
+{
+	weightedFilterFixed(output, input, depth, sigmaD, sigmaR, true, width, height);
+}
+
+void CPUImageUtil::adaptiveBilateralFilterIntensity(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, float adaptFactor, unsigned int width, unsigned int height)
+{
+	weightedFilterAdaptive(output, input, depth, AdaptiveSigma(sigmaD, adaptFactor, true), sigmaR, true, width, height);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Validation against the scalar kernels
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//! single threaded reference: f(x, y) for every pixel
+template<class Func>
+static void forEachPixel(unsigned int width, unsigned int height, const Func& f)
+{
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) f((int)x, (int)y);
+	}
+}
+
+//! max. relative (to max(1, |reference|)) deviation; an -inf/nan mismatch counts as infinite
+static float maxDeviation(const float* result, const float* reference, size_t numPixels)
+{
+	float maxDev = 0.0f;
+	for (size_t i = 0; i < numPixels; i++) {
+		const float a = result[i], b = reference[i];
+		if (a == b) continue;
+		if (std::isinf(a) || std::isinf(b) || a != a || b != b) return std::numeric_limits<float>::infinity();
+		maxDev = std::max(maxDev, std::fabs(a - b) / std::max(1.0f, std::fabs(b)));
+	}
+	return maxDev;
+}
+
+static float maxDeviation(const float2* result, const float2* reference, size_t numPixels)
+{
+	return maxDeviation(&result->x, &reference->x, 2 * numPixels);
+}
+
+static float maxDeviation(const float4* result, const float4* reference, size_t numPixels)
+{
+	return maxDeviation(&result->x, &reference->x, 4 * numPixels);
+}
+
+//! max. absolute deviation of a channel
+static float maxDeviation(const uchar4* result, const uchar4* reference, size_t numPixels)
+{
+	int maxDev = 0;
+	const unsigned char* a = (const unsigned char*)result;
+	const unsigned char* b = (const unsigned char*)reference;
+	for (size_t i = 0; i < 4 * numPixels; i++) maxDev = std::max(maxDev, std::abs((int)a[i] - (int)b[i]));
+	return (float)maxDev;
+}
+
+//! runs reference and optimized version on identically initialized outputs and reports deviation/timings
+template<class T, class RefFunc, class OptFunc>
+static bool validateRoutine(std::ostream& out, const char* name, size_t numPixels, float tolerance, const RefFunc& ref, const OptFunc& opt)
+{
+	const unsigned int numIterations = 3;
+	std::vector<T> resultRef(numPixels), resultOpt(numPixels);
+	std::memset(resultRef.data(), 0x7f, sizeof(T)*numPixels);	//some kernels leave pixels untouched
+	std::memset(resultOpt.data(), 0x7f, sizeof(T)*numPixels);
+
+	Timer t;
+	for (unsigned int i = 0; i < numIterations; i++) ref(resultRef.data());
+	const double timeRef = t.getElapsedTimeMS() / numIterations;
+	t.start();
+	for (unsigned int i = 0; i < numIterations; i++) opt(resultOpt.data());
+	const double timeOpt = t.getElapsedTimeMS() / numIterations;
+
+	const float maxDev = maxDeviation(resultOpt.data(), resultRef.data(), numPixels);
+	const bool valid = maxDev <= tolerance;
+	out << "\t" << name << ": " << timeRef << " ms -> " << timeOpt << " ms (x" << (timeOpt > 0.0 ? timeRef / timeOpt : 0.0) << "), max dev " << maxDev
+		<< (valid ? "" : " FAILED") << std::endl;
+	return valid;
+}
+
+bool CPUImageUtil::validate(unsigned int width, unsigned int height, std::ostream& out /*= std::cout*/)
+{
+	const unsigned int numPixels = width * height;
+	const unsigned int resampledWidth = width / 2, resampledHeight = height / 2;
+	const float exact = 1e-6f;		//same float operations; slack for compilers contracting to fma
+	const float approxExp = 1e-4f;	//vectorized exp in the weights
+
+	//synthetic input: slanted planes with a depth discontinuity, noise and holes
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<float> noise(-0.005f, 0.005f);
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<float> depth(numPixels);
+	std::vector<uchar4> color(numPixels);
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			const unsigned int idx = y*width + x;
+			float d = 1.0f + 2.0f * y / height + 0.2f * std::sin(0.05f * x) + noise(rng);
+			if (x > width / 2) d += 0.5f;
+			const int r = byte(rng);
+			if (r < 8 || (x > width / 4 && x < width / 3 && y > height / 4 && y < height / 3)) d = CPU_MINF;
+			else if (r < 10) d = 0.0f;
+			depth[idx] = d;
+			color[idx].x = (unsigned char)(255 * x / width);
+			color[idx].y = (unsigned char)(255 * y / height);
+			color[idx].z = (unsigned char)((x * 7 + y * 13 + byte(rng) / 8) & 0xff);
+			color[idx].w = 255;
+		}
+	}
+	float intrinsicsInvValues[16] = { 0.0f };
+	const float focal = 0.9f * width;
+	intrinsicsInvValues[0] = 1.0f / focal;	intrinsicsInvValues[2] = -0.5f * width / focal;
+	intrinsicsInvValues[5] = 1.0f / focal;	intrinsicsInvValues[6] = -0.5f * height / focal;
+	intrinsicsInvValues[10] = 1.0f;			intrinsicsInvValues[15] = 1.0f;
+	const float4x4 intrinsicsInv(intrinsicsInvValues);
+
+	std::vector<float> intensity(numPixels);
+	std::vector<float4> cameraPos(numPixels), normals(numPixels);
+	forEachPixel(width, height, [&](int x, int y) { intensity[y*width + x] = convertToIntensity(color[y*width + x]); });
+	forEachPixel(width, height, [&](int x, int y) { convertDepthFloatToCameraSpaceFloat4Pixel(cameraPos.data(), depth.data(), intrinsicsInv, width, x, y); });
+	forEachPixel(width, height, [&](int x, int y) { computeNormalsPixel(normals.data(), cameraPos.data(), width, height, x, y); });
+
+	const float* d = depth.data();
+	const float* in = intensity.data();
+	const uchar4* c = color.data();
+	const float4* cp = cameraPos.data();
+	const float4* nm = normals.data();
+	const float sigmaD = 2.0f, sigmaR = 0.05f, adaptFactor = 1.0f;
+
+	out << "validating CPUImageUtil (" << width << "x" << height << ", " << vfloat::Width << " lanes, " << CPUParallel::getNumThreads() << " threads)" << std::endl;
+	bool valid = true;
+	valid &= validateRoutine<float>(out, "resampleToIntensity", resampledWidth * resampledHeight, exact,
+		[&](float* o) { forEachPixel(resampledWidth, resampledHeight, [&](int x, int y) { resampleToIntensityPixel(o, resampledWidth, resampledHeight, c, width, height, x, y); }); },
+		[&](float* o) { resampleToIntensity(o, resampledWidth, resampledHeight, c, width, height); });
+	valid &= validateRoutine<float4>(out, "resampleFloat4", resampledWidth * resampledHeight, exact,
+		[&](float4* o) { forEachPixel(resampledWidth, resampledHeight, [&](int x, int y) { resamplePixel(o, resampledWidth, resampledHeight, cp, width, height, x, y); }); },
+		[&](float4* o) { resampleFloat4(o, resampledWidth, resampledHeight, cp, width, height); });
+	valid &= validateRoutine<float>(out, "resampleFloat", resampledWidth * resampledHeight, exact,
+		[&](float* o) { forEachPixel(resampledWidth, resampledHeight, [&](int x, int y) { resamplePixel(o, resampledWidth, resampledHeight, d, width, height, x, y); }); },
+		[&](float* o) { resampleFloat(o, resampledWidth, resampledHeight, d, width, height); });
+	valid &= validateRoutine<uchar4>(out, "resampleUCHAR4", resampledWidth * resampledHeight, 0.0f,
+		[&](uchar4* o) { forEachPixel(resampledWidth, resampledHeight, [&](int x, int y) { resamplePixel(o, resampledWidth, resampledHeight, c, width, height, x, y); }); },
+		[&](uchar4* o) { resampleUCHAR4(o, resampledWidth, resampledHeight, c, width, height); });
+	valid &= validateRoutine<float4>(out, "convertDepthFloatToCameraSpaceFloat4", numPixels, exact,
+		[&](float4* o) { forEachPixel(width, height, [&](int x, int y) { convertDepthFloatToCameraSpaceFloat4Pixel(o, d, intrinsicsInv, width, x, y); }); },
+		[&](float4* o) { convertDepthFloatToCameraSpaceFloat4(o, d, intrinsicsInv, width, height); });
+	valid &= validateRoutine<float4>(out, "computeNormals", numPixels, exact,
+		[&](float4* o) { forEachPixel(width, height, [&](int x, int y) { computeNormalsPixel(o, cp, width, height, x, y); }); },
+		[&](float4* o) { computeNormals(o, cp, width, height); });
+	valid &= validateRoutine<float4>(out, "computeNormalsSobel", numPixels, exact,
+		[&](float4* o) { forEachPixel(width, height, [&](int x, int y) { computeNormalsSobelPixel(o, cp, width, height, x, y); }); },
+		[&](float4* o) { computeNormalsSobel(o, cp, width, height); });
+	valid &= validateRoutine<uchar4>(out, "convertNormalsFloat4ToUCHAR4", numPixels, 0.0f,
+		[&](uchar4* o) { forEachPixel(width, height, [&](int x, int y) { convertNormalsFloat4ToUCHAR4Pixel(o, nm, width, x, y); }); },
+		[&](uchar4* o) { convertNormalsFloat4ToUCHAR4(o, nm, width, height); });
+	valid &= validateRoutine<uchar4>(out, "jointBilateralFilterColorUCHAR4", numPixels, 1.0f,
+		[&](uchar4* o) { forEachPixel(width, height, [&](int x, int y) { jointBilateralFilterColorUCHAR4Pixel(o, c, d, sigmaD, sigmaR, width, height, x, y); }); },
+		[&](uchar4* o) { jointBilateralFilterColorUCHAR4(o, c, d, sigmaD, sigmaR, width, height); });
+	valid &= validateRoutine<float>(out, "erodeDepthMap", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { erodeDepthMapPixel(o, d, 3, width, height, 0.05f, 0.3f, x, y); }); },
+		[&](float* o) { erodeDepthMap(o, d, 3, width, height, 0.05f, 0.3f); });
+	valid &= validateRoutine<float>(out, "gaussFilterDepthMap", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { gaussFilterDepthMapPixel(o, d, sigmaD, sigmaR, width, height, x, y); }); },
+		[&](float* o) { gaussFilterDepthMap(o, d, sigmaD, sigmaR, width, height); });
+	valid &= validateRoutine<float>(out, "gaussFilterIntensity", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { gaussFilterIntensityPixel(o, in, sigmaD, width, height, x, y); }); },
+		[&](float* o) { gaussFilterIntensity(o, in, sigmaD, width, height); });
+	valid &= validateRoutine<float>(out, "convertUCHAR4ToIntensityFloat", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { o[y*width + x] = convertToIntensity(c[y*width + x]); }); },
+		[&](float* o) { convertUCHAR4ToIntensityFloat(o, c, width, height); });
+	valid &= validateRoutine<float2>(out, "computeIntensityDerivatives", numPixels, exact,
+		[&](float2* o) { forEachPixel(width, height, [&](int x, int y) { computeIntensityDerivativesPixel(o, in, width, height, x, y); }); },
+		[&](float2* o) { computeIntensityDerivatives(o, in, width, height); });
+	valid &= validateRoutine<float>(out, "computeIntensityGradientMagnitude", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { computeIntensityGradientMagnitudePixel(o, in, width, height, x, y); }); },
+		[&](float* o) { computeIntensityGradientMagnitude(o, in, width, height); });
+	valid &= validateRoutine<float>(out, "adaptiveGaussFilterDepthMap", numPixels, approxExp,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { adaptiveGaussFilterDepthMapPixel(o, d, sigmaD, sigmaR, adaptFactor, width, height, x, y); }); },
+		[&](float* o) { adaptiveGaussFilterDepthMap(o, d, sigmaD, sigmaR, adaptFactor, width, height); });
+	valid &= validateRoutine<float>(out, "adaptiveGaussFilterIntensity", numPixels, approxExp,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { adaptiveGaussFilterIntensityPixel(o, in, d, sigmaD, adaptFactor, width, height, x, y); }); },
+		[&](float* o) { adaptiveGaussFilterIntensity(o, in, d, sigmaD, adaptFactor, width, height); });
+	valid &= validateRoutine<float>(out, "jointBilateralFilterFloat", numPixels, exact,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { jointBilateralFilterFloatPixel(o, in, d, sigmaD, sigmaR, width, height, x, y); }); },
+		[&](float* o) { jointBilateralFilterFloat(o, in, d, sigmaD, sigmaR, width, height); });
+	valid &= validateRoutine<float>(out, "adaptiveBilateralFilterIntensity", numPixels, approxExp,
+		[&](float* o) { forEachPixel(width, height, [&](int x, int y) { adaptiveBilateralFilterIntensityPixel(o, in, d, sigmaD, sigmaR, adaptFactor, width, height, x, y); }); },
+		[&](float* o) { adaptiveBilateralFilterIntensity(o, in, d, sigmaD, sigmaR, adaptFactor, width, height); });
+	return valid;
+}
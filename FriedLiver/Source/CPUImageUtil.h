@@ -0,0 +1,56 @@
+#pragma once
+#ifndef CPU_IMAGE_UTIL_H
+#define CPU_IMAGE_UTIL_H
+
+#include <cuda_runtime.h>
+#include "mLibCuda.h"
+
+#include <cstring>
+#include <iostream>
+
+//! host counterparts of CUDAImageUtil (same arguments and results on host memory); the kernels are vectorized with
+//! CPUSimd.h and split into row bands on CPUParallel. Filters match the cuda kernels bit for bit except where they
+//! evaluate exp per tap (color bilateral and adaptive filters), which use a vectorized exp (~2 ulp).
+class CPUImageUtil {
+public:
+	template<class T> static void copy(T* output, const T* input, unsigned int width, unsigned int height) {
+		std::memcpy(output, input, sizeof(T)*width*height);
+	}
+	static void resampleToIntensity(float* output, unsigned int outputWidth, unsigned int outputHeight, const uchar4* input, unsigned int inputWidth, unsigned int inputHeight);
+
+	static void resampleFloat4(float4* output, unsigned int outputWidth, unsigned int outputHeight, const float4* input, unsigned int inputWidth, unsigned int inputHeight);
+	static void resampleFloat(float* output, unsigned int outputWidth, unsigned int outputHeight, const float* input, unsigned int inputWidth, unsigned int inputHeight);
+	static void resampleUCHAR4(uchar4* output, unsigned int outputWidth, unsigned int outputHeight, const uchar4* input, unsigned int inputWidth, unsigned int inputHeight);
+
+	static void convertDepthFloatToCameraSpaceFloat4(float4* output, const float* input, const float4x4& intrinsicsInv, unsigned int width, unsigned int height);
+	static void computeNormals(float4* output, const float4* input, unsigned int width, unsigned int height);
+
+	static void jointBilateralFilterColorUCHAR4(uchar4* output, const uchar4* input, const float* depth, float sigmaD, float sigmaR, unsigned int width, unsigned int height);
+
+	static void erodeDepthMap(float* output, const float* input, int structureSize, unsigned int width, unsigned int height, float dThresh, float fracReq);
+
+	static void gaussFilterDepthMap(float* output, const float* input, float sigmaD, float sigmaR, unsigned int width, unsigned int height);
+	//no invalid checks!
+	static void gaussFilterIntensity(float* output, const float* input, float sigmaD, unsigned int width, unsigned int height);
+
+	static void convertUCHAR4ToIntensityFloat(float* output, const uchar4* input, unsigned int width, unsigned int height);
+
+	static void computeIntensityDerivatives(float2* output, const float* input, unsigned int width, unsigned int height);
+	static void computeIntensityGradientMagnitude(float* output, const float* input, unsigned int width, unsigned int height);
+
+	static void convertNormalsFloat4ToUCHAR4(uchar4* output, const float4* input, unsigned int width, unsigned int height);
+	static void computeNormalsSobel(float4* output, const float4* input, unsigned int width, unsigned int height);
+
+	//adaptive filtering based on depth
+	static void adaptiveGaussFilterDepthMap(float* output, const float* input, float sigmaD, float sigmaR, float adaptFactor, unsigned int width, unsigned int height);
+	static void adaptiveGaussFilterIntensity(float* output, const float* input, const float* depth, float sigmaD, float adaptFactor, unsigned int width, unsigned int height);
+
+	static void jointBilateralFilterFloat(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, unsigned int width, unsigned int height);
+	static void adaptiveBilateralFilterIntensity(float* output, const float* input, const float* depth, float sigmaD, float sigmaR, float adaptFactor, unsigned int width, unsigned int height);
+
+	//! runs every routine and a scalar single threaded port of the cuda kernel on synthetic width x height frames;
+	//! prints the max. deviation and the timings, returns false if a result is off by more than the expected rounding
+	static bool validate(unsigned int width, unsigned int height, std::ostream& out = std::cout);
+};
+
+#endif //CPU_IMAGE_UTIL_H
@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "CPUParallel.h"
+
+#include <algorithm>
+
+std::vector<std::thread> CPUParallel::s_workers;
+
+std::mutex CPUParallel::s_jobMutex;
+std::mutex CPUParallel::s_mutex;
+std::condition_variable CPUParallel::s_cvJob;
+std::condition_variable CPUParallel::s_cvDone;
+
+const CPUParallel::RangeFunc* CPUParallel::s_func = NULL;
+unsigned int CPUParallel::s_begin = 0;
+unsigned int CPUParallel::s_end = 0;
+unsigned int CPUParallel::s_chunkSize = 1;
+std::atomic<unsigned int> CPUParallel::s_nextChunk(0);
+unsigned int CPUParallel::s_numChunks = 0;
+unsigned int CPUParallel::s_numBusy = 0;
+unsigned int CPUParallel::s_generation = 0;
+bool CPUParallel::s_exit = false;
+std::exception_ptr CPUParallel::s_exception;
+
+//! set while a thread runs chunks of a job (owner and workers), nested calls then run inline
+static thread_local bool s_inJob = false;
+
+void CPUParallel::init(unsigned int numThreads /*= 0*/)
+{
+	destroy();
+	if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	//joinable std::threads must not survive until static destruction (DepthSensing exits via exit(0))
+	static bool registeredAtExit = false;
+	if (!registeredAtExit) {
+		atexit(destroy);
+		registeredAtExit = true;
+	}
+
+	s_exit = false;
+	for (unsigned int i = 1; i < numThreads; i++) {
+		s_workers.push_back(std::thread(workerFunc));
+	}
+}
+
+void CPUParallel::destroy()
+{
+	{
+		std::unique_lock<std::mutex> lock(s_mutex);
+		s_exit = true;
+	}
+	s_cvJob.notify_all();
+	for (std::thread& t : s_workers) t.join();
+	s_workers.clear();
+}
+
+void CPUParallel::parallelFor(unsigned int begin, unsigned int end, const RangeFunc& f, unsigned int grainSize /*= 1*/)
+{
+	if (end <= begin) return;
+	const unsigned int n = end - begin;
+	grainSize = std::max(1u, grainSize);
+
+	//run inline if there is nothing to split, or if the pool is already busy (nested call / other thread)
+	if (s_workers.empty() || n <= grainSize || s_inJob || !s_jobMutex.try_lock()) {
+		f(begin, end);
+		return;
+	}
+
+	//a few chunks per thread for load balancing
+	const unsigned int numThreads = getNumThreads();
+	const unsigned int chunkSize = std::max(grainSize, (n + 4 * numThreads - 1) / (4 * numThreads));
+	{
+		std::unique_lock<std::mutex> lock(s_mutex);
+		s_func = &f;
+		s_begin = begin;
+		s_end = end;
+		s_chunkSize = chunkSize;
+		s_numChunks = (n + chunkSize - 1) / chunkSize;
+		s_nextChunk = 0;
+		s_exception = NULL;
+		s_generation++;
+	}
+	s_cvJob.notify_all();
+
+	runChunks();
+
+	std::exception_ptr exception;
+	{
+		std::unique_lock<std::mutex> lock(s_mutex);
+		s_cvDone.wait(lock, [] { return s_numBusy == 0; });
+		s_func = NULL;
+		std::swap(exception, s_exception);
+	}
+	s_jobMutex.unlock();
+	if (exception) std::rethrow_exception(exception);
+}
+
+void CPUParallel::runChunks()
+{
+	s_inJob = true;
+	while (true) {
+		const unsigned int c = s_nextChunk++;
+		if (c >= s_numChunks) break;
+		const unsigned int b = s_begin + c * s_chunkSize;
+		const unsigned int e = std::min(s_end, b + s_chunkSize);
+		try {
+			(*s_func)(b, e);
+		}
+		catch (...) {
+			//keep the first one, skip the remaining chunks
+			std::unique_lock<std::mutex> lock(s_mutex);
+			if (!s_exception) s_exception = std::current_exception();
+			s_nextChunk = s_numChunks;
+		}
+	}
+	s_inJob = false;
+}
+
+void CPUParallel::workerFunc()
+{
+	unsigned int seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(s_mutex);
+			s_cvJob.wait(lock, [&seenGeneration] { return s_exit || s_generation != seenGeneration; });
+			if (s_exit) return;
+			seenGeneration = s_generation;
+			if (s_func == NULL) continue;	//woke up after the job was already finished
+			s_numBusy++;
+		}
+
+		runChunks();
+
+		{
+			std::unique_lock<std::mutex> lock(s_mutex);
+			s_numBusy--;
+		}
+		s_cvDone.notify_all();
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <exception>
+
+//! persistent worker pool for the cpu kernels; the calling thread participates in every job
+class CPUParallel {
+public:
+	//! f(chunkBegin, chunkEnd) for contiguous sub-ranges of [begin, end)
+	typedef std::function<void(unsigned int, unsigned int)> RangeFunc;
+
+	//! numThreads == 0 -> std::thread::hardware_concurrency()
+	static void init(unsigned int numThreads = 0);
+	static void destroy();
+
+	static unsigned int getNumThreads() {
+		return (unsigned int)s_workers.size() + 1;
+	}
+
+	//! splits [begin, end) into chunks of at least grainSize elements and processes them on the pool;
+	//! the first exception thrown by a chunk is rethrown here once all threads are done (the remaining chunks are skipped)
+	static void parallelFor(unsigned int begin, unsigned int end, const RangeFunc& f, unsigned int grainSize = 1);
+
+	//! convenience wrapper: f(i) for each i in [begin, end)
+	static void parallelForEach(unsigned int begin, unsigned int end, const std::function<void(unsigned int)>& f, unsigned int grainSize = 1) {
+		parallelFor(begin, end, [&f](unsigned int b, unsigned int e) {
+			for (unsigned int i = b; i < e; i++) f(i);
+		}, grainSize);
+	}
+
+private:
+	static void workerFunc();
+	static void runChunks();
+
+	static std::vector<std::thread> s_workers;
+
+	//! only one job is in flight; nested or concurrent calls (e.g., from the recon and bundling thread) run inline
+	static std::mutex s_jobMutex;
+	static std::mutex s_mutex;
+	static std::condition_variable s_cvJob;
+	static std::condition_variable s_cvDone;
+
+	static const RangeFunc* s_func;
+	static unsigned int s_begin;
+	static unsigned int s_end;
+	static unsigned int s_chunkSize;
+	static std::atomic<unsigned int> s_nextChunk;
+	static unsigned int s_numChunks;
+	static unsigned int s_numBusy;
+	static unsigned int s_generation;
+	static bool s_exit;
+	static std::exception_ptr s_exception;
+};
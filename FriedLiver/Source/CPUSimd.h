@@ -0,0 +1,340 @@
+#pragma once
+
+/************************************************************************/
+/* Minimal SIMD float vector for the cpu kernels                        */
+/************************************************************************/
+
+//! vfloat has 8 lanes with AVX2, 4 with SSE2 (always available on x64) and 1 otherwise (or if CPU_SIMD_SCALAR is defined);
+//! kernels are written once against it and process vfloat::Width pixels at a time
+#if defined(__AVX2__) && !defined(CPU_SIMD_SCALAR)
+#include <immintrin.h>
+#define CPU_SIMD_AVX2
+#elif (defined(_M_X64) || defined(__SSE2__)) && !defined(CPU_SIMD_SCALAR)
+#include <emmintrin.h>
+#define CPU_SIMD_SSE2
+#endif
+#include <cmath>
+
+#if defined(CPU_SIMD_AVX2)
+
+struct vfloat {
+	static const unsigned int Width = 8;
+	__m256 v;
+	vfloat() {}
+	vfloat(__m256 _v) : v(_v) {}
+};
+struct vmask {
+	__m256 v;
+	vmask(__m256 _v) : v(_v) {}
+};
+
+inline vfloat vset1(float f) { return _mm256_set1_ps(f); }
+inline vfloat vzero() { return _mm256_setzero_ps(); }
+//! start, start + 1, ...
+inline vfloat vramp(float start) { return _mm256_add_ps(_mm256_set1_ps(start), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f)); }
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, const vfloat& a) { _mm256_storeu_ps(p, a.v); }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat vmin(const vfloat& a, const vfloat& b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat& a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat vabs(const vfloat& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline vfloat vfloor(const vfloat& a) { return _mm256_floor_ps(a.v); }
+//! 2^n for integral n in [-126, 127]
+inline vfloat vpow2i(const vfloat& n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23)); }
+
+//same semantics as the scalar comparison operators (!= is true for nan)
+inline vmask vcmpeq(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline vmask vcmpneq(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ); }
+inline vmask vcmplt(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vmask vcmple(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vmask vcmpgt(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vmask vcmpge(const vfloat& a, const vfloat& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vmask operator&(const vmask& a, const vmask& b) { return _mm256_and_ps(a.v, b.v); }
+inline vmask operator|(const vmask& a, const vmask& b) { return _mm256_or_ps(a.v, b.v); }
+inline bool vany(const vmask& m) { return _mm256_movemask_ps(m.v) != 0; }
+//! m ? a : b
+inline vfloat vselect(const vmask& m, const vfloat& a, const vfloat& b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+//! m ? a : 0
+inline vfloat vand(const vmask& m, const vfloat& a) { return _mm256_and_ps(m.v, a.v); }
+
+//! channels of Width consecutive 4 byte pixels (e.g., uchar4)
+inline void vloadBytes4(const unsigned char* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	x = _mm256_cvtepi32_ps(_mm256_and_si256(v, mask));
+	y = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask));
+	z = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask));
+	w = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 24));
+}
+//! components of Width consecutive float4 (array of structures -> structure of arrays)
+inline void vloadFloat4(const float* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	__m128 a0 = _mm_loadu_ps(p + 0), a1 = _mm_loadu_ps(p + 4), a2 = _mm_loadu_ps(p + 8), a3 = _mm_loadu_ps(p + 12);
+	__m128 b0 = _mm_loadu_ps(p + 16), b1 = _mm_loadu_ps(p + 20), b2 = _mm_loadu_ps(p + 24), b3 = _mm_loadu_ps(p + 28);
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+	x = _mm256_insertf128_ps(_mm256_castps128_ps256(a0), b0, 1);
+	y = _mm256_insertf128_ps(_mm256_castps128_ps256(a1), b1, 1);
+	z = _mm256_insertf128_ps(_mm256_castps128_ps256(a2), b2, 1);
+	w = _mm256_insertf128_ps(_mm256_castps128_ps256(a3), b3, 1);
+}
+inline void vstoreFloat4(float* p, const vfloat& x, const vfloat& y, const vfloat& z, const vfloat& w) {
+	__m128 a0 = _mm256_castps256_ps128(x.v), a1 = _mm256_castps256_ps128(y.v), a2 = _mm256_castps256_ps128(z.v), a3 = _mm256_castps256_ps128(w.v);
+	__m128 b0 = _mm256_extractf128_ps(x.v, 1), b1 = _mm256_extractf128_ps(y.v, 1), b2 = _mm256_extractf128_ps(z.v, 1), b3 = _mm256_extractf128_ps(w.v, 1);
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+	_mm_storeu_ps(p + 0, a0); _mm_storeu_ps(p + 4, a1); _mm_storeu_ps(p + 8, a2); _mm_storeu_ps(p + 12, a3);
+	_mm_storeu_ps(p + 16, b0); _mm_storeu_ps(p + 20, b1); _mm_storeu_ps(p + 24, b2); _mm_storeu_ps(p + 28, b3);
+}
+
+#elif defined(CPU_SIMD_SSE2)
+
+struct vfloat {
+	static const unsigned int Width = 4;
+	__m128 v;
+	vfloat() {}
+	vfloat(__m128 _v) : v(_v) {}
+};
+struct vmask {
+	__m128 v;
+	vmask(__m128 _v) : v(_v) {}
+};
+
+inline vfloat vset1(float f) { return _mm_set1_ps(f); }
+inline vfloat vzero() { return _mm_setzero_ps(); }
+inline vfloat vramp(float start) { return _mm_add_ps(_mm_set1_ps(start), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)); }
+inline vfloat vload(const float* p) { return _mm_loadu_ps(p); }
+inline void vstore(float* p, const vfloat& a) { _mm_storeu_ps(p, a.v); }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat vmin(const vfloat& a, const vfloat& b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vsqrt(const vfloat& a) { return _mm_sqrt_ps(a.v); }
+inline vfloat vabs(const vfloat& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline vfloat vfloor(const vfloat& a) {
+	//truncate, then correct negative non-integers (|a| < 2^31)
+	const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+inline vfloat vpow2i(const vfloat& n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127)), 23)); }
+
+inline vmask vcmpeq(const vfloat& a, const vfloat& b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline vmask vcmpneq(const vfloat& a, const vfloat& b) { return _mm_cmpneq_ps(a.v, b.v); }
+inline vmask vcmplt(const vfloat& a, const vfloat& b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vmask vcmple(const vfloat& a, const vfloat& b) { return _mm_cmple_ps(a.v, b.v); }
+inline vmask vcmpgt(const vfloat& a, const vfloat& b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vmask vcmpge(const vfloat& a, const vfloat& b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vmask operator&(const vmask& a, const vmask& b) { return _mm_and_ps(a.v, b.v); }
+inline vmask operator|(const vmask& a, const vmask& b) { return _mm_or_ps(a.v, b.v); }
+inline bool vany(const vmask& m) { return _mm_movemask_ps(m.v) != 0; }
+inline vfloat vselect(const vmask& m, const vfloat& a, const vfloat& b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+inline vfloat vand(const vmask& m, const vfloat& a) { return _mm_and_ps(m.v, a.v); }
+
+inline void vloadBytes4(const unsigned char* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	const __m128i v = _mm_loadu_si128((const __m128i*)p);
+	const __m128i mask = _mm_set1_epi32(0xff);
+	x = _mm_cvtepi32_ps(_mm_and_si128(v, mask));
+	y = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask));
+	z = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask));
+	w = _mm_cvtepi32_ps(_mm_srli_epi32(v, 24));
+}
+inline void vloadFloat4(const float* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	__m128 a0 = _mm_loadu_ps(p + 0), a1 = _mm_loadu_ps(p + 4), a2 = _mm_loadu_ps(p + 8), a3 = _mm_loadu_ps(p + 12);
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	x = a0; y = a1; z = a2; w = a3;
+}
+inline void vstoreFloat4(float* p, const vfloat& x, const vfloat& y, const vfloat& z, const vfloat& w) {
+	__m128 a0 = x.v, a1 = y.v, a2 = z.v, a3 = w.v;
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_mm_storeu_ps(p + 0, a0); _mm_storeu_ps(p + 4, a1); _mm_storeu_ps(p + 8, a2); _mm_storeu_ps(p + 12, a3);
+}
+
+#else
+
+struct vfloat {
+	static const unsigned int Width = 1;
+	float v;
+	vfloat() {}
+	vfloat(float _v) : v(_v) {}
+};
+struct vmask {
+	bool v;
+	vmask(bool _v) : v(_v) {}
+};
+
+inline vfloat vset1(float f) { return f; }
+inline vfloat vzero() { return 0.0f; }
+inline vfloat vramp(float start) { return start; }
+inline vfloat vload(const float* p) { return *p; }
+inline void vstore(float* p, const vfloat& a) { *p = a.v; }
+
+inline vfloat operator+(const vfloat& a, const vfloat& b) { return a.v + b.v; }
+inline vfloat operator-(const vfloat& a, const vfloat& b) { return a.v - b.v; }
+inline vfloat operator*(const vfloat& a, const vfloat& b) { return a.v * b.v; }
+inline vfloat operator/(const vfloat& a, const vfloat& b) { return a.v / b.v; }
+inline vfloat vmin(const vfloat& a, const vfloat& b) { return a.v < b.v ? a.v : b.v; }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { return a.v > b.v ? a.v : b.v; }
+inline vfloat vsqrt(const vfloat& a) { return std::sqrt(a.v); }
+inline vfloat vabs(const vfloat& a) { return std::fabs(a.v); }
+inline vfloat vfloor(const vfloat& a) { return std::floor(a.v); }
+inline vfloat vpow2i(const vfloat& n) { return std::ldexp(1.0f, (int)n.v); }
+
+inline vmask vcmpeq(const vfloat& a, const vfloat& b) { return a.v == b.v; }
+inline vmask vcmpneq(const vfloat& a, const vfloat& b) { return a.v != b.v; }
+inline vmask vcmplt(const vfloat& a, const vfloat& b) { return a.v < b.v; }
+inline vmask vcmple(const vfloat& a, const vfloat& b) { return a.v <= b.v; }
+inline vmask vcmpgt(const vfloat& a, const vfloat& b) { return a.v > b.v; }
+inline vmask vcmpge(const vfloat& a, const vfloat& b) { return a.v >= b.v; }
+inline vmask operator&(const vmask& a, const vmask& b) { return a.v && b.v; }
+inline vmask operator|(const vmask& a, const vmask& b) { return a.v || b.v; }
+inline bool vany(const vmask& m) { return m.v; }
+inline vfloat vselect(const vmask& m, const vfloat& a, const vfloat& b) { return m.v ? a : b; }
+inline vfloat vand(const vmask& m, const vfloat& a) { return m.v ? a.v : 0.0f; }
+
+inline void vloadBytes4(const unsigned char* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	x = (float)p[0]; y = (float)p[1]; z = (float)p[2]; w = (float)p[3];
+}
+inline void vloadFloat4(const float* p, vfloat& x, vfloat& y, vfloat& z, vfloat& w) {
+	x = p[0]; y = p[1]; z = p[2]; w = p[3];
+}
+inline void vstoreFloat4(float* p, const vfloat& x, const vfloat& y, const vfloat& z, const vfloat& w) {
+	p[0] = x.v; p[1] = y.v; p[2] = z.v; p[3] = w.v;
+}
+
+#endif
+
+//! exp(x) to ~2 ulp (cephes expf); exp(x <= -87) is flushed to zero, so no intermediate becomes denormal (slow)
+inline vfloat vexp(vfloat x)
+{
+	const vmask notUnderflow = vcmpgt(x, vset1(-87.0f));
+	x = vmin(vmax(x, vset1(-87.0f)), vset1(88.3762626f));
+	const vfloat fx = vmin(vfloor(x * vset1(1.44269504f) + vset1(0.5f)), vset1(127.0f));	//2^128 would overflow the exponent
+	x = x - fx * vset1(0.693359375f);
+	x = x - fx * vset1(-2.12194440e-4f);
+	const vfloat z = x * x;
+	vfloat y = vset1(1.9875691500e-4f);
+	y = y * x + vset1(1.3981999507e-3f);
+	y = y * x + vset1(8.3334519073e-3f);
+	y = y * x + vset1(4.1665795894e-2f);
+	y = y * x + vset1(1.6666665459e-1f);
+	y = y * x + vset1(5.0000001201e-1f);
+	y = y * z + x + vset1(1.0f);
+	return vand(notUnderflow, y * vpow2i(fx));
+}
+
+//! atan2(y, x) to ~2 ulp (cephes atanf after octant reduction); atan2(0, 0) = 0
+inline vfloat vatan2(const vfloat& y, const vfloat& x)
+{
+	const vfloat ax = vabs(x), ay = vabs(y);
+	const vfloat mx = vmax(ax, ay), mn = vmin(ax, ay);
+	vfloat a = vand(vcmpgt(mx, vzero()), mn / vmax(mx, vset1(1e-30f)));	//in [0, 1]
+
+	//tan(pi/8) < a <= 1 -> atan(a) = pi/4 + atan((a - 1) / (a + 1))
+	const vmask big = vcmpgt(a, vset1(0.414213562f));
+	a = vselect(big, (a - vset1(1.0f)) / (a + vset1(1.0f)), a);
+	const vfloat z = a * a;
+	vfloat r = vset1(8.05374449538e-2f);
+	r = r * z - vset1(1.38776856032e-1f);
+	r = r * z + vset1(1.99777106478e-1f);
+	r = r * z - vset1(3.33329491539e-1f);
+	r = r * z * a + a + vand(big, vset1(0.785398163f));
+
+	r = vselect(vcmpgt(ay, ax), vset1(1.57079633f) - r, r);
+	r = vselect(vcmplt(x, vzero()), vset1(3.14159265f) - r, r);
+	return vselect(vcmplt(y, vzero()), vzero() - r, r);
+}
+
+/************************************************************************/
+/* Descriptor dot products (SiftMatchCPU)                               */
+/************************************************************************/
+
+//! descriptors are widened to 128 shorts once, so the inner loop is a plain 16 bit multiply-add (exact, unlike the
+//! signed x unsigned byte products of maddubs / vpdpbusd, since descriptor bytes can exceed 127)
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__) && !defined(CPU_SIMD_SCALAR)
+#define CPU_SIMD_AVX512VNNI
+#endif
+
+inline void vwidenDescriptor(const unsigned char* d, short* out) {
+	for (int i = 0; i < 128; i++) out[i] = (short)d[i];
+}
+
+//! dots[k] = a . b[k] for four widened descriptors
+inline void vdotDescriptor4(const short* a, const short* const* b, int* dots)
+{
+#if defined(CPU_SIMD_AVX512VNNI)
+	__m512i acc0 = _mm512_setzero_si512(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	for (int c = 0; c < 128; c += 32) {
+		const __m512i va = _mm512_loadu_si512((const void*)(a + c));
+		acc0 = _mm512_dpwssd_epi32(acc0, va, _mm512_loadu_si512((const void*)(b[0] + c)));
+		acc1 = _mm512_dpwssd_epi32(acc1, va, _mm512_loadu_si512((const void*)(b[1] + c)));
+		acc2 = _mm512_dpwssd_epi32(acc2, va, _mm512_loadu_si512((const void*)(b[2] + c)));
+		acc3 = _mm512_dpwssd_epi32(acc3, va, _mm512_loadu_si512((const void*)(b[3] + c)));
+	}
+	dots[0] = _mm512_reduce_add_epi32(acc0);
+	dots[1] = _mm512_reduce_add_epi32(acc1);
+	dots[2] = _mm512_reduce_add_epi32(acc2);
+	dots[3] = _mm512_reduce_add_epi32(acc3);
+#elif defined(CPU_SIMD_AVX2)
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	for (int c = 0; c < 128; c += 16) {
+		const __m256i va = _mm256_loadu_si256((const __m256i*)(a + c));
+		acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(va, _mm256_loadu_si256((const __m256i*)(b[0] + c))));
+		acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(va, _mm256_loadu_si256((const __m256i*)(b[1] + c))));
+		acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(va, _mm256_loadu_si256((const __m256i*)(b[2] + c))));
+		acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(va, _mm256_loadu_si256((const __m256i*)(b[3] + c))));
+	}
+	//lane sums of the four accumulators at once
+	const __m256i h = _mm256_hadd_epi32(_mm256_hadd_epi32(acc0, acc1), _mm256_hadd_epi32(acc2, acc3));
+	_mm_storeu_si128((__m128i*)dots, _mm_add_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1)));
+#elif defined(CPU_SIMD_SSE2)
+	__m128i acc0 = _mm_setzero_si128(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	for (int c = 0; c < 128; c += 8) {
+		const __m128i va = _mm_loadu_si128((const __m128i*)(a + c));
+		acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(va, _mm_loadu_si128((const __m128i*)(b[0] + c))));
+		acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(va, _mm_loadu_si128((const __m128i*)(b[1] + c))));
+		acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(va, _mm_loadu_si128((const __m128i*)(b[2] + c))));
+		acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(va, _mm_loadu_si128((const __m128i*)(b[3] + c))));
+	}
+	//transpose so one vector holds the four sums
+	const __m128i t0 = _mm_unpacklo_epi32(acc0, acc1), t1 = _mm_unpackhi_epi32(acc0, acc1);
+	const __m128i t2 = _mm_unpacklo_epi32(acc2, acc3), t3 = _mm_unpackhi_epi32(acc2, acc3);
+	const __m128i s01 = _mm_add_epi32(t0, t1), s23 = _mm_add_epi32(t2, t3);
+	_mm_storeu_si128((__m128i*)dots, _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23)));
+#else
+	for (int k = 0; k < 4; k++) {
+		int dot = 0;
+		for (int c = 0; c < 128; c++) dot += a[c] * b[k][c];
+		dots[k] = dot;
+	}
+#endif
+}
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+inline int cpuPopcount64(unsigned long long v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(v);
+#elif defined(__GNUC__)
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ull);
+	v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+	return (int)((((v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full) * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+//! hamming distance of two 256 bit strings
+inline int vhamming256(const unsigned long long* a, const unsigned long long* b)
+{
+	return cpuPopcount64(a[0] ^ b[0]) + cpuPopcount64(a[1] ^ b[1]) + cpuPopcount64(a[2] ^ b[2]) + cpuPopcount64(a[3] ^ b[3]);
+}
@@ -16,6 +16,7 @@ CUDACache::CUDACache(unsigned int widthDepthInput, unsigned int heightDepthInput
 	m_width = widthDownSampled;
 	m_height = heightDownSampled;
 	m_maxNumImages = maxNumImages;
+	m_numPyramidLevels = std::max(1u, std::min(GlobalBundlingState::get().s_denseVerifyPyramidLevels, (unsigned int)CUDACACHE_PYRAMID_LEVELS));
 
 	m_intrinsics = inputIntrinsics;
 	m_intrinsics._m00 *= (float)widthDownSampled / (float)widthDepthInput;
@@ -82,9 +83,26 @@ void CUDACache::storeFrame(const float* d_depth, unsigned int inputDepthWidth, u
 	else std::swap(frame.d_intensityDownsampled, d_intensityHelper);
 	CUDAImageUtil::computeIntensityDerivatives(frame.d_intensityDerivsDownsampled, frame.d_intensityDownsampled, m_width, m_height);
 
+	computePyramid(m_currentFrame);
 	m_currentFrame++;
 }
 
+void CUDACache::computePyramid(unsigned int frame)
+{
+	CUDACachedFrame& f = m_cache[frame];
+	for (unsigned int level = 1; level < m_numPyramidLevels; level++) {
+		const unsigned int levelWidth = getPyramidWidth(level);
+		const unsigned int levelHeight = getPyramidHeight(level);
+		CUDAImageUtil::resampleFloat(f.d_depthPyramid[level], levelWidth, levelHeight, f.d_depthDownsampled, m_width, m_height);
+		CUDAImageUtil::resampleFloat4(f.d_cameraposPyramid[level], levelWidth, levelHeight, f.d_cameraposDownsampled, m_width, m_height);
+#ifdef CUDACACHE_FLOAT_NORMALS
+		CUDAImageUtil::resampleFloat4(f.d_normalsPyramid[level], levelWidth, levelHeight, f.d_normalsDownsampled, m_width, m_height);
+#else
+		CUDAImageUtil::resampleUCHAR4(f.d_normalsPyramidUCHAR4[level], levelWidth, levelHeight, f.d_normalsDownsampledUCHAR4, m_width, m_height);
+#endif
+	}
+}
+
 void CUDACache::fuseDepthFrames(CUDACache* globalCache, const int* d_validImages, const float4x4* d_transforms) const
 {
 	assert(globalCache->m_currentFrame > 0);
@@ -115,4 +133,5 @@ void CUDACache::fuseDepthFrames(CUDACache* globalCache, const int* d_validImages
 	CUDAImageUtil::computeNormals(globalFrame.d_normalsDownsampled, globalFrame.d_cameraposDownsampled, m_width, m_height);
 	//CUDAImageUtil::convertNormalsFloat4ToUCHAR4(globalFrame.d_normalsDownsampledUCHAR4, globalFrame.d_normalsDownsampled, m_width, m_height);
 #endif
+	globalCache->computePyramid(globalFrameIdx);
 }
@@ -34,6 +34,7 @@ public:
 #ifdef CUDACACHE_FLOAT_NORMALS
 		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_cache[m_currentFrame].d_normalsDownsampled, other->m_cache[frameFrom].d_normalsDownsampled, sizeof(float4) * m_width * m_height, cudaMemcpyDeviceToDevice));
 #endif
+		computePyramid(m_currentFrame);
 		m_currentFrame++;
 	}
 
@@ -48,6 +49,24 @@ public:
 	const mat4f& getIntrinsics() const { return m_intrinsics; }
 	const mat4f& getIntrinsicsInv() const { return m_intrinsicsInv; }
 
+	//! pyramid levels of the cached frames (level 0 is the cache resolution)
+	unsigned int getNumPyramidLevels() const { return m_numPyramidLevels; }
+	unsigned int getPyramidWidth(unsigned int level) const { return CUDACachedFrame::getPyramidSize(m_width, level); }
+	unsigned int getPyramidHeight(unsigned int level) const { return CUDACachedFrame::getPyramidSize(m_height, level); }
+	mat4f getPyramidIntrinsics(unsigned int level) const {
+		const unsigned int width = getPyramidWidth(level);
+		const unsigned int height = getPyramidHeight(level);
+		mat4f intrinsics = m_intrinsics;
+		//same pixel mapping as the resampling: x_level = x * (width - 1) / (m_width - 1)
+		const float scaleX = (float)(width - 1) / (float)(m_width - 1);
+		const float scaleY = (float)(height - 1) / (float)(m_height - 1);
+		intrinsics._m00 *= scaleX;
+		intrinsics._m11 *= scaleY;
+		intrinsics._m02 *= scaleX;
+		intrinsics._m12 *= scaleY;
+		return intrinsics;
+	}
+
 	unsigned int getNumFrames() const { return m_currentFrame; }
 
 	//! warning: untested!
@@ -137,6 +156,7 @@ public:
 #ifdef CUDACACHE_FLOAT_NORMALS
 			MLIB_CUDA_SAFE_CALL(cudaMemcpy(f.d_normalsDownsampled, normals.getData(), sizeof(float4)*normals.getNumPixels(), cudaMemcpyHostToDevice));
 #endif
+			computePyramid(i);
 		}
 		s.close();
 	}
@@ -193,6 +213,7 @@ public:
 #ifdef CUDACACHE_FLOAT_NORMALS
 			MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_cache[i].d_normalsDownsampled, cachedFrames[i].d_normalsDownsampled, sizeof(float4) * m_width * m_height, cudaMemcpyDeviceToDevice));
 #endif
+			computePyramid(i);
 		}
 	}
 
@@ -200,10 +221,13 @@ public:
 
 private:
 
+	//! subsamples the coarser pyramid levels (if any) of a frame from its cache resolution data
+	void computePyramid(unsigned int frame);
+
 	void alloc() {
 		m_cache.resize(m_maxNumImages);
 		for (CUDACachedFrame& f : m_cache) {
-			f.alloc(m_width, m_height);
+			f.alloc(m_width, m_height, m_numPyramidLevels);
 		}
 		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_cache, sizeof(CUDACachedFrame)*m_maxNumImages));
 		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_cache, m_cache.data(), sizeof(CUDACachedFrame)*m_maxNumImages, cudaMemcpyHostToDevice));
@@ -236,6 +260,7 @@ private:
 
 	unsigned int m_currentFrame;
 	unsigned int m_maxNumImages;
+	unsigned int m_numPyramidLevels;	//s_denseVerifyPyramidLevels; 1: no coarser levels are kept
 
 	std::vector < CUDACachedFrame > m_cache;
 	CUDACachedFrame*				d_cache;
@@ -7,8 +7,12 @@
 #define CUDACACHE_UCHAR_NORMALS
 #define CUDACACHE_FLOAT_NORMALS
 
+//! max depth/camera position/normal pyramid levels per cached frame (level 0 is the cache resolution, each level halves it); used by the dense verify
+#define CUDACACHE_PYRAMID_LEVELS 3
+
 struct CUDACachedFrame {
-	void alloc(unsigned int width, unsigned int height) {
+	//! only the first numPyramidLevels levels are allocated (the others stay NULL)
+	void alloc(unsigned int width, unsigned int height, unsigned int numPyramidLevels) {
 		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_depthDownsampled, sizeof(float) * width * height));
 		//MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_colorDownsampled, sizeof(uchar4) * width * height));
 		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_cameraposDownsampled, sizeof(float4) * width * height));
@@ -21,6 +25,35 @@ struct CUDACachedFrame {
 #ifdef CUDACACHE_FLOAT_NORMALS
 		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_normalsDownsampled, sizeof(float4) * width * height));
 #endif
+
+		//level 0 aliases the cache resolution
+		d_depthPyramid[0] = d_depthDownsampled;
+		d_cameraposPyramid[0] = d_cameraposDownsampled;
+#ifdef CUDACACHE_FLOAT_NORMALS
+		d_normalsPyramid[0] = d_normalsDownsampled;
+#else
+		d_normalsPyramidUCHAR4[0] = d_normalsDownsampledUCHAR4;
+#endif
+		for (unsigned int level = 1; level < CUDACACHE_PYRAMID_LEVELS; level++) {
+			d_depthPyramid[level] = NULL;
+			d_cameraposPyramid[level] = NULL;
+#ifdef CUDACACHE_FLOAT_NORMALS
+			d_normalsPyramid[level] = NULL;
+#else
+			d_normalsPyramidUCHAR4[level] = NULL;
+#endif
+		}
+		for (unsigned int level = 1; level < numPyramidLevels; level++) {
+			const unsigned int levelWidth = getPyramidSize(width, level);
+			const unsigned int levelHeight = getPyramidSize(height, level);
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_depthPyramid[level], sizeof(float) * levelWidth * levelHeight));
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_cameraposPyramid[level], sizeof(float4) * levelWidth * levelHeight));
+#ifdef CUDACACHE_FLOAT_NORMALS
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_normalsPyramid[level], sizeof(float4) * levelWidth * levelHeight));
+#else
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_normalsPyramidUCHAR4[level], sizeof(uchar4) * levelWidth * levelHeight));
+#endif
+		}
 	}
 	void free() {
 		MLIB_CUDA_SAFE_FREE(d_depthDownsampled);
@@ -35,6 +68,21 @@ struct CUDACachedFrame {
 #ifdef CUDACACHE_FLOAT_NORMALS
 		MLIB_CUDA_SAFE_FREE(d_normalsDownsampled); 
 #endif
+
+		for (unsigned int level = 1; level < CUDACACHE_PYRAMID_LEVELS; level++) {
+			MLIB_CUDA_SAFE_FREE(d_depthPyramid[level]);
+			MLIB_CUDA_SAFE_FREE(d_cameraposPyramid[level]);
+#ifdef CUDACACHE_FLOAT_NORMALS
+			MLIB_CUDA_SAFE_FREE(d_normalsPyramid[level]);
+#else
+			MLIB_CUDA_SAFE_FREE(d_normalsPyramidUCHAR4[level]);
+#endif
+		}
+	}
+
+	//! width/height of a pyramid level
+	static unsigned int getPyramidSize(unsigned int size, unsigned int level) {
+		return (size >> level) > 0 ? (size >> level) : 1;
 	}
 
 	float* d_depthDownsampled;
@@ -50,6 +98,15 @@ struct CUDACachedFrame {
 #ifdef CUDACACHE_FLOAT_NORMALS
 	float4* d_normalsDownsampled;
 #endif
+
+	//pyramid for the dense verify (nearest neighbor subsampled from level 0)
+	float* d_depthPyramid[CUDACACHE_PYRAMID_LEVELS];
+	float4* d_cameraposPyramid[CUDACACHE_PYRAMID_LEVELS];
+#ifdef CUDACACHE_FLOAT_NORMALS
+	float4* d_normalsPyramid[CUDACACHE_PYRAMID_LEVELS];
+#else
+	uchar4* d_normalsPyramidUCHAR4[CUDACACHE_PYRAMID_LEVELS];
+#endif
 };
 
 #endif //CUDA_CACHE_UTIL
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "CUDADepthFilter.h"
+#include "CUDAImageUtil.h"
+
+#define DEPTH_FILTER_REPORT_INTERVAL 100	//frames between error reports
+#define DOMAIN_TRANSFORM_ITERATIONS 3
+#define BILATERAL_GRID_PAD 1				//cells around the grid for the [1 2 1] blur and the trilinear slice
+
+extern "C" void separableDepthFilterCU(float* d_output, float2* d_tmp, const float* d_input, float sigmaD, float sigmaR, unsigned int width, unsigned int height);
+extern "C" void bilateralGridDepthFilterCU(float* d_output, float2* d_grid, float2* d_gridTmp, const int3& cellDim, const float3& gridScale, int gridPad,
+	const float* d_input, float depthMin, float depthMax, unsigned int width, unsigned int height);
+extern "C" void domainTransformDepthFilterCU(float* d_output, const float* d_input, float sigmaD, float sigmaR, unsigned int numIterations, unsigned int width, unsigned int height);
+
+//the grid blur has a std. dev. of 1/sqrt(2) cells, so a spacing of sqrt(2)*sigmaD matches the exact spatial kernel;
+//the range is sampled at sigmaR (the exact filter cuts off at |dDepth| = sigmaR)
+static inline float3 bilateralGridScale(float sigmaD, float sigmaR)
+{
+	return make_float3(1.0f / (1.41421356f*sigmaD), 1.0f / (1.41421356f*sigmaD), 1.0f / sigmaR);
+}
+
+CUDADepthFilter::CUDADepthFilter(unsigned int width, unsigned int height, MODE mode, float sigmaD, float sigmaR, float depthMin, float depthMax, bool bReportError)
+{
+	if ((int)mode < 0 || mode >= NUM_MODES) throw MLIB_EXCEPTION("invalid depth filter mode " + std::to_string((int)mode));
+
+	m_mode = mode;
+	m_width = width;
+	m_height = height;
+	m_sigmaD = sigmaD;
+	m_sigmaR = sigmaR;
+	m_depthMin = depthMin;
+	m_depthMax = depthMax;
+	m_bReportError = bReportError && mode != EXACT;
+
+	d_separableTmp = NULL;
+	d_grid = NULL;
+	d_gridTmp = NULL;
+	d_reference = NULL;
+	m_cellDim = make_int3(0, 0, 0);
+
+	if (m_mode == SEPARABLE) {
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_separableTmp, sizeof(float2)*m_width*m_height));
+	}
+	else if (m_mode == BILATERAL_GRID) {
+		const float3 scale = bilateralGridScale(m_sigmaD, m_sigmaR);
+		m_cellDim.x = (int)std::ceil((m_width - 1)*scale.x) + 1 + 2 * BILATERAL_GRID_PAD;
+		m_cellDim.y = (int)std::ceil((m_height - 1)*scale.y) + 1 + 2 * BILATERAL_GRID_PAD;
+		m_cellDim.z = (int)std::ceil((m_depthMax - m_depthMin)*scale.z) + 1 + 2 * BILATERAL_GRID_PAD;
+		const size_t numCells = (size_t)m_cellDim.x*m_cellDim.y*m_cellDim.z;
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_grid, sizeof(float2)*numCells));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_gridTmp, sizeof(float2)*numCells));
+	}
+
+	memset(&m_errorStats, 0, sizeof(ErrorStats));
+	if (m_bReportError) {
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_reference, sizeof(float)*m_width*m_height));
+		m_hostOutput.resize(m_width*m_height);
+		m_hostReference.resize(m_width*m_height);
+		MLIB_CUDA_SAFE_CALL(cudaEventCreate(&m_eventStart));
+		MLIB_CUDA_SAFE_CALL(cudaEventCreate(&m_eventFilter));
+		MLIB_CUDA_SAFE_CALL(cudaEventCreate(&m_eventExact));
+	}
+}
+
+CUDADepthFilter::~CUDADepthFilter()
+{
+	if (m_bReportError) {
+		if (m_errorStats.numFrames > 0) printErrorStats();
+		MLIB_CUDA_SAFE_CALL(cudaEventDestroy(m_eventStart));
+		MLIB_CUDA_SAFE_CALL(cudaEventDestroy(m_eventFilter));
+		MLIB_CUDA_SAFE_CALL(cudaEventDestroy(m_eventExact));
+	}
+	MLIB_CUDA_SAFE_FREE(d_separableTmp);
+	MLIB_CUDA_SAFE_FREE(d_grid);
+	MLIB_CUDA_SAFE_FREE(d_gridTmp);
+	MLIB_CUDA_SAFE_FREE(d_reference);
+}
+
+const char* CUDADepthFilter::getModeName(MODE mode)
+{
+	switch (mode) {
+	case EXACT:				return "exact";
+	case SEPARABLE:			return "separable";
+	case BILATERAL_GRID:	return "bilateral grid";
+	case DOMAIN_TRANSFORM:	return "domain transform";
+	default:				return "unknown";
+	}
+}
+
+void CUDADepthFilter::apply(float* d_output, const float* d_input)
+{
+	if (!m_bReportError) {
+		applyMode(d_output, d_input);
+		return;
+	}
+
+	MLIB_CUDA_SAFE_CALL(cudaEventRecord(m_eventStart));
+	applyMode(d_output, d_input);
+	MLIB_CUDA_SAFE_CALL(cudaEventRecord(m_eventFilter));
+	CUDAImageUtil::gaussFilterDepthMap(d_reference, d_input, m_sigmaD, m_sigmaR, m_width, m_height);
+	MLIB_CUDA_SAFE_CALL(cudaEventRecord(m_eventExact));
+	MLIB_CUDA_SAFE_CALL(cudaEventSynchronize(m_eventExact));
+
+	float timeFilter, timeExact;
+	MLIB_CUDA_SAFE_CALL(cudaEventElapsedTime(&timeFilter, m_eventStart, m_eventFilter));
+	MLIB_CUDA_SAFE_CALL(cudaEventElapsedTime(&timeExact, m_eventFilter, m_eventExact));
+	m_errorStats.timeFilterMS += timeFilter;
+	m_errorStats.timeExactMS += timeExact;
+
+	accumulateError(d_output, d_reference);
+	if (m_errorStats.numFrames % DEPTH_FILTER_REPORT_INTERVAL == 0) printErrorStats();
+}
+
+void CUDADepthFilter::applyMode(float* d_output, const float* d_input)
+{
+	switch (m_mode) {
+	case EXACT:
+		CUDAImageUtil::gaussFilterDepthMap(d_output, d_input, m_sigmaD, m_sigmaR, m_width, m_height);
+		break;
+	case SEPARABLE:
+		separableDepthFilterCU(d_output, d_separableTmp, d_input, m_sigmaD, m_sigmaR, m_width, m_height);
+		break;
+	case BILATERAL_GRID:
+		bilateralGridDepthFilterCU(d_output, d_grid, d_gridTmp, m_cellDim, bilateralGridScale(m_sigmaD, m_sigmaR), BILATERAL_GRID_PAD,
+			d_input, m_depthMin, m_depthMax, m_width, m_height);
+		break;
+	case DOMAIN_TRANSFORM:
+		domainTransformDepthFilterCU(d_output, d_input, m_sigmaD, m_sigmaR, DOMAIN_TRANSFORM_ITERATIONS, m_width, m_height);
+		break;
+	default:
+		break;
+	}
+}
+
+void CUDADepthFilter::accumulateError(const float* d_output, const float* d_reference)
+{
+	const unsigned int numPixels = m_width*m_height;
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_hostOutput.data(), d_output, sizeof(float)*numPixels, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_hostReference.data(), d_reference, sizeof(float)*numPixels, cudaMemcpyDeviceToHost));
+
+	const float minf = -std::numeric_limits<float>::infinity();
+	for (unsigned int i = 0; i < numPixels; i++) {
+		const bool valid = m_hostOutput[i] != minf;
+		const bool validRef = m_hostReference[i] != minf;
+		if (valid && validRef) {
+			const float err = std::abs(m_hostOutput[i] - m_hostReference[i]);
+			m_errorStats.sumAbsError += err;
+			m_errorStats.maxAbsError = std::max(m_errorStats.maxAbsError, err);
+			m_errorStats.numCompared++;
+		}
+		else if (valid != validRef) {
+			m_errorStats.numMismatch++;
+		}
+	}
+	m_errorStats.numPixels += numPixels;
+	m_errorStats.numFrames++;
+}
+
+void CUDADepthFilter::printErrorStats() const
+{
+	if (!m_bReportError || m_errorStats.numFrames == 0) {
+		std::cout << "depth filter (" << getModeName(m_mode) << "): no error stats" << std::endl;
+		return;
+	}
+	const ErrorStats& s = m_errorStats;
+	const double meanErr = s.numCompared > 0 ? s.sumAbsError / (double)s.numCompared : 0.0;
+	std::cout << "depth filter (" << getModeName(m_mode) << ") vs exact over " << s.numFrames << " frames: "
+		<< "mean |err| " << 1000.0*meanErr << " mm, max |err| " << 1000.0f*s.maxAbsError << " mm, "
+		<< "valid mismatch " << 100.0*(double)s.numMismatch / (double)s.numPixels << "%, "
+		<< "time " << s.timeFilterMS / s.numFrames << " ms (exact " << s.timeExactMS / s.numFrames << " ms)" << std::endl;
+}
@@ -0,0 +1,250 @@
+#include "mLibCuda.h"
+
+#define T_PER_BLOCK 16
+#define THREADS_PER_LINE 128	//domain transform: one block per row/column
+
+/////////////////////////////////////////////////////////////////////////////////////
+// separable approximation
+/////////////////////////////////////////////////////////////////////////////////////
+
+//! horizontal pass: per pixel the (weighted depth sum, weight sum) over the row, range test against the pixel itself
+__global__ void separableDepthFilterHorizontal_Kernel(float2* d_tmp, const float* d_input, float sigmaD, float sigmaR, int kernelRadius, unsigned int width, unsigned int height)
+{
+	const int x = blockIdx.x*blockDim.x + threadIdx.x;
+	const int y = blockIdx.y*blockDim.y + threadIdx.y;
+	if (x >= width || y >= height) return;
+
+	const float depthCenter = d_input[y*width + x];
+	float2 res = make_float2(0.0f, 0.0f);
+	if (depthCenter != MINF) {
+		const int mMin = max(x - kernelRadius, 0);
+		const int mMax = min(x + kernelRadius, (int)width - 1);
+		for (int m = mMin; m <= mMax; m++) {
+			const float currentDepth = d_input[y*width + m];
+			if (currentDepth != MINF && fabs(depthCenter - currentDepth) < sigmaR) {
+				const float weight = exp(-((m - x)*(m - x)) / (2.0f*sigmaD*sigmaD));
+				res.x += weight*currentDepth;
+				res.y += weight;
+			}
+		}
+	}
+	d_tmp[y*width + x] = res;
+}
+
+//! vertical pass over the row sums; the range test uses the unfiltered depth of the row centers
+__global__ void separableDepthFilterVertical_Kernel(float* d_output, const float2* d_tmp, const float* d_input, float sigmaD, float sigmaR, int kernelRadius, unsigned int width, unsigned int height)
+{
+	const int x = blockIdx.x*blockDim.x + threadIdx.x;
+	const int y = blockIdx.y*blockDim.y + threadIdx.y;
+	if (x >= width || y >= height) return;
+
+	d_output[y*width + x] = MINF;
+
+	const float depthCenter = d_input[y*width + x];
+	if (depthCenter == MINF) return;
+
+	float sum = 0.0f;
+	float sumWeight = 0.0f;
+	const int nMin = max(y - kernelRadius, 0);
+	const int nMax = min(y + kernelRadius, (int)height - 1);
+	for (int n = nMin; n <= nMax; n++) {
+		const float currentDepth = d_input[n*width + x];
+		if (currentDepth != MINF && fabs(depthCenter - currentDepth) < sigmaR) {
+			const float weight = exp(-((n - y)*(n - y)) / (2.0f*sigmaD*sigmaD));
+			const float2 row = d_tmp[n*width + x];
+			sum += weight*row.x;
+			sumWeight += weight*row.y;
+		}
+	}
+	if (sumWeight > 0.0f) d_output[y*width + x] = sum / sumWeight;
+}
+
+extern "C" void separableDepthFilterCU(float* d_output, float2* d_tmp, const float* d_input, float sigmaD, float sigmaR, unsigned int width, unsigned int height)
+{
+	const dim3 gridSize((width + T_PER_BLOCK - 1) / T_PER_BLOCK, (height + T_PER_BLOCK - 1) / T_PER_BLOCK);
+	const dim3 blockSize(T_PER_BLOCK, T_PER_BLOCK);
+	const int kernelRadius = (int)ceil(2.0*sigmaD);
+
+	separableDepthFilterHorizontal_Kernel << <gridSize, blockSize >> >(d_tmp, d_input, sigmaD, sigmaR, kernelRadius, width, height);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+	separableDepthFilterVertical_Kernel << <gridSize, blockSize >> >(d_output, d_tmp, d_input, sigmaD, sigmaR, kernelRadius, width, height);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// bilateral grid
+/////////////////////////////////////////////////////////////////////////////////////
+
+__device__ inline bool isInGridRange(float depth, float depthMin, float depthMax)
+{
+	return depth != MINF && depth >= depthMin && depth <= depthMax;
+}
+
+//! nearest neighbor splat of (depth, 1); gridScale = 1/spacing for x, y, depth
+__global__ void splatBilateralGrid_Kernel(float2* d_grid, int3 cellDim, float3 gridScale, int gridPad, const float* d_input, float depthMin, float depthMax, unsigned int width, unsigned int height)
+{
+	const int x = blockIdx.x*blockDim.x + threadIdx.x;
+	const int y = blockIdx.y*blockDim.y + threadIdx.y;
+	if (x >= width || y >= height) return;
+
+	const float depth = d_input[y*width + x];
+	if (!isInGridRange(depth, depthMin, depthMax)) return;
+
+	const int gx = (int)(x*gridScale.x + 0.5f) + gridPad;
+	const int gy = (int)(y*gridScale.y + 0.5f) + gridPad;
+	const int gz = (int)((depth - depthMin)*gridScale.z + 0.5f) + gridPad;
+	float2* cell = &d_grid[(gz*cellDim.y + gy)*cellDim.x + gx];
+	atomicAdd(&cell->x, depth);
+	atomicAdd(&cell->y, 1.0f);
+}
+
+//! [1 2 1]/4 along one axis; the grid padding keeps the blurred mass inside
+__global__ void blurBilateralGrid_Kernel(float2* d_output, const float2* d_input, int3 cellDim, int axis)
+{
+	const int idx = blockIdx.x*blockDim.x + threadIdx.x;
+	const int numCells = cellDim.x*cellDim.y*cellDim.z;
+	if (idx >= numCells) return;
+
+	int coord, size, stride;
+	if (axis == 0)		{ coord = idx % cellDim.x;					size = cellDim.x; stride = 1; }
+	else if (axis == 1) { coord = (idx / cellDim.x) % cellDim.y;	size = cellDim.y; stride = cellDim.x; }
+	else				{ coord = idx / (cellDim.x*cellDim.y);		size = cellDim.z; stride = cellDim.x*cellDim.y; }
+
+	const float2 c = d_input[idx];
+	float2 res = make_float2(0.5f*c.x, 0.5f*c.y);
+	if (coord > 0) {
+		const float2 p = d_input[idx - stride];
+		res.x += 0.25f*p.x; res.y += 0.25f*p.y;
+	}
+	if (coord + 1 < size) {
+		const float2 n = d_input[idx + stride];
+		res.x += 0.25f*n.x; res.y += 0.25f*n.y;
+	}
+	d_output[idx] = res;
+}
+
+//! trilinear lookup of the blurred grid; depth outside [depthMin, depthMax] is passed through
+__global__ void sliceBilateralGrid_Kernel(float* d_output, const float2* d_grid, int3 cellDim, float3 gridScale, int gridPad, const float* d_input, float depthMin, float depthMax, unsigned int width, unsigned int height)
+{
+	const int x = blockIdx.x*blockDim.x + threadIdx.x;
+	const int y = blockIdx.y*blockDim.y + threadIdx.y;
+	if (x >= width || y >= height) return;
+
+	const float depth = d_input[y*width + x];
+	d_output[y*width + x] = depth;
+	if (!isInGridRange(depth, depthMin, depthMax)) return;
+
+	const float fx = x*gridScale.x + gridPad;
+	const float fy = y*gridScale.y + gridPad;
+	const float fz = (depth - depthMin)*gridScale.z + gridPad;
+	const int ix = (int)fx, iy = (int)fy, iz = (int)fz;	//padding keeps ix+1, iy+1, iz+1 inside
+	const float ax = fx - ix, ay = fy - iy, az = fz - iz;
+
+	float2 res = make_float2(0.0f, 0.0f);
+	for (int k = 0; k < 2; k++) {
+		for (int j = 0; j < 2; j++) {
+			for (int i = 0; i < 2; i++) {
+				const float w = (i ? ax : 1.0f - ax) * (j ? ay : 1.0f - ay) * (k ? az : 1.0f - az);
+				const float2 cell = d_grid[((iz + k)*cellDim.y + iy + j)*cellDim.x + ix + i];
+				res.x += w*cell.x;
+				res.y += w*cell.y;
+			}
+		}
+	}
+	if (res.y > 0.0f) d_output[y*width + x] = res.x / res.y;
+}
+
+extern "C" void bilateralGridDepthFilterCU(float* d_output, float2* d_grid, float2* d_gridTmp, const int3& cellDim, const float3& gridScale, int gridPad,
+	const float* d_input, float depthMin, float depthMax, unsigned int width, unsigned int height)
+{
+	const dim3 gridSize((width + T_PER_BLOCK - 1) / T_PER_BLOCK, (height + T_PER_BLOCK - 1) / T_PER_BLOCK);
+	const dim3 blockSize(T_PER_BLOCK, T_PER_BLOCK);
+	const int numCells = cellDim.x*cellDim.y*cellDim.z;
+	const int blockSizeGrid = T_PER_BLOCK*T_PER_BLOCK;
+	const int gridSizeGrid = (numCells + blockSizeGrid - 1) / blockSizeGrid;
+
+	MLIB_CUDA_SAFE_CALL(cudaMemset(d_grid, 0, sizeof(float2)*numCells));
+	splatBilateralGrid_Kernel << <gridSize, blockSize >> >(d_grid, cellDim, gridScale, gridPad, d_input, depthMin, depthMax, width, height);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+	//x: grid -> tmp, y: tmp -> grid, z: grid -> tmp
+	blurBilateralGrid_Kernel << <gridSizeGrid, blockSizeGrid >> >(d_gridTmp, d_grid, cellDim, 0);
+	blurBilateralGrid_Kernel << <gridSizeGrid, blockSizeGrid >> >(d_grid, d_gridTmp, cellDim, 1);
+	blurBilateralGrid_Kernel << <gridSizeGrid, blockSizeGrid >> >(d_gridTmp, d_grid, cellDim, 2);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+	sliceBilateralGrid_Kernel << <gridSize, blockSize >> >(d_output, d_gridTmp, cellDim, gridScale, gridPad, d_input, depthMin, depthMax, width, height);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// domain transform (recursive filter)
+/////////////////////////////////////////////////////////////////////////////////////
+
+//! one block per line: the line and its feedback coefficients a^dt go to shared memory, then one thread runs the
+//! causal and the anti-causal recursion; invalid pixels (in d_input) break the chain and stay invalid
+__global__ void recursiveFilterLine_Kernel(float* d_data, const float* d_input, unsigned int length, unsigned int elementStride, unsigned int lineStride,
+	float logA, float sigmaRatio)
+{
+	extern __shared__ float s_line[];
+	float* s_val = s_line;
+	float* s_coeff = s_line + length;
+
+	const unsigned int offset = blockIdx.x*lineStride;
+	for (unsigned int i = threadIdx.x; i < length; i += blockDim.x) {
+		const float curr = d_input[offset + i*elementStride];
+		s_val[i] = d_data[offset + i*elementStride];
+		s_coeff[i] = 0.0f;
+		if (i > 0 && curr != MINF) {
+			const float prev = d_input[offset + (i - 1)*elementStride];
+			if (prev != MINF) s_coeff[i] = exp(logA*(1.0f + sigmaRatio*fabs(curr - prev)));	//a^dt, dt = 1 + sigmaS/sigmaR*|dI|
+		}
+	}
+	__syncthreads();
+
+	if (threadIdx.x == 0) {
+		for (unsigned int i = 1; i < length; i++) {
+			if (s_coeff[i] > 0.0f) s_val[i] += s_coeff[i] * (s_val[i - 1] - s_val[i]);
+		}
+		for (int i = (int)length - 2; i >= 0; i--) {
+			if (s_coeff[i + 1] > 0.0f) s_val[i] += s_coeff[i + 1] * (s_val[i + 1] - s_val[i]);
+		}
+	}
+	__syncthreads();
+
+	for (unsigned int i = threadIdx.x; i < length; i += blockDim.x) {
+		d_data[offset + i*elementStride] = s_val[i];
+	}
+}
+
+extern "C" void domainTransformDepthFilterCU(float* d_output, const float* d_input, float sigmaD, float sigmaR, unsigned int numIterations, unsigned int width, unsigned int height)
+{
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_output, d_input, sizeof(float)*width*height, cudaMemcpyDeviceToDevice));
+
+	const float sigmaRatio = sigmaD / sigmaR;
+	for (unsigned int i = 0; i < numIterations; i++) {
+		//sigma of iteration i such that the iterations sum up to sigmaD
+		const float sigmaH = sigmaD * sqrtf(3.0f) * powf(2.0f, (float)(numIterations - (i + 1))) / sqrtf(powf(4.0f, (float)numIterations) - 1.0f);
+		const float logA = -sqrtf(2.0f) / sigmaH;
+
+		recursiveFilterLine_Kernel << <height, THREADS_PER_LINE, 2 * width*sizeof(float) >> >(d_output, d_input, width, 1, width, logA, sigmaRatio);
+		recursiveFilterLine_Kernel << <width, THREADS_PER_LINE, 2 * height*sizeof(float) >> >(d_output, d_input, height, width, 1, logA, sigmaRatio);
+#ifdef _DEBUG
+		cutilSafeCall(cudaDeviceSynchronize());
+		cutilCheckMsg(__FUNCTION__);
+#endif
+	}
+}
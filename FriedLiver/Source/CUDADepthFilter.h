@@ -0,0 +1,79 @@
+#pragma once
+#ifndef CUDA_DEPTH_FILTER_H
+#define CUDA_DEPTH_FILTER_H
+
+#include <cuda_runtime.h>
+#include "mLibCuda.h"
+
+#include <vector>
+
+//! edge-preserving smoothing of sensor depth (invalid = MINF); EXACT is CUDAImageUtil::gaussFilterDepthMap (cost ~ sigmaD^2),
+//! the other modes approximate it at a cost independent of sigmaD
+class CUDADepthFilter {
+public:
+	enum MODE {
+		EXACT = 0,
+		SEPARABLE = 1,			//horizontal then vertical pass; the range test of the second pass only sees the column
+		BILATERAL_GRID = 2,		//splat into a coarse (x, y, depth) grid, blur, slice trilinear; smooth range kernel
+		DOMAIN_TRANSFORM = 3,	//recursive filter along rows and columns (Gastal and Oliveira 2011); smooth range kernel
+		NUM_MODES
+	};
+
+	//! depthMin/depthMax bound the bilateral grid, depth outside is passed through unfiltered;
+	//! bReportError: additionally runs the exact filter every frame and accumulates the deviation and the timings
+	CUDADepthFilter(unsigned int width, unsigned int height, MODE mode, float sigmaD, float sigmaR, float depthMin, float depthMax, bool bReportError);
+	~CUDADepthFilter();
+
+	//! d_output and d_input are width x height on the GPU and must not alias
+	void apply(float* d_output, const float* d_input);
+
+	MODE getMode() const {
+		return m_mode;
+	}
+	static const char* getModeName(MODE mode);
+
+	//! deviation from the exact filter accumulated over all frames so far (bReportError only)
+	void printErrorStats() const;
+
+private:
+	struct ErrorStats {
+		unsigned int		numFrames;
+		unsigned long long	numCompared;	//pixels valid in both results
+		unsigned long long	numMismatch;	//pixels valid in only one of them
+		unsigned long long	numPixels;
+		double				sumAbsError;
+		float				maxAbsError;
+		double				timeFilterMS;
+		double				timeExactMS;
+	};
+
+	void applyMode(float* d_output, const float* d_input);
+	void accumulateError(const float* d_output, const float* d_reference);
+
+	MODE m_mode;
+	unsigned int m_width;
+	unsigned int m_height;
+	float m_sigmaD;
+	float m_sigmaR;
+	float m_depthMin;
+	float m_depthMax;
+
+	//separable
+	float2* d_separableTmp;
+
+	//bilateral grid
+	float2* d_grid;
+	float2* d_gridTmp;
+	int3 m_cellDim;
+
+	bool m_bReportError;
+	ErrorStats m_errorStats;
+	float* d_reference;
+	std::vector<float> m_hostOutput;
+	std::vector<float> m_hostReference;
+	cudaEvent_t m_eventStart;
+	cudaEvent_t m_eventFilter;
+	cudaEvent_t m_eventExact;
+};
+
+#endif //CUDA_DEPTH_FILTER_H
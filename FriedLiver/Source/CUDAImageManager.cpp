@@ -11,14 +11,263 @@ unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_height = 0;
 float*		CUDAImageManager::ManagedRGBDInputFrame::s_depthIntegrationGlobal = NULL;
 uchar4*		CUDAImageManager::ManagedRGBDInputFrame::s_colorIntegrationGlobal = NULL;
 
-CUDAImageManager::ManagedRGBDInputFrame* CUDAImageManager::ManagedRGBDInputFrame::s_activeColorGPU = NULL;
-CUDAImageManager::ManagedRGBDInputFrame* CUDAImageManager::ManagedRGBDInputFrame::s_activeDepthGPU = NULL;
-
 CUDAImageManager::ManagedRGBDInputFrame* CUDAImageManager::ManagedRGBDInputFrame::s_activeColorCPU = NULL;
 CUDAImageManager::ManagedRGBDInputFrame* CUDAImageManager::ManagedRGBDInputFrame::s_activeDepthCPU = NULL;
 
+std::vector<CUDAImageManager::ManagedRGBDInputFrame::CacheSlot> CUDAImageManager::ManagedRGBDInputFrame::s_gpuCache;
+std::vector<CUDAImageManager::ManagedRGBDInputFrame::CacheSlot> CUDAImageManager::ManagedRGBDInputFrame::s_hostCache;
+UINT64		CUDAImageManager::ManagedRGBDInputFrame::s_cacheTick = 0;
+CUDAImageManager::ManagedRGBDInputFrame::StagingBuffer CUDAImageManager::ManagedRGBDInputFrame::s_staging[2] = { { NULL, NULL, NULL }, { NULL, NULL, NULL } };
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_nextStaging = 0;
+cudaStream_t CUDAImageManager::ManagedRGBDInputFrame::s_uploadStream = NULL;
+int			CUDAImageManager::ManagedRGBDInputFrame::s_lastAccessedGPUSlot = -1;
+
+bool		CUDAImageManager::ManagedRGBDInputFrame::s_bCompress = false;
+float		CUDAImageManager::ManagedRGBDInputFrame::s_compressionDepthShift = 5000.0f;
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_compressionMaxColorError = 0;
+
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_numGPUCacheHits = 0;
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_numGPUCacheUploads = 0;
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_numCompressedFrames = 0;
+UINT64		CUDAImageManager::ManagedRGBDInputFrame::s_numCompressedBytes = 0;
+unsigned int CUDAImageManager::ManagedRGBDInputFrame::s_numDecodes = 0;
+double		CUDAImageManager::ManagedRGBDInputFrame::s_timeCompressMS = 0.0;
+double		CUDAImageManager::ManagedRGBDInputFrame::s_timeDecodeMS = 0.0;
+
 Timer CUDAImageManager::s_timer;
 
+void CUDAImageManager::ManagedRGBDInputFrame::globalInit(unsigned int width, unsigned int height, bool isOnGPU, unsigned int numGPUCachedFrames,
+	bool bCompress, float compressionDepthShift, unsigned int compressionMaxColorError, unsigned int numHostCachedFrames)
+{
+	globalFree();
+
+	s_width = width;
+	s_height = height;
+#ifdef USE_CPU_FUSION
+	isOnGPU = false;	//the cpu kernels read the host frames directly
+#endif
+	s_bIsOnGPU = isOnGPU;
+	s_bCompress = !isOnGPU && bCompress;
+	s_compressionDepthShift = compressionDepthShift;
+	s_compressionMaxColorError = compressionMaxColorError;
+
+	if (!s_bIsOnGPU) {
+		//at least two slots: the frame in use and the one being prefetched
+		s_gpuCache.resize(std::max(2u, numGPUCachedFrames));
+		for (CacheSlot& s : s_gpuCache) {
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&s.depth, sizeof(float)*width*height));
+			MLIB_CUDA_SAFE_CALL(cudaMalloc(&s.color, sizeof(uchar4)*width*height));
+			s.frame = NULL;
+			s.lastUse = 0;
+			s.uploadDone = NULL;
+			MLIB_CUDA_SAFE_CALL(cudaEventCreateWithFlags(&s.accessDone, cudaEventDisableTiming));
+		}
+		s_lastAccessedGPUSlot = -1;
+		for (StagingBuffer& s : s_staging) {
+			MLIB_CUDA_SAFE_CALL(cudaMallocHost(&s.h_depth, sizeof(float)*width*height));
+			MLIB_CUDA_SAFE_CALL(cudaMallocHost(&s.h_color, sizeof(uchar4)*width*height));
+			MLIB_CUDA_SAFE_CALL(cudaEventCreateWithFlags(&s.uploadDone, cudaEventDisableTiming));
+		}
+		s_nextStaging = 0;
+		//non-blocking stream so that uploads overlap with kernels on the default stream; the two are ordered per slot by
+		//the uploadDone/accessDone events (see accessGPUCacheSlot)
+		MLIB_CUDA_SAFE_CALL(cudaStreamCreateWithFlags(&s_uploadStream, cudaStreamNonBlocking));
+
+		if (s_bCompress) {
+			s_hostCache.resize(std::max(1u, numHostCachedFrames));
+			for (CacheSlot& s : s_hostCache) {
+				s.depth = new float[width*height];
+				s.color = new uchar4[width*height];
+				s.frame = NULL;
+				s.lastUse = 0;
+				s.uploadDone = NULL;
+				s.accessDone = NULL;
+			}
+		}
+	}
+	else {
+		s_depthIntegrationGlobal = new float[width*height];
+		s_colorIntegrationGlobal = new uchar4[width*height];
+	}
+	s_cacheTick = 0;
+	s_numGPUCacheHits = 0;
+	s_numGPUCacheUploads = 0;
+	s_numCompressedFrames = 0;
+	s_numCompressedBytes = 0;
+	s_numDecodes = 0;
+	s_timeCompressMS = 0.0;
+	s_timeDecodeMS = 0.0;
+}
+
+void CUDAImageManager::ManagedRGBDInputFrame::globalFree()
+{
+	for (CacheSlot& s : s_gpuCache) {
+		MLIB_CUDA_SAFE_FREE(s.depth);
+		MLIB_CUDA_SAFE_FREE(s.color);
+		if (s.accessDone) MLIB_CUDA_SAFE_CALL(cudaEventDestroy(s.accessDone));
+	}
+	s_gpuCache.clear();
+	for (CacheSlot& s : s_hostCache) {
+		SAFE_DELETE_ARRAY(s.depth);
+		SAFE_DELETE_ARRAY(s.color);
+	}
+	s_hostCache.clear();
+	for (StagingBuffer& s : s_staging) {
+		if (s.h_depth) MLIB_CUDA_SAFE_CALL(cudaFreeHost(s.h_depth));
+		if (s.h_color) MLIB_CUDA_SAFE_CALL(cudaFreeHost(s.h_color));
+		if (s.uploadDone) MLIB_CUDA_SAFE_CALL(cudaEventDestroy(s.uploadDone));
+		s.h_depth = NULL;
+		s.h_color = NULL;
+		s.uploadDone = NULL;
+	}
+	if (s_uploadStream) {
+		MLIB_CUDA_SAFE_CALL(cudaStreamDestroy(s_uploadStream));
+		s_uploadStream = NULL;
+	}
+	SAFE_DELETE_ARRAY(s_depthIntegrationGlobal);
+	SAFE_DELETE_ARRAY(s_colorIntegrationGlobal);
+	s_activeDepthCPU = NULL;
+	s_activeColorCPU = NULL;
+}
+
+void CUDAImageManager::ManagedRGBDInputFrame::compress()
+{
+	if (!s_bCompress || !m_depthIntegration) return;
+	//the codec quantizes depth (and color for maxColorError > 0), so from here on every consumer, including the
+	//first integration, sees the decoded frame; this keeps integration and de-integration exact inverses
+	const bool bGPUResident = m_gpuCacheSlot >= 0;
+
+	Timer t;
+	m_compressed.clear();
+	RGBDFrameCodec::compressDepth(m_depthIntegration, s_width, s_height, s_compressionDepthShift, m_compressed);
+	m_compressedDepthBytes = m_compressed.size();
+	RGBDFrameCodec::compressColor(m_colorIntegration, s_width, s_height, s_compressionMaxColorError, m_compressed);
+	m_compressed.shrink_to_fit();
+	s_timeCompressMS += t.getElapsedTimeMS();
+
+	SAFE_DELETE_ARRAY(m_depthIntegration);
+	SAFE_DELETE_ARRAY(m_colorIntegration);
+	s_numCompressedFrames++;
+	s_numCompressedBytes += m_compressed.size();
+
+	//replace the original images in the gpu cache by the decoded ones
+	if (bGPUResident) {
+		releaseCacheSlot(true);
+		makeGPUResident();
+	}
+}
+
+int CUDAImageManager::ManagedRGBDInputFrame::acquireCacheSlot(bool bGPU)
+{
+	std::vector<CacheSlot>& cache = bGPU ? s_gpuCache : s_hostCache;
+	int& slot = bGPU ? m_gpuCacheSlot : m_hostCacheSlot;
+	if (slot < 0) {
+		int lru = 0;
+		for (int i = 1; i < (int)cache.size(); i++) {
+			if (cache[i].lastUse < cache[lru].lastUse) lru = i;
+		}
+		if (cache[lru].frame) (bGPU ? cache[lru].frame->m_gpuCacheSlot : cache[lru].frame->m_hostCacheSlot) = -1;
+		cache[lru].frame = this;
+		slot = lru;
+	}
+	cache[slot].lastUse = ++s_cacheTick;
+	return slot;
+}
+
+void CUDAImageManager::ManagedRGBDInputFrame::releaseCacheSlot(bool bGPU)
+{
+	std::vector<CacheSlot>& cache = bGPU ? s_gpuCache : s_hostCache;
+	int& slot = bGPU ? m_gpuCacheSlot : m_hostCacheSlot;
+	if (slot < 0) return;
+	cache[slot].frame = NULL;
+	cache[slot].lastUse = 0;
+	slot = -1;
+}
+
+int CUDAImageManager::ManagedRGBDInputFrame::makeHostResident()
+{
+	if (m_hostCacheSlot >= 0) return acquireCacheSlot(false);
+	const int slot = acquireCacheSlot(false);
+
+	Timer t;
+	RGBDFrameCodec::decompressDepth(m_compressed.data(), m_compressedDepthBytes, s_width, s_height, s_hostCache[slot].depth);
+	RGBDFrameCodec::decompressColor(m_compressed.data() + m_compressedDepthBytes, m_compressed.size() - m_compressedDepthBytes, s_width, s_height, s_hostCache[slot].color);
+	s_timeDecodeMS += t.getElapsedTimeMS();
+	s_numDecodes++;
+	return slot;
+}
+
+int CUDAImageManager::ManagedRGBDInputFrame::makeGPUResident()
+{
+	if (m_gpuCacheSlot >= 0) {
+		s_numGPUCacheHits++;
+		return acquireCacheSlot(true);
+	}
+	const int slot = acquireCacheSlot(true);
+	s_numGPUCacheUploads++;
+
+	//the staging buffer may still be read by its previous upload
+	StagingBuffer& staging = s_staging[s_nextStaging];
+	s_nextStaging = (s_nextStaging + 1) % 2;
+	MLIB_CUDA_SAFE_CALL(cudaEventSynchronize(staging.uploadDone));
+	//the slot may still be read (or written) by queued kernels of its previous frame
+	if (slot == s_lastAccessedGPUSlot) {
+		MLIB_CUDA_SAFE_CALL(cudaEventRecord(s_gpuCache[slot].accessDone, 0));
+		s_lastAccessedGPUSlot = -1;
+	}
+	MLIB_CUDA_SAFE_CALL(cudaStreamWaitEvent(s_uploadStream, s_gpuCache[slot].accessDone, 0));
+
+	if (m_depthIntegration) {
+		memcpy(staging.h_depth, m_depthIntegration, sizeof(float)*s_width*s_height);
+		memcpy(staging.h_color, m_colorIntegration, sizeof(uchar4)*s_width*s_height);
+	}
+	else if (m_hostCacheSlot >= 0) {
+		memcpy(staging.h_depth, s_hostCache[m_hostCacheSlot].depth, sizeof(float)*s_width*s_height);
+		memcpy(staging.h_color, s_hostCache[m_hostCacheSlot].color, sizeof(uchar4)*s_width*s_height);
+	}
+	else {
+		//decoded straight into pinned memory
+		Timer t;
+		RGBDFrameCodec::decompressDepth(m_compressed.data(), m_compressedDepthBytes, s_width, s_height, staging.h_depth);
+		RGBDFrameCodec::decompressColor(m_compressed.data() + m_compressedDepthBytes, m_compressed.size() - m_compressedDepthBytes, s_width, s_height, staging.h_color);
+		s_timeDecodeMS += t.getElapsedTimeMS();
+		s_numDecodes++;
+	}
+	MLIB_CUDA_SAFE_CALL(cudaMemcpyAsync(s_gpuCache[slot].depth, staging.h_depth, sizeof(float)*s_width*s_height, cudaMemcpyHostToDevice, s_uploadStream));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpyAsync(s_gpuCache[slot].color, staging.h_color, sizeof(uchar4)*s_width*s_height, cudaMemcpyHostToDevice, s_uploadStream));
+	MLIB_CUDA_SAFE_CALL(cudaEventRecord(staging.uploadDone, s_uploadStream));
+	//the staging event is only re-recorded for a later upload, which a wait on it then includes
+	s_gpuCache[slot].uploadDone = staging.uploadDone;
+	return slot;
+}
+
+int CUDAImageManager::ManagedRGBDInputFrame::accessGPUCacheSlot(bool bUpload)
+{
+	const int slot = bUpload ? makeGPUResident() : acquireCacheSlot(true);
+	CacheSlot& s = s_gpuCache[slot];
+	if (s.uploadDone) MLIB_CUDA_SAFE_CALL(cudaStreamWaitEvent(0, s.uploadDone, 0));
+	//the kernels using the previously accessed slot have all been queued by now
+	if (s_lastAccessedGPUSlot >= 0 && s_lastAccessedGPUSlot != slot) MLIB_CUDA_SAFE_CALL(cudaEventRecord(s_gpuCache[s_lastAccessedGPUSlot].accessDone, 0));
+	s_lastAccessedGPUSlot = slot;
+	return slot;
+}
+
+void CUDAImageManager::ManagedRGBDInputFrame::printStats(std::ostream& out /*= std::cout*/)
+{
+	if (s_bIsOnGPU) return;
+	out << "=============== INPUT FRAME GPU CACHE ===============" << std::endl;
+	out << "#slots = " << s_gpuCache.size() << std::endl;
+	out << "#hits = " << s_numGPUCacheHits << ", #uploads = " << s_numGPUCacheUploads << std::endl;
+	if (s_bCompress && s_numCompressedFrames > 0) {
+		const double rawBytes = (double)(sizeof(float) + sizeof(uchar4)) * s_width * s_height * s_numCompressedFrames;
+		out << "=============== INPUT FRAME COMPRESSION ===============" << std::endl;
+		out << "#frames = " << s_numCompressedFrames << ", stored = " << s_numCompressedBytes / (1024.0 * 1024.0) << " MB (" << rawBytes / std::max(s_numCompressedBytes, (UINT64)1) << "x smaller)" << std::endl;
+		out << "avg compress = " << s_timeCompressMS / s_numCompressedFrames << " ms";
+		if (s_numDecodes > 0) out << ", #decodes = " << s_numDecodes << ", avg decode = " << s_timeDecodeMS / s_numDecodes << " ms";
+		out << std::endl;
+	}
+}
+
 bool CUDAImageManager::process()
 {
 	if (!m_RGBDSensor->processDepth()) return false;	// Order is important!
@@ -28,11 +277,20 @@ bool CUDAImageManager::process()
 		return false;
 	}
 
-	if (GlobalBundlingState::get().s_enableGlobalTimings) { TimingLog::addLocalFrameTiming(); cudaDeviceSynchronize(); s_timer.start(); }
+	BundlingFrameQueue::Frame* bundlingFrame = m_bundlingQueue.getPushFrame();
+	if (!bundlingFrame) throw MLIB_EXCEPTION("bundling queue is full; integrate processed frames first");
+	bundlingFrame->frameIdx = m_currFrame;
+	bundlingFrame->bEndOfSequence = false;
+	float* d_depthInputRaw = bundlingFrame->d_depthRaw;
+	float* d_depthInputFiltered = bundlingFrame->d_depthFilt;
+	uchar4* d_colorInput = bundlingFrame->d_color;
+
+	if (GlobalBundlingState::get().s_enableGlobalTimings) { TimingLog::addLocalFrameTiming(m_currFrame); cudaDeviceSynchronize(); s_timer.start(); }
 
 	m_data.push_back(ManagedRGBDInputFrame());
 	ManagedRGBDInputFrame& frame = m_data.back();
 	frame.alloc();
+	bool bColorInGPUCache = false, bDepthInGPUCache = false;	//host frames: resampled on the gpu directly into the frame's cache slot
 
 	////////////////////////////////////////////////////////////////////////////////////
 	// Process Color
@@ -55,9 +313,10 @@ bool CUDAImageManager::process()
 			CUDAImageUtil::resampleUCHAR4(frame.m_colorIntegration, m_widthIntegration, m_heightIntegration, d_colorInput, m_RGBDSensor->getColorWidth(), m_RGBDSensor->getColorHeight());
 		}
 		else {
-			CUDAImageUtil::resampleUCHAR4(frame.s_colorIntegrationGlobal, m_widthIntegration, m_heightIntegration, d_colorInput, m_RGBDSensor->getColorWidth(), m_RGBDSensor->getColorHeight());
-			MLIB_CUDA_SAFE_CALL(cudaMemcpy(frame.m_colorIntegration, frame.s_colorIntegrationGlobal, sizeof(uchar4)*m_widthIntegration*m_heightIntegration, cudaMemcpyDeviceToHost));
-			frame.s_activeColorGPU = &frame;
+			uchar4* d_colorIntegration = ManagedRGBDInputFrame::s_gpuCache[frame.accessGPUCacheSlot(false)].color;
+			CUDAImageUtil::resampleUCHAR4(d_colorIntegration, m_widthIntegration, m_heightIntegration, d_colorInput, m_RGBDSensor->getColorWidth(), m_RGBDSensor->getColorHeight());
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(frame.m_colorIntegration, d_colorIntegration, sizeof(uchar4)*m_widthIntegration*m_heightIntegration, cudaMemcpyDeviceToHost));
+			bColorInGPUCache = true;
 		}
 	}
 
@@ -105,8 +364,7 @@ bool CUDAImageManager::process()
 		}
 	}
 	if (GlobalBundlingState::get().s_depthFilter) { //smooth
-		CUDAImageUtil::gaussFilterDepthMap(d_depthInputFiltered, d_depthInputRaw, GlobalBundlingState::get().s_depthSigmaD, GlobalBundlingState::get().s_depthSigmaR,
-			m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight());
+		m_depthFilter->apply(d_depthInputFiltered, d_depthInputRaw);
 	}
 	else {
 		CUDAImageUtil::copy<float>(d_depthInputFiltered, d_depthInputRaw, m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight());
@@ -140,11 +398,14 @@ bool CUDAImageManager::process()
 			CUDAImageUtil::resampleFloat(frame.m_depthIntegration, m_widthIntegration, m_heightIntegration, d_depthInputFiltered, m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight());
 		}
 		else {
-			CUDAImageUtil::resampleFloat(frame.s_depthIntegrationGlobal, m_widthIntegration, m_heightIntegration, d_depthInputFiltered, m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight());
-			MLIB_CUDA_SAFE_CALL(cudaMemcpy(frame.m_depthIntegration, frame.s_depthIntegrationGlobal, sizeof(float)*m_widthIntegration*m_heightIntegration, cudaMemcpyDeviceToHost));
-			frame.s_activeDepthGPU = &frame;
+			float* d_depthIntegration = ManagedRGBDInputFrame::s_gpuCache[frame.accessGPUCacheSlot(false)].depth;
+			CUDAImageUtil::resampleFloat(d_depthIntegration, m_widthIntegration, m_heightIntegration, d_depthInputFiltered, m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight());
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(frame.m_depthIntegration, d_depthIntegration, sizeof(float)*m_widthIntegration*m_heightIntegration, cudaMemcpyDeviceToHost));
+			bDepthInGPUCache = true;
 		}
 	}
+	//the frame stays gpu resident for its integration (a few frames later) only if both images are in its slot
+	if (bColorInGPUCache != bDepthInGPUCache) frame.releaseCacheSlot(true);
 
 	//////////////////////////////////////////////////////////////////////////////////////
 	//// SIFT Intensity Image
@@ -153,6 +414,9 @@ bool CUDAImageManager::process()
 
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); s_timer.stop(); TimingLog::getFrameTiming(true).timeSensorProcess = s_timer.getElapsedTimeMS(); }
 
+	frame.compress();
+
+	m_bundlingQueue.push();	//ready for bundling thread
 	m_currFrame++;
 	return true;
 }
@@ -4,6 +4,9 @@
 #include "CUDAImageCalibrator.h"
 #include "GlobalBundlingState.h"
 #include "TimingLog.h"
+#include "BundlingFrameQueue.h"
+#include "RGBDFrameCodec.h"
+#include "CUDADepthFilter.h"
 
 #include <cuda_runtime.h>
 
@@ -14,42 +17,22 @@ public:
 	public:
 		friend class CUDAImageManager;
 
-		static void globalInit(unsigned int width, unsigned int height, bool isOnGPU)
-		{
-			globalFree();
-
-			s_width = width;
-			s_height = height;
-			s_bIsOnGPU = isOnGPU;
-
-			if (!s_bIsOnGPU) {
-				MLIB_CUDA_SAFE_CALL(cudaMalloc(&s_depthIntegrationGlobal, sizeof(float)*width*height));
-				MLIB_CUDA_SAFE_CALL(cudaMalloc(&s_colorIntegrationGlobal, sizeof(uchar4)*width*height));
-			}
-			else {
-				s_depthIntegrationGlobal = new float[width*height];
-				s_colorIntegrationGlobal = new uchar4[width*height];
-			}
-		}
-		static void globalFree()
-		{
-			if (!s_bIsOnGPU) {
-				MLIB_CUDA_SAFE_FREE(s_depthIntegrationGlobal);
-				MLIB_CUDA_SAFE_FREE(s_colorIntegrationGlobal);
-			}
-			else {
-				SAFE_DELETE_ARRAY(s_depthIntegrationGlobal);
-				SAFE_DELETE_ARRAY(s_colorIntegrationGlobal);
-			}
-		}
+		//! isOnGPU: all frames stay on the GPU; otherwise they live on the host and the last numGPUCachedFrames used ones are kept on the GPU (LRU)
+		//! bCompress (host frames only): frames are stored compressed (RGBDFrameCodec) and the last numHostCachedFrames used ones are kept decoded for CPU access
+		static void globalInit(unsigned int width, unsigned int height, bool isOnGPU, unsigned int numGPUCachedFrames,
+			bool bCompress, float compressionDepthShift, unsigned int compressionMaxColorError, unsigned int numHostCachedFrames);
+		static void globalFree();
 
 
 		void alloc() {
+			m_gpuCacheSlot = -1;
+			m_hostCacheSlot = -1;
 			if (s_bIsOnGPU) {
 				MLIB_CUDA_SAFE_CALL(cudaMalloc(&m_depthIntegration, sizeof(float)*s_width*s_height));
 				MLIB_CUDA_SAFE_CALL(cudaMalloc(&m_colorIntegration, sizeof(uchar4)*s_width*s_height));
 			}
 			else {
+				//compressed frames only keep these until CUDAImageManager::process is done with them (then they are replaced by the decoded frame)
 				m_depthIntegration = new float[s_width*s_height];
 				m_colorIntegration = new uchar4[s_width*s_height];
 			}
@@ -62,37 +45,43 @@ public:
 				MLIB_CUDA_SAFE_FREE(m_colorIntegration);
 			}
 			else {
+				releaseCacheSlot(true);
+				releaseCacheSlot(false);
 				SAFE_DELETE_ARRAY(m_depthIntegration);
 				SAFE_DELETE_ARRAY(m_colorIntegration);
+				s_numCompressedBytes -= m_compressed.size();
+				std::vector<BYTE>().swap(m_compressed);
 			}
 		}
 
 
-		const float* getDepthFrameGPU() {	//be aware that only one depth frame is globally valid at a time
+		//! depth and color share a cache slot; the pointers stay valid until numGPUCachedFrames other frames have been accessed
+		const float* getDepthFrameGPU() {
 			if (s_bIsOnGPU) {
 				return m_depthIntegration;
 			}
 			else {
-				if (this != s_activeDepthGPU) {
-					MLIB_CUDA_SAFE_CALL(cudaMemcpy(s_depthIntegrationGlobal, m_depthIntegration, sizeof(float)*s_width*s_height, cudaMemcpyHostToDevice));
-					s_activeDepthGPU = this;
-				}
-				return s_depthIntegrationGlobal;
+				return s_gpuCache[accessGPUCacheSlot(true)].depth;
 			}
 		}
-		const uchar4* getColorFrameGPU() {	//be aware that only one depth frame is globally valid at a time
+		const uchar4* getColorFrameGPU() {
 			if (s_bIsOnGPU) {
 				return m_colorIntegration;
 			}
 			else {
-				if (this != s_activeColorGPU) {
-					MLIB_CUDA_SAFE_CALL(cudaMemcpy(s_colorIntegrationGlobal, m_colorIntegration, sizeof(uchar4)*s_width*s_height, cudaMemcpyHostToDevice));
-					s_activeColorGPU = this;
-				}
-				return s_colorIntegrationGlobal;
+				return s_gpuCache[accessGPUCacheSlot(true)].color;
 			}
 		}
+		//! starts the upload of a host frame without waiting for it (e.g., the next frame to reintegrate)
+		void prefetchGPU() {
+			if (!s_bIsOnGPU) makeGPUResident();
+		}
+		//! decodes a compressed host frame into the host cache ahead of its next cpu access
+		void prefetchCPU() {
+			if (!s_bIsOnGPU && !m_depthIntegration) makeHostResident();
+		}
 
+		//! for compressed frames the pointers stay valid until numHostCachedFrames other frames have been accessed
 		const float* getDepthFrameCPU() {
 			if (s_bIsOnGPU) {
 				if (this != s_activeDepthCPU) {
@@ -101,40 +90,98 @@ public:
 				}
 				return s_depthIntegrationGlobal;
 			}
+			else if (m_depthIntegration) {
+				return m_depthIntegration;	//no copy (USE_CPU_FUSION)
+			}
 			else {
-				return m_depthIntegration;
+				return s_hostCache[makeHostResident()].depth;
 			}
 		}
 		const uchar4* getColorFrameCPU() {
 			if (s_bIsOnGPU) {
 				if (this != s_activeColorCPU) {
 					MLIB_CUDA_SAFE_CALL(cudaMemcpy(s_colorIntegrationGlobal, m_colorIntegration, sizeof(uchar4)*s_width*s_height, cudaMemcpyDeviceToHost));
-					s_activeDepthCPU = this;
+					s_activeColorCPU = this;
 				}
 				return s_colorIntegrationGlobal;
 			}
+			else if (m_colorIntegration) {
+				return m_colorIntegration;	//no copy (USE_CPU_FUSION)
+			}
 			else {
-				return m_colorIntegration;
+				return s_hostCache[makeHostResident()].color;
 			}
 		}
 
+		static void printStats(std::ostream& out = std::cout);
+
 	private:
-		float*	m_depthIntegration;	//either on the GPU or CPU
-		uchar4*	m_colorIntegration;	//either on the GPU or CPU
+		//! host frames: encodes the frame and drops the uncompressed images (if compression is enabled)
+		void compress();
+		//! returns the cache slot holding this frame, uploading it (asynchronously) if necessary
+		int makeGPUResident();
+		//! returns the host cache slot holding the decoded frame
+		int makeHostResident();
+		//! slot for this frame in the gpu/host cache without filling it (the caller does); evicts the least recently used frame
+		int acquireCacheSlot(bool bGPU);
+		void releaseCacheSlot(bool bGPU);
+		//! gpu cache slot for kernels on the default stream (bUpload: the frame's data is uploaded, otherwise the caller fills it);
+		//! orders the default stream after the slot's pending upload
+		int accessGPUCacheSlot(bool bUpload);
+
+		float*	m_depthIntegration;	//either on the GPU or CPU (NULL for compressed frames)
+		uchar4*	m_colorIntegration;	//either on the GPU or CPU (NULL for compressed frames)
+		int		m_gpuCacheSlot;		//host frames only: index into s_gpuCache or -1
+		int		m_hostCacheSlot;	//compressed frames only: index into s_hostCache or -1
+
+		std::vector<BYTE>	m_compressed;				//compressed depth followed by compressed color
+		size_t				m_compressedDepthBytes;
 
 		static bool			s_bIsOnGPU;
 		static unsigned int s_width;
 		static unsigned int s_height;
 
+		//host copies of gpu frames (for getDepthFrameCPU/getColorFrameCPU)
 		static float*		s_depthIntegrationGlobal;
 		static uchar4*		s_colorIntegrationGlobal;
-		static ManagedRGBDInputFrame*	s_activeColorGPU;
-		static ManagedRGBDInputFrame*	s_activeDepthGPU;
-
-		static float*		s_depthIntegrationGlobalCPU;
-		static uchar4*		s_colorIntegrationGlobalCPU;
 		static ManagedRGBDInputFrame*	s_activeColorCPU;
 		static ManagedRGBDInputFrame*	s_activeDepthCPU;
+
+		//gpu copies of host frames, decoded copies of compressed frames
+		struct CacheSlot {
+			float*					depth;
+			uchar4*					color;
+			ManagedRGBDInputFrame*	frame;
+			UINT64					lastUse;
+			//gpu cache only: the last upload into the slot (a staging buffer event), and the default stream work on it
+			cudaEvent_t				uploadDone;
+			cudaEvent_t				accessDone;
+		};
+		//pinned staging buffers; two so that filling one overlaps with the dma of the other
+		struct StagingBuffer {
+			float*		h_depth;
+			uchar4*		h_color;
+			cudaEvent_t	uploadDone;
+		};
+		static std::vector<CacheSlot>		s_gpuCache;
+		static std::vector<CacheSlot>		s_hostCache;
+		static UINT64						s_cacheTick;
+		static StagingBuffer				s_staging[2];
+		static unsigned int					s_nextStaging;
+		static cudaStream_t					s_uploadStream;
+		static int							s_lastAccessedGPUSlot;	//its accessDone is recorded once another slot is accessed
+
+		static bool			s_bCompress;
+		static float		s_compressionDepthShift;
+		static unsigned int	s_compressionMaxColorError;
+
+		static unsigned int	s_numGPUCacheHits;
+		static unsigned int	s_numGPUCacheUploads;
+		static unsigned int	s_numCompressedFrames;
+		static UINT64		s_numCompressedBytes;	//of the frames currently stored
+		static unsigned int	s_numDecodes;
+		static double		s_timeCompressMS;
+		static double		s_timeDecodeMS;
 	};
 
 	CUDAImageManager(unsigned int widthIntegration, unsigned int heightIntegration, unsigned int widthSIFT, unsigned int heightSIFT, RGBDSensor* sensor, bool storeFramesOnGPU = false) {
@@ -146,15 +193,16 @@ public:
 		m_widthIntegration = widthIntegration;
 		m_heightIntegration = heightIntegration;
 
-		const unsigned int bufferDimDepthInput = m_RGBDSensor->getDepthWidth()*m_RGBDSensor->getDepthHeight();
-		const unsigned int bufferDimColorInput = m_RGBDSensor->getColorWidth()*m_RGBDSensor->getColorHeight();
-
-		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_depthInputRaw, sizeof(float)*bufferDimDepthInput));
-		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_depthInputFiltered, sizeof(float)*bufferDimDepthInput));
-		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_colorInput, sizeof(uchar4)*bufferDimColorInput));
+		//input frames in flight between depth sensing and bundling
+		m_bundlingQueue.alloc(std::max(1u, GlobalAppState::get().s_numBundlingFramesInFlight),
+			m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight(), m_RGBDSensor->getColorWidth(), m_RGBDSensor->getColorHeight());
 
 		m_currFrame = 0;
 
+		m_depthFilter = new CUDADepthFilter(m_RGBDSensor->getDepthWidth(), m_RGBDSensor->getDepthHeight(), (CUDADepthFilter::MODE)GlobalBundlingState::get().s_depthFilterMode,
+			GlobalBundlingState::get().s_depthSigmaD, GlobalBundlingState::get().s_depthSigmaR, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax,
+			GlobalBundlingState::get().s_depthFilterReportError);
+
 
 		const unsigned int rgbdSensorWidthDepth = m_RGBDSensor->getDepthWidth();
 		const unsigned int rgbdSensorHeightDepth = m_RGBDSensor->getDepthHeight();
@@ -189,8 +237,10 @@ public:
 			m_SIFTdepthIntrinsics._m12 *= (float)(m_heightSIFTdepth-1) / (float)(m_RGBDSensor->getColorHeight()-1);
 		}
 
-		ManagedRGBDInputFrame::globalInit(getIntegrationWidth(), getIntegrationHeight(), storeFramesOnGPU);
-		m_bHasBundlingFrameRdy = false;
+		//frames are referenced by address (gpu cache), so m_data must never reallocate
+		m_data.reserve(GlobalBundlingState::get().s_maxNumImages * GlobalBundlingState::get().s_submapSize);
+		ManagedRGBDInputFrame::globalInit(getIntegrationWidth(), getIntegrationHeight(), storeFramesOnGPU, GlobalAppState::get().s_integrationGPUCacheSize,
+			GlobalAppState::get().s_compressInputFrames, GlobalAppState::get().s_compressInputFramesDepthShift, GlobalAppState::get().s_compressInputFramesColorError, GlobalAppState::get().s_integrationHostCacheSize);
 	}
 
 	HRESULT OnD3D11CreateDevice(ID3D11Device* device) {
@@ -202,9 +252,8 @@ public:
 	~CUDAImageManager() {
 		reset();
 
-		MLIB_CUDA_SAFE_FREE(d_depthInputRaw);
-		MLIB_CUDA_SAFE_FREE(d_depthInputFiltered);
-		MLIB_CUDA_SAFE_FREE(d_colorInput);
+		m_bundlingQueue.free();
+		SAFE_DELETE(m_depthFilter);
 
 		//m_imageCalibrator.OnD3D11DestroyDevice();
 
@@ -218,12 +267,15 @@ public:
 		m_data.clear();
 	}
 
+	//! reads the next sensor frame and pushes it to the bundling queue; the queue must not be full
 	bool process();
 
-	void copyToBundling(float* d_depthRaw, float* d_depthFilt, uchar4* d_color) const {
-		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_depthRaw, d_depthInputRaw, sizeof(float)*m_RGBDSensor->getDepthWidth()* m_RGBDSensor->getDepthHeight(), cudaMemcpyDeviceToDevice));
-		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_depthFilt, d_depthInputFiltered, sizeof(float)*m_RGBDSensor->getDepthWidth()* m_RGBDSensor->getDepthHeight(), cudaMemcpyDeviceToDevice));
-		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_color, d_colorInput, sizeof(uchar4)*m_RGBDSensor->getColorWidth()*m_RGBDSensor->getColorHeight(), cudaMemcpyDeviceToDevice));
+	//! input frames for OnlineBundler::processInput and its results for integration
+	BundlingFrameQueue& getBundlingQueue() {
+		return m_bundlingQueue;
+	}
+	const BundlingFrameQueue& getBundlingQueue() const {
+		return m_bundlingQueue;
 	}
 
 
@@ -289,23 +341,7 @@ public:
 		return m_SIFTdepthIntrinsics;
 	}
 
-
-	bool hasBundlingFrameRdy() const {
-		return m_bHasBundlingFrameRdy;
-	}
-
-	//! must be called by depth sensing to signal bundling that a frame is ready
-	void setBundlingFrameRdy() {
-		m_bHasBundlingFrameRdy = true;
-	}
-
-	//! must be called by bundling to signal depth sensing it can read it a new frame
-	void confirmRdyBundlingFrame() {
-		m_bHasBundlingFrameRdy = false;
-	}
 private:
-	bool m_bHasBundlingFrameRdy;
-
 	RGBDSensor* m_RGBDSensor;
 	CUDAImageCalibrator m_imageCalibrator;
 
@@ -321,10 +357,11 @@ private:
 	unsigned int m_heightIntegration;
 	mat4f m_SIFTdepthIntrinsics;
 
-	//! temporary GPU storage for inputting the current frame
-	float*	d_depthInputRaw;
-	uchar4*	d_colorInput;
-	float*	d_depthInputFiltered;
+	//! GPU storage for the input frames (sensor resolution) handed to bundling
+	BundlingFrameQueue m_bundlingQueue;
+
+	//! smoothing of the input depth (s_depthFilter), mode from s_depthFilterMode
+	CUDADepthFilter* m_depthFilter;
 
 	unsigned int m_widthSIFTdepth;
 	unsigned int m_heightSIFTdepth;
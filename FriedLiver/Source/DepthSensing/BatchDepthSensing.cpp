@@ -0,0 +1,332 @@
+#include "stdafx.h"
+
+#include "BatchDepthSensing.h"
+
+#include "GlobalAppState.h"
+#include "GlobalBundlingState.h"
+#include "CUDAImageManager.h"
+
+#ifdef USE_CPU_FUSION
+#include "CPUSceneRepHashSDF.h"
+#include "../CPUImageUtil.h"
+#else
+#include "CUDASceneRepHashSDF.h"
+#include "CUDARayCastSDF.h"
+#include "CUDAMarchingCubesHashSDF.h"
+#endif
+
+#include "../SensorDataReader.h"
+#include "../TimingLog.h"
+
+//! drives input -> bundling -> (re)integration in a tight loop; mirrors OnD3D11FrameRender without any visualization
+class BatchDepthSensing
+{
+public:
+	BatchDepthSensing(OnlineBundler* bundler, RGBDSensor* sensor, CUDAImageManager* imageManager) {
+		m_bundler = bundler;
+		m_sensor = sensor;
+		m_imageManager = imageManager;
+		m_numFramesPastEnd = 0;
+
+		const GlobalAppState& gas = GlobalAppState::get();
+		if (gas.s_streamingEnabled) MLIB_WARNING("streaming is not supported in batch mode (ignored)");
+		if (gas.s_sensorIdx != 8) MLIB_WARNING("batch mode expects the SensorDataReader (s_sensorIdx = 8)");
+
+		m_depthCameraParams.fx = m_imageManager->getDepthIntrinsics()(0, 0);
+		m_depthCameraParams.fy = m_imageManager->getDepthIntrinsics()(1, 1);
+		m_depthCameraParams.mx = m_imageManager->getDepthIntrinsics()(0, 2);
+		m_depthCameraParams.my = m_imageManager->getDepthIntrinsics()(1, 2);
+		m_depthCameraParams.m_sensorDepthWorldMin = gas.s_renderDepthMin;
+		m_depthCameraParams.m_sensorDepthWorldMax = gas.s_renderDepthMax;
+		m_depthCameraParams.m_imageWidth = m_imageManager->getIntegrationWidth();
+		m_depthCameraParams.m_imageHeight = m_imageManager->getIntegrationHeight();
+
+#ifdef USE_CPU_FUSION
+		m_sceneRep = new CPUSceneRepHashSDF(CPUSceneRepHashSDF::parametersFromGlobalAppState(gas));
+#ifdef _DEBUG
+		if (!CPUImageUtil::validate(m_depthCameraParams.m_imageWidth, m_depthCameraParams.m_imageHeight)) MLIB_WARNING("CPUImageUtil does not match the reference kernels");
+#endif
+#else
+		DepthCameraData::updateParams(m_depthCameraParams);
+		m_sceneRep = new CUDASceneRepHashSDF(CUDASceneRepHashSDF::parametersFromGlobalAppState(gas));
+		m_marchingCubes = new CUDAMarchingCubesHashSDF(CUDAMarchingCubesHashSDF::parametersFromGlobalAppState(gas));
+
+		//the marching cubes only need the ray cast constants/buffers, not the d3d ray interval splatting of CUDARayCastSDF
+		const RayCastParams rayCastParams = CUDARayCastSDF::parametersFromGlobalAppState(gas, m_imageManager->getDepthIntrinsics(), m_imageManager->getDepthIntrinsicsInv());
+		m_rayCastData.allocate(rayCastParams);
+		m_rayCastData.updateParams(rayCastParams);
+#endif
+	}
+
+	~BatchDepthSensing() {
+		SAFE_DELETE(m_sceneRep);
+#ifndef USE_CPU_FUSION
+		SAFE_DELETE(m_marchingCubes);
+		m_rayCastData.free();
+#endif
+	}
+
+	int run() {
+		Timer t;
+		while (true) {
+			if (ConditionManager::shouldExit()) return finish(true);
+			if (!processFrame()) break;
+		}
+		const int status = finish(false);
+		std::cout << "batch processing time " << t.getElapsedTime() << " seconds" << std::endl;
+		return status;
+	}
+
+private:
+	//! returns false once the sequence is done and all reintegration has been applied
+	bool processFrame() {
+		Timer t;
+		const bool enableGlobalTimings = GlobalBundlingState::get().s_enableGlobalTimings;
+
+		///////////////////////////////////////
+		// Reconstruction of the frames bundling is done with
+		///////////////////////////////////////
+		if (enableGlobalTimings) { cudaDeviceSynchronize(); t.start(); }
+		const unsigned int numIntegrated = integrateProcessedFrames(); //frees a slot in the bundling queue if it is full
+		if (enableGlobalTimings) { cudaDeviceSynchronize(); t.stop(); if (numIntegrated > 0) TimingLog::getFrameTiming(true).timeReconstruct = t.getElapsedTimeMS(); }
+
+		///////////////////////////////////////
+		// Read Input
+		///////////////////////////////////////
+		bool bGotDepth = m_imageManager->process();	//pushes to the bundling thread
+		if (!m_sensor->isReceivingFrames()) { //sequence is done
+			if (bGotDepth) throw MLIB_EXCEPTION("ERROR bGotDepth = true but sequence is done");
+
+			m_imageManager->getBundlingQueue().pushEndOfSequence(m_imageManager->getCurrFrameNumber()); // let bundling still optimize after scanning done
+		}
+#ifndef RUN_MULTITHREADED
+		m_bundler->processInput();
+#endif
+
+		///////////////////////////////////////
+		// Fix old frames
+		///////////////////////////////////////
+		if (enableGlobalTimings) { cudaDeviceSynchronize(); t.start(); }
+		reintegrate();
+		if (enableGlobalTimings) { cudaDeviceSynchronize(); t.stop(); TimingLog::getFrameTiming(true).timeReIntegrate = t.getElapsedTimeMS(); }
+
+		///////////////////////////////////////////
+		////// Bundling Optimization
+		///////////////////////////////////////////
+#ifndef RUN_MULTITHREADED
+		m_bundler->process(GlobalBundlingState::get().s_numLocalNonLinIterations, GlobalBundlingState::get().s_numLocalLinIterations,
+			GlobalBundlingState::get().s_numGlobalNonLinIterations, GlobalBundlingState::get().s_numGlobalLinIterations);
+#endif
+
+		if (bGotDepth && GlobalBundlingState::get().s_verbose) {
+			std::cout << "<<< [Frame: " << m_imageManager->getCurrFrameNumber() << " ] " << getHeapFreeCount() << " >>>" << std::endl;
+		}
+
+		///////////////////////////////////////////
+		////// End of sequence
+		///////////////////////////////////////////
+		if (!m_sensor->isReceivingFrames()) {
+			//keep solving for s_numSolveFramesBeforeExit frames (-1: until there is no reintegration work left)
+			//at least one end-of-sequence frame must have come back, i.e., all input frames are integrated
+			const unsigned int numSolveFrames = GlobalAppState::get().s_numSolveFramesBeforeExit;
+			const unsigned int endSolveFrame = (numSolveFrames == (unsigned int)-1) ? 1 : numSolveFrames + 1;
+			if (m_numFramesPastEnd >= endSolveFrame) {
+				TrajectoryManager* tm = m_bundler->getTrajectoryManager();
+				tm->generateUpdateLists();
+				if (tm->getNumActiveOperations() == 0) {
+					std::cout << "[no more reintegration ops] " << m_numFramesPastEnd << " frames past end" << std::endl;
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//! integrates the frames bundling is done with; only waits for bundling if the queue is full
+	unsigned int integrateProcessedFrames() {
+		BundlingFrameQueue& bundlingQueue = m_imageManager->getBundlingQueue();
+		unsigned int numIntegrated = 0;
+		while (true) {
+			BundlingFrameQueue::Frame* f = bundlingQueue.waitForResult();
+			if (!f) break;
+			if (f->bEndOfSequence) {
+				m_numFramesPastEnd++;	//counted when bundling has processed it (it may still be busy with the last input frames)
+				bundlingQueue.popResult();
+				continue;
+			}
+
+			const unsigned int frameIdx = f->frameIdx;
+			const mat4f transformation = f->transform;
+			const bool validTransform = f->bValidTransform;
+			bundlingQueue.popResult();
+
+			if (validTransform && GlobalAppState::get().s_reconstructionEnabled) {
+				integrate(frameIdx, transformation);
+				m_bundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::Integrated, transformation, frameIdx);
+			}
+			else {
+				m_bundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::NotIntegrated_NoTransform, mat4f::zero(-std::numeric_limits<float>::infinity()), frameIdx);
+			}
+			numIntegrated++;
+		}
+		return numIntegrated;
+	}
+
+	void integrate(unsigned int frameIdx, const mat4f& transformation) {
+		if (!GlobalAppState::get().s_integrationEnabled) return;
+		auto& f = m_imageManager->getIntegrateFrame(frameIdx);
+#ifdef USE_CPU_FUSION
+		m_sceneRep->integrate(transformation, f.getDepthFrameCPU(), f.getColorFrameCPU(), m_depthCameraParams);
+#else
+		DepthCameraData depthCameraData(f.getDepthFrameGPU(), f.getColorFrameGPU());
+		m_sceneRep->integrate(transformation, depthCameraData, m_depthCameraParams, NULL);
+#endif
+	}
+
+	void deIntegrate(unsigned int frameIdx, const mat4f& transformation) {
+		if (!GlobalAppState::get().s_integrationEnabled) return;
+		auto& f = m_imageManager->getIntegrateFrame(frameIdx);
+#ifdef USE_CPU_FUSION
+		m_sceneRep->deIntegrate(transformation, f.getDepthFrameCPU(), f.getColorFrameCPU(), m_depthCameraParams);
+#else
+		DepthCameraData depthCameraData(f.getDepthFrameGPU(), f.getColorFrameGPU());
+		m_sceneRep->deIntegrate(transformation, depthCameraData, m_depthCameraParams, NULL);
+#endif
+	}
+
+	//! see reintegrate() in DepthSensing.cpp
+	void reintegrate() {
+		const unsigned int maxPerFrameFixes = GlobalAppState::get().s_maxFrameFixes;
+		TrajectoryManager* tm = m_bundler->getTrajectoryManager();
+
+		if (tm->getNumActiveOperations() < maxPerFrameFixes) {
+			tm->generateUpdateLists();
+		}
+
+		for (unsigned int fixes = 0; fixes < maxPerFrameFixes; fixes++) {
+			mat4f newTransform = mat4f::zero();
+			mat4f oldTransform = mat4f::zero();
+			unsigned int frameIdx = (unsigned int)-1;
+
+			if (tm->getTopFromDeIntegrateList(oldTransform, frameIdx)) {
+				deIntegrate(frameIdx, oldTransform);
+			}
+			else if (tm->getTopFromIntegrateList(newTransform, frameIdx)) {
+				integrate(frameIdx, newTransform);
+				tm->confirmIntegration(frameIdx);
+			}
+			else if (tm->getTopFromReIntegrateList(oldTransform, newTransform, frameIdx)) {
+				deIntegrate(frameIdx, oldTransform);
+				integrate(frameIdx, newTransform);
+				tm->confirmIntegration(frameIdx);
+			}
+			else {
+				break; //no more work to do
+			}
+			//get the next frame ready while the current one is being fused
+			if (fixes + 1 < maxPerFrameFixes && tm->getNextFrameIdx(frameIdx)) {
+				CUDAImageManager::ManagedRGBDInputFrame& next = m_imageManager->getIntegrateFrame(frameIdx);
+#ifdef USE_CPU_FUSION
+				next.prefetchCPU();
+#else
+				next.prefetchGPU();
+#endif
+			}
+		}
+		m_sceneRep->garbageCollect();
+	}
+
+	unsigned int getHeapFreeCount() {
+#ifdef USE_CPU_FUSION
+		const unsigned int numSDFBlocks = m_sceneRep->getHashParams().m_numSDFBlocks;
+		return numSDFBlocks - std::min(numSDFBlocks, m_sceneRep->getNumAllocatedBlocks());
+#else
+		return m_sceneRep->getHeapFreeCount();
+#endif
+	}
+
+	void saveMesh(const std::string& filename) {
+		std::cout << "running marching cubes..." << std::endl;
+		Timer t;
+#ifdef USE_CPU_FUSION
+		m_sceneRep->saveMesh(filename);
+#else
+		m_marchingCubes->clearMeshBuffer();
+		m_marchingCubes->extractIsoSurface(m_sceneRep->getHashData(), m_sceneRep->getHashParams(), m_rayCastData);
+		const mat4f& rigidTransform = mat4f::identity();
+		m_marchingCubes->saveMesh(filename, &rigidTransform, true);
+#endif
+		std::cout << "Mesh generation time " << t.getElapsedTime() << " seconds" << std::endl;
+	}
+
+	//! see StopScanningAndExit in DepthSensing.cpp
+	int finish(bool aborted) {
+		m_imageManager->getBundlingQueue().printStats();
+		CUDAImageManager::ManagedRGBDInputFrame::printStats();
+		std::cout << "[ stop scanning ]" << std::endl;
+		const std::string sensFile = GlobalAppState::get().s_binaryDumpSensorFile;
+		std::ofstream s(util::directoryFromPath(sensFile) + "processed.txt");
+		if (aborted) {
+			s << "valid = false" << std::endl;
+			s << "ABORTED" << std::endl; // can only be due to invalid first chunk
+			return BATCH_STATUS_ABORTED;
+		}
+
+		//estimate validity of reconstruction
+		bool valid = true;
+		const unsigned int heapFreeCount = getHeapFreeCount();
+		if (heapFreeCount < 800) valid = false; // probably a messed up reconstruction (used up all the heap...)
+
+		//write trajectory
+		std::vector<mat4f> trajectory;
+		m_bundler->getTrajectoryManager()->getOptimizedTransforms(trajectory);
+		const unsigned int numValidTransforms = PoseHelper::countNumValidTransforms(trajectory);
+		const unsigned int numTransforms = (unsigned int)trajectory.size();
+		if (numValidTransforms < (unsigned int)std::round(0.5f * numTransforms)) valid = false; // not enough valid transforms
+		std::cout << "#VALID TRANSFORMS = " << numValidTransforms << std::endl;
+		if (GlobalAppState::get().s_sensorIdx == 8) ((SensorDataReader*)m_sensor)->saveToFile(sensFile, trajectory); //overwrite the original file
+
+		//save ply
+		saveMesh(util::removeExtensions(sensFile) + ".ply");
+
+		if (!GlobalAppState::get().s_printTimingsDirectory.empty()) {
+			const std::string outDir = GlobalAppState::get().s_printTimingsDirectory;
+			if (!util::directoryExists(outDir)) util::makeDirectory(outDir);
+			TimingLog::printAllTimings(outDir);
+		}
+
+		//write out confirmation file
+		if (valid)  s << "valid = true" << std::endl;
+		else		s << "valid = false" << std::endl;
+		s << "heapFreeCount = " << heapFreeCount << std::endl;
+		s << "numValidOptTransforms = " << numValidTransforms << std::endl;
+		s << "numTransforms = " << numTransforms << std::endl;
+
+		return valid ? BATCH_STATUS_VALID : BATCH_STATUS_INVALID;
+	}
+
+
+	OnlineBundler*		m_bundler;
+	RGBDSensor*			m_sensor;
+	CUDAImageManager*	m_imageManager;
+
+#ifdef USE_CPU_FUSION
+	CPUSceneRepHashSDF*			m_sceneRep;
+#else
+	CUDASceneRepHashSDF*		m_sceneRep;
+	CUDAMarchingCubesHashSDF*	m_marchingCubes;
+	RayCastData					m_rayCastData;
+#endif
+	DepthCameraParams	m_depthCameraParams;
+
+	unsigned int		m_numFramesPastEnd;
+};
+
+
+int startBatchDepthSensing(OnlineBundler* bundler, RGBDSensor* sensor, CUDAImageManager* imageManager)
+{
+	BatchDepthSensing batch(bundler, sensor, imageManager);
+	const int status = batch.run();
+	fflush(stdout);
+	return status;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "RGBDSensor.h"
+#include "TrajectoryManager.h"
+#include "OnlineBundler.h"
+#include "ConditionManager.h"
+
+//! return codes of the windowless driver (process exit code in batch mode)
+enum BATCH_STATUS {
+	BATCH_STATUS_VALID = 0,
+	BATCH_STATUS_INVALID = 1,	//finished, but the reconstruction looks broken (heap used up or too few valid transforms)
+	BATCH_STATUS_ABORTED = 2,	//bundler gave up (invalid first chunk)
+	BATCH_STATUS_ERROR = 3		//exception
+};
+
+//! windowless counterpart of startDepthSensing for offline .sens processing (s_batchMode): no rendering, no vsync,
+//! writes trajectory, mesh and processed.txt next to s_binaryDumpSensorFile and returns a BATCH_STATUS instead of calling exit
+int startBatchDepthSensing(OnlineBundler* bundler, RGBDSensor* sensor, CUDAImageManager* imageManager);
@@ -0,0 +1,333 @@
+#include "stdafx.h"
+
+#include "CPUSceneRepHashSDF.h"
+#include "CPUParallel.h"
+#include "Tables.h"
+
+#include <unordered_set>
+
+#define SDF_BLOCK_NUM_VOXELS (SDF_BLOCK_SIZE*SDF_BLOCK_SIZE*SDF_BLOCK_SIZE)
+
+void CPUSceneRepHashSDF::create(const HashParams& params)
+{
+	m_hashParams = params;
+	m_blockMap.reserve(m_hashParams.m_numSDFBlocks);
+	reset();
+}
+
+void CPUSceneRepHashSDF::destroy()
+{
+	m_blockMap.clear();
+	m_blockPos.clear();
+	m_SDFBlocks.clear();
+	m_freeBlocks.clear();
+}
+
+void CPUSceneRepHashSDF::reset()
+{
+	m_numIntegratedFrames = 0;
+	m_rigidTransform.setIdentity();
+	m_hashParams.m_numOccupiedBlocks = 0;
+	destroy();
+}
+
+vec3i CPUSceneRepHashSDF::worldToSDFBlock(const vec3f& worldPos) const
+{
+	//same rounding as VoxelUtilHashSDF::worldToVirtualVoxelPos/virtualVoxelPosToSDFBlock
+	const vec3f p = worldPos / m_hashParams.m_virtualVoxelSize;
+	vec3i v((int)(p.x + (p.x > 0.0f ? 0.5f : (p.x < 0.0f ? -0.5f : 0.0f))),
+		(int)(p.y + (p.y > 0.0f ? 0.5f : (p.y < 0.0f ? -0.5f : 0.0f))),
+		(int)(p.z + (p.z > 0.0f ? 0.5f : (p.z < 0.0f ? -0.5f : 0.0f))));
+	if (v.x < 0) v.x -= SDF_BLOCK_SIZE - 1;
+	if (v.y < 0) v.y -= SDF_BLOCK_SIZE - 1;
+	if (v.z < 0) v.z -= SDF_BLOCK_SIZE - 1;
+	return vec3i(v.x / SDF_BLOCK_SIZE, v.y / SDF_BLOCK_SIZE, v.z / SDF_BLOCK_SIZE);
+}
+
+const Voxel* CPUSceneRepHashSDF::getVoxel(const vec3i& virtualVoxelPos) const
+{
+	vec3i block = virtualVoxelPos;
+	if (block.x < 0) block.x -= SDF_BLOCK_SIZE - 1;
+	if (block.y < 0) block.y -= SDF_BLOCK_SIZE - 1;
+	if (block.z < 0) block.z -= SDF_BLOCK_SIZE - 1;
+	block = vec3i(block.x / SDF_BLOCK_SIZE, block.y / SDF_BLOCK_SIZE, block.z / SDF_BLOCK_SIZE);
+
+	const auto it = m_blockMap.find(block);
+	if (it == m_blockMap.end()) return NULL;
+
+	const vec3i local = virtualVoxelPos - block * SDF_BLOCK_SIZE;
+	return &m_SDFBlocks[it->second * SDF_BLOCK_NUM_VOXELS + (local.z * SDF_BLOCK_SIZE + local.y) * SDF_BLOCK_SIZE + local.x];
+}
+
+void CPUSceneRepHashSDF::alloc(const float* depth, const DepthCameraParams& depthCameraParams)
+{
+	const unsigned int width = depthCameraParams.m_imageWidth;
+	const unsigned int height = depthCameraParams.m_imageHeight;
+	const float blockExtent = SDF_BLOCK_SIZE * m_hashParams.m_virtualVoxelSize;
+
+	//every chunk of rows collects its touched blocks; merged into the map afterwards (map insertion is serial)
+	std::mutex mergeMutex;
+	std::unordered_set<vec3i, BlockHash> touched;
+	CPUParallel::parallelFor(0, height, [&](unsigned int yBegin, unsigned int yEnd) {
+		std::unordered_set<vec3i, BlockHash> local;
+		for (unsigned int y = yBegin; y < yEnd; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				const float d = depth[y * width + x];
+				if (d == -std::numeric_limits<float>::infinity() || d < depthCameraParams.m_sensorDepthWorldMin
+					|| d > depthCameraParams.m_sensorDepthWorldMax || d >= m_hashParams.m_maxIntegrationDistance) continue;
+
+				//walk along the ray through the truncation region (half a block per step)
+				const float t = getTruncation(d);
+				const float zMin = std::max(d - t, depthCameraParams.m_sensorDepthWorldMin);
+				const float zMax = d + t;
+				const vec3f rayDir(((float)x - depthCameraParams.mx) / depthCameraParams.fx, ((float)y - depthCameraParams.my) / depthCameraParams.fy, 1.0f);
+				for (float z = zMin;; z += 0.5f * blockExtent) {
+					z = std::min(z, zMax);
+					local.insert(worldToSDFBlock(m_rigidTransform * (rayDir * z)));
+					if (z >= zMax) break;
+				}
+			}
+		}
+		std::unique_lock<std::mutex> lock(mergeMutex);
+		touched.insert(local.begin(), local.end());
+	});
+
+	for (const vec3i& b : touched) {
+		if (m_blockMap.find(b) != m_blockMap.end()) continue;
+
+		unsigned int idx;
+		if (!m_freeBlocks.empty()) {
+			idx = m_freeBlocks.back();
+			m_freeBlocks.pop_back();
+			m_blockPos[idx] = b;
+		}
+		else {
+			idx = (unsigned int)m_blockPos.size();
+			m_blockPos.push_back(b);
+			m_SDFBlocks.resize(m_SDFBlocks.size() + SDF_BLOCK_NUM_VOXELS);
+		}
+		Voxel* v = &m_SDFBlocks[idx * SDF_BLOCK_NUM_VOXELS];
+		for (unsigned int i = 0; i < SDF_BLOCK_NUM_VOXELS; i++) {
+			v[i].sdf = 0.0f;
+			v[i].weight = 0.0f;
+			v[i].color = make_uchar4(0, 0, 0, 0);
+		}
+		m_blockMap[b] = idx;
+	}
+}
+
+void CPUSceneRepHashSDF::integrateDepthMap(const float* depth, const uchar4* color, const DepthCameraParams& depthCameraParams, bool deIntegrate)
+{
+	const unsigned int width = depthCameraParams.m_imageWidth;
+	const unsigned int height = depthCameraParams.m_imageHeight;
+	const mat4f rigidTransformInverse = m_rigidTransform.getInverse();
+	const float voxelSize = m_hashParams.m_virtualVoxelSize;
+	const float blockRadius = 0.5f * std::sqrt(3.0f) * SDF_BLOCK_SIZE * voxelSize;
+
+	//compactify: blocks in the view frustum (counterpart of compactifyHashAllInOneCUDA)
+	std::vector<unsigned int> visible;
+	visible.reserve(m_blockMap.size());
+	for (const auto& b : m_blockMap) {
+		const vec3f center = virtualVoxelPosToWorld(b.first * SDF_BLOCK_SIZE) + 0.5f * voxelSize * (SDF_BLOCK_SIZE - 1.0f);
+		const vec3f c = rigidTransformInverse * center;
+		if (c.z + blockRadius < depthCameraParams.m_sensorDepthWorldMin || c.z - blockRadius > depthCameraParams.m_sensorDepthWorldMax) continue;
+		if (c.z > blockRadius) {
+			const float px = depthCameraParams.fx * c.x / c.z + depthCameraParams.mx;
+			const float py = depthCameraParams.fy * c.y / c.z + depthCameraParams.my;
+			const float margin = depthCameraParams.fx * blockRadius / c.z;
+			if (px < -margin || py < -margin || px > width + margin || py > height + margin) continue;
+		}
+		visible.push_back(b.second);
+	}
+	m_hashParams.m_numOccupiedBlocks = (unsigned int)visible.size();
+
+	const float weightMax = (float)m_hashParams.m_integrationWeightMax;
+	CPUParallel::parallelForEach(0, (unsigned int)visible.size(), [&](unsigned int b) {
+		const unsigned int blockIdx = visible[b];
+		const vec3i base = m_blockPos[blockIdx] * SDF_BLOCK_SIZE;
+		Voxel* voxels = &m_SDFBlocks[blockIdx * SDF_BLOCK_NUM_VOXELS];
+
+		for (unsigned int i = 0; i < SDF_BLOCK_NUM_VOXELS; i++) {
+			const vec3i pi = base + vec3i(i % SDF_BLOCK_SIZE, (i % (SDF_BLOCK_SIZE * SDF_BLOCK_SIZE)) / SDF_BLOCK_SIZE, i / (SDF_BLOCK_SIZE * SDF_BLOCK_SIZE));
+			const vec3f pf = rigidTransformInverse * virtualVoxelPosToWorld(pi);
+			if (pf.z <= 0.0f) continue;
+
+			const int sx = (int)(depthCameraParams.fx * pf.x / pf.z + depthCameraParams.mx + 0.5f);
+			const int sy = (int)(depthCameraParams.fy * pf.y / pf.z + depthCameraParams.my + 0.5f);
+			if (sx < 0 || sy < 0 || sx >= (int)width || sy >= (int)height) continue;
+
+			const float d = depth[sy * width + sx];
+			if (d == -std::numeric_limits<float>::infinity() || d >= m_hashParams.m_maxIntegrationDistance) continue;
+
+			float sdf = d - pf.z;
+			const float truncation = getTruncation(d);
+			if (std::abs(sdf) >= truncation) continue;
+			sdf = std::max(-truncation, std::min(truncation, sdf));
+
+			const float weightUpdate = 1.0f;
+			const vec3f currColor = color ? vec3f(color[sy * width + sx].x, color[sy * width + sx].y, color[sy * width + sx].z) : vec3f(0.0f, 255.0f, 0.0f);
+
+			Voxel& v = voxels[i];
+			const vec3f oldColor(v.color.x, v.color.y, v.color.z);
+			vec3f res;
+			if (!deIntegrate) {
+				res = (v.weight == 0.0f) ? currColor : 0.2f * currColor + 0.8f * oldColor;
+				v.sdf = (sdf * weightUpdate + v.sdf * v.weight) / (weightUpdate + v.weight);
+				v.weight = std::min(weightMax, weightUpdate + v.weight);
+			}
+			else {
+				if (v.weight - weightUpdate <= 0.001f) {
+					v.sdf = 0.0f;
+					v.color = make_uchar4(0, 0, 0, 0);
+					v.weight = 0.0f;
+					continue;
+				}
+				res = (oldColor * v.weight - currColor * weightUpdate) / (v.weight - weightUpdate);
+				v.sdf = (v.sdf * v.weight - sdf * weightUpdate) / (v.weight - weightUpdate);
+				v.weight = v.weight - weightUpdate;
+			}
+			res = vec3f(std::round(res.x), std::round(res.y), std::round(res.z));
+			res = vec3f(math::clamp(res.x, 0.0f, 254.5f), math::clamp(res.y, 0.0f, 254.5f), math::clamp(res.z, 0.0f, 254.5f));
+			v.color = make_uchar4((unsigned char)res.x, (unsigned char)res.y, (unsigned char)res.z, 255);
+		}
+	}, 16);
+}
+
+void CPUSceneRepHashSDF::garbageCollect()
+{
+	if (!GlobalAppState::get().s_garbageCollectionEnabled) return;
+
+	for (auto it = m_blockMap.begin(); it != m_blockMap.end();) {
+		const Voxel* v = &m_SDFBlocks[it->second * SDF_BLOCK_NUM_VOXELS];
+		bool empty = true;
+		for (unsigned int i = 0; i < SDF_BLOCK_NUM_VOXELS && empty; i++) {
+			if (v[i].weight > 0.0f) empty = false;
+		}
+		if (empty) {
+			m_freeBlocks.push_back(it->second);
+			it = m_blockMap.erase(it);
+		}
+		else {
+			it++;
+		}
+	}
+}
+
+void CPUSceneRepHashSDF::extractIsoSurface(MeshDataf& meshData, float threshMarchingCubes, float threshMarchingCubes2) const
+{
+	std::vector<unsigned int> blocks;
+	blocks.reserve(m_blockMap.size());
+	for (const auto& b : m_blockMap) blocks.push_back(b.second);
+
+	const float isolevel = 0.0f;
+	//cube between voxel centers; corner naming as in MarchingCubesSDFUtil::extractIsoSurfaceAtPosition
+	const vec3i offsets[8] = { vec3i(0, 0, 0), vec3i(1, 0, 0), vec3i(0, 1, 0), vec3i(0, 0, 1), vec3i(1, 1, 0), vec3i(0, 1, 1), vec3i(1, 0, 1), vec3i(1, 1, 1) };
+	//edge k connects corners edges[k][0] and edges[k][1] (see vertlist in extractIsoSurfaceAtPosition)
+	const unsigned int edges[12][2] = { { 2, 4 }, { 4, 1 }, { 1, 0 }, { 0, 2 }, { 5, 7 }, { 7, 6 }, { 6, 3 }, { 3, 5 }, { 2, 5 }, { 4, 7 }, { 1, 6 }, { 0, 3 } };
+
+	std::mutex meshMutex;
+	CPUParallel::parallelFor(0, (unsigned int)blocks.size(), [&](unsigned int bBegin, unsigned int bEnd) {
+		std::vector<vec3f> vertices;
+		std::vector<vec4f> colors;
+		for (unsigned int b = bBegin; b < bEnd; b++) {
+			const vec3i base = m_blockPos[blocks[b]] * SDF_BLOCK_SIZE;
+			for (unsigned int i = 0; i < SDF_BLOCK_NUM_VOXELS; i++) {
+				const vec3i pi = base + vec3i(i % SDF_BLOCK_SIZE, (i % (SDF_BLOCK_SIZE * SDF_BLOCK_SIZE)) / SDF_BLOCK_SIZE, i / (SDF_BLOCK_SIZE * SDF_BLOCK_SIZE));
+
+				const Voxel* corners[8];
+				bool valid = true;
+				for (unsigned int k = 0; k < 8 && valid; k++) {
+					corners[k] = getVoxel(pi + offsets[k]);
+					valid = corners[k] != NULL && corners[k]->weight > 0.0f;
+				}
+				if (!valid) continue;
+
+				float dist[8];	//000, 100, 010, 001, 110, 011, 101, 111
+				for (unsigned int k = 0; k < 8; k++) dist[k] = corners[k]->sdf;
+
+				unsigned int cubeindex = 0;
+				if (dist[2] < isolevel) cubeindex += 1;
+				if (dist[4] < isolevel) cubeindex += 2;
+				if (dist[1] < isolevel) cubeindex += 4;
+				if (dist[0] < isolevel) cubeindex += 8;
+				if (dist[5] < isolevel) cubeindex += 16;
+				if (dist[7] < isolevel) cubeindex += 32;
+				if (dist[6] < isolevel) cubeindex += 64;
+				if (dist[3] < isolevel) cubeindex += 128;
+				if (edgeTable[cubeindex] == 0 || edgeTable[cubeindex] == 255) continue;
+
+				for (unsigned int k = 0; k < 8 && valid; k++) {
+					if (std::abs(dist[k]) > threshMarchingCubes2) valid = false;
+					for (unsigned int l = 0; l < 8 && valid; l++) {
+						if (dist[k] * dist[l] < 0.0f) valid = std::abs(dist[k]) + std::abs(dist[l]) <= threshMarchingCubes;
+						else valid = std::abs(dist[k] - dist[l]) <= threshMarchingCubes;
+					}
+				}
+				if (!valid) continue;
+
+				vec3f p[8];
+				vec3f c[8];
+				for (unsigned int k = 0; k < 8; k++) {
+					p[k] = virtualVoxelPosToWorld(pi + offsets[k]);
+					c[k] = vec3f(corners[k]->color.x, corners[k]->color.y, corners[k]->color.z) / 255.0f;
+				}
+
+				vec3f vertlist[12];
+				vec3f colorlist[12];
+				for (unsigned int e = 0; e < 12; e++) {
+					if (!(edgeTable[cubeindex] & (1 << e))) continue;
+					const unsigned int a = edges[e][0], b = edges[e][1];
+					float mu = 0.0f;
+					if (std::abs(isolevel - dist[a]) < 0.00001f) mu = 0.0f;
+					else if (std::abs(isolevel - dist[b]) < 0.00001f) mu = 1.0f;
+					else if (std::abs(dist[a] - dist[b]) >= 0.00001f) mu = (isolevel - dist[a]) / (dist[b] - dist[a]);
+					vertlist[e] = p[a] + mu * (p[b] - p[a]);
+					colorlist[e] = c[a] + mu * (c[b] - c[a]);
+				}
+
+				for (int t = 0; triTable[cubeindex][t] != -1; t += 3) {
+					for (int k = 0; k < 3; k++) {
+						vertices.push_back(vertlist[triTable[cubeindex][t + k]]);
+						colors.push_back(vec4f(colorlist[triTable[cubeindex][t + k]], 1.0f));
+					}
+				}
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(meshMutex);
+		meshData.m_Vertices.insert(meshData.m_Vertices.end(), vertices.begin(), vertices.end());
+		meshData.m_Colors.insert(meshData.m_Colors.end(), colors.begin(), colors.end());
+	}, 64);
+}
+
+void CPUSceneRepHashSDF::saveMesh(const std::string& filename, const mat4f* transform /*= NULL*/) const
+{
+	const GlobalAppState& gas = GlobalAppState::get();
+	const float thresh = gas.s_SDFMarchingCubeThreshFactor*gas.s_SDFVoxelSize;
+
+	MeshDataf meshData;
+	extractIsoSurface(meshData, thresh, thresh);
+
+	std::string folder = util::directoryFromPath(filename);
+	if (!folder.empty() && !util::directoryExists(folder)) {
+		util::makeDirectory(folder);
+	}
+
+	//create index buffer (required for merging the triangle soup)
+	meshData.m_FaceIndicesVertices.resize(meshData.m_Vertices.size() / 3);
+	for (unsigned int i = 0; i < (unsigned int)meshData.m_Vertices.size() / 3; i++) {
+		meshData.m_FaceIndicesVertices[i][0] = 3 * i + 0;
+		meshData.m_FaceIndicesVertices[i][1] = 3 * i + 1;
+		meshData.m_FaceIndicesVertices[i][2] = 3 * i + 2;
+	}
+	meshData.mergeCloseVertices(0.00001f, true);
+	meshData.removeDuplicateFaces();
+
+	if (transform) {
+		meshData.applyTransform(*transform);
+	}
+
+	std::cout << "saving mesh (" << filename << ") ...";
+	MeshIOf::saveToFile(filename, meshData);
+	std::cout << "done!" << std::endl;
+}
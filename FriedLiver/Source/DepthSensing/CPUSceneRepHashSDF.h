@@ -0,0 +1,122 @@
+#pragma once
+
+#include "GlobalAppState.h"
+#include "VoxelUtilHashSDF.h"
+#include "CUDADepthCameraParams.h"
+
+#include <unordered_map>
+
+//! cpu counterpart of CUDASceneRepHashSDF/CUDAMarchingCubesHashSDF, used by the batch driver with USE_CPU_FUSION
+//! sdf blocks are stored in a std::unordered_map instead of the gpu hash/heap; all per-block work runs on CPUParallel
+class CPUSceneRepHashSDF
+{
+public:
+	CPUSceneRepHashSDF(const HashParams& params) {
+		create(params);
+	}
+	~CPUSceneRepHashSDF() {
+		destroy();
+	}
+
+	static HashParams parametersFromGlobalAppState(const GlobalAppState& gas) {
+		HashParams params;
+		params.m_rigidTransform.setIdentity();
+		params.m_rigidTransformInverse.setIdentity();
+		params.m_hashNumBuckets = gas.s_hashNumBuckets;
+		params.m_hashBucketSize = HASH_BUCKET_SIZE;
+		params.m_hashMaxCollisionLinkedListSize = gas.s_hashMaxCollisionLinkedListSize;
+		params.m_SDFBlockSize = SDF_BLOCK_SIZE;
+		params.m_numSDFBlocks = gas.s_hashNumSDFBlocks;
+		params.m_virtualVoxelSize = gas.s_SDFVoxelSize;
+		params.m_numOccupiedBlocks = 0;
+		params.m_maxIntegrationDistance = gas.s_SDFMaxIntegrationDistance;
+		params.m_truncation = gas.s_SDFTruncation;
+		params.m_truncScale = gas.s_SDFTruncationScale;
+		params.m_integrationWeightSample = gas.s_SDFIntegrationWeightSample;
+		params.m_integrationWeightMax = gas.s_SDFIntegrationWeightMax;
+		return params;
+	}
+
+	//! depth in meters (MINF for invalid), color may be NULL; both at depthCameraParams resolution
+	void integrate(const mat4f& lastRigidTransform, const float* depth, const uchar4* color, const DepthCameraParams& depthCameraParams) {
+		m_rigidTransform = lastRigidTransform;
+
+		//allocate all sdf blocks within the truncation region of the depth map
+		alloc(depth, depthCameraParams);
+
+		//volumetrically integrate the depth data into the blocks in the view frustum
+		integrateDepthMap(depth, color, depthCameraParams, false);
+
+		m_numIntegratedFrames++;
+	}
+
+	void deIntegrate(const mat4f& lastRigidTransform, const float* depth, const uchar4* color, const DepthCameraParams& depthCameraParams) {
+		m_rigidTransform = lastRigidTransform;
+
+		integrateDepthMap(depth, color, depthCameraParams, true);
+
+		m_numIntegratedFrames--;
+	}
+
+	//! frees all blocks whose voxels all have zero weight
+	void garbageCollect();
+
+	//! resets the hash to the initial state (i.e., clears all data)
+	void reset();
+
+	//! appends the marching cubes triangle soup (see CUDAMarchingCubesHashSDF::copyTrianglesToCPU) to meshData
+	void extractIsoSurface(MeshDataf& meshData, float threshMarchingCubes, float threshMarchingCubes2) const;
+
+	//! extracts, merges close vertices and writes the mesh
+	void saveMesh(const std::string& filename, const mat4f* transform = NULL) const;
+
+	unsigned int getNumAllocatedBlocks() const {
+		return (unsigned int)m_blockMap.size();
+	}
+
+	unsigned int getNumIntegratedFrames() const {
+		return m_numIntegratedFrames;
+	}
+
+	const HashParams& getHashParams() const {
+		return m_hashParams;
+	}
+
+	const mat4f& getLastRigidTransform() const {
+		return m_rigidTransform;
+	}
+
+private:
+	struct BlockHash {
+		size_t operator()(const vec3i& p) const {
+			//see teschner et al. (same primes as VoxelUtilHashSDF::computeHashPos)
+			return (size_t)((p.x * 73856093) ^ (p.y * 19349669) ^ (p.z * 83492791));
+		}
+	};
+
+	void create(const HashParams& params);
+	void destroy();
+
+	void alloc(const float* depth, const DepthCameraParams& depthCameraParams);
+	void integrateDepthMap(const float* depth, const uchar4* color, const DepthCameraParams& depthCameraParams, bool deIntegrate);
+
+	float getTruncation(float z) const {
+		return m_hashParams.m_truncation + m_hashParams.m_truncScale * z;
+	}
+	vec3i worldToSDFBlock(const vec3f& worldPos) const;
+	vec3f virtualVoxelPosToWorld(const vec3i& pos) const {
+		return vec3f((float)pos.x, (float)pos.y, (float)pos.z) * m_hashParams.m_virtualVoxelSize;
+	}
+	//! returns NULL if the voxel's block is not allocated
+	const Voxel* getVoxel(const vec3i& virtualVoxelPos) const;
+
+	HashParams m_hashParams;
+	mat4f m_rigidTransform;
+
+	std::unordered_map<vec3i, unsigned int, BlockHash> m_blockMap;	//sdf block pos -> block index
+	std::vector<vec3i> m_blockPos;			//block index -> sdf block pos
+	std::vector<Voxel> m_SDFBlocks;			//SDF_BLOCK_SIZE^3 voxels per block index
+	std::vector<unsigned int> m_freeBlocks;	//block indices released by garbage collection
+
+	unsigned int m_numIntegratedFrames;
+};
@@ -107,6 +107,9 @@ OnlineBundler*				g_depthSensingBundler = NULL;
 
 mat4f g_transformWorld = mat4f::identity();
 
+std::vector<mat4f>			g_inputTrajectory;			//sensor trajectory (s_binaryDumpSensorUseTrajectory); frames are integrated after bundling
+unsigned int				g_numFramesPastEnd = 0;		//end-of-sequence frames processed by bundling
+
 void ResetDepthSensing();
 void StopScanningAndExtractIsoSurfaceMC(const std::string& filename = "./scans/scan.ply", bool overwriteExistingFile = false);
 void DumpinputManagerData(const std::string& filename = "./dump/dump.sensor");
@@ -851,6 +854,50 @@ void visualizeFrame(ID3D11DeviceContext* pd3dImmediateContext, ID3D11Device* pd3
 
 
 
+//! integrates the frames bundling is done with (sift detection/matching); only waits for bundling if the queue is full
+//! returns the number of integrated frames; validTransform/bGlobalTrackingLost are those of the last one
+unsigned int integrateProcessedFrames(bool& validTransform, bool& bGlobalTrackingLost)
+{
+	BundlingFrameQueue& bundlingQueue = g_CudaImageManager->getBundlingQueue();
+	unsigned int numIntegrated = 0;
+	while (true) {
+		BundlingFrameQueue::Frame* f = bundlingQueue.waitForResult();
+		if (!f) break;
+		if (f->bEndOfSequence) {
+			g_numFramesPastEnd++;
+			bundlingQueue.popResult();
+			continue;
+		}
+
+		const unsigned int frameIdx = f->frameIdx;
+		mat4f transformation = f->transform;
+		validTransform = f->bValidTransform;
+		bGlobalTrackingLost = f->bGlobalTrackingLost;
+		bundlingQueue.popResult();
+
+		if (GlobalAppState::get().s_binaryDumpSensorUseTrajectory && GlobalAppState::get().s_sensorIdx == 3) {
+			//overwrite transform and use given trajectory in this case
+			transformation = g_inputTrajectory[frameIdx];
+			validTransform = true;
+		}
+
+		if (validTransform && GlobalAppState::get().s_reconstructionEnabled) {
+			DepthCameraData depthCameraData(g_CudaImageManager->getIntegrateFrame(frameIdx).getDepthFrameGPU(), g_CudaImageManager->getIntegrateFrame(frameIdx).getColorFrameGPU());
+			integrate(depthCameraData, transformation);
+			g_depthSensingBundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::Integrated, transformation, frameIdx);
+		}
+		else {
+			g_depthSensingBundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::NotIntegrated_NoTransform, mat4f::zero(-std::numeric_limits<float>::infinity()), frameIdx);
+		}
+
+		if (validTransform) {
+			g_lastRigidTransform = transformation;
+		}
+		numIntegrated++;
+	}
+	return numIntegrated;
+}
+
 void reintegrate()
 {
 	const unsigned int maxPerFrameFixes = GlobalAppState::get().s_maxFrameFixes;
@@ -875,7 +922,6 @@ void reintegrate()
 			DepthCameraData depthCameraData(f.getDepthFrameGPU(), f.getColorFrameGPU());
 			MLIB_ASSERT(!isnan(oldTransform[0]) && oldTransform[0] != -std::numeric_limits<float>::infinity());
 			deIntegrate(depthCameraData, oldTransform);
-			continue;
 		}
 		else if (tm->getTopFromIntegrateList(newTransform, frameIdx)) {
 			auto& f = g_CudaImageManager->getIntegrateFrame(frameIdx);
@@ -883,7 +929,6 @@ void reintegrate()
 			MLIB_ASSERT(!isnan(newTransform[0]) && newTransform[0] != -std::numeric_limits<float>::infinity());
 			integrate(depthCameraData, newTransform);
 			tm->confirmIntegration(frameIdx);
-			continue;
 		}
 		else if (tm->getTopFromReIntegrateList(oldTransform, newTransform, frameIdx)) {
 			auto& f = g_CudaImageManager->getIntegrateFrame(frameIdx);
@@ -892,11 +937,12 @@ void reintegrate()
 			deIntegrate(depthCameraData, oldTransform);
 			integrate(depthCameraData, newTransform);
 			tm->confirmIntegration(frameIdx);
-			continue;
 		}
 		else {
 			break; //no more work to do
 		}
+		//upload the next frame while the current one is being fused
+		if (fixes + 1 < maxPerFrameFixes && tm->getNextFrameIdx(frameIdx)) g_CudaImageManager->getIntegrateFrame(frameIdx).prefetchGPU();
 	}
 	g_sceneRep->garbageCollect();
 }
@@ -917,6 +963,9 @@ void StopScanningAndExit(bool aborted = false)
 	std::cout << "=============== OPTIMIZATION ===============" << std::endl;
 	g_depthSensingBundler->printMemStats();
 #endif
+	g_CudaImageManager->getBundlingQueue().printStats();
+	CUDAImageManager::ManagedRGBDInputFrame::printStats();
+	g_depthSensingBundler->printSolverStats();
 	std::cout << "[ stop scanning and exit ]" << std::endl;
 	if (!aborted) {
 		//estimate validity of reconstruction
@@ -975,27 +1024,32 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	//Start Timing
 	if (GlobalBundlingState::get().s_enablePerFrameTimings) { GlobalAppState::get().WaitForGPU(); GlobalAppState::get().s_Timer.start(); }
 
+	///////////////////////////////////////
+	// Reconstruction of the frames bundling is done with (sift extraction, sift matching, and key point filtering)
+	///////////////////////////////////////
+	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.start(); }
+	bool validTransform = true; bool bGlobalTrackingLost = false;
+	const unsigned int numIntegrated = integrateProcessedFrames(validTransform, bGlobalTrackingLost); //frees a slot in the bundling queue if it is full
+	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.stop(); if (numIntegrated > 0) TimingLog::getFrameTiming(true).timeReconstruct = t.getElapsedTimeMS(); }
+
 	///////////////////////////////////////
 	// Read Input
 	///////////////////////////////////////
-#ifdef RUN_MULTITHREADED
-	ConditionManager::lockImageManagerFrameReady(ConditionManager::Recon);
-	while (g_CudaImageManager->hasBundlingFrameRdy()) { //wait until bundling is done with previous frame
-		ConditionManager::waitImageManagerFrameReady(ConditionManager::Recon);
-	}
-	bool bGotDepth = g_CudaImageManager->process();
-	if (bGotDepth) {
-		g_CudaImageManager->setBundlingFrameRdy();					//ready for bundling thread
-		ConditionManager::unlockAndNotifyImageManagerFrameReady(ConditionManager::Recon);
-	}
+	bool bGotDepth = g_CudaImageManager->process();	//pushes to the bundling thread
 	if (!g_depthSensingRGBDSensor->isReceivingFrames()) { //sequence is done
 		if (bGotDepth) throw MLIB_EXCEPTION("ERROR bGotDepth = true but sequence is done");
 
-		g_CudaImageManager->setBundlingFrameRdy();				// let bundling still optimize after scanning done
-		ConditionManager::unlockAndNotifyImageManagerFrameReady(ConditionManager::Recon);
+		g_CudaImageManager->getBundlingQueue().pushEndOfSequence(g_CudaImageManager->getCurrFrameNumber()); // let bundling still optimize after scanning done
+	}
+	if (bGotDepth) {
+		if (GlobalAppState::get().s_binaryDumpSensorUseTrajectory && GlobalAppState::get().s_sensorIdx == 3) {
+			g_inputTrajectory.push_back(g_depthSensingRGBDSensor->getRigidTransform());
+		}
+		if (GlobalAppState::getInstance().s_recordData) {
+			g_depthSensingRGBDSensor->recordFrame();
+		}
 	}
-#else
-	bool bGotDepth = g_CudaImageManager->process();
+#ifndef RUN_MULTITHREADED
 	g_depthSensingBundler->processInput();
 #endif
 
@@ -1007,64 +1061,11 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.stop(); TimingLog::getFrameTiming(true).timeReIntegrate = t.getElapsedTimeMS(); }
 
 
-#ifdef RUN_MULTITHREADED
-	//wait until the bundling thread is done with: sift extraction, sift matching, and key point filtering
-	ConditionManager::lockBundlerProcessedInput(ConditionManager::Recon);
-	while (!g_depthSensingBundler->hasProcssedInputFrame()) ConditionManager::waitBundlerProcessedInput(ConditionManager::Recon);
-
-	if (!g_depthSensingRGBDSensor->isReceivingFrames()) { // let bundling still optimize after scanning done
-		g_depthSensingBundler->confirmProcessedInputFrame();
-		ConditionManager::unlockAndNotifyBundlerProcessedInput(ConditionManager::Recon);
-	}
-#endif
-
-	///////////////////////////////////////
-	// Reconstruction of current frame
-	///////////////////////////////////////	
-	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.start(); }
-	bool validTransform = true; bool bGlobalTrackingLost = false;
-	if (bGotDepth) {
-		mat4f transformation = mat4f::zero();
-		unsigned int frameIdx;
-		validTransform = g_depthSensingBundler->getCurrentIntegrationFrame(transformation, frameIdx, bGlobalTrackingLost);
-#ifdef RUN_MULTITHREADED
-		//allow bundler to process new frame
-		g_depthSensingBundler->confirmProcessedInputFrame();
-		ConditionManager::unlockAndNotifyBundlerProcessedInput(ConditionManager::Recon);
-#endif
-
-		if (GlobalAppState::get().s_binaryDumpSensorUseTrajectory && GlobalAppState::get().s_sensorIdx == 3) {
-			//overwrite transform and use given trajectory in this case
-			transformation = g_depthSensingRGBDSensor->getRigidTransform();
-			validTransform = true;
-		}
-
-		if (GlobalAppState::getInstance().s_recordData) {
-			g_depthSensingRGBDSensor->recordFrame();
-
-		}
-
-		if (validTransform && GlobalAppState::get().s_reconstructionEnabled) {
-			DepthCameraData depthCameraData(g_CudaImageManager->getIntegrateFrame(frameIdx).getDepthFrameGPU(), g_CudaImageManager->getIntegrateFrame(frameIdx).getColorFrameGPU());
-			integrate(depthCameraData, transformation);
-			g_depthSensingBundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::Integrated, transformation, g_CudaImageManager->getCurrFrameNumber());
-		}
-		else {
-			g_depthSensingBundler->getTrajectoryManager()->addFrame(TrajectoryManager::TrajectoryFrame::NotIntegrated_NoTransform, mat4f::zero(-std::numeric_limits<float>::infinity()), g_CudaImageManager->getCurrFrameNumber());
-		}
-
-
-		if (validTransform) {
-			g_lastRigidTransform = transformation;
-		}
-	}
-	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.stop(); TimingLog::getFrameTiming(true).timeReconstruct = t.getElapsedTimeMS(); }
-
 	///////////////////////////////////////
 	// Render with view of current frame
 	///////////////////////////////////////
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { t.start(); } // just sync-ed //{ GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.start(); }
-	bool trackingLost = bGotDepth && (!validTransform || bGlobalTrackingLost); //tracking lost when local frame has tracking lost or global frame has tracking lost
+	bool trackingLost = numIntegrated > 0 && (!validTransform || bGlobalTrackingLost); //tracking lost when local frame has tracking lost or global frame has tracking lost
 	visualizeFrame(pd3dImmediateContext, pd3dDevice, g_transformWorld * g_lastRigidTransform, trackingLost);
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { GlobalAppState::get().WaitForGPU(); cudaDeviceSynchronize(); t.stop(); TimingLog::getFrameTiming(true).timeVisualize = t.getElapsedTimeMS(); }
 
@@ -1112,17 +1113,16 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 		exit(1);
 	}
 	if (!g_depthSensingRGBDSensor->isReceivingFrames() && GlobalAppState::get().s_sensorIdx == 8 && GlobalAppState::get().s_numSolveFramesBeforeExit != (unsigned int)-1) { //todo something better?
-		static unsigned int countPastLast = 0;
+		//counted when bundling has processed them (it may still be busy with the last input frames)
 		const unsigned int endSolveFrame = GlobalAppState::get().s_numSolveFramesBeforeExit + 1;
-		if (countPastLast >= endSolveFrame) {
+		if (g_numFramesPastEnd >= endSolveFrame) {
 			TrajectoryManager* tm = g_depthSensingBundler->getTrajectoryManager();
 			tm->generateUpdateLists();
 			if (tm->getNumActiveOperations() == 0) {
-				std::cout << "[no more reintegration ops] " << countPastLast << " frames past end" << std::endl;
+				std::cout << "[no more reintegration ops] " << g_numFramesPastEnd << " frames past end" << std::endl;
 				StopScanningAndExit();
 			}
 		}
-		countPastLast++;
 	}
 
 	DXUT_EndPerfEvent();
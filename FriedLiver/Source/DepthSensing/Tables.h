@@ -15,9 +15,9 @@
 // May 1994 
 // http://paulbourke.net/geometry/polygonise/
 
-//#ifdef CUDA_GPU_CODE
+#ifdef __CUDACC__
 __device__
-//#endif
+#endif
 	const static int edgeTable[256]={
 		0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
 		0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
@@ -52,9 +52,9 @@ __device__
 		0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
 		0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0   };
 
-//#ifdef CUDA_GPU_CODE
+#ifdef __CUDACC__
 __device__
-//#endif
+#endif
 	const static int triTable[256][16] =
 {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -117,9 +117,9 @@ private:
 
 	void init(unsigned int minDevices = 2, unsigned int maxPhysicalDevices = 2)
 	{
-		unsigned int numDevices;
-		cudaGetDeviceCount((int*)&numDevices);
-		assert(numDevices > 0);
+		int numCudaDevices = 0;
+		if (cudaGetDeviceCount(&numCudaDevices) != cudaSuccess || numCudaDevices == 0) throw MLIB_EXCEPTION("no cuda device found (required also with USE_CPU_FUSION)");
+		unsigned int numDevices = (unsigned int)numCudaDevices;
 		numDevices = std::min(maxPhysicalDevices, numDevices);	//if we want to artificially reduces the number of GPUs
 		for (unsigned int i = 0; i < numDevices; i++) {
 			m_gpus.push_back(GPU(i));
@@ -110,74 +110,38 @@ OnlineBundler* g_bundler = NULL;
 
 
 void bundlingOptimization() {
-	g_bundler->process(GlobalBundlingState::get().s_numLocalNonLinIterations, GlobalBundlingState::get().s_numLocalLinIterations,
+	g_bundler->submitProcess(GlobalBundlingState::get().s_numLocalNonLinIterations, GlobalBundlingState::get().s_numLocalLinIterations,
 		GlobalBundlingState::get().s_numGlobalNonLinIterations, GlobalBundlingState::get().s_numGlobalLinIterations);
 	//g_bundler->resetDEBUG(false, false); // for no opt
 }
 
-void bundlingOptimizationThreadFunc() {
-
-	DualGPU::get().setDevice(DualGPU::DEVICE_BUNDLING);
-
-	bundlingOptimization();
-}
-
 void bundlingThreadFunc() {
 	assert(g_RGBDSensor && g_imageManager);
-	DualGPU::get().setDevice(DualGPU::DEVICE_BUNDLING);
+	DualGPU::get().setDevice(DualGPU::DEVICE_BUNDLING);	//the solver worker inherits the device
 	g_bundler = new OnlineBundler(g_RGBDSensor, g_imageManager);
 
-	std::thread tOpt;
-
 	while (1) {
-		// opt
-		if (g_RGBDSensor->isReceivingFrames()) {
-			if (g_bundler->getCurrProcessedFrame() % 10 == 0) { // stop solve
-				if (tOpt.joinable()) {
-					tOpt.join();
-				}
+		// opt (runs on the persistent solver worker, overlapping with sift of the next frames)
+		// the frames still queued when the sensor stops keep the submap cadence; the queue is drained once the end-of-sequence marker came through
+		if (!g_bundler->isPastEndOfInput()) {
+			if (g_bundler->getCurrProcessedFrame() % 10 == 0) { // finish solve before the next local submap is prepared
+				g_bundler->waitForSolver();
 			}
 			if (g_bundler->getCurrProcessedFrame() % 10 == 1) { // start solve
-				MLIB_ASSERT(!tOpt.joinable());
-				tOpt = std::thread(bundlingOptimizationThreadFunc);
-			}
-		}
-		else { // stop then start solve
-			if (tOpt.joinable()) {
-				tOpt.join();
+				MLIB_ASSERT(g_bundler->isSolverIdle());
+				bundlingOptimization();
 			}
-			tOpt = std::thread(bundlingOptimizationThreadFunc);
 		}
-		//wait for a new input frame (LOCK IMAGE MANAGER)
-		ConditionManager::lockImageManagerFrameReady(ConditionManager::Bundling);
-		while (!g_imageManager->hasBundlingFrameRdy()) {
-			ConditionManager::waitImageManagerFrameReady(ConditionManager::Bundling);
+		else { // one solve round per input tick
+			g_bundler->waitForSolver();
+			bundlingOptimization();
 		}
-		{
-			ConditionManager::lockBundlerProcessedInput(ConditionManager::Bundling);
-			while (g_bundler->hasProcssedInputFrame()) { //wait until depth sensing has confirmed the last one (WAITING THAT DEPTH SENSING RELEASES ITS LOCK)
-				ConditionManager::waitBundlerProcessedInput(ConditionManager::Bundling);
-			}
-			{
-				if (g_bundler->getExitBundlingThread()) {
-					if (tOpt.joinable()) {
-						tOpt.join();
-					}
-					ConditionManager::release(ConditionManager::Bundling);
-					break;
-				}
-				g_bundler->processInput();						//perform sift and whatever
-			}
-			g_bundler->setProcessedInputFrame();			//let depth sensing know we have a frame (UNLOCK BUNDLING)
-			ConditionManager::unlockAndNotifyBundlerProcessedInput(ConditionManager::Bundling);
-		}
-		g_imageManager->confirmRdyBundlingFrame();		//here it's processing with a new input frame  (GIVE DEPTH SENSING THE POSSIBLITY TO LOCK IF IT WANTS)
-		ConditionManager::unlockAndNotifyImageManagerFrameReady(ConditionManager::Bundling);
-
-		if (g_bundler->getExitBundlingThread()) {
-			ConditionManager::release(ConditionManager::Bundling);
+		//wait for a new input frame (depth sensing runs ahead by up to s_numBundlingFramesInFlight frames)
+		if (!g_imageManager->getBundlingQueue().waitForInput() || g_bundler->getExitBundlingThread()) {
+			g_bundler->waitForSolver();
 			break;
 		}
+		g_bundler->processInput();						//perform sift and whatever; the result goes back through the queue
 	}
 }
 
@@ -189,6 +153,7 @@ int main(int argc, char** argv)
 	//_CrtSetBreakAlloc(15453);
 #endif 
 
+	int exitCode = 0;
 	try {
 		std::string fileNameDescGlobalApp;
 		std::string fileNameDescGlobalBundling;
@@ -249,9 +214,18 @@ int main(int argc, char** argv)
 		ParameterFile parameterFileGlobalBundling(fileNameDescGlobalBundling);
 		GlobalBundlingState::getInstance().readMembers(parameterFileGlobalBundling);
 
+		CPUParallel::init(GlobalAppState::get().s_cpuNumThreads);
+
 		DualGPU& dualGPU = DualGPU::get();	//needs to be called to initialize devices
 		dualGPU.setDevice(DualGPU::DEVICE_RECONSTRUCTION);	//main gpu
-		ConditionManager::init();
+
+		if (GlobalBundlingState::get().s_siftBenchmark) {
+			dualGPU.setDevice(DualGPU::DEVICE_BUNDLING);	//where sift runs
+			runSiftPyramidBenchmark();
+			runSiftMatchBenchmark();
+			CPUParallel::destroy();
+			return 0;
+		}
 
 		g_RGBDSensor = getRGBDSensor();
 
@@ -272,8 +246,14 @@ int main(int argc, char** argv)
 
 		dualGPU.setDevice(DualGPU::DEVICE_RECONSTRUCTION);	//main gpu
 
-		//start depthSensing render loop
-		startDepthSensing(g_bundler, getRGBDSensor(), g_imageManager);
+		if (GlobalAppState::get().s_batchMode) {
+			//windowless: runs until the sequence is done and all reintegration is applied
+			exitCode = startBatchDepthSensing(g_bundler, getRGBDSensor(), g_imageManager);
+		}
+		else {
+			//start depthSensing render loop
+			startDepthSensing(g_bundler, getRGBDSensor(), g_imageManager);
+		}
 
 		//TimingLog::printAllTimings();
 		//g_bundler->saveGlobalSiftManagerAndCacheToFile("debug/global");
@@ -285,38 +265,49 @@ int main(int argc, char** argv)
 
 #ifdef RUN_MULTITHREADED 
 		g_bundler->exitBundlingThread();
-
-		g_imageManager->setBundlingFrameRdy();			//release all bundling locks
-		g_bundler->confirmProcessedInputFrame();		//release all bundling locks
-		ConditionManager::release(ConditionManager::Recon); // release bundling locks
+		g_imageManager->getBundlingQueue().shutdown();	//wake up the bundling thread if it waits for input
 
 		if (bundlingThread.joinable())	bundlingThread.join();	//wait for the bundling thread to return;
 #endif
+		g_imageManager->getBundlingQueue().printStats();
+		g_bundler->printSolverStats();
 		SAFE_DELETE(g_bundler);
 		SAFE_DELETE(g_imageManager);
-
-		//ConditionManager::DEBUGRELEASE();
+		CPUParallel::destroy();
 
 		//this is a bit of a hack due to a bug in std::thread (a static object cannot join if the main thread exists)
 		auto* s = getRGBDSensor();
 		SAFE_DELETE(s);
 
-		std::cout << "DONE! <<press key to exit program>>" << std::endl;
-		getchar();
+		if (GlobalAppState::get().s_batchMode) {
+			std::cout << "DONE! status = " << exitCode << std::endl;
+		}
+		else {
+			std::cout << "DONE! <<press key to exit program>>" << std::endl;
+			getchar();
+		}
 	}
 	catch (const std::exception& e)
 	{
+		if (GlobalAppState::get().s_batchMode) {
+			std::cerr << "Exception caught: " << e.what() << std::endl;
+			exit(BATCH_STATUS_ERROR);
+		}
 		MessageBoxA(NULL, e.what(), "Exception caught", MB_ICONERROR);
 		exit(EXIT_FAILURE);
 	}
 	catch (...)
 	{
+		if (GlobalAppState::get().s_batchMode) {
+			std::cerr << "UNKNOWN EXCEPTION" << std::endl;
+			exit(BATCH_STATUS_ERROR);
+		}
 		MessageBoxA(NULL, "UNKNOWN EXCEPTION", "Exception caught", MB_ICONERROR);
 		exit(EXIT_FAILURE);
 	}
 
 
-	return 0;
+	return exitCode;
 }
 
 
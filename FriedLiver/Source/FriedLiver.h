@@ -54,11 +54,14 @@
 #include "SiftGPU/MatrixConversion.h"
 #include "SiftGPU/CUDATimer.h"
 #include "SiftGPU/SIFTMatchFilter.h"
+#include "SiftGPU/SiftBenchmark.h"
 #include "CUDAImageManager.h"
 
 #include "ConditionManager.h"
+#include "CPUParallel.h"
 #include "DualGPU.h"
 #include "OnlineBundler.h"
 #include "DepthSensing/DepthSensing.h"
+#include "DepthSensing/BatchDepthSensing.h"
 
 
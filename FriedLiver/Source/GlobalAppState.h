@@ -101,7 +101,17 @@
 	X(mat4f, s_topVideoTransformWorld) \
 	X(vec4f, s_topVideoCameraPose) \
 	X(vec2f, s_topVideoMinMax) \
-	X(unsigned int, s_numSolveFramesBeforeExit)
+	X(unsigned int, s_numSolveFramesBeforeExit) \
+	X(unsigned int, s_cpuNumThreads) \
+	X(bool, s_batchMode) \
+	X(unsigned int, s_numBundlingFramesInFlight) \
+	X(unsigned int, s_sensorDataNumDecodeThreads) \
+	X(unsigned int, s_sensorDataPrefetchSize) \
+	X(unsigned int, s_integrationGPUCacheSize) \
+	X(bool, s_compressInputFrames) \
+	X(float, s_compressInputFramesDepthShift) \
+	X(unsigned int, s_compressInputFramesColorError) \
+	X(unsigned int, s_integrationHostCacheSize)
 
 
 #ifndef VAR_NAME
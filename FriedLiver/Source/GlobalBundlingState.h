@@ -24,6 +24,9 @@
 	X(unsigned int, s_numLocalLinIterations) \
 	X(unsigned int, s_numGlobalNonLinIterations) \
 	X(unsigned int, s_numGlobalLinIterations) \
+	X(unsigned int, s_directSolverMinNumImages) \
+	X(bool, s_useCPUSolver) \
+	X(bool, s_validateCPUSolver) \
 	X(unsigned int, s_downsampledWidth) \
 	X(unsigned int, s_downsampledHeight) \
 	X(float, s_verifySiftErrThresh) \
@@ -41,14 +44,40 @@
 	X(float, s_depthSigmaD) \
 	X(float, s_depthSigmaR) \
 	X(bool, s_depthFilter) \
+	X(unsigned int, s_depthFilterMode) \
+	X(bool, s_depthFilterReportError) \
 	X(unsigned int, s_minNumMatchesLocal) \
 	X(unsigned int, s_minNumMatchesGlobal) \
 	X(bool, s_useComprehensiveFrameInvalidation) \
 	X(float, s_maxKabschResidual2) \
 	X(float, s_minKeyScale) \
+	X(bool, s_useCPUSift) \
+	X(unsigned int, s_siftPyramidWorkers) \
+	X(bool, s_siftBenchmark) \
 	X(float, s_siftMatchThresh) \
 	X(float, s_siftMatchRatioMaxLocal) \
 	X(float, s_siftMatchRatioMaxGlobal) \
+	X(bool, s_useBinaryDescriptors) \
+	X(unsigned int, s_binaryMatchMaxHamming) \
+	X(bool, s_useCPUSiftMatch) \
+	X(unsigned int, s_siftMatchBatchImages) \
+	X(float, s_guidedMatchRadius) \
+	X(unsigned int, s_placeRecognitionTopK) \
+	X(unsigned int, s_placeRecognitionTemporalFrames) \
+	X(unsigned int, s_placeRecognitionTrainFrames) \
+	X(bool, s_useDescriptorIndex) \
+	X(unsigned int, s_descriptorIndexTrainFrames) \
+	X(bool, s_useCPUMatchFilter) \
+	X(bool, s_useRansacMatchFilter) \
+	X(float, s_ransacConfidence) \
+	X(unsigned int, s_ransacMaxHypotheses) \
+	X(bool, s_useFusedMatchFilter) \
+	X(bool, s_matchFilterBenchmark) \
+	X(unsigned int, s_cascadeMinNumMatches) \
+	X(float, s_cascadeAcceptResidualRatio) \
+	X(float, s_cascadeRejectResidualRatio) \
+	X(unsigned int, s_denseVerifyPyramidLevels) \
+	X(float, s_denseVerifyPyramidMargin) \
 	X(bool, s_useLocalVerify) \
 	X(bool, s_useLocalDense) \
 	X(unsigned int, s_numOptPerResidualRemoval) \
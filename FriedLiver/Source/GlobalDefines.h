@@ -11,4 +11,8 @@
 
 #define USE_LIE_SPACE
 
+//batch mode fuses and meshes on the cpu (CPUSceneRepHashSDF) from the host input frames; this is not a headless build:
+//the image manager, input filtering, sift, the bundling queue and the solver still need a cuda device
+//#define USE_CPU_FUSION
+
 #endif //_GLOBAL_DEFINES_
\ No newline at end of file
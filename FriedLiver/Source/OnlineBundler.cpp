@@ -28,7 +28,7 @@ extern "C" void updateTrajectoryCU(
 
 #define ID_MARK_OFFSET 2
 
-OnlineBundler::OnlineBundler(const RGBDSensor* sensor, const CUDAImageManager* imageManager)
+OnlineBundler::OnlineBundler(const RGBDSensor* sensor, CUDAImageManager* imageManager)
 {
 	//init input data
 	m_cudaImageManager = imageManager;
@@ -76,8 +76,8 @@ OnlineBundler::OnlineBundler(const RGBDSensor* sensor, const CUDAImageManager* i
 	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_imageInvalidateList, sizeof(int)*maxNumImages*m_submapSize));
 	m_invalidImagesList.resize(maxNumImages*m_submapSize, 1);
 
-	m_bHasProcessedInputFrame = false;
 	m_bExitBundlingThread = false;
+	m_bGlobalMatched = false;
 #ifdef EVALUATE_SPARSE_CORRESPONDENCES
 	if (GlobalAppState::get().s_sensorIdx != 8) throw MLIB_EXCEPTION("unable to evaluate sparse corrs for non sens-data input");
 	std::vector<mat4f> trajectory; 
@@ -92,6 +92,8 @@ OnlineBundler::OnlineBundler(const RGBDSensor* sensor, const CUDAImageManager* i
 
 OnlineBundler::~OnlineBundler()
 {
+	m_solverWorker.stop(); //finish queued solves before the bundlers go away
+
 	SAFE_DELETE(m_local);
 	SAFE_DELETE(m_optLocal);
 	SAFE_DELETE(m_global);
@@ -103,9 +105,12 @@ OnlineBundler::~OnlineBundler()
 	MLIB_CUDA_SAFE_FREE(d_imageInvalidateList);
 }
 
-void OnlineBundler::getCurrentFrame()
+void OnlineBundler::getCurrentFrame(const BundlingFrameQueue::Frame& frame)
 {
-	m_cudaImageManager->copyToBundling(m_input.d_inputDepthRaw, m_input.d_inputDepthFilt, m_input.d_inputColor);
+	//copy out of the queue slot (possibly from the other gpu) so depth sensing can reuse it
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_input.d_inputDepthRaw, frame.d_depthRaw, sizeof(float)*m_input.m_inputDepthWidth*m_input.m_inputDepthHeight, cudaMemcpyDeviceToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_input.d_inputDepthFilt, frame.d_depthFilt, sizeof(float)*m_input.m_inputDepthWidth*m_input.m_inputDepthHeight, cudaMemcpyDeviceToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_input.d_inputColor, frame.d_color, sizeof(uchar4)*m_input.m_inputColorWidth*m_input.m_inputColorHeight, cudaMemcpyDeviceToDevice));
 	CUDAImageUtil::resampleToIntensity(m_input.d_intensitySIFT, m_input.m_widthSIFT, m_input.m_heightSIFT,
 		m_input.d_inputColor, m_input.m_inputColorWidth, m_input.m_inputColorHeight);
 
@@ -166,9 +171,23 @@ void OnlineBundler::prepareLocalSolve(unsigned int curFrame, bool isSequenceEnd)
 
 void OnlineBundler::processInput()
 {
-	const unsigned int curFrame = m_cudaImageManager->getCurrFrameNumber();
+	BundlingFrameQueue& queue = m_cudaImageManager->getBundlingQueue();
+	BundlingFrameQueue::Frame* frame = queue.getInput();
+	if (!frame) return; //nothing pushed (e.g., sensor has no new frame yet)
+
+	processInputFrame(*frame);
+
+	unsigned int frameIdx = frame->frameIdx;
+	frame->bValidTransform = getCurrentIntegrationFrame(frame->transform, frameIdx, frame->bGlobalTrackingLost);
+	MLIB_ASSERT(!frame->bValidTransform || frame->bEndOfSequence || frameIdx == frame->frameIdx);
+	queue.finishInput();
+}
+
+void OnlineBundler::processInputFrame(const BundlingFrameQueue::Frame& frame)
+{
+	const unsigned int curFrame = frame.frameIdx;
 	const bool bIsLastLocal = isLastLocalFrame(curFrame);
-	if (curFrame > 0 && m_state.m_lastFrameProcessed == curFrame) { //sequence has ended (no new frames from cudaimagemanager)
+	if (frame.bEndOfSequence) { //sequence has ended (no new frames from cudaimagemanager)
 		if (m_state.m_numFramesPastEnd == 0 && m_state.m_localToSolve == -1) {
 			if (!bIsLastLocal) prepareLocalSolve(curFrame, true);
 		}
@@ -196,7 +215,8 @@ void OnlineBundler::processInput()
 		return; //nothing new to process
 	}
 	//get depth/color data
-	getCurrentFrame();
+	getCurrentFrame(frame);
+	if (GlobalBundlingState::get().s_enableGlobalTimings) TimingLog::setCurrentLocalFrame(curFrame);
 
 	// feature detect
 	if (GlobalBundlingState::get().s_enableGlobalTimings) { cudaDeviceSynchronize(); m_timer.start(); }
@@ -239,10 +259,10 @@ bool OnlineBundler::getCurrentIntegrationFrame(mat4f& siftTransform, unsigned in
 	}
 }
 
-void OnlineBundler::optimizeLocal(unsigned int numNonLinIterations, unsigned int numLinIterations)
+bool OnlineBundler::optimizeLocal(unsigned int numNonLinIterations, unsigned int numLinIterations)
 {
 	MLIB_ASSERT(m_state.m_bUseSolve);
-	if (m_state.m_processState == BundlerState::DO_NOTHING) return;
+	if (m_state.m_processState == BundlerState::DO_NOTHING) return false;
 
 	mutex_optLocal.lock();
 	BundlerState::PROCESS_STATE optLocalState = m_state.m_processState;
@@ -268,6 +288,7 @@ void OnlineBundler::optimizeLocal(unsigned int numNonLinIterations, unsigned int
 	m_state.m_lastLocalSolved = curLocalIdx;
 	m_state.m_totalNumOptLocalFrames = m_submapSize * m_state.m_lastLocalSolved + numLocalFrames; //last local solved is 0-indexed so this doesn't overcount
 	mutex_optLocal.unlock();
+	return true;
 }
 
 void OnlineBundler::initializeNextGlobalTransform(unsigned int lastMatchedIdx, unsigned int lastValidLocal)
@@ -277,25 +298,30 @@ void OnlineBundler::initializeNextGlobalTransform(unsigned int lastMatchedIdx, u
 	initNextGlobalTransformCU(m_global->getTrajectoryGPU(), numFrames, lastMatchedIdx, d_localTrajectories, lastValidLocal, m_submapSize + 1);
 }
 
-void OnlineBundler::processGlobal()
+bool OnlineBundler::revalidateGlobal()
+{
+	MLIB_ASSERT(m_state.m_bUseSolve);
+	if (m_state.m_processState != BundlerState::DO_NOTHING || m_state.m_numFramesPastEnd == 0) return false;
+
+	//sequence is over, try revalidation still
+	unsigned int idx = m_global->tryRevalidation(m_state.m_lastLocalSolved, true);
+	if (idx != (unsigned int)-1) { //validate chunk images
+		const std::vector<int>& validLocal = m_localTrajectoriesValid[idx];
+		for (unsigned int i = 0; i < validLocal.size(); i++) {
+			if (validLocal[i] == 1)	validateImages(idx * m_submapSize + i);
+		}
+		m_state.m_processState = BundlerState::PROCESS;
+	}
+	return true;
+}
+
+bool OnlineBundler::matchGlobal()
 {
 	//global match/filter
 	MLIB_ASSERT(m_state.m_bUseSolve);
 
 	BundlerState::PROCESS_STATE processState = m_state.m_processState;
-	if (processState == BundlerState::DO_NOTHING) {
-		if (m_state.m_numFramesPastEnd != 0) { //sequence is over, try revalidation still
-			unsigned int idx = m_global->tryRevalidation(m_state.m_lastLocalSolved, true);
-			if (idx != (unsigned int)-1) { //validate chunk images
-				const std::vector<int>& validLocal = m_localTrajectoriesValid[idx];
-				for (unsigned int i = 0; i < validLocal.size(); i++) {
-					if (validLocal[i] == 1)	validateImages(idx * m_submapSize + i);
-				}
-				m_state.m_processState = BundlerState::PROCESS;
-			}
-		}
-		return;
-	}
+	if (processState == BundlerState::DO_NOTHING) return false;
 
 	if (GlobalBundlingState::get().s_enableGlobalTimings) TimingLog::addGlobalFrameTiming();
 	m_state.m_processState = BundlerState::DO_NOTHING;
@@ -358,6 +384,7 @@ void OnlineBundler::processGlobal()
 		mutex_optLocal.unlock();
 		invalidateImages(m_submapSize * m_state.m_lastLocalSolved, m_state.m_totalNumOptLocalFrames); 
 	}
+	return true;
 }
 
 void OnlineBundler::updateTrajectory(unsigned int curFrame)
@@ -370,11 +397,11 @@ void OnlineBundler::updateTrajectory(unsigned int curFrame)
 	mutex_completeTrajectory.unlock();
 }
 
-void OnlineBundler::optimizeGlobal(unsigned int numNonLinIterations, unsigned int numLinIterations)
+bool OnlineBundler::optimizeGlobal(unsigned int numNonLinIterations, unsigned int numLinIterations)
 {
 	MLIB_ASSERT(m_state.m_bUseSolve);
 	const bool isSequenceDone = m_state.m_numFramesPastEnd > 0;
-	if (!isSequenceDone && m_state.m_processState == BundlerState::DO_NOTHING) return; //always solve after end of sequence
+	if (!isSequenceDone && m_state.m_processState == BundlerState::DO_NOTHING) return false; //always solve after end of sequence
 	MLIB_ASSERT(m_state.m_lastLocalSolved >= 0);
 
 	const BundlerState::PROCESS_STATE state = isSequenceDone ? BundlerState::PROCESS : m_state.m_processState; //always solve after end of sequence
@@ -405,6 +432,20 @@ void OnlineBundler::optimizeGlobal(unsigned int numNonLinIterations, unsigned in
 	}
 
 	m_state.m_processState = BundlerState::DO_NOTHING;
+	return true;
+}
+
+void OnlineBundler::submitProcess(unsigned int numNonLinItersLocal, unsigned int numLinItersLocal, unsigned int numNonLinItersGlobal, unsigned int numLinItersGlobal)
+{
+	if (!m_state.m_bUseSolve) return; //solver off
+	if (!m_solverWorker.isRunning()) m_solverWorker.start();
+
+	//jobs run in order on the worker, so each stage sees the state left by the previous one (as in process())
+	const unsigned int timingFrame = (unsigned int)std::max(m_state.m_lastFrameProcessed, 0); //local solve timings go to the frame that triggered it
+	m_solverWorker.submit(SolverWorker::JOB_LOCAL_SOLVE, [=] { TimingLog::setCurrentLocalFrame(timingFrame); return optimizeLocal(numNonLinItersLocal, numLinItersLocal); });
+	m_solverWorker.submit(SolverWorker::JOB_GLOBAL_MATCH, [=] { m_bGlobalMatched = matchGlobal(); return m_bGlobalMatched; });
+	m_solverWorker.submit(SolverWorker::JOB_REVALIDATION, [=] { return !m_bGlobalMatched && revalidateGlobal(); });
+	m_solverWorker.submit(SolverWorker::JOB_GLOBAL_SOLVE, [=] { return optimizeGlobal(numNonLinItersGlobal, numLinItersGlobal); });
 }
 
 void OnlineBundler::process(unsigned int numNonLinItersLocal, unsigned int numLinItersLocal, unsigned int numNonLinItersGlobal, unsigned int numLinItersGlobal)
@@ -412,7 +453,7 @@ void OnlineBundler::process(unsigned int numNonLinItersLocal, unsigned int numLi
 	if (!m_state.m_bUseSolve) return; //solver off
 
 	optimizeLocal(numNonLinItersLocal, numLinItersLocal);
-	processGlobal();
+	if (!matchGlobal()) revalidateGlobal(); //revalidation only in rounds without a new global frame
 	optimizeGlobal(numNonLinItersGlobal, numLinItersGlobal);
 
 	//{ //no opt
@@ -1,5 +1,7 @@
 #pragma once
 #include "OnlineBundlerHelper.h"
+#include "BundlingFrameQueue.h"
+#include "SolverWorker.h"
 
 
 class Bundler;
@@ -9,26 +11,27 @@ class TrajectoryManager;
 
 class OnlineBundler {
 public:
-	OnlineBundler(const RGBDSensor* sensor, const CUDAImageManager* imageManager);
+	OnlineBundler(const RGBDSensor* sensor, CUDAImageManager* imageManager);
 	~OnlineBundler();
 
-
-	bool getCurrentIntegrationFrame(mat4f& siftTransform, unsigned int& frameIdx, bool& bGlobalTrackingLost);
-
-	//feature detect/match for current frame
+	//feature detect/match for the oldest input frame of the bundling queue; its integration transform is handed back through the queue
 	void processInput();
 
 	//local opt and global match/opt
 	void process(unsigned int numNonLinItersLocal, unsigned int numLinItersLocal, unsigned int numNonLinItersGlobal, unsigned int numLinItersGlobal);
+	//same stages as process(), queued on the persistent solver worker so they overlap with processInput (worker starts on the calling thread's device)
+	void submitProcess(unsigned int numNonLinItersLocal, unsigned int numLinItersLocal, unsigned int numNonLinItersGlobal, unsigned int numLinItersGlobal);
+	void waitForSolver()						{ m_solverWorker.waitUntilIdle(); }
+	bool isSolverIdle()							{ return m_solverWorker.isIdle(); }
+	void printSolverStats()						{ m_solverWorker.printStats(); }
 
 	TrajectoryManager* getTrajectoryManager()	{ return m_trajectoryManager; }
-	bool hasProcssedInputFrame() const			{ return m_bHasProcessedInputFrame; }
-	void setProcessedInputFrame()				{ m_bHasProcessedInputFrame = true; }
-	void confirmProcessedInputFrame()			{ m_bHasProcessedInputFrame = false; }
 	void exitBundlingThread()					{ m_bExitBundlingThread = true; }
 	bool getExitBundlingThread() const			{ return m_bExitBundlingThread; }
 
 	unsigned int getCurrProcessedFrame() const	{ return m_state.m_lastFrameProcessed; }
+	//! an end-of-sequence marker came through the bundling queue, i.e., all input frames have been processed
+	bool isPastEndOfInput() const				{ return m_state.m_numFramesPastEnd > 0; }
 
 	// -- various logging
 	void saveGlobalSparseCorrsToFile(const std::string& filename) const;
@@ -40,15 +43,19 @@ public:
 private:
 
 	bool isLastLocalFrame(unsigned int curFrame) const { return (curFrame >= m_submapSize && (curFrame % m_submapSize) == 0); }
-	void getCurrentFrame();
+	void getCurrentFrame(const BundlingFrameQueue::Frame& frame);
+	void processInputFrame(const BundlingFrameQueue::Frame& frame);
+	bool getCurrentIntegrationFrame(mat4f& siftTransform, unsigned int& frameIdx, bool& bGlobalTrackingLost);
 	void computeCurrentSiftTransform(bool bIsValid, unsigned int frameIdx, unsigned int localFrameIdx, unsigned int lastValidCompleteTransform);
 
 	void prepareLocalSolve(unsigned int curFrame, bool isSequenceEnd);
 	void initializeNextGlobalTransform(unsigned int lastMatchedIdx, unsigned int lastValidLocal);
 
-	void processGlobal();
-	void optimizeLocal(unsigned int numNonLinIterations, unsigned int numLinIterations);
-	void optimizeGlobal(unsigned int numNonLinIterations, unsigned int numLinIterations);
+	//solver stages (run in this order); return false if there was nothing to do
+	bool optimizeLocal(unsigned int numNonLinIterations, unsigned int numLinIterations);
+	bool matchGlobal();
+	bool revalidateGlobal();
+	bool optimizeGlobal(unsigned int numNonLinIterations, unsigned int numLinIterations);
 
 	void updateTrajectory(unsigned int curFrame);
 	void invalidateImages(unsigned int startFrame, unsigned int endFrame = -1) {
@@ -67,9 +74,8 @@ private:
 	}
 
 	//*********** for interfacing with recon ************
-	bool m_bHasProcessedInputFrame;
 	bool m_bExitBundlingThread;
-	const CUDAImageManager*		m_cudaImageManager; //managed outside
+	CUDAImageManager*			m_cudaImageManager; //managed outside
 
 	//*********** input data ************
 	BundlerInputData			m_input;
@@ -104,4 +110,7 @@ private:
 	std::vector<mat4f>			m_currIntegrateTransform;
 
 	Timer						m_timer;
+
+	SolverWorker				m_solverWorker;
+	bool						m_bGlobalMatched;	//solver worker only: revalidation is skipped in rounds with a global match
 };
@@ -0,0 +1,295 @@
+#include "stdafx.h"
+#include "RGBDFrameCodec.h"
+
+#include <algorithm>
+#include <limits>
+
+#define RGBD_CODEC_NUM_CONTEXTS 12	//contexts by local gradient magnitude (log2)
+#define RGBD_CODEC_UNARY_LIMIT 24	//longer Golomb codes are escaped (raw value)
+
+class RGBDFrameCodec::BitWriter
+{
+public:
+	BitWriter(std::vector<BYTE>& out) : m_out(out), m_acc(0), m_numBits(0) {}
+
+	//! value < 2^n, n <= 32
+	void write(unsigned int value, unsigned int n) {
+		m_acc = (m_acc << n) | value;
+		m_numBits += n;
+		while (m_numBits >= 8) {
+			m_numBits -= 8;
+			m_out.push_back((BYTE)(m_acc >> m_numBits));
+		}
+		m_acc &= (1ull << m_numBits) - 1;
+	}
+	void writeGolomb(unsigned int m, unsigned int k, unsigned int escapeBits) {
+		const unsigned int q = m >> k;
+		if (q < RGBD_CODEC_UNARY_LIMIT) {
+			write(((1u << q) - 1) << 1, q + 1);
+			write(m & ((1u << k) - 1), k);
+		}
+		else {
+			write((1u << RGBD_CODEC_UNARY_LIMIT) - 1, RGBD_CODEC_UNARY_LIMIT);
+			write(m, escapeBits);
+		}
+	}
+	void flush() {
+		if (m_numBits > 0) write(0, 8 - m_numBits);
+	}
+
+private:
+	std::vector<BYTE>&	m_out;
+	UINT64				m_acc;
+	unsigned int		m_numBits;
+};
+
+class RGBDFrameCodec::BitReader
+{
+public:
+	BitReader(const BYTE* data, size_t numBytes) : m_data(data), m_end(data + numBytes), m_acc(0), m_numBits(0), m_numPadding(0) {}
+
+	//! n <= 32
+	unsigned int read(unsigned int n) {
+		if (m_numBits < n) refill();
+		m_numBits -= n;
+		if (m_numBits < m_numPadding) throw MLIB_EXCEPTION("corrupt compressed frame (truncated)");
+		return (unsigned int)((m_acc >> m_numBits) & ((1ull << n) - 1));
+	}
+	unsigned int readGolomb(unsigned int k, unsigned int escapeBits) {
+		if (m_numBits < RGBD_CODEC_UNARY_LIMIT + 1) refill();
+		unsigned int q = 0;
+		while (q < RGBD_CODEC_UNARY_LIMIT && ((m_acc >> (m_numBits - 1 - q)) & 1)) q++;
+		if (q == RGBD_CODEC_UNARY_LIMIT) {
+			m_numBits -= q;
+			return read(escapeBits);
+		}
+		m_numBits -= q + 1;
+		return (q << k) | read(k);
+	}
+	//! everything but the padding of the last byte must have been read
+	void finish() const {
+		if (m_data != m_end || m_numBits - m_numPadding >= 8) throw MLIB_EXCEPTION("corrupt compressed frame (trailing data)");
+	}
+
+private:
+	//! buffers whole bytes (at least 57 bits); past the end zeros are shifted in, reading them means the data is truncated
+	void refill() {
+		while (m_numBits <= 56) {
+			m_acc <<= 8;
+			if (m_data != m_end) m_acc |= *m_data++;
+			else m_numPadding += 8;
+			m_numBits += 8;
+		}
+	}
+
+	const BYTE*		m_data;
+	const BYTE*		m_end;
+	UINT64			m_acc;
+	unsigned int	m_numBits;
+	unsigned int	m_numPadding;	//zero bits shifted in past the end (the low bits of m_acc)
+};
+
+//adaptive Golomb-Rice parameter: k such that the mean code value is about 2^k
+struct RGBDCodecContext {
+	unsigned int A, N;
+	void init(unsigned int a) {
+		A = a; N = 1;
+	}
+	unsigned int getK() const {
+		unsigned int k = 0;
+		while ((N << k) < A && k < 24) k++;
+		return k;
+	}
+	void update(unsigned int m) {
+		A += m; N++;
+		if (N >= 64) { A >>= 1; N >>= 1; }
+	}
+};
+
+//causal neighbors: a left, b above, c above left, d above right (replicated at the borders)
+static inline void getNeighbors(const int* rec, unsigned int width, unsigned int x, unsigned int y, int& a, int& b, int& c, int& d)
+{
+	const int* row = rec + y*width;
+	const int* rowAbove = row - width;
+	a = x > 0 ? row[x - 1] : (y > 0 ? rowAbove[0] : 0);
+	b = y > 0 ? rowAbove[x] : a;
+	c = (y > 0 && x > 0) ? rowAbove[x - 1] : b;
+	d = (y > 0 && x + 1 < width) ? rowAbove[x + 1] : b;
+}
+
+static inline int predictMED(int a, int b, int c)
+{
+	if (c >= std::max(a, b)) return std::min(a, b);
+	if (c <= std::min(a, b)) return std::max(a, b);
+	return a + b - c;
+}
+
+static inline unsigned int getContext(int a, int b, int c, int d)
+{
+	unsigned int activity = std::abs(d - b) + std::abs(b - c) + std::abs(c - a);
+	unsigned int ctx = 0;
+	while (activity) { ctx++; activity >>= 1; }
+	return std::min(ctx, (unsigned int)RGBD_CODEC_NUM_CONTEXTS - 1);
+}
+
+void RGBDFrameCodec::encodePlane(const int* plane, int* rec, unsigned int width, unsigned int height, unsigned int bitDepth, unsigned int near, BitWriter& writer)
+{
+	MLIB_ASSERT(width < (1u << 16));
+	const int range = 1 << bitDepth;
+	const int step = 2 * near + 1;
+	RGBDCodecContext ctxs[RGBD_CODEC_NUM_CONTEXTS], runCtx;
+	for (RGBDCodecContext& c : ctxs) c.init(std::max(2, (range + 32) / 64));
+	runCtx.init(2);
+
+	for (unsigned int y = 0; y < height; y++) {
+		const int* row = plane + y*width;
+		int* recRow = rec + y*width;
+		for (unsigned int x = 0; x < width;) {
+			int a, b, c, d;
+			getNeighbors(rec, width, x, y, a, b, c, d);
+			if (near == 0 && a == b && b == c && c == d) {
+				//flat neighborhood: run of pixels equal to a, terminated by a regular pixel unless it reaches the end of the row
+				unsigned int run = 0;
+				while (x + run < width && row[x + run] == a) recRow[x + run++] = a;
+				writer.writeGolomb(run, runCtx.getK(), 16);
+				runCtx.update(run);
+				x += run;
+				if (x == width) continue;
+				getNeighbors(rec, width, x, y, a, b, c, d);
+			}
+
+			const int pred = predictMED(a, b, c);
+			int e = row[x] - pred;
+			if (near == 0) {
+				if (e < -range / 2) e += range;
+				else if (e >= range / 2) e -= range;
+				recRow[x] = row[x];
+			}
+			else {
+				e = e > 0 ? (e + (int)near) / step : -(((int)near - e) / step);
+				recRow[x] = std::min(std::max(pred + e * step, 0), range - 1);
+			}
+			const unsigned int m = e >= 0 ? 2 * e : -2 * e - 1;
+			RGBDCodecContext& ctx = ctxs[getContext(a, b, c, d)];
+			writer.writeGolomb(m, ctx.getK(), bitDepth + 1);
+			ctx.update(m);
+			x++;
+		}
+	}
+}
+
+void RGBDFrameCodec::decodePlane(int* plane, unsigned int width, unsigned int height, unsigned int bitDepth, unsigned int near, BitReader& reader)
+{
+	const int range = 1 << bitDepth;
+	const int step = 2 * near + 1;
+	RGBDCodecContext ctxs[RGBD_CODEC_NUM_CONTEXTS], runCtx;
+	for (RGBDCodecContext& c : ctxs) c.init(std::max(2, (range + 32) / 64));
+	runCtx.init(2);
+
+	for (unsigned int y = 0; y < height; y++) {
+		int* row = plane + y*width;
+		for (unsigned int x = 0; x < width;) {
+			int a, b, c, d;
+			getNeighbors(plane, width, x, y, a, b, c, d);
+			if (near == 0 && a == b && b == c && c == d) {
+				const unsigned int run = reader.readGolomb(runCtx.getK(), 16);
+				runCtx.update(run);
+				if (run > width - x) throw MLIB_EXCEPTION("corrupt compressed frame (run length)");
+				for (unsigned int i = 0; i < run; i++) row[x + i] = a;
+				x += run;
+				if (x == width) continue;
+				getNeighbors(plane, width, x, y, a, b, c, d);
+			}
+
+			const int pred = predictMED(a, b, c);
+			RGBDCodecContext& ctx = ctxs[getContext(a, b, c, d)];
+			const unsigned int m = reader.readGolomb(ctx.getK(), bitDepth + 1);
+			ctx.update(m);
+			const int e = (m & 1) ? -(int)((m + 1) >> 1) : (int)(m >> 1);
+			if (near == 0) row[x] = (pred + e) & (range - 1);
+			else row[x] = std::min(std::max(pred + e * step, 0), range - 1);
+			x++;
+		}
+	}
+}
+
+void RGBDFrameCodec::compressDepth(const float* depth, unsigned int width, unsigned int height, float depthShift, std::vector<BYTE>& out)
+{
+	const unsigned int numPixels = width * height;
+	std::vector<int> plane(numPixels), rec(numPixels);
+	for (unsigned int i = 0; i < numPixels; i++) {
+		int q = 0;	//invalid
+		if (depth[i] > 0.0f) {
+			const double v = (double)depth[i] * depthShift + 0.5;
+			if (v < 65536.0) q = (int)v;
+		}
+		plane[i] = q;
+	}
+
+	const size_t headerOffset = out.size();
+	out.resize(headerOffset + sizeof(float));
+	memcpy(&out[headerOffset], &depthShift, sizeof(float));
+	BitWriter writer(out);
+	encodePlane(plane.data(), rec.data(), width, height, 16, 0, writer);
+	writer.flush();
+}
+
+void RGBDFrameCodec::decompressDepth(const BYTE* data, size_t numBytes, unsigned int width, unsigned int height, float* depth)
+{
+	if (numBytes < sizeof(float)) throw MLIB_EXCEPTION("corrupt compressed frame (header)");
+	float depthShift;
+	memcpy(&depthShift, data, sizeof(float));
+
+	const unsigned int numPixels = width * height;
+	std::vector<int> plane(numPixels);
+	BitReader reader(data + sizeof(float), numBytes - sizeof(float));
+	decodePlane(plane.data(), width, height, 16, 0, reader);
+	reader.finish();
+
+	//same rounding as depth = raw / sensorDepthShift for raw * (depthShift / sensorDepthShift) == q
+	for (unsigned int i = 0; i < numPixels; i++) {
+		depth[i] = plane[i] == 0 ? -std::numeric_limits<float>::infinity() : (float)plane[i] / depthShift;
+	}
+}
+
+void RGBDFrameCodec::compressColor(const uchar4* color, unsigned int width, unsigned int height, unsigned int maxError, std::vector<BYTE>& out)
+{
+	if (maxError > 255) throw MLIB_EXCEPTION("invalid max color error " + std::to_string(maxError));
+	const unsigned int numPixels = width * height;
+	std::vector<int> plane(numPixels), rec(numPixels);
+
+	out.push_back((BYTE)maxError);
+	BitWriter writer(out);
+	for (unsigned int p = 0; p < 4; p++) {
+		for (unsigned int i = 0; i < numPixels; i++) {
+			const uchar4& c = color[i];
+			if (p == 3) plane[i] = c.w;
+			else if (maxError > 0) plane[i] = p == 0 ? c.x : (p == 1 ? c.y : c.z);
+			//lossless: green and the differences to it (the residuals are coded mod 256)
+			else plane[i] = p == 0 ? c.y : (((p == 1 ? c.x : c.z) - c.y) & 0xff);
+		}
+		encodePlane(plane.data(), rec.data(), width, height, 8, p == 3 ? 0 : maxError, writer);
+	}
+	writer.flush();
+}
+
+void RGBDFrameCodec::decompressColor(const BYTE* data, size_t numBytes, unsigned int width, unsigned int height, uchar4* color)
+{
+	if (numBytes < 1) throw MLIB_EXCEPTION("corrupt compressed frame (header)");
+	const unsigned int maxError = data[0];
+
+	const unsigned int numPixels = width * height;
+	std::vector<int> plane(numPixels);
+	BitReader reader(data + 1, numBytes - 1);
+	for (unsigned int p = 0; p < 4; p++) {
+		decodePlane(plane.data(), width, height, 8, p == 3 ? 0 : maxError, reader);
+		for (unsigned int i = 0; i < numPixels; i++) {
+			uchar4& c = color[i];
+			if (p == 0) { if (maxError > 0) c.x = (unsigned char)plane[i]; else c.y = (unsigned char)plane[i]; }
+			else if (p == 1) { if (maxError > 0) c.y = (unsigned char)plane[i]; else c.x = (unsigned char)(plane[i] + c.y); }
+			else if (p == 2) { c.z = (unsigned char)(maxError > 0 ? plane[i] : plane[i] + c.y); }
+			else c.w = (unsigned char)plane[i];
+		}
+	}
+	reader.finish();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+/************************************************************************/
+/* Compression of the integration input frames kept on the host        */
+/************************************************************************/
+
+#include <vector>
+
+//! JPEG-LS style image coder (MED prediction, context-adaptive Golomb-Rice codes, run mode for flat regions);
+//! encoding or decoding a 320x240 depth+color frame takes a few ms on one core
+class RGBDFrameCodec
+{
+public:
+	//! depth in meters is stored as round(depth * depthShift) in 16 bits: for sensor depth whose depth shift divides depthShift only float rounding is lost
+	//! (e.g., 1000 or 5000 for depthShift = 5000); invalid (-inf, <= 0) and depth >= 65536 / depthShift are decoded as -inf
+	static void compressDepth(const float* depth, unsigned int width, unsigned int height, float depthShift, std::vector<BYTE>& out);
+	//! maxError == 0: lossless; otherwise each color channel is off by at most maxError (alpha is always lossless)
+	static void compressColor(const uchar4* color, unsigned int width, unsigned int height, unsigned int maxError, std::vector<BYTE>& out);
+
+	//! data/numBytes is exactly the range appended by the compress call
+	static void decompressDepth(const BYTE* data, size_t numBytes, unsigned int width, unsigned int height, float* depth);
+	static void decompressColor(const BYTE* data, size_t numBytes, unsigned int width, unsigned int height, uchar4* color);
+
+private:
+	class BitWriter;
+	class BitReader;
+
+	//! plane values are in [0, 2^bitDepth); near > 0 quantizes the prediction residuals (rec gets the decoded values)
+	static void encodePlane(const int* plane, int* rec, unsigned int width, unsigned int height, unsigned int bitDepth, unsigned int near, BitWriter& writer);
+	static void decodePlane(int* plane, unsigned int width, unsigned int height, unsigned int bitDepth, unsigned int near, BitReader& reader);
+};
@@ -0,0 +1,311 @@
+#include "stdafx.h"
+#include "SensorDataIndex.h"
+
+#include <fstream>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "stb_image.h"	//compiled into mLib for SensorData
+
+#define SENSOR_DATA_VERSION 4
+#define SENSOR_DATA_INDEX_MAGIC 0x58444953	//"SIDX"
+#define SENSOR_DATA_INDEX_VERSION 1
+
+SensorDataIndex::SensorDataIndex()
+{
+	m_data = NULL;
+	m_fileSize = 0;
+	m_fileHandle = NULL;
+	m_mappingHandle = NULL;
+
+	m_colorCompressionType = -1;
+	m_depthCompressionType = -1;
+	m_colorWidth = m_colorHeight = 0;
+	m_depthWidth = m_depthHeight = 0;
+	m_depthShift = 1.0f;
+}
+
+SensorDataIndex::~SensorDataIndex()
+{
+	close();
+}
+
+void SensorDataIndex::open(const std::string& filename)
+{
+	close();
+	m_filename = filename;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE) throw MLIB_EXCEPTION("could not open file " + filename);
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	m_fileSize = (UINT64)size.QuadPart;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) { CloseHandle(file); throw MLIB_EXCEPTION("could not map file " + filename); }
+	m_data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_data) { CloseHandle(mapping); CloseHandle(file); throw MLIB_EXCEPTION("could not map file " + filename); }
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) throw MLIB_EXCEPTION("could not open file " + filename);
+	struct stat st;
+	fstat(fd, &st);
+	m_fileSize = (UINT64)st.st_size;
+	void* data = mmap(NULL, (size_t)m_fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) throw MLIB_EXCEPTION("could not map file " + filename);
+	m_data = (const unsigned char*)data;
+#endif
+
+	const size_t firstFrameOffset = readHeader();
+	const std::string indexFile = filename + ".idx";
+	if (!loadIndex(indexFile) || (!m_frameOffsets.empty() && m_frameOffsets.front() != firstFrameOffset)) {
+		std::cout << "building frame index... ";
+		buildIndex(firstFrameOffset);
+		std::cout << "DONE!" << std::endl;
+		saveIndex(indexFile);
+	}
+}
+
+void SensorDataIndex::close()
+{
+	if (m_data) {
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+		CloseHandle((HANDLE)m_mappingHandle);
+		CloseHandle((HANDLE)m_fileHandle);
+#else
+		munmap((void*)m_data, (size_t)m_fileSize);
+#endif
+	}
+	m_data = NULL;
+	m_fileSize = 0;
+	m_fileHandle = NULL;
+	m_mappingHandle = NULL;
+	m_frameOffsets.clear();
+}
+
+size_t SensorDataIndex::readHeader()
+{
+	size_t offset = 0;
+	auto read = [&](void* dst, size_t size) {
+		if (offset + size > m_fileSize) throw MLIB_EXCEPTION("truncated sens file " + m_filename);
+		memcpy(dst, m_data + offset, size);
+		offset += size;
+	};
+
+	unsigned int version;
+	read(&version, sizeof(unsigned int));
+	if (version != SENSOR_DATA_VERSION) throw MLIB_EXCEPTION("invalid sens file version " + std::to_string(version));
+
+	UINT64 strLen;
+	read(&strLen, sizeof(UINT64));
+	m_sensorName.resize((size_t)strLen);
+	if (strLen > 0) read(&m_sensorName[0], (size_t)strLen);
+
+	read(&m_colorIntrinsic, sizeof(mat4f));
+	read(&m_colorExtrinsic, sizeof(mat4f));
+	read(&m_depthIntrinsic, sizeof(mat4f));
+	read(&m_depthExtrinsic, sizeof(mat4f));
+	read(&m_colorCompressionType, sizeof(int));
+	read(&m_depthCompressionType, sizeof(int));
+	read(&m_colorWidth, sizeof(unsigned int));
+	read(&m_colorHeight, sizeof(unsigned int));
+	read(&m_depthWidth, sizeof(unsigned int));
+	read(&m_depthHeight, sizeof(unsigned int));
+	read(&m_depthShift, sizeof(float));
+
+	UINT64 numFrames;
+	read(&numFrames, sizeof(UINT64));
+	m_frameOffsets.assign((size_t)numFrames, 0);	//filled by loadIndex/buildIndex
+	return offset;
+}
+
+void SensorDataIndex::buildIndex(size_t firstFrameOffset)
+{
+	//only touches the frame headers (one page per frame)
+	UINT64 offset = firstFrameOffset;
+	for (size_t i = 0; i < m_frameOffsets.size(); i++) {
+		if (offset + sizeof(FrameHeader) > m_fileSize) throw MLIB_EXCEPTION("truncated sens file " + m_filename + " at frame " + std::to_string(i));
+		m_frameOffsets[i] = offset;
+		const FrameHeader h = getFrameHeader((unsigned int)i);
+		offset += sizeof(FrameHeader) + h.colorSizeBytes + h.depthSizeBytes;
+	}
+	if (offset > m_fileSize) throw MLIB_EXCEPTION("truncated sens file " + m_filename);
+}
+
+bool SensorDataIndex::loadIndex(const std::string& indexFile)
+{
+	std::ifstream in(indexFile, std::ios::binary);
+	if (!in.is_open()) return false;
+
+	unsigned int magic = 0, version = 0;
+	UINT64 fileSize = 0, numFrames = 0;
+	in.read((char*)&magic, sizeof(unsigned int));
+	in.read((char*)&version, sizeof(unsigned int));
+	in.read((char*)&fileSize, sizeof(UINT64));
+	in.read((char*)&numFrames, sizeof(UINT64));
+	if (!in || magic != SENSOR_DATA_INDEX_MAGIC || version != SENSOR_DATA_INDEX_VERSION || fileSize != m_fileSize || numFrames != m_frameOffsets.size()) {
+		MLIB_WARNING("stale frame index " + indexFile + ", rebuilding");
+		return false;
+	}
+	if (numFrames > 0) in.read((char*)m_frameOffsets.data(), sizeof(UINT64)*numFrames);
+	if (!in) return false;
+
+	if (numFrames > 0) { //cheap sanity check of the last frame
+		const FrameHeader h = getFrameHeader((unsigned int)numFrames - 1);
+		if (m_frameOffsets.back() + sizeof(FrameHeader) + h.colorSizeBytes + h.depthSizeBytes > m_fileSize) return false;
+	}
+	return true;
+}
+
+void SensorDataIndex::saveIndex(const std::string& indexFile) const
+{
+	std::ofstream out(indexFile, std::ios::binary);
+	if (!out.is_open()) {
+		MLIB_WARNING("could not write frame index " + indexFile + " (will be rebuilt on the next run)");
+		return;
+	}
+	const unsigned int magic = SENSOR_DATA_INDEX_MAGIC, version = SENSOR_DATA_INDEX_VERSION;
+	const UINT64 numFrames = m_frameOffsets.size();
+	out.write((const char*)&magic, sizeof(unsigned int));
+	out.write((const char*)&version, sizeof(unsigned int));
+	out.write((const char*)&m_fileSize, sizeof(UINT64));
+	out.write((const char*)&numFrames, sizeof(UINT64));
+	out.write((const char*)m_frameOffsets.data(), sizeof(UINT64)*numFrames);
+}
+
+SensorDataIndex::FrameHeader SensorDataIndex::getFrameHeader(unsigned int frameIdx) const
+{
+	FrameHeader h;
+	memcpy(&h, m_data + m_frameOffsets[frameIdx], sizeof(FrameHeader));
+	return h;
+}
+
+bool SensorDataIndex::hasColorData() const
+{
+	return getNumFrames() > 0 && getFrameHeader(0).colorSizeBytes > 0;
+}
+
+mat4f SensorDataIndex::getCameraToWorld(unsigned int frameIdx) const
+{
+	if (frameIdx >= getNumFrames()) throw MLIB_EXCEPTION("invalid frame index " + std::to_string(frameIdx));
+	return getFrameHeader(frameIdx).cameraToWorld;
+}
+
+unsigned short* SensorDataIndex::decompressDepthAlloc(unsigned int frameIdx) const
+{
+	if (frameIdx >= getNumFrames()) throw MLIB_EXCEPTION("invalid frame index " + std::to_string(frameIdx));
+	const FrameHeader h = getFrameHeader(frameIdx);
+	const unsigned char* compressed = m_data + m_frameOffsets[frameIdx] + sizeof(FrameHeader) + h.colorSizeBytes;
+	const size_t numBytes = sizeof(unsigned short)*m_depthWidth*m_depthHeight;
+
+	unsigned short* depth = NULL;
+	if (m_depthCompressionType == SensorData::TYPE_RAW_USHORT) {
+		if (h.depthSizeBytes != numBytes) throw MLIB_EXCEPTION("invalid raw depth size in frame " + std::to_string(frameIdx));
+		depth = (unsigned short*)std::malloc(numBytes);
+		memcpy(depth, compressed, numBytes);
+	}
+	else if (m_depthCompressionType == SensorData::TYPE_ZLIB_USHORT) {
+		int len = 0;
+		depth = (unsigned short*)stbi_zlib_decode_malloc((const char*)compressed, (int)h.depthSizeBytes, &len);
+		if (!depth || (size_t)len != numBytes) { std::free(depth); throw MLIB_EXCEPTION("could not decompress depth of frame " + std::to_string(frameIdx)); }
+	}
+	else {
+		throw MLIB_EXCEPTION("unsupported depth compression type " + std::to_string(m_depthCompressionType));
+	}
+	return depth;
+}
+
+vec3uc* SensorDataIndex::decompressColorAlloc(unsigned int frameIdx) const
+{
+	if (frameIdx >= getNumFrames()) throw MLIB_EXCEPTION("invalid frame index " + std::to_string(frameIdx));
+	const FrameHeader h = getFrameHeader(frameIdx);
+	const unsigned char* compressed = m_data + m_frameOffsets[frameIdx] + sizeof(FrameHeader);
+	const size_t numBytes = sizeof(vec3uc)*m_colorWidth*m_colorHeight;
+
+	vec3uc* color = NULL;
+	if (m_colorCompressionType == SensorData::TYPE_RAW) {
+		if (h.colorSizeBytes != numBytes) throw MLIB_EXCEPTION("invalid raw color size in frame " + std::to_string(frameIdx));
+		color = (vec3uc*)std::malloc(numBytes);
+		memcpy(color, compressed, numBytes);
+	}
+	else if (m_colorCompressionType == SensorData::TYPE_PNG || m_colorCompressionType == SensorData::TYPE_JPEG) {
+		int width = 0, height = 0;
+		color = (vec3uc*)stbi_load_from_memory(compressed, (int)h.colorSizeBytes, &width, &height, NULL, 3);
+		if (!color || (unsigned int)width != m_colorWidth || (unsigned int)height != m_colorHeight) { std::free(color); throw MLIB_EXCEPTION("could not decompress color of frame " + std::to_string(frameIdx)); }
+	}
+	else {
+		throw MLIB_EXCEPTION("unsupported color compression type " + std::to_string(m_colorCompressionType));
+	}
+	return color;
+}
+
+void SensorDataIndex::releaseFrameData(unsigned int frameIdx) const
+{
+	if (frameIdx >= getNumFrames()) return;
+	const FrameHeader h = getFrameHeader(frameIdx);
+	const UINT64 begin = m_frameOffsets[frameIdx];
+	const UINT64 end = begin + sizeof(FrameHeader) + h.colorSizeBytes + h.depthSizeBytes;
+#ifdef _WIN32
+	//unlocking pages that are not locked removes them from the working set (they stay in the file cache)
+	VirtualUnlock((LPVOID)(m_data + begin), (SIZE_T)(end - begin));
+#else
+	const UINT64 pageSize = (UINT64)sysconf(_SC_PAGESIZE);
+	const UINT64 pageBegin = begin / pageSize * pageSize;
+	madvise((void*)(m_data + pageBegin), (size_t)(end - pageBegin), MADV_DONTNEED);
+#endif
+}
+
+void SensorDataIndex::saveToFile(const std::string& filename, const std::vector<mat4f>& trajectory) const
+{
+	mat4f invalidTransform; invalidTransform.setZero(-std::numeric_limits<float>::infinity());
+	const unsigned int numFrames = getNumFrames();
+
+	if (filename == m_filename) {
+		//frame sizes do not change, so only the poses need to be written
+		std::fstream out(filename, std::ios::binary | std::ios::in | std::ios::out);
+		if (!out.is_open()) throw MLIB_EXCEPTION("could not open file " + filename);
+		for (unsigned int i = 0; i < numFrames; i++) {
+			const mat4f& transform = i < trajectory.size() ? trajectory[i] : invalidTransform;
+			out.seekp((std::streamoff)m_frameOffsets[i]);
+			out.write((const char*)&transform, sizeof(mat4f));
+		}
+		if (!out) throw MLIB_EXCEPTION("could not write poses to " + filename);
+		return;
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) throw MLIB_EXCEPTION("could not open file " + filename);
+	const UINT64 headerSize = numFrames > 0 ? m_frameOffsets[0] : m_fileSize;
+	out.write((const char*)m_data, (std::streamsize)headerSize);
+	for (unsigned int i = 0; i < numFrames; i++) {
+		const FrameHeader h = getFrameHeader(i);
+		const mat4f& transform = i < trajectory.size() ? trajectory[i] : invalidTransform;
+		out.write((const char*)&transform, sizeof(mat4f));
+		out.write((const char*)(m_data + m_frameOffsets[i] + sizeof(mat4f)), (std::streamsize)(sizeof(FrameHeader) - sizeof(mat4f) + h.colorSizeBytes + h.depthSizeBytes));
+	}
+	//rest of the file (imu frames)
+	if (numFrames > 0) {
+		const FrameHeader h = getFrameHeader(numFrames - 1);
+		const UINT64 end = m_frameOffsets.back() + sizeof(FrameHeader) + h.colorSizeBytes + h.depthSizeBytes;
+		out.write((const char*)(m_data + end), (std::streamsize)(m_fileSize - end));
+	}
+	if (!out) throw MLIB_EXCEPTION("could not write " + filename);
+}
+
+std::ostream& operator<<(std::ostream& s, const SensorDataIndex& sensorData)
+{
+	s << "Sensor: " << sensorData.m_sensorName << std::endl;
+	s << "#frames: " << sensorData.getNumFrames() << std::endl;
+	s << "color: " << sensorData.m_colorWidth << "x" << sensorData.m_colorHeight << " (compression " << sensorData.m_colorCompressionType << ")" << std::endl;
+	s << "depth: " << sensorData.m_depthWidth << "x" << sensorData.m_depthHeight << " (compression " << sensorData.m_depthCompressionType << ", shift " << sensorData.m_depthShift << ")" << std::endl;
+	return s;
+}
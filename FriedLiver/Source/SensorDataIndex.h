@@ -0,0 +1,78 @@
+#pragma once
+
+/************************************************************************/
+/* Memory-mapped, random-access view of a .sens file                    */
+/************************************************************************/
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+//! replaces SensorData::loadFromFile (which reads every compressed frame into RAM) for offline replay:
+//! the file is mapped read-only, frame offsets come from a sidecar index (<file>.idx, built on the first open),
+//! and frames are only touched when they are decoded
+class SensorDataIndex
+{
+public:
+	SensorDataIndex();
+	~SensorDataIndex();
+
+	void open(const std::string& filename);
+	void close();
+	bool isOpen() const {
+		return m_data != NULL;
+	}
+
+	unsigned int getNumFrames() const {
+		return (unsigned int)m_frameOffsets.size();
+	}
+	bool hasColorData() const;
+
+	mat4f getCameraToWorld(unsigned int frameIdx) const;
+
+	//! malloc'ed (free with std::free), same as SensorData::decompress*Alloc
+	unsigned short* decompressDepthAlloc(unsigned int frameIdx) const;
+	vec3uc* decompressColorAlloc(unsigned int frameIdx) const;
+	//! hint that the compressed data of a frame is no longer needed (drops its pages from the working set)
+	void releaseFrameData(unsigned int frameIdx) const;
+
+	//! writes the file with the given trajectory (invalid transforms for the remaining frames);
+	//! if filename is the mapped file, only the poses are patched in place
+	void saveToFile(const std::string& filename, const std::vector<mat4f>& trajectory) const;
+
+	//header (same fields as SensorData)
+	std::string		m_sensorName;
+	mat4f			m_colorIntrinsic, m_colorExtrinsic;
+	mat4f			m_depthIntrinsic, m_depthExtrinsic;
+	int				m_colorCompressionType;		//SensorData::COMPRESSION_TYPE_COLOR
+	int				m_depthCompressionType;		//SensorData::COMPRESSION_TYPE_DEPTH
+	unsigned int	m_colorWidth, m_colorHeight;
+	unsigned int	m_depthWidth, m_depthHeight;
+	float			m_depthShift;
+
+private:
+	//per-frame layout in the file: cameraToWorld, timeStampColor, timeStampDepth, colorSizeBytes, depthSizeBytes, color, depth
+	struct FrameHeader {
+		mat4f		cameraToWorld;
+		UINT64		timeStampColor;
+		UINT64		timeStampDepth;
+		UINT64		colorSizeBytes;
+		UINT64		depthSizeBytes;
+	};
+	FrameHeader getFrameHeader(unsigned int frameIdx) const;	//copied out, frames are not aligned in the file
+
+	size_t readHeader();
+	void buildIndex(size_t firstFrameOffset);
+	bool loadIndex(const std::string& indexFile);
+	void saveIndex(const std::string& indexFile) const;
+
+	std::string				m_filename;
+	const unsigned char*	m_data;
+	UINT64					m_fileSize;
+	void*					m_fileHandle;
+	void*					m_mappingHandle;
+
+	std::vector<UINT64>		m_frameOffsets;		//byte offset of each FrameHeader
+};
+
+std::ostream& operator<<(std::ostream& s, const SensorDataIndex& sensorData);
@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include "SensorDataPrefetcher.h"
+
+#include <algorithm>
+#include <emmintrin.h>
+#if defined(__AVX__) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#define SENSOR_DATA_PREFETCHER_SSSE3
+#endif
+
+SensorDataPrefetcher::SensorDataPrefetcher()
+{
+	m_numFrames = 0;
+	m_numDepthPixels = 0;
+	m_numColorPixels = 0;
+	m_depthShift = 1.0f;
+	m_bHasColor = false;
+	m_numThreads = 0;
+
+	m_nextToDecode = 0;
+	m_nextToConsume = 0;
+	m_bExit = false;
+
+	m_numFramesConsumed = 0;
+	m_numStalls = 0;
+	m_timeStallsMS = 0.0;
+}
+
+SensorDataPrefetcher::~SensorDataPrefetcher()
+{
+	free();
+}
+
+void SensorDataPrefetcher::init(const DecodeFunc& decode, unsigned int numFrames, unsigned int depthWidth, unsigned int depthHeight, float depthShift,
+	unsigned int colorWidth, unsigned int colorHeight, bool bHasColor, unsigned int numThreads, unsigned int numBuffers)
+{
+	free();
+	if (numBuffers == 0) throw MLIB_EXCEPTION("sensor data prefetcher needs at least one buffer");
+	if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+	m_decode = decode;
+	m_numFrames = numFrames;
+	m_numDepthPixels = depthWidth * depthHeight;
+	m_numColorPixels = colorWidth * colorHeight;
+	m_depthShift = depthShift;
+	m_bHasColor = bHasColor;
+
+	m_frames.resize(numBuffers);
+	m_bReady.resize(numBuffers, false);
+	for (Frame& f : m_frames) {
+		f.frameIdx = (unsigned int)-1;
+		f.depth = new float[m_numDepthPixels];
+		f.color = m_bHasColor ? new vec4uc[m_numColorPixels] : NULL;
+	}
+
+	m_numFramesConsumed = 0;
+	m_numStalls = 0;
+	m_timeStallsMS = 0.0;
+
+	m_error = nullptr;
+	m_nextToDecode = 0;
+	m_nextToConsume = 0;
+	startThreads(numThreads);
+}
+
+void SensorDataPrefetcher::free()
+{
+	stopThreads();
+	for (Frame& f : m_frames) {
+		SAFE_DELETE_ARRAY(f.depth);
+		SAFE_DELETE_ARRAY(f.color);
+	}
+	m_frames.clear();
+	m_bReady.clear();
+}
+
+void SensorDataPrefetcher::restart(unsigned int startFrame /*= 0*/)
+{
+	stopThreads();
+	std::fill(m_bReady.begin(), m_bReady.end(), false);
+	m_error = nullptr;
+	m_nextToDecode = startFrame;
+	m_nextToConsume = startFrame;
+	startThreads(m_numThreads);
+}
+
+void SensorDataPrefetcher::startThreads(unsigned int numThreads)
+{
+	m_numThreads = numThreads;
+	m_bExit = false;
+	for (unsigned int i = 0; i < numThreads; i++) {
+		m_threads.push_back(std::thread(&SensorDataPrefetcher::decoderFunc, this));
+	}
+}
+
+void SensorDataPrefetcher::stopThreads()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bExit = true;
+	}
+	m_cvDecode.notify_all();
+	for (std::thread& t : m_threads) t.join();
+	m_threads.clear();
+}
+
+void SensorDataPrefetcher::decoderFunc()
+{
+	while (true) {
+		unsigned int frameIdx;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			//a buffer is free once the frame getNumBuffers() before has been released
+			m_cvDecode.wait(lock, [this] { return m_bExit || (m_nextToDecode < m_numFrames && m_nextToDecode < m_nextToConsume + getNumBuffers()); });
+			if (m_bExit) return;
+			frameIdx = m_nextToDecode++;
+		}
+
+		Frame& f = m_frames[frameIdx % getNumBuffers()];
+		unsigned short* depth = NULL;
+		vec3uc* color = NULL;
+		try {
+			m_decode(frameIdx, depth, color);
+			convertDepth(depth, f.depth, m_numDepthPixels, m_depthShift);
+			if (m_bHasColor) convertColor(color, f.color, m_numColorPixels);
+		}
+		catch (...) {
+			//handed to the reader thread in waitForFrame
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (!m_error) m_error = std::current_exception();
+		}
+		std::free(depth);
+		std::free(color);
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			f.frameIdx = frameIdx;
+			m_bReady[frameIdx % getNumBuffers()] = true;
+		}
+		m_cvReady.notify_all();
+	}
+}
+
+const SensorDataPrefetcher::Frame& SensorDataPrefetcher::waitForFrame()
+{
+	if (m_nextToConsume >= m_numFrames) throw MLIB_EXCEPTION("sensor data prefetcher: no more frames");
+	const unsigned int slot = m_nextToConsume % getNumBuffers();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_bReady[slot]) {
+		Timer t;
+		m_numStalls++;
+		m_cvReady.wait(lock, [this, slot] { return m_bReady[slot] || m_error; });
+		m_timeStallsMS += t.getElapsedTimeMS();
+	}
+	if (m_error) std::rethrow_exception(m_error);
+	MLIB_ASSERT(m_frames[slot].frameIdx == m_nextToConsume);
+	return m_frames[slot];
+}
+
+void SensorDataPrefetcher::releaseFrame()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bReady[m_nextToConsume % getNumBuffers()] = false;
+		m_nextToConsume++;
+		m_numFramesConsumed++;
+	}
+	m_cvDecode.notify_one();
+}
+
+void SensorDataPrefetcher::convertDepth(const unsigned short* raw, float* depth, unsigned int numPixels, float depthShift)
+{
+	unsigned int i = 0;
+	//8 pixels at a time (division instead of a reciprocal multiply to match the scalar version exactly)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 shift = _mm_set1_ps(depthShift);
+	const __m128 minusInf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+	for (; i + 8 <= numPixels; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(raw + i));
+		const __m128i lo = _mm_unpacklo_epi16(v, zero);
+		const __m128i hi = _mm_unpackhi_epi16(v, zero);
+		const __m128 dLo = _mm_div_ps(_mm_cvtepi32_ps(lo), shift);
+		const __m128 dHi = _mm_div_ps(_mm_cvtepi32_ps(hi), shift);
+		const __m128 invalidLo = _mm_castsi128_ps(_mm_cmpeq_epi32(lo, zero));
+		const __m128 invalidHi = _mm_castsi128_ps(_mm_cmpeq_epi32(hi, zero));
+		_mm_storeu_ps(depth + i, _mm_or_ps(_mm_and_ps(invalidLo, minusInf), _mm_andnot_ps(invalidLo, dLo)));
+		_mm_storeu_ps(depth + i + 4, _mm_or_ps(_mm_and_ps(invalidHi, minusInf), _mm_andnot_ps(invalidHi, dHi)));
+	}
+	for (; i < numPixels; i++) {
+		if (raw[i] == 0) depth[i] = -std::numeric_limits<float>::infinity();
+		else depth[i] = (float)raw[i] / depthShift;
+	}
+}
+
+void SensorDataPrefetcher::convertColor(const vec3uc* raw, vec4uc* color, unsigned int numPixels)
+{
+	const unsigned char alpha = vec4uc(vec3uc(0, 0, 0)).w;
+	unsigned int i = 0;
+#ifdef SENSOR_DATA_PREFETCHER_SSSE3
+	//4 pixels (12 bytes) at a time; the 16 byte load may read past the last pixel, so stop early
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alphaMask = _mm_set1_epi32((int)((unsigned int)alpha << 24));
+	for (; i + 6 <= numPixels; i += 4) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(raw + i));
+		_mm_storeu_si128((__m128i*)(color + i), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alphaMask));
+	}
+#endif
+	for (; i < numPixels; i++) {
+		color[i] = vec4uc(raw[i].x, raw[i].y, raw[i].z, alpha);
+	}
+}
+
+void SensorDataPrefetcher::printStats(std::ostream& out /*= std::cout*/) const
+{
+	out << "=============== SENSOR DATA PREFETCHER ===============" << std::endl;
+	out << "#decoder threads = " << m_numThreads << ", #buffers = " << getNumBuffers() << std::endl;
+	out << "#frames read = " << m_numFramesConsumed << std::endl;
+	out << "reader stalls (frame not decoded yet) = " << m_numStalls << " [" << m_timeStallsMS << " ms]" << std::endl;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/************************************************************************/
+/* Decodes .sens frames ahead of SensorDataReader::processDepth         */
+/************************************************************************/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <iostream>
+#include <exception>
+
+//! decoder threads decompress and convert frames (in order) into a pool of reusable buffers;
+//! the consumer takes them one by one, so at most getNumBuffers() frames are decoded ahead
+class SensorDataPrefetcher
+{
+public:
+	//! returns malloc'ed decompressed frame data (freed with std::free); color may be NULL if there is no color data
+	typedef std::function<void(unsigned int frameIdx, unsigned short*& depth, vec3uc*& color)> DecodeFunc;
+
+	struct Frame {
+		unsigned int	frameIdx;
+		float*			depth;		//meters, -inf for invalid
+		vec4uc*			color;		//NULL if there is no color data
+	};
+
+	SensorDataPrefetcher();
+	~SensorDataPrefetcher();
+
+	//! numThreads == 0 -> half the cores (the rest is busy with depth sensing/bundling)
+	void init(const DecodeFunc& decode, unsigned int numFrames, unsigned int depthWidth, unsigned int depthHeight, float depthShift,
+		unsigned int colorWidth, unsigned int colorHeight, bool bHasColor, unsigned int numThreads, unsigned int numBuffers);
+	void free();
+
+	//! restarts decoding at startFrame (drops all frames decoded so far)
+	void restart(unsigned int startFrame = 0);
+
+	unsigned int getNumBuffers() const {
+		return (unsigned int)m_frames.size();
+	}
+
+	//! blocks until the next frame is decoded; it stays valid until releaseFrame
+	const Frame& waitForFrame();
+	void releaseFrame();
+
+	void printStats(std::ostream& out = std::cout) const;
+
+	//! depth[i] = raw[i] == 0 ? -inf : raw[i] / depthShift
+	static void convertDepth(const unsigned short* raw, float* depth, unsigned int numPixels, float depthShift);
+	//! same as vec4uc(vec3uc) per pixel
+	static void convertColor(const vec3uc* raw, vec4uc* color, unsigned int numPixels);
+
+private:
+	void startThreads(unsigned int numThreads);
+	void stopThreads();
+	void decoderFunc();
+
+	DecodeFunc					m_decode;
+	unsigned int				m_numFrames;
+	unsigned int				m_numDepthPixels;
+	unsigned int				m_numColorPixels;
+	float						m_depthShift;
+	bool						m_bHasColor;
+	unsigned int				m_numThreads;
+
+	std::vector<Frame>			m_frames;		//pooled output buffers; frame i lives in m_frames[i % getNumBuffers()]
+	std::vector<bool>			m_bReady;
+
+	std::vector<std::thread>	m_threads;
+	std::mutex					m_mutex;
+	std::condition_variable		m_cvDecode;
+	std::condition_variable		m_cvReady;
+	unsigned int				m_nextToDecode;
+	unsigned int				m_nextToConsume;
+	bool						m_bExit;
+	std::exception_ptr			m_error;	//first decoding error, rethrown by waitForFrame
+
+	//consumer stalls (reading is the bottleneck)
+	unsigned int				m_numFramesConsumed;
+	unsigned int				m_numStalls;
+	double						m_timeStallsMS;
+};
@@ -24,9 +24,6 @@ SensorDataReader::SensorDataReader()
 	m_currFrame = 0;
 	m_bHasColorData = false;
 	//parameters are read from the calibration file
-
-	m_sensorData = NULL;
-	m_sensorDataCache = NULL;
 }
 
 SensorDataReader::~SensorDataReader()
@@ -42,25 +39,24 @@ void SensorDataReader::createFirstConnected()
 	std::string filename = GlobalAppState::get().s_binaryDumpSensorFile;
 
 	std::cout << "Start loading binary dump... ";
-	m_sensorData = new SensorData;
-	m_sensorData->loadFromFile(filename);
+	m_sensorData.open(filename);
 	std::cout << "DONE!" << std::endl;
-	std::cout << *m_sensorData << std::endl;
+	std::cout << m_sensorData << std::endl;
 
 	//std::cout << "depth intrinsics:" << std::endl;
-	//std::cout << m_sensorData->m_calibrationDepth.m_intrinsic << std::endl;
+	//std::cout << m_sensorData.m_depthIntrinsic << std::endl;
 	//std::cout << "color intrinsics:" << std::endl;
-	//std::cout << m_sensorData->m_calibrationColor.m_intrinsic << std::endl;
+	//std::cout << m_sensorData.m_colorIntrinsic << std::endl;
 
-	RGBDSensor::init(m_sensorData->m_depthWidth, m_sensorData->m_depthHeight, std::max(m_sensorData->m_colorWidth, 1u), std::max(m_sensorData->m_colorHeight, 1u), 1);
-	initializeDepthIntrinsics(m_sensorData->m_calibrationDepth.m_intrinsic(0, 0), m_sensorData->m_calibrationDepth.m_intrinsic(1, 1), m_sensorData->m_calibrationDepth.m_intrinsic(0, 2), m_sensorData->m_calibrationDepth.m_intrinsic(1, 2));
-	initializeColorIntrinsics(m_sensorData->m_calibrationColor.m_intrinsic(0, 0), m_sensorData->m_calibrationColor.m_intrinsic(1, 1), m_sensorData->m_calibrationColor.m_intrinsic(0, 2), m_sensorData->m_calibrationColor.m_intrinsic(1, 2));
+	RGBDSensor::init(m_sensorData.m_depthWidth, m_sensorData.m_depthHeight, std::max(m_sensorData.m_colorWidth, 1u), std::max(m_sensorData.m_colorHeight, 1u), 1);
+	initializeDepthIntrinsics(m_sensorData.m_depthIntrinsic(0, 0), m_sensorData.m_depthIntrinsic(1, 1), m_sensorData.m_depthIntrinsic(0, 2), m_sensorData.m_depthIntrinsic(1, 2));
+	initializeColorIntrinsics(m_sensorData.m_colorIntrinsic(0, 0), m_sensorData.m_colorIntrinsic(1, 1), m_sensorData.m_colorIntrinsic(0, 2), m_sensorData.m_colorIntrinsic(1, 2));
 
-	initializeDepthExtrinsics(m_sensorData->m_calibrationDepth.m_extrinsic);
-	initializeColorExtrinsics(m_sensorData->m_calibrationColor.m_extrinsic);
+	initializeDepthExtrinsics(m_sensorData.m_depthExtrinsic);
+	initializeColorExtrinsics(m_sensorData.m_colorExtrinsic);
 
 
-	m_numFrames = (unsigned int)m_sensorData->m_frames.size();
+	m_numFrames = m_sensorData.getNumFrames();
 	if (m_numFrames > GlobalBundlingState::get().s_maxNumImages * GlobalBundlingState::get().s_submapSize) {
 		throw MLIB_EXCEPTION("sens file #frames = " + std::to_string(m_numFrames) + ", please change param file to accommodate");
 		//std::cout << "WARNING: sens file #frames = " << m_numFrames << ", please change param file to accommodate" << std::endl;
@@ -68,52 +64,49 @@ void SensorDataReader::createFirstConnected()
 		//getchar();
 	}
 
-	if (m_numFrames > 0 && m_sensorData->m_frames[0].getColorCompressed()) {
-		m_bHasColorData = true;
-	}
-	else {
-		m_bHasColorData = false;
-	}
+	m_bHasColorData = m_sensorData.hasColorData();
 
-	const unsigned int cacheSize = 10;
-	m_sensorDataCache = new ml::SensorData::RGBDFrameCacheRead(m_sensorData, cacheSize);
+	const SensorDataIndex* sensorData = &m_sensorData;
+	const bool bHasColorData = m_bHasColorData;
+	m_prefetcher.init([sensorData, bHasColorData](unsigned int frameIdx, unsigned short*& depth, vec3uc*& color) {
+		depth = sensorData->decompressDepthAlloc(frameIdx);
+		if (bHasColorData) color = sensorData->decompressColorAlloc(frameIdx);
+		sensorData->releaseFrameData(frameIdx); //keeps the resident set bounded by the prefetch window
+	}, m_numFrames, getDepthWidth(), getDepthHeight(), m_sensorData.m_depthShift, getColorWidth(), getColorHeight(), m_bHasColorData,
+		GlobalAppState::get().s_sensorDataNumDecodeThreads, GlobalAppState::get().s_sensorDataPrefetchSize);
 }
 
 bool SensorDataReader::processDepth()
 {
 	if (m_currFrame >= m_numFrames)
 	{
-		GlobalAppState::get().s_playData = false;
-		//std::cout << "binary dump sequence complete - press space to run again" << std::endl;
-		stopReceivingFrames();
-		std::cout << "binary dump sequence complete - stopped receiving frames" << std::endl;
+		if (isReceivingFrames()) {
+			GlobalAppState::get().s_playData = false;
+			//std::cout << "binary dump sequence complete - press space to run again" << std::endl;
+			stopReceivingFrames();
+			std::cout << "binary dump sequence complete - stopped receiving frames" << std::endl;
+			m_prefetcher.printStats();
+		}
+		//the prefetcher only starts decoding from the beginning again once playback is re-armed
+		if (!GlobalAppState::get().s_playData) return false;
 		m_currFrame = 0;
+		m_prefetcher.restart(m_currFrame);
+		m_bIsReceivingFrames = true;
 	}
 
 	if (GlobalAppState::get().s_playData) {
 
-		float* depth = getDepthFloat();
-
-		//TODO check why the frame cache is not used?
-		ml::SensorData::RGBDFrameCacheRead::FrameState frameState = m_sensorDataCache->getNext();
-		//ml::SensorData::RGBDFrameCacheRead::FrameState frameState;
-		//frameState.m_colorFrame = m_sensorData->decompressColorAlloc(m_currFrame);
-		//frameState.m_depthFrame = m_sensorData->decompressDepthAlloc(m_currFrame);
-
-
-		for (unsigned int i = 0; i < getDepthWidth()*getDepthHeight(); i++) {
-			if (frameState.m_depthFrame[i] == 0) depth[i] = -std::numeric_limits<float>::infinity();
-			else depth[i] = (float)frameState.m_depthFrame[i] / m_sensorData->m_depthShift;
-		}
+		//already decompressed and converted by the prefetcher threads
+		const SensorDataPrefetcher::Frame& frame = m_prefetcher.waitForFrame();
+		MLIB_ASSERT(frame.frameIdx == m_currFrame);
+		memcpy(getDepthFloat(), frame.depth, sizeof(float)*getDepthWidth()*getDepthHeight());
 
 		incrementRingbufIdx();
 
 		if (m_bHasColorData) {
-			for (unsigned int i = 0; i < getColorWidth()*getColorHeight(); i++) {
-				m_colorRGBX[i] = vec4uc(frameState.m_colorFrame[i]);
-			}
+			memcpy(m_colorRGBX, frame.color, sizeof(vec4uc)*getColorWidth()*getColorHeight());
 		}
-		frameState.free();
+		m_prefetcher.releaseFrame();
 
 		m_currFrame++;
 		return true;
@@ -125,14 +118,14 @@ bool SensorDataReader::processDepth()
 
 std::string SensorDataReader::getSensorName() const
 {
-	return m_sensorData->m_sensorName;
+	return m_sensorData.m_sensorName;
 }
 
 ml::mat4f SensorDataReader::getRigidTransform(int offset) const
 {
 	unsigned int idx = m_currFrame - 1 + offset;
-	if (idx >= m_sensorData->m_frames.size()) throw MLIB_EXCEPTION("invalid trajectory index " + std::to_string(idx));
-	const mat4f& transform = m_sensorData->m_frames[idx].getCameraToWorld();
+	if (idx >= m_sensorData.getNumFrames()) throw MLIB_EXCEPTION("invalid trajectory index " + std::to_string(idx));
+	const mat4f transform = m_sensorData.getCameraToWorld(idx);
 	return transform;
 	//return m_data.m_trajectory[idx];
 }
@@ -143,32 +136,20 @@ void SensorDataReader::releaseData()
 	m_bHasColorData = false;
 
 
-	SAFE_DELETE(m_sensorDataCache);
-	if (m_sensorData) {
-		m_sensorData->free();
-		SAFE_DELETE(m_sensorData);
-	}
+	m_prefetcher.free();
+	m_sensorData.close();
 }
 
 void SensorDataReader::saveToFile(const std::string& filename, const std::vector<mat4f>& trajectory) const
 {
-	const unsigned int numFrames = (unsigned int)std::min(trajectory.size(), m_sensorData->m_frames.size());
-	for (unsigned int i = 0; i < numFrames; i++) {
-		m_sensorData->m_frames[i].setCameraToWorld(trajectory[i]);
-	}
-	//fill in rest invalid
-	mat4f invalidTransform; invalidTransform.setZero(-std::numeric_limits<float>::infinity());
-	for (unsigned int i = (unsigned int)trajectory.size(); i < m_sensorData->m_frames.size(); i++) {
-		m_sensorData->m_frames[i].setCameraToWorld(invalidTransform);
-	}
-
-	m_sensorData->saveToFile(filename);
+	//rest is filled in invalid; overwriting the original file only rewrites the poses
+	m_sensorData.saveToFile(filename, trajectory);
 }
 
 void SensorDataReader::evaluateTrajectory(const std::vector<mat4f>& trajectory) const
 {
 	std::vector<mat4f> referenceTrajectory;
-	for (const auto& f : m_sensorData->m_frames) referenceTrajectory.push_back(f.getCameraToWorld());
+	for (unsigned int f = 0; f < m_sensorData.getNumFrames(); f++) referenceTrajectory.push_back(m_sensorData.getCameraToWorld(f));
 	const size_t numTransforms = std::min(trajectory.size(), referenceTrajectory.size());
 	// make sure reference trajectory starts at identity
 	mat4f offset = referenceTrajectory.front().getInverse();
@@ -190,10 +171,10 @@ void SensorDataReader::evaluateTrajectory(const std::vector<mat4f>& trajectory)
 void SensorDataReader::getTrajectory(std::vector<mat4f>& trajectory) const
 {
 	trajectory.clear();
-	if (!m_sensorData) return;
-	trajectory.resize(m_sensorData->m_frames.size());
-	for (unsigned int f = 0; f < m_sensorData->m_frames.size(); f++) {
-		trajectory[f] = m_sensorData->m_frames[f].getCameraToWorld();
+	if (!m_sensorData.isOpen()) return;
+	trajectory.resize(m_sensorData.getNumFrames());
+	for (unsigned int f = 0; f < m_sensorData.getNumFrames(); f++) {
+		trajectory[f] = m_sensorData.getCameraToWorld(f);
 		if (trajectory[f][0] == -std::numeric_limits<float>::infinity())
 			throw MLIB_EXCEPTION("ERROR invalid transform in reference trajectory");
 	}
@@ -7,6 +7,8 @@
 
 #include "GlobalAppState.h"
 #include "RGBDSensor.h"
+#include "SensorDataPrefetcher.h"
+#include "SensorDataIndex.h"
 #include "stdafx.h"
 
 #ifdef SENSOR_DATA_READER
@@ -43,6 +45,7 @@ public:
 	mat4f getRigidTransform(int offset) const;
 
 
+	void startReceivingFrames() { m_bIsReceivingFrames = true; GlobalAppState::get().s_playData = true; }
 	void stopReceivingFrames() { m_bIsReceivingFrames = false; }
 
 	//kind of a hack
@@ -55,8 +58,8 @@ private:
 	//! deletes all allocated data
 	void releaseData();
 
-	ml::SensorData* m_sensorData;
-	ml::SensorData::RGBDFrameCacheRead* m_sensorDataCache;
+	SensorDataIndex m_sensorData;		//memory-mapped; frames are only decoded by the prefetcher
+	SensorDataPrefetcher m_prefetcher;	//decompresses/converts frames ahead on s_sensorDataNumDecodeThreads threads
 
 	unsigned int	m_numFrames;
 	unsigned int	m_currFrame;
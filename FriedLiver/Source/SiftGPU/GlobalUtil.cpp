@@ -53,6 +53,7 @@ int	GlobalUtil::_octave_num_default = -1;
 int	GlobalUtil::_FixedOrientation = 0; //upright
 int	GlobalUtil::_LoweOrigin = 0;       //(0, 0) to be at the top-left corner.
 int	GlobalUtil::_NormalizedSIFT = 1;   //normalize descriptor
+int	GlobalUtil::_BinaryDescriptor = 0; //steered brief tests (SIFT_BINARY_DESCRIPTOR_BITS) instead of the sift histograms
 ///
 int GlobalUtil::_TruncateMethod = 0;
 
@@ -62,6 +63,7 @@ int GlobalUtil::_FeatureCountThreshold = -1;
 bool GlobalUtil::_EnableDetailedTimings = false;
 float GlobalUtil::_SiftDepthMin = 0.1f;
 float GlobalUtil::_SiftDepthMax = 3.0f;
+int GlobalUtil::_PyramidWorkers = 1;	//octaves built concurrently (cuda streams in SiftPyramid, wavefront of row tiles in SiftCPU); 1 = in sequence
 
 
 
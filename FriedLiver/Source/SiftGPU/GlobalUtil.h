@@ -48,10 +48,12 @@ public:
 	static int		_FixedOrientation;
 	static int		_LoweOrigin;
 	static int		_NormalizedSIFT;
+	static int		_BinaryDescriptor;
 	static int		_FeatureCountThreshold;
 	static bool		_EnableDetailedTimings;
 	static float	_SiftDepthMin;
 	static float	_SiftDepthMax;
+	static int		_PyramidWorkers;
 };
 
 
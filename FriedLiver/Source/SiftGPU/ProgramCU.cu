@@ -156,7 +156,7 @@ texture<int4, 1, cudaReadModeElementType> texDataList;
 //}
 
 //////////////////////////////////////////////////////////////
-template<int FW> __global__ void FilterH(float* d_result, int width, unsigned int filterIndex)
+template<int FW> __global__ void FilterH(float* d_result, const float* d_src, int width, unsigned int filterIndex)
 {
 
 	const int HALF_WIDTH = FW >> 1;
@@ -176,7 +176,7 @@ template<int FW> __global__ void FilterH(float* d_result, int width, unsigned in
 		if (cache_index < CACHE_WIDTH)
 		{
 			int fetch_index = src_index < index_min ? index_min : (src_index > index_max ? index_max : src_index);
-			data[cache_index] = tex1Dfetch(texData, fetch_index);
+			data[cache_index] = d_src[fetch_index];
 			src_index += FILTERH_TILE_WIDTH;
 			cache_index += FILTERH_TILE_WIDTH;
 		}
@@ -195,7 +195,7 @@ template<int FW> __global__ void FilterH(float* d_result, int width, unsigned in
 
 
 ////////////////////////////////////////////////////////////////////
-template<int  FW>  __global__ void FilterV(float* d_result, int width, int height, unsigned int filterIndex)
+template<int  FW>  __global__ void FilterV(float* d_result, const float* d_src, int width, int height, unsigned int filterIndex)
 {
 	const int HALF_WIDTH = FW >> 1;
 	const int CACHE_WIDTH = FW + FILTERV_TILE_HEIGHT - 1;
@@ -234,7 +234,7 @@ template<int  FW>  __global__ void FilterV(float* d_result, int width, int heigh
 			if (cache_col_start < CACHE_WIDTH - i * FILTERV_BLOCK_HEIGHT)
 			{
 				int fetch_index = data_index < col ? col : (data_index > data_index_max ? data_index_max : data_index);
-				data[cache_index + i * FILTERV_BLOCK_HEIGHT] = tex1Dfetch(texData, fetch_index);
+				data[cache_index + i * FILTERV_BLOCK_HEIGHT] = d_src[fetch_index];
 				data_index += IMUL(FILTERV_BLOCK_HEIGHT, width);
 			}
 		}
@@ -327,7 +327,7 @@ void ProgramCU::SampleImageU(CuTexImage *dst, CuTexImage *src, int log_scale)
 	}
 }
 
-template<int LOG_SCALE> __global__ void DownsampleKernel(float* d_result, int src_width, int dst_width)
+template<int LOG_SCALE> __global__ void DownsampleKernel(float* d_result, const float* d_src, int src_width, int dst_width)
 {
 	const int dst_col = IMUL(blockIdx.x, FILTERH_TILE_WIDTH) + threadIdx.x;
 	if (dst_col >= dst_width) return;
@@ -336,11 +336,11 @@ template<int LOG_SCALE> __global__ void DownsampleKernel(float* d_result, int sr
 	const int src_row = blockIdx.y << LOG_SCALE;
 	const int src_idx = IMUL(src_row, src_width) + src_col;
 	const int dst_idx = IMUL(dst_width, dst_row) + dst_col;
-	d_result[dst_idx] = tex1Dfetch(texData, src_idx);
+	d_result[dst_idx] = d_src[src_idx];
 
 }
 
-__global__ void DownsampleKernel(float* d_result, int src_width, int dst_width, const int log_scale)
+__global__ void DownsampleKernel(float* d_result, const float* d_src, int src_width, int dst_width, const int log_scale)
 {
 	const int dst_col = IMUL(blockIdx.x, FILTERH_TILE_WIDTH) + threadIdx.x;
 	if (dst_col >= dst_width) return;
@@ -349,23 +349,23 @@ __global__ void DownsampleKernel(float* d_result, int src_width, int dst_width,
 	const int src_row = blockIdx.y << log_scale;
 	const int src_idx = IMUL(src_row, src_width) + src_col;
 	const int dst_idx = IMUL(dst_width, dst_row) + dst_col;
-	d_result[dst_idx] = tex1Dfetch(texData, src_idx);
+	d_result[dst_idx] = d_src[src_idx];
 
 }
 
-void ProgramCU::SampleImageD(CuTexImage *dst, CuTexImage *src, int log_scale)
+void ProgramCU::SampleImageD(CuTexImage *dst, CuTexImage *src, int log_scale, cudaStream_t stream)
 {
 	int src_width = src->GetImgWidth(), dst_width = dst->GetImgWidth();
+	const float* d_src = (const float*)src->_cuData;
 
-	src->BindTexture(texData);
 	dim3 grid((dst_width + FILTERH_TILE_WIDTH - 1) / FILTERH_TILE_WIDTH, dst->GetImgHeight());
 	dim3 block(FILTERH_TILE_WIDTH);
 	switch (log_scale)
 	{
-	case 1: 	DownsampleKernel<1> << < grid, block >> > ((float*)dst->_cuData, src_width, dst_width);	break;
-	case 2:	DownsampleKernel<2> << < grid, block >> > ((float*)dst->_cuData, src_width, dst_width);	break;
-	case 3: 	DownsampleKernel<3> << < grid, block >> > ((float*)dst->_cuData, src_width, dst_width);	break;
-	default:	DownsampleKernel << < grid, block >> > ((float*)dst->_cuData, src_width, dst_width, log_scale);
+	case 1: 	DownsampleKernel<1> << < grid, block, 0, stream >> > ((float*)dst->_cuData, d_src, src_width, dst_width);	break;
+	case 2:	DownsampleKernel<2> << < grid, block, 0, stream >> > ((float*)dst->_cuData, d_src, src_width, dst_width);	break;
+	case 3: 	DownsampleKernel<3> << < grid, block, 0, stream >> > ((float*)dst->_cuData, d_src, src_width, dst_width);	break;
+	default:	DownsampleKernel << < grid, block, 0, stream >> > ((float*)dst->_cuData, d_src, src_width, dst_width, log_scale);
 	}
 }
 
@@ -460,22 +460,21 @@ void ProgramCU::CreateFilterKernel(float sigma, float* kernel, int& width)
 }
 
 
-template<int FW> void ProgramCU::FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int filterIndex)
+//the filters read global memory instead of texData so that the octaves can be built on concurrent streams
+template<int FW> void ProgramCU::FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int filterIndex, cudaStream_t stream)
 {
 	int width = src->GetImgWidth(), height = src->GetImgHeight();
 
 	//horizontal filtering
-	src->BindTexture(texData);
 	dim3 gridh((width + FILTERH_TILE_WIDTH - 1) / FILTERH_TILE_WIDTH, height);
 	dim3 blockh(FILTERH_TILE_WIDTH);
-	FilterH<FW> << <gridh, blockh >> >((float*)buf->_cuData, width, filterIndex);
+	FilterH<FW> << <gridh, blockh, 0, stream >> >((float*)buf->_cuData, (const float*)src->_cuData, width, filterIndex);
 	CheckErrorCUDA("FilterH");
 
 	///vertical filtering
-	buf->BindTexture(texData);
 	dim3 gridv((width + FILTERV_TILE_WIDTH - 1) / FILTERV_TILE_WIDTH, (height + FILTERV_TILE_HEIGHT - 1) / FILTERV_TILE_HEIGHT);
 	dim3 blockv(FILTERV_TILE_WIDTH, FILTERV_BLOCK_HEIGHT);
-	FilterV<FW> << <gridv, blockv >> >((float*)dst->_cuData, width, height, filterIndex);
+	FilterV<FW> << <gridv, blockv, 0, stream >> >((float*)dst->_cuData, (const float*)buf->_cuData, width, height, filterIndex);
 	CheckErrorCUDA("FilterV");
 }
 
@@ -483,28 +482,28 @@ template<int FW> void ProgramCU::FilterImage(CuTexImage *dst, CuTexImage *src, C
 // tested on 2048x1500 image, the time on pyramid construction is
 // OpenGL version : 18ms
 // CUDA version: 28 ms
-void ProgramCU::FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int width, unsigned int filterIndex)
+void ProgramCU::FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int width, unsigned int filterIndex, cudaStream_t stream)
 {
 	//CUDATimer timer;
 	//timer.startEvent("FilterImage");
 
 	switch (width)
 	{
-	case 5:		FilterImage< 5>(dst, src, buf, filterIndex);	break;
-	case 7:		FilterImage< 7>(dst, src, buf, filterIndex);	break;
-	case 9:		FilterImage< 9>(dst, src, buf, filterIndex);	break;
-	case 11:	FilterImage<11>(dst, src, buf, filterIndex);	break;
-	case 13:	FilterImage<13>(dst, src, buf, filterIndex);	break;
-	case 15:	FilterImage<15>(dst, src, buf, filterIndex);	break;
-	case 17:	FilterImage<17>(dst, src, buf, filterIndex);	break;
-	case 19:	FilterImage<19>(dst, src, buf, filterIndex);	break;
-	case 21:	FilterImage<21>(dst, src, buf, filterIndex);	break;
-	case 23:	FilterImage<23>(dst, src, buf, filterIndex);	break;
-	case 25:	FilterImage<25>(dst, src, buf, filterIndex);	break;
-	case 27:	FilterImage<27>(dst, src, buf, filterIndex);	break;
-	case 29:	FilterImage<29>(dst, src, buf, filterIndex);	break;
-	case 31:	FilterImage<31>(dst, src, buf, filterIndex);	break;
-	case 33:	FilterImage<33>(dst, src, buf, filterIndex);	break;
+	case 5:		FilterImage< 5>(dst, src, buf, filterIndex, stream);	break;
+	case 7:		FilterImage< 7>(dst, src, buf, filterIndex, stream);	break;
+	case 9:		FilterImage< 9>(dst, src, buf, filterIndex, stream);	break;
+	case 11:	FilterImage<11>(dst, src, buf, filterIndex, stream);	break;
+	case 13:	FilterImage<13>(dst, src, buf, filterIndex, stream);	break;
+	case 15:	FilterImage<15>(dst, src, buf, filterIndex, stream);	break;
+	case 17:	FilterImage<17>(dst, src, buf, filterIndex, stream);	break;
+	case 19:	FilterImage<19>(dst, src, buf, filterIndex, stream);	break;
+	case 21:	FilterImage<21>(dst, src, buf, filterIndex, stream);	break;
+	case 23:	FilterImage<23>(dst, src, buf, filterIndex, stream);	break;
+	case 25:	FilterImage<25>(dst, src, buf, filterIndex, stream);	break;
+	case 27:	FilterImage<27>(dst, src, buf, filterIndex, stream);	break;
+	case 29:	FilterImage<29>(dst, src, buf, filterIndex, stream);	break;
+	case 31:	FilterImage<31>(dst, src, buf, filterIndex, stream);	break;
+	case 33:	FilterImage<33>(dst, src, buf, filterIndex, stream);	break;
 	default:	break;
 	}
 	//timer.endEvent();
@@ -1417,6 +1416,84 @@ void ProgramCU::ComputeDescriptor(CuTexImage*list, CuTexImage* got, float* d_out
 	CheckErrorCUDA("ComputeDescriptor");
 }
 
+#define BINARY_DESCRIPTOR_PER_BLOCK 4	//one warp per feature
+
+//global instead of constant memory: the lanes of a warp read different tests
+__device__ float4 d_binaryPattern[SIFT_BINARY_DESCRIPTOR_BITS];
+
+//! bilinear lookup at texture coordinates (pixel centers at +0.5), clamped to the level
+inline __device__ float sampleLevelBilinear(const float* d_gus, int width, int height, float x, float y)
+{
+	x = min(max(x - 0.5f, 0.0f), width - 1.0f);
+	y = min(max(y - 0.5f, 0.0f), height - 1.0f);
+	const int x0 = min((int)x, width - 2);
+	const int y0 = min((int)y, height - 2);
+	const float fx = x - x0, fy = y - y0;
+	const float* p = d_gus + y0 * width + x0;
+	return (1.0f - fy) * ((1.0f - fx) * p[0] + fx * p[1]) + fy * ((1.0f - fx) * p[width] + fx * p[width + 1]);
+}
+
+void __global__ ComputeBinaryDescriptor_Kernel(const float4* d_keys, int num, const float* d_gus, int width, int height, unsigned int* d_des)
+{
+	const int ftidx = blockIdx.x * BINARY_DESCRIPTOR_PER_BLOCK + threadIdx.y;
+	if (ftidx >= num) return;
+
+	const float4 key = d_keys[ftidx];
+	const float r = fabs(key.z * SIFT_BINARY_DESCRIPTOR_WINDOW_FACTOR);
+	float s, c; sincosf(key.w, &s, &c);
+	const float cr = c * r, sr = s * r;
+#pragma unroll
+	for (int w = 0; w < SIFT_BINARY_DESCRIPTOR_BITS / 32; w++) {
+		const float4 t = d_binaryPattern[w * 32 + threadIdx.x];
+		const float v1 = sampleLevelBilinear(d_gus, width, height, cr * t.x - sr * t.y + key.x, cr * t.y + sr * t.x + key.y);
+		const float v2 = sampleLevelBilinear(d_gus, width, height, cr * t.z - sr * t.w + key.x, cr * t.w + sr * t.z + key.y);
+		const unsigned int bits = __ballot_sync(0xffffffff, v1 < v2);
+		if (threadIdx.x == 0) d_des[ftidx * 128 + w] = bits;
+	}
+}
+
+void ProgramCU::ComputeBinaryDescriptor(CuTexImage* list, CuTexImage* gus, float* d_outDescriptors)
+{
+	const int num = list->GetImgWidth();
+	if (num == 0) return;
+
+	dim3 grid((num + BINARY_DESCRIPTOR_PER_BLOCK - 1) / BINARY_DESCRIPTOR_PER_BLOCK);
+	dim3 block(32, BINARY_DESCRIPTOR_PER_BLOCK);
+	ComputeBinaryDescriptor_Kernel << <grid, block >> >((const float4*)list->_cuData, num, (const float*)gus->_cuData,
+		gus->GetImgWidth(), gus->GetImgHeight(), (unsigned int*)d_outDescriptors);
+	CheckErrorCUDA("ComputeBinaryDescriptor");
+}
+
+//! lcg in (0, 1)
+static double binaryPatternRandom(unsigned int& seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return ((seed >> 8) + 0.5) / double(1 << 24);
+}
+
+void ProgramCU::CreateBinaryPattern(float4* pattern)
+{
+	//brief G II: isotropic gaussian around the key (sigma = radius / 2.5), clamped to the window; fixed seed
+	unsigned int seed = 0x2545F491u;
+	float v[4];
+	for (int i = 0; i < SIFT_BINARY_DESCRIPTOR_BITS; i++) {
+		for (int k = 0; k < 4; k += 2) {
+			const double r = sqrt(-2.0 * log(binaryPatternRandom(seed)));
+			const double phi = 2.0 * 3.14159265358979323846 * binaryPatternRandom(seed);
+			v[k] = (float)fmin(fmax(0.4 * r * cos(phi), -1.0), 1.0);
+			v[k + 1] = (float)fmin(fmax(0.4 * r * sin(phi), -1.0), 1.0);
+		}
+		pattern[i] = make_float4(v[0], v[1], v[2], v[3]);
+	}
+}
+
+void ProgramCU::InitBinaryPattern()
+{
+	float4 pattern[SIFT_BINARY_DESCRIPTOR_BITS];
+	CreateBinaryPattern(pattern);
+	cutilSafeCall(cudaMemcpyToSymbol(d_binaryPattern, pattern, sizeof(pattern)));
+}
+
 //////////////////////////////////////////////////////
 int ProgramCU::CheckErrorCUDA(const char* location)
 {
@@ -1756,6 +1833,76 @@ void ProgramCU::MultiplyDescriptor(CuTexImage* des1, CuTexImage* des2, CuTexImag
 	ProgramCU::CheckErrorCUDA("MultiplyDescriptor");
 }
 
+void __global__ MultiplyDescriptorBinary_Kernel(int* d_result, int num1, int num2, int4* d_temp, const uint4* d_des1, const uint4* d_des2)
+{
+	const int idx1 = blockIdx.y * MULT_BLOCK_DIMY;
+	const int idx2 = blockIdx.x * MULT_BLOCK_DIMX + threadIdx.x;
+
+	//the bits of MULT_BLOCK_DIMY features of des1 (2 uint4 each, features are 8 uint4 apart)
+	__shared__ uint4 sharedFeatures[2 * MULT_BLOCK_DIMY];
+	if (threadIdx.x < 2 * MULT_BLOCK_DIMY && idx1 + (threadIdx.x >> 1) < num1) {
+		sharedFeatures[threadIdx.x] = d_des1[(idx1 + (threadIdx.x >> 1)) * 8 + (threadIdx.x & 1)];
+	}
+	__syncthreads();
+
+	if (idx2 >= num2) return;
+	const uint4 a = d_des2[idx2 * 8];
+	const uint4 b = d_des2[idx2 * 8 + 1];
+
+	//dot product of the +-1 bit vectors (bits - 2 * hamming), scaled to the 512^2 of the uchar sift descriptors
+	int results[MULT_BLOCK_DIMY];
+#pragma unroll
+	for (int k = 0; k < MULT_BLOCK_DIMY; k++) {
+		const uint4 p = sharedFeatures[2 * k];
+		const uint4 q = sharedFeatures[2 * k + 1];
+		const int hamming = __popc(p.x ^ a.x) + __popc(p.y ^ a.y) + __popc(p.z ^ a.z) + __popc(p.w ^ a.w)
+			+ __popc(q.x ^ b.x) + __popc(q.y ^ b.y) + __popc(q.z ^ b.z) + __popc(q.w ^ b.w);
+		results[k] = max(SIFT_BINARY_DESCRIPTOR_BITS - 2 * hamming, 0) * (262144 / SIFT_BINARY_DESCRIPTOR_BITS);
+	}
+
+	const int dst_idx = IMUL(idx1, num2) + idx2;
+	if (d_temp)
+	{
+		int3 cmp_result = make_int3(0, -1, 0);
+#pragma unroll
+		for (int i = 0; i < MULT_BLOCK_DIMY; ++i)
+		{
+			if (idx1 + i < num1)
+			{
+				cmp_result = results[i] > cmp_result.x ?
+					make_int3(results[i], idx1 + i, cmp_result.x) :
+					make_int3(cmp_result.x, cmp_result.y, max(cmp_result.z, results[i]));
+				d_result[dst_idx + IMUL(i, num2)] = results[i];
+			}
+		}
+		d_temp[IMUL(blockIdx.y, num2) + idx2] = make_int4(cmp_result.x, cmp_result.y, cmp_result.z, 0);
+	}
+	else
+	{
+#pragma unroll
+		for (int i = 0; i < MULT_BLOCK_DIMY; ++i)
+		{
+			if (idx1 + i < num1) d_result[dst_idx + IMUL(i, num2)] = results[i];
+		}
+	}
+}
+
+void ProgramCU::MultiplyDescriptorBinary(CuTexImage* des1, CuTexImage* des2, CuTexImage* texDot, CuTexImage* texCRT)
+{
+	int num1 = des1->GetImgWidth() / 8;
+	int num2 = des2->GetImgWidth() / 8;
+
+	dim3 grid((num2 + MULT_BLOCK_DIMX - 1) / MULT_BLOCK_DIMX, (num1 + MULT_BLOCK_DIMY - 1) / MULT_BLOCK_DIMY);
+	dim3 block(MULT_TBLOCK_DIMX, MULT_TBLOCK_DIMY);
+
+	texDot->InitTexture(num2, num1);
+	if (texCRT) texCRT->InitTexture(num2, (num1 + MULT_BLOCK_DIMY - 1) / MULT_BLOCK_DIMY, 4);
+
+	MultiplyDescriptorBinary_Kernel << <grid, block >> >((int*)texDot->_cuData, num1, num2, (texCRT ? (int4*)texCRT->_cuData : NULL),
+		(const uint4*)des1->_cuData, (const uint4*)des2->_cuData);
+	ProgramCU::CheckErrorCUDA("MultiplyDescriptorBinary");
+}
+
 texture<float, 1, cudaReadModeElementType> texLoc1;
 texture<float2, 1, cudaReadModeElementType> texLoc2;
 struct Matrix33{ float mat[3][3]; };
@@ -1935,6 +2082,68 @@ void ProgramCU::GetColMatch(CuTexImage* texCRT, float distmax, float ratiomax, C
 	ProgramCU::CheckErrorCUDA(__FUNCTION__);
 }
 
+#define COLMATCH_BATCH_BLOCK_WIDTH 32
+#define COLMATCH_BATCH_BLOCK_HEIGHT 8
+
+void __global__  ColMatchBatch_Kernel(const int* d_dot, int num2, const int2* d_imageRows, float distmax, float ratiomax, const int* d_rowResult, const float* d_matchDistances,
+	uint2* d_outKeyPointIndices, float* d_outMatchDistances, int* d_numMatches, uint2 keyPointOffset)
+{
+	const int image = blockIdx.y;
+	const int colIdx = blockIdx.x * COLMATCH_BATCH_BLOCK_WIDTH + threadIdx.x;
+	const int2 rows = d_imageRows[image];
+
+	//each thread row takes every COLMATCH_BATCH_BLOCK_HEIGHT-th feature of the image (coalesced along the columns)
+	int3 localResult = make_int3(0, -1, 0);
+	if (colIdx < num2) {
+		for (int i = rows.x + threadIdx.y; i < rows.x + rows.y; i += COLMATCH_BATCH_BLOCK_HEIGHT) {
+			const int v = d_dot[i * num2 + colIdx];
+			localResult = localResult.x < v ?
+				make_int3(v, i, localResult.x) :
+				make_int3(localResult.x, localResult.y, max(localResult.z, v));
+		}
+	}
+
+	__shared__ int3 result[COLMATCH_BATCH_BLOCK_HEIGHT][COLMATCH_BATCH_BLOCK_WIDTH];
+	result[threadIdx.y][threadIdx.x] = localResult;
+	__syncthreads();
+
+	if (threadIdx.y == 0 && colIdx < num2) {
+		int3 res = result[0][threadIdx.x];
+#pragma unroll
+		for (int k = 1; k < COLMATCH_BATCH_BLOCK_HEIGHT; k++) {
+			const int3 other = result[k][threadIdx.x];
+			res = res.x < other.x ?
+				make_int3(other.x, other.y, max(res.x, other.z)) :
+				make_int3(res.x, res.y, max(res.z, other.x));
+		}
+		const float dist = acosf(min(res.x * 0.000003814697265625f, 1.0f)); // first min
+		const float distn = acosf(min(res.z * 0.000003814697265625f, 1.0f)); // second min
+		const int f1 = (dist < distmax) && (dist < distn * ratiomax) ? res.y : -1;
+		if (f1 >= 0 && d_rowResult[f1] == colIdx) {
+			int addr = atomicAdd(d_numMatches + image, 1); //counter is wrong if >= MAX_MATCHES_PER_IMAGE_PAIR_RAW
+			if (addr < MAX_MATCHES_PER_IMAGE_PAIR_RAW) {
+				addr += image * MAX_MATCHES_PER_IMAGE_PAIR_RAW;
+				d_outKeyPointIndices[addr] = make_uint2(f1 + keyPointOffset.x, colIdx + keyPointOffset.y);
+				d_outMatchDistances[addr] = d_matchDistances[f1];
+			}
+		}
+	}
+}
+
+void ProgramCU::GetColMatchBatch(CuTexImage* texDot, const int2* d_imageRows, int numImages, float distmax, float ratiomax, CuTexImage* rowMatch, float* d_matchDistances,
+	uint2* d_outKeyPointIndices, float* d_outMatchDistances, int* d_numMatches, uint2 keyPointOffset)
+{
+	const int num2 = texDot->GetImgWidth();
+	dim3 grid((num2 + COLMATCH_BATCH_BLOCK_WIDTH - 1) / COLMATCH_BATCH_BLOCK_WIDTH, numImages);
+	dim3 block(COLMATCH_BATCH_BLOCK_WIDTH, COLMATCH_BATCH_BLOCK_HEIGHT);
+
+	cutilSafeCall(cudaMemset(d_numMatches, 0, sizeof(int) * numImages));
+	ColMatchBatch_Kernel << <grid, block >> >((const int*)texDot->_cuData, num2, d_imageRows, distmax, ratiomax, (const int*)rowMatch->_cuData, d_matchDistances,
+		d_outKeyPointIndices, d_outMatchDistances, d_numMatches, keyPointOffset);
+
+	ProgramCU::CheckErrorCUDA(__FUNCTION__);
+}
+
 
 
 
@@ -2106,6 +2315,30 @@ void __global__  ConvertDescriptorToUChar_Kernel(const float* d_descriptorsFloat
 	}
 }
 
+void __global__  ConvertBinaryDescriptorToUChar_Kernel(const float* d_descriptorsFloat, unsigned int numDescriptorElements, unsigned char* d_descriptorsUChar)
+{
+	unsigned int idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+	if (idx < numDescriptorElements) {
+		const unsigned int byteIdx = idx & 127;
+		const unsigned char* bits = (const unsigned char*)(d_descriptorsFloat + (idx - byteIdx));
+		d_descriptorsUChar[idx] = byteIdx < SIFT_BINARY_DESCRIPTOR_BITS / 8 ? bits[byteIdx] : 0;
+	}
+}
+
+void ProgramCU::ConvertBinaryDescriptorToUChar(float* d_descriptorsFloat, unsigned int numDescriptors, unsigned char* d_descriptorsUChar) {
+	if (numDescriptors == 0) return;
+
+	const unsigned int numDescriptorElements = numDescriptors * 128;
+	const unsigned int threadsPerBlock = 64;
+	dim3 grid((numDescriptorElements + threadsPerBlock - 1) / threadsPerBlock);
+	dim3 block(threadsPerBlock, 1, 1);
+
+	ConvertBinaryDescriptorToUChar_Kernel << < grid, block >> > (d_descriptorsFloat, numDescriptorElements, d_descriptorsUChar);
+
+	ProgramCU::CheckErrorCUDA(__FUNCTION__);
+}
+
 void ProgramCU::ConvertDescriptorToUChar(float* d_descriptorsFloat, unsigned int numDescriptorElements, unsigned char* d_descriptorsUChar) {
 	if (numDescriptorElements == 0) return;
 
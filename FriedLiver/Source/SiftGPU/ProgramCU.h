@@ -23,6 +23,11 @@
 #ifndef _PROGRAM_CU_H
 #define _PROGRAM_CU_H
 
+#include <cuda_runtime.h>
+
+//binary descriptor tests; packed into the first SIFT_BINARY_DESCRIPTOR_BITS / 8 bytes of a SIFTKeyPointDesc (the rest is 0)
+#define SIFT_BINARY_DESCRIPTOR_BITS 256
+#define SIFT_BINARY_DESCRIPTOR_WINDOW_FACTOR 6.0f	//test points lie within this many key sigmas of the key
 
 class CuTexImage;
 
@@ -36,8 +41,8 @@ public:
 	static void InitFilterKernels(const std::vector<float>& sigmas, std::vector<unsigned int>& filterWidths);
     ////SIFTGPU FUNCTIONS
 	static void CreateFilterKernel(float sigma, float* kernel, int& width);
-	template<int KWIDTH> static void FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int filterIndex);
-	static void FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int width, unsigned int filterIndex);
+	template<int KWIDTH> static void FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int filterIndex, cudaStream_t stream);
+	static void FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, unsigned int width, unsigned int filterIndex, cudaStream_t stream = 0);
 	//static void FilterImage(CuTexImage *dst, CuTexImage *src, CuTexImage* buf, float sigma);
 	static void ComputeDOG(CuTexImage* gus, CuTexImage* dog, CuTexImage* got);
 	static void ComputeKEY(CuTexImage* dog, CuTexImage* key, float Tdog, float Tedge, CuTexImage* featureList, int* d_featureCount, unsigned int featureOctLevelidx, float keyLocScale, float keyLocOffset, const float* d_depthData, float siftDepthMin, float siftDepthMax);
@@ -47,11 +52,16 @@ public:
 	static unsigned int ReshapeFeatureList(CuTexImage* raw, CuTexImage* out, int* d_featureCount, float keyLocScale);	//returns the number of features
 	static void ComputeOrientation(CuTexImage*list, CuTexImage* got, CuTexImage*key, float sigma, float sigma_step);
 	static void ComputeDescriptor(CuTexImage*list, CuTexImage* got, float* d_outDescriptors, int rect = 0, int stream = 0);
+	//! steered brief on the gaussian level of the keys; the bit words of key k are at d_outDescriptors + 128 * k (as uint)
+	static void ComputeBinaryDescriptor(CuTexImage* list, CuTexImage* gus, float* d_outDescriptors);
+	//! test point pairs (x1, y1, x2, y2) in units of the window radius, same on cpu (SiftCPU) and gpu
+	static void CreateBinaryPattern(float4* pattern);
+	static void InitBinaryPattern();
 	static void CreateGlobalKeyPointList(CuTexImage* curLevelList, float4* d_outKeypointList, float keyLocScale, float keyLocOffset, const float* d_depthData, int maxNumElements);	//returns the number of features
 
     //data conversion
 	static void SampleImageU(CuTexImage *dst, CuTexImage *src, int log_scale);
-	static void SampleImageD(CuTexImage *dst, CuTexImage *src, int log_scale = 1); 
+	static void SampleImageD(CuTexImage *dst, CuTexImage *src, int log_scale = 1, cudaStream_t stream = 0); 
 	static void ReduceToSingleChannel(CuTexImage* dst, CuTexImage* src, int convert_rgb);
     static void ConvertByteToFloat(CuTexImage*src, CuTexImage* dst);
     
@@ -64,13 +74,20 @@ public:
 	
 	//SIFTMATCH FUNCTIONS	
 	static void MultiplyDescriptor(CuTexImage* tex1, CuTexImage* tex2, CuTexImage* texDot, CuTexImage* texCRT);
+	//! hamming distances of binary descriptors, written as the dot products of the +-1 bit vectors (scaled like MultiplyDescriptor)
+	static void MultiplyDescriptorBinary(CuTexImage* tex1, CuTexImage* tex2, CuTexImage* texDot, CuTexImage* texCRT);
 	static void MultiplyDescriptorG(CuTexImage* texDes1, CuTexImage* texDes2,
 		CuTexImage* texLoc1, CuTexImage* texLoc2, CuTexImage* texDot, CuTexImage* texCRT,
 		float H[3][3], float hdistmax, float F[3][3], float fdistmax);
 	static void GetRowMatch(CuTexImage* texDot, CuTexImage* texMatch, float* d_matchDistances, float distmax, float ratiomax);
 	static void GetColMatch(CuTexImage* texCRT, float distmax, float ratiomax, CuTexImage* rowMatch, float* d_matchDistances, uint2* d_outKeyPointIndices, float* d_outMatchDistances, int* d_numMatches, uint2 keyPointOffset, int* numMatches = NULL);
+	//! texDot rows are the features of numImages images (d_imageRows: first row, #rows; 0 rows to skip an image); column best of
+	//! each image, mutual check against rowMatch, outputs of image i at d_numMatches + i and MAX_MATCHES_PER_IMAGE_PAIR_RAW * i
+	static void GetColMatchBatch(CuTexImage* texDot, const int2* d_imageRows, int numImages, float distmax, float ratiomax, CuTexImage* rowMatch, float* d_matchDistances,
+		uint2* d_outKeyPointIndices, float* d_outMatchDistances, int* d_numMatches, uint2 keyPointOffset);
 
 	static void ConvertDescriptorToUChar(float* d_descriptorsFloat, unsigned int numDescriptorElements, unsigned char* d_descriptorsUChar);
+	static void ConvertBinaryDescriptorToUChar(float* d_descriptorsFloat, unsigned int numDescriptors, unsigned char* d_descriptorsUChar);
 };
 
 #endif
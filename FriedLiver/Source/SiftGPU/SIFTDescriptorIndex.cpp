@@ -0,0 +1,265 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "SIFTDescriptorIndex.h"
+#include "SIFTVocabularyTree.h"
+#include "ProgramCU.h"
+#include "../CPUParallel.h"
+#include "../CPUSimd.h"
+
+//! dim is a multiple of vfloat::Width
+static inline float dot(const float* a, const float* b, unsigned int dim)
+{
+	vfloat acc = vzero();
+	for (unsigned int i = 0; i < dim; i += vfloat::Width) acc = acc + vload(a + i) * vload(b + i);
+	float lanes[vfloat::Width];
+	vstore(lanes, acc);
+	float d = 0.0f;
+	for (unsigned int i = 0; i < vfloat::Width; i++) d += lanes[i];
+	return d;
+}
+
+SIFTDescriptorIndex::SIFTDescriptorIndex(unsigned int numTrainImages, bool binaryDescriptors)
+{
+	m_numTrainImages = std::max(numTrainImages, 1u);
+	m_binaryDescriptors = binaryDescriptors;
+	m_dim = binaryDescriptors ? SIFT_BINARY_DESCRIPTOR_BITS : 128;
+	m_subDim = m_dim / SIFT_DESCRIPTOR_INDEX_SUBSPACES;
+	m_numDescriptors = 0;
+}
+
+SIFTDescriptorIndex::~SIFTDescriptorIndex()
+{
+}
+
+void SIFTDescriptorIndex::reset()
+{
+	for (unsigned int l = 0; l < SIFT_DESCRIPTOR_INDEX_LISTS; l++) {
+		m_listImages[l].clear();
+		m_listKeys[l].clear();
+		m_listCodes[l].clear();
+	}
+	m_numDescriptors = 0;
+	m_imageAdded.clear();
+	m_pendingImages.clear();
+	m_pendingDescriptors.clear();
+}
+
+float SIFTDescriptorIndex::toDistance(float dist2) const
+{
+	//sift descriptors have norm 512: dot = 512^2 - dist2 / 2; binary: dist2 is the hamming distance (as MultiplyDescriptorBinary_Kernel)
+	const float cosine = m_binaryDescriptors ? std::max(1.0f - 2.0f * dist2 / SIFT_BINARY_DESCRIPTOR_BITS, 0.0f) : 1.0f - dist2 / 524288.0f;
+	return std::acos(std::min(std::max(cosine, -1.0f), 1.0f));
+}
+
+void SIFTDescriptorIndex::train()
+{
+	//evenly spaced sample of the pending descriptors
+	size_t numDescriptors = 0;
+	for (unsigned int i = 0; i < m_pendingDescriptors.size(); i++) numDescriptors += m_pendingDescriptors[i].size() / 128;
+	const size_t stride = std::max(numDescriptors / SIFT_DESCRIPTOR_INDEX_MAX_TRAIN_DESCRIPTORS, (size_t)1);
+	std::vector<float> samples;
+	size_t idx = 0;
+	for (unsigned int i = 0; i < m_pendingDescriptors.size(); i++) {
+		for (size_t k = 0; k < m_pendingDescriptors[i].size() / 128; k++, idx++) {
+			if (idx % stride != 0) continue;
+			samples.resize(samples.size() + m_dim);
+			SIFTVocabularyTree::toFloat(m_pendingDescriptors[i].data() + k * 128, m_binaryDescriptors, samples.data() + samples.size() - m_dim);
+		}
+	}
+	const unsigned int numSamples = (unsigned int)(samples.size() / m_dim);
+	if (numSamples < SIFT_DESCRIPTOR_INDEX_CENTROIDS) return; //try again with the next image
+
+	//coarse quantizer
+	std::vector<unsigned int> indices(numSamples);
+	for (unsigned int i = 0; i < numSamples; i++) indices[i] = i;
+	std::vector<float> coarseCenters;
+	std::vector<unsigned int> assignment;
+	SIFTVocabularyTree::kmeans(samples, m_dim, indices, SIFT_DESCRIPTOR_INDEX_LISTS, SIFT_DESCRIPTOR_INDEX_KMEANS_ITERATIONS, coarseCenters, assignment);
+
+	//product quantizer of the residuals
+	m_pqCenters.resize(SIFT_DESCRIPTOR_INDEX_SUBSPACES * SIFT_DESCRIPTOR_INDEX_CENTROIDS * m_subDim);
+	std::vector<float> subSamples(numSamples * m_subDim);
+	std::vector<float> centers;
+	std::vector<unsigned int> subAssignment;
+	for (unsigned int m = 0; m < SIFT_DESCRIPTOR_INDEX_SUBSPACES; m++) {
+		for (unsigned int i = 0; i < numSamples; i++) {
+			for (unsigned int d = 0; d < m_subDim; d++) {
+				const unsigned int dim = m * m_subDim + d;
+				subSamples[i * m_subDim + d] = samples[i * m_dim + dim] - coarseCenters[assignment[i] * m_dim + dim];
+			}
+		}
+		SIFTVocabularyTree::kmeans(subSamples, m_subDim, indices, SIFT_DESCRIPTOR_INDEX_CENTROIDS, SIFT_DESCRIPTOR_INDEX_KMEANS_ITERATIONS, centers, subAssignment);
+		std::copy(centers.begin(), centers.end(), m_pqCenters.begin() + m * SIFT_DESCRIPTOR_INDEX_CENTROIDS * m_subDim);
+	}
+
+	//query independent part of the distance tables
+	const unsigned int tableSize = SIFT_DESCRIPTOR_INDEX_SUBSPACES * SIFT_DESCRIPTOR_INDEX_CENTROIDS;
+	m_listTerms.resize(SIFT_DESCRIPTOR_INDEX_LISTS * tableSize);
+	for (unsigned int l = 0; l < SIFT_DESCRIPTOR_INDEX_LISTS; l++) {
+		for (unsigned int m = 0; m < SIFT_DESCRIPTOR_INDEX_SUBSPACES; m++) {
+			for (unsigned int k = 0; k < SIFT_DESCRIPTOR_INDEX_CENTROIDS; k++) {
+				const float* p = m_pqCenters.data() + (m * SIFT_DESCRIPTOR_INDEX_CENTROIDS + k) * m_subDim;
+				const float* c = coarseCenters.data() + l * m_dim + m * m_subDim;
+				m_listTerms[l * tableSize + m * SIFT_DESCRIPTOR_INDEX_CENTROIDS + k] = dot(p, p, m_subDim) + 2.0f * dot(c, p, m_subDim);
+			}
+		}
+	}
+	m_coarseCenters.swap(coarseCenters); //trained
+
+	for (unsigned int i = 0; i < m_pendingImages.size(); i++) {
+		insert(m_pendingImages[i], m_pendingDescriptors[i].data(), (unsigned int)(m_pendingDescriptors[i].size() / 128));
+	}
+	m_pendingImages.clear();
+	m_pendingDescriptors.clear();
+}
+
+void SIFTDescriptorIndex::insert(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys)
+{
+	std::vector<unsigned int> lists(numKeys);
+	std::vector<unsigned char> codes(numKeys * SIFT_DESCRIPTOR_INDEX_SUBSPACES);
+	CPUParallel::parallelFor(0, numKeys, [&](unsigned int b, unsigned int e) {
+		std::vector<float> x(m_dim);
+		for (unsigned int k = b; k < e; k++) {
+			SIFTVocabularyTree::toFloat(descriptors + k * 128, m_binaryDescriptors, x.data());
+			const unsigned int l = SIFTVocabularyTree::nearestCenter(x.data(), m_coarseCenters.data(), SIFT_DESCRIPTOR_INDEX_LISTS, m_dim);
+			for (unsigned int d = 0; d < m_dim; d++) x[d] -= m_coarseCenters[l * m_dim + d];
+			for (unsigned int m = 0; m < SIFT_DESCRIPTOR_INDEX_SUBSPACES; m++) {
+				codes[k * SIFT_DESCRIPTOR_INDEX_SUBSPACES + m] = (unsigned char)SIFTVocabularyTree::nearestCenter(x.data() + m * m_subDim,
+					m_pqCenters.data() + m * SIFT_DESCRIPTOR_INDEX_CENTROIDS * m_subDim, SIFT_DESCRIPTOR_INDEX_CENTROIDS, m_subDim);
+			}
+			lists[k] = l;
+		}
+	}, 64);
+
+	for (unsigned int k = 0; k < numKeys; k++) {
+		m_listImages[lists[k]].push_back(imageIdx);
+		m_listKeys[lists[k]].push_back(k);
+		m_listCodes[lists[k]].insert(m_listCodes[lists[k]].end(), codes.begin() + k * SIFT_DESCRIPTOR_INDEX_SUBSPACES, codes.begin() + (k + 1) * SIFT_DESCRIPTOR_INDEX_SUBSPACES);
+	}
+	m_numDescriptors += numKeys;
+}
+
+void SIFTDescriptorIndex::addImage(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys)
+{
+	if (imageIdx >= m_imageAdded.size()) m_imageAdded.resize(imageIdx + 1, false);
+	if (m_imageAdded[imageIdx]) return;
+	m_imageAdded[imageIdx] = true;
+
+	if (isTrained()) {
+		insert(imageIdx, descriptors, numKeys);
+	}
+	else {
+		m_pendingImages.push_back(imageIdx);
+		m_pendingDescriptors.push_back(std::vector<unsigned char>(descriptors, descriptors + 128 * numKeys));
+		if (m_pendingImages.size() >= m_numTrainImages) train();
+	}
+}
+
+void SIFTDescriptorIndex::search(const float* x, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx, const int* imageMask,
+	std::vector<float>& table, std::vector<Neighbor>& neighbors) const
+{
+	const unsigned int tableSize = SIFT_DESCRIPTOR_INDEX_SUBSPACES * SIFT_DESCRIPTOR_INDEX_CENTROIDS;
+	neighbors.clear();
+
+	//probed lists
+	float coarseDist2[SIFT_DESCRIPTOR_INDEX_LISTS];
+	unsigned int lists[SIFT_DESCRIPTOR_INDEX_LISTS];
+	const float xx = dot(x, x, m_dim);
+	for (unsigned int l = 0; l < SIFT_DESCRIPTOR_INDEX_LISTS; l++) {
+		const float* c = m_coarseCenters.data() + l * m_dim;
+		coarseDist2[l] = xx - 2.0f * dot(x, c, m_dim) + dot(c, c, m_dim);
+		lists[l] = l;
+	}
+	std::partial_sort(lists, lists + SIFT_DESCRIPTOR_INDEX_PROBES, lists + SIFT_DESCRIPTOR_INDEX_LISTS, [&](unsigned int a, unsigned int b) {
+		return coarseDist2[a] < coarseDist2[b];
+	});
+
+	//<x, p> of all pq centroids, shared by the probed lists
+	table.resize(2 * tableSize);
+	float* xp = table.data() + tableSize;
+	for (unsigned int m = 0; m < SIFT_DESCRIPTOR_INDEX_SUBSPACES; m++) {
+		for (unsigned int k = 0; k < SIFT_DESCRIPTOR_INDEX_CENTROIDS; k++) {
+			xp[m * SIFT_DESCRIPTOR_INDEX_CENTROIDS + k] = dot(x + m * m_subDim, m_pqCenters.data() + (m * SIFT_DESCRIPTOR_INDEX_CENTROIDS + k) * m_subDim, m_subDim);
+		}
+	}
+
+	for (unsigned int p = 0; p < SIFT_DESCRIPTOR_INDEX_PROBES; p++) {
+		const unsigned int l = lists[p];
+		if (m_listImages[l].empty()) continue;
+		//|x - c - p|^2 = |x - c|^2 + |p|^2 + 2 <c, p> - 2 <x, p>
+		const float* terms = m_listTerms.data() + l * tableSize;
+		for (unsigned int i = 0; i < tableSize; i++) table[i] = terms[i] - 2.0f * xp[i];
+
+		const unsigned char* codes = m_listCodes[l].data();
+		for (unsigned int e = 0; e < m_listImages[l].size(); e++, codes += SIFT_DESCRIPTOR_INDEX_SUBSPACES) {
+			const unsigned int image = m_listImages[l][e];
+			if (image < imageBegin || image >= imageEnd || image == excludeIdx || !imageMask[image]) continue;
+			float dist2 = coarseDist2[l];
+			for (unsigned int m = 0; m < SIFT_DESCRIPTOR_INDEX_SUBSPACES; m++) dist2 += table[m * SIFT_DESCRIPTOR_INDEX_CENTROIDS + codes[m]];
+			if (neighbors.size() == SIFT_DESCRIPTOR_INDEX_NEIGHBORS && dist2 >= neighbors.back().dist2) continue;
+
+			//insertion into the sorted neighbors
+			Neighbor n; n.dist2 = dist2; n.image = image; n.key = m_listKeys[l][e];
+			if (neighbors.size() < SIFT_DESCRIPTOR_INDEX_NEIGHBORS) neighbors.push_back(n);
+			unsigned int i = (unsigned int)neighbors.size() - 1;
+			for (; i > 0 && neighbors[i - 1].dist2 > dist2; i--) neighbors[i] = neighbors[i - 1];
+			neighbors[i] = n;
+		}
+	}
+}
+
+void SIFTDescriptorIndex::match(const unsigned char* descriptors, unsigned int numKeys, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx,
+	const int* imageMask, float distmax, float ratiomax, std::vector<Match>& matches) const
+{
+	matches.clear();
+	if (!isTrained() || numKeys == 0 || imageBegin >= imageEnd) return;
+
+	//per query key: the best neighbor of each image which passes the ratio test against the second best of that image
+	std::vector< std::vector<Match> > keyMatches(numKeys);
+	CPUParallel::parallelFor(0, numKeys, [&](unsigned int b, unsigned int e) {
+		std::vector<float> x(m_dim), table;
+		std::vector<Neighbor> neighbors;
+		for (unsigned int k = b; k < e; k++) {
+			SIFTVocabularyTree::toFloat(descriptors + k * 128, m_binaryDescriptors, x.data());
+			search(x.data(), imageBegin, imageEnd, excludeIdx, imageMask, table, neighbors);
+
+			//the second best of an image is at least the last neighbor if the list is full; otherwise all probed entries are in
+			//the list, and an image without a second one there has no known second best (the ratio test cannot pass)
+			const float bound = neighbors.size() == SIFT_DESCRIPTOR_INDEX_NEIGHBORS ? neighbors.back().dist2 : std::numeric_limits<float>::infinity();
+			for (unsigned int i = 0; i < neighbors.size(); i++) {
+				bool first = true;
+				for (unsigned int j = 0; j < i && first; j++) first = neighbors[j].image != neighbors[i].image;
+				if (!first) continue;
+				float second = bound;
+				for (unsigned int j = i + 1; j < neighbors.size(); j++) {
+					if (neighbors[j].image == neighbors[i].image) { second = neighbors[j].dist2; break; }
+				}
+				if (second == std::numeric_limits<float>::infinity()) continue;
+				const float dist = toDistance(neighbors[i].dist2);
+				const float distn = toDistance(second);
+				if (dist < distmax && dist < distn * ratiomax) {
+					Match m; m.image = neighbors[i].image; m.imageKey = neighbors[i].key; m.queryKey = k; m.distance = dist;
+					keyMatches[k].push_back(m);
+				}
+			}
+		}
+	}, 16);
+
+	for (unsigned int k = 0; k < numKeys; k++) matches.insert(matches.end(), keyMatches[k].begin(), keyMatches[k].end());
+	//one match per image key (as the mutual best match of SiftMatchGPU)
+	std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+		if (a.image != b.image) return a.image < b.image;
+		if (a.imageKey != b.imageKey) return a.imageKey < b.imageKey;
+		return a.distance < b.distance || (a.distance == b.distance && a.queryKey < b.queryKey);
+	});
+	matches.erase(std::unique(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+		return a.image == b.image && a.imageKey == b.imageKey;
+	}), matches.end());
+	std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+		return a.image < b.image || (a.image == b.image && (a.distance < b.distance || (a.distance == b.distance && a.queryKey < b.queryKey)));
+	});
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#ifndef SIFT_DESCRIPTOR_INDEX_H
+#define SIFT_DESCRIPTOR_INDEX_H
+
+#include <vector>
+
+#define SIFT_DESCRIPTOR_INDEX_LISTS 64					//ivf coarse cells
+#define SIFT_DESCRIPTOR_INDEX_PROBES 8					//cells scanned per query descriptor
+#define SIFT_DESCRIPTOR_INDEX_SUBSPACES 16				//pq code bytes per descriptor (instead of 128)
+#define SIFT_DESCRIPTOR_INDEX_CENTROIDS 256				//per subspace
+#define SIFT_DESCRIPTOR_INDEX_NEIGHBORS 16				//approximate nearest neighbors per query descriptor
+#define SIFT_DESCRIPTOR_INDEX_KMEANS_ITERATIONS 8
+#define SIFT_DESCRIPTOR_INDEX_MAX_TRAIN_DESCRIPTORS 20000
+
+////////////////////////////////////////////////////////////////
+//class SIFTDescriptorIndex
+//description: approximate nearest neighbor index (ivf-pq) over the descriptors of the global keyframes; the
+//             coarse and product quantizers are trained on the first images, afterwards only the list ids and
+//             pq codes of the residuals are kept; matching runs the ratio test per image on the asymmetric
+//             distances of the nearest neighbors
+////////////////////////////////////////////////////////////////
+class SIFTDescriptorIndex
+{
+public:
+	struct Match {
+		unsigned int image;
+		unsigned int imageKey;
+		unsigned int queryKey;
+		float distance;		//as SiftMatchGPU (acos of the normalized dot product)
+	};
+
+	//! the quantizers are trained once numTrainImages images have been added; binaryDescriptors: as SiftMatchGPU
+	SIFTDescriptorIndex(unsigned int numTrainImages, bool binaryDescriptors);
+	~SIFTDescriptorIndex();
+
+	//! removes all images (trained quantizers are kept)
+	void reset();
+
+	bool isTrained() const {
+		return !m_coarseCenters.empty();
+	}
+
+	//! numKeys descriptors of 128 bytes (SIFTKeyPointDesc) of the image imageIdx (SIFTImageManager index)
+	void addImage(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys);
+
+	//! matches of the query descriptors to the added images in [imageBegin, imageEnd) except excludeIdx with imageMask[image] != 0;
+	//! at most one match per image key, sorted by image and distance
+	void match(const unsigned char* descriptors, unsigned int numKeys, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx,
+		const int* imageMask, float distmax, float ratiomax, std::vector<Match>& matches) const;
+
+	//! number of indexed descriptors
+	size_t getNumDescriptors() const {
+		return m_numDescriptors;
+	}
+
+private:
+	struct Neighbor {
+		float dist2;
+		unsigned int image;
+		unsigned int key;
+	};
+
+	void train();
+	void insert(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys);
+	//! the SIFT_DESCRIPTOR_INDEX_NEIGHBORS nearest indexed descriptors (squared distances), best first
+	void search(const float* x, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx, const int* imageMask,
+		std::vector<float>& table, std::vector<Neighbor>& neighbors) const;
+	float toDistance(float dist2) const;
+
+	unsigned int m_numTrainImages;
+	bool m_binaryDescriptors;
+	unsigned int m_dim;
+	unsigned int m_subDim;
+
+	std::vector<float> m_coarseCenters;		//m_dim per list
+	std::vector<float> m_pqCenters;			//per subspace SIFT_DESCRIPTOR_INDEX_CENTROIDS x m_subDim
+	std::vector<float> m_listTerms;			//per list, subspace and centroid: |p|^2 + 2 <c, p> (the query independent part of the adc table)
+
+	//inverted lists
+	std::vector<unsigned int> m_listImages[SIFT_DESCRIPTOR_INDEX_LISTS];
+	std::vector<unsigned int> m_listKeys[SIFT_DESCRIPTOR_INDEX_LISTS];
+	std::vector<unsigned char> m_listCodes[SIFT_DESCRIPTOR_INDEX_LISTS];	//SIFT_DESCRIPTOR_INDEX_SUBSPACES per entry
+	size_t m_numDescriptors;
+	std::vector<bool> m_imageAdded;
+
+	//images added before training
+	std::vector<unsigned int> m_pendingImages;
+	std::vector< std::vector<unsigned char> > m_pendingDescriptors;
+};
+
+#endif
@@ -293,6 +293,10 @@ void SIFTImageManager::alloc()
 	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_currFilteredMatchKeyPointIndices, sizeof(uint2)*maxImageMatches*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED));
 	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_currFilteredTransforms, sizeof(float4x4)*maxImageMatches));
 	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_currFilteredTransformsInv, sizeof(float4x4)*maxImageMatches));
+	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_currMatchFilterCounts, sizeof(int)*MATCH_FILTER_NUM_COUNTS));
+	MLIB_CUDA_SAFE_CALL(cudaMemset(d_currMatchFilterCounts, 0, sizeof(int)*MATCH_FILTER_NUM_COUNTS));
+	const unsigned int maxVerifyPairs = std::max(maxImageMatches, (m_maxNumImages * (m_maxNumImages - 1)) / 2); // filter: per prev image, trajectory: all pairs
+	MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_denseVerifyUndecided, sizeof(int)*maxVerifyPairs));
 
 	m_validImages.resize(m_maxNumImages, 0);
 	m_validImages[0] = 1; // first is valid
@@ -335,6 +339,8 @@ void SIFTImageManager::free()
 	MLIB_CUDA_SAFE_FREE(d_currFilteredMatchKeyPointIndices);
 	MLIB_CUDA_SAFE_FREE(d_currFilteredTransforms);
 	MLIB_CUDA_SAFE_FREE(d_currFilteredTransformsInv);
+	MLIB_CUDA_SAFE_FREE(d_currMatchFilterCounts);
+	MLIB_CUDA_SAFE_FREE(d_denseVerifyUndecided);
 
 	m_validImages.clear();
 	MLIB_CUDA_SAFE_FREE(d_validImages);
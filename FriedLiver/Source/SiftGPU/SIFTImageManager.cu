@@ -197,7 +197,8 @@ void __global__ FilterKeyPointMatchesCU_Kernel(
 	float4x4* d_filteredTransformsInv,
 	float4x4 siftIntrinsicsInv,
 	unsigned int minNumMatches,
-	float maxKabschRes2)
+	float maxKabschRes2,
+	int* d_matchFilterCounts)
 {
 	const unsigned int imagePairIdx = blockIdx.x + startFrame;
 	if (imagePairIdx == curFrame) return;
@@ -239,6 +240,7 @@ void __global__ FilterKeyPointMatchesCU_Kernel(
 		unsigned int curr = filterKeyPointMatches(d_keyPointsGlobal, matchKeyPointIndices, matchDistances, numMatches,
 			trans, siftIntrinsicsInv, minNumMatches, maxKabschRes2);//, (imagePairIdx == 63 && curFrame == 76));
 		numFilteredMatches = curr;
+		if (curr == 0) atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_KEY_POINT], 1);
 		d_filteredTransforms[imagePairIdx] = trans;
 		d_filteredTransformsInv[imagePairIdx] = trans.getInverse();
 	}
@@ -285,7 +287,8 @@ void SIFTImageManager::FilterKeyPointMatchesCU(unsigned int curFrame, unsigned i
 		d_currFilteredTransformsInv,
 		siftIntrinsicsInv,
 		minNumMatches,
-		maxKabschRes2);
+		maxKabschRes2,
+		d_currMatchFilterCounts);
 
 	if (m_timer) m_timer->endEvent();
 
@@ -322,7 +325,8 @@ void __global__ FilterMatchesBySurfaceAreaCU_Kernel(
 	int* d_numFilteredMatchesPerImagePair,
 	const uint2* d_filteredMatchKeyPointIndicesGlobal,
 	const float4x4 colorIntrinsicsInv,
-	float areaThresh)
+	float areaThresh,
+	int* d_matchFilterCounts)
 {
 	const unsigned int imagePairIdx = blockIdx.x + startFrame;
 	if (imagePairIdx == curFrame) return;
@@ -384,6 +388,7 @@ void __global__ FilterMatchesBySurfaceAreaCU_Kernel(
 		if (area0 < areaThresh && area1 < areaThresh) {
 			//printf("INVALID AREA [%d %d] (%f %f)\n", imagePairIdx, gridDim.x, area0, area1);
 			d_numFilteredMatchesPerImagePair[imagePairIdx] = 0;
+			atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_SURFACE_AREA], 1);
 		}
 	}
 }
@@ -404,7 +409,8 @@ void SIFTImageManager::FilterMatchesBySurfaceAreaCU(unsigned int curFrame, unsig
 		d_currNumFilteredMatchesPerImagePair,
 		d_currFilteredMatchKeyPointIndices,
 		colorIntrinsicsInv,
-		areaThresh);
+		areaThresh,
+		d_currMatchFilterCounts);
 
 	if (m_timer) m_timer->endEvent();
 
@@ -486,11 +492,129 @@ __device__ float3 computeProjError(unsigned int idx, unsigned int imageWidth, un
 	return out;
 }
 
+//! max squared residual of the filtered matches under the kabsch transform (prev to cur); the result is in the first thread (numMatches <= warpSize)
+__device__ float computeMaxKabschResidual2(unsigned int linearThreadIdx, const SIFTKeyPoint* d_keyPoints, const uint2* d_keyPointIndices,
+	unsigned int numMatches, const float4x4& transform, const float4x4& siftIntrinsicsInv)
+{
+	float res2 = 0.0f;
+	if (linearThreadIdx < numMatches) {
+		const SIFTKeyPoint& key0 = d_keyPoints[d_keyPointIndices[linearThreadIdx].x];
+		const SIFTKeyPoint& key1 = d_keyPoints[d_keyPointIndices[linearThreadIdx].y];
+		const float3 src = siftIntrinsicsInv * (key0.depth * make_float3(key0.pos.x, key0.pos.y, 1.0f));
+		const float3 tgt = siftIntrinsicsInv * (key1.depth * make_float3(key1.pos.x, key1.pos.y, 1.0f));
+		const float3 d = transform * src - tgt;
+		res2 = dot(d, d);
+	}
+	return warpReduceMax(res2);
+}
+
+//! 1: accept, -1: reject, 0: needs the dense verify
+__device__ int decideMatchFilterCascade(const MatchFilterCascade& cascade, unsigned int numMatches, float maxRes2)
+{
+	if (numMatches >= cascade.minNumMatches) return maxRes2 <= cascade.acceptRes2 ? 1 : 0;
+	return maxRes2 > cascade.rejectRes2 ? -1 : 0; //only poorly supported pairs are rejected without the dense verify
+}
+
+//! cascade decision of an image pair before its dense verify (all threads of the block); decided pairs are counted, rejected ones invalidated
+__device__ int applyMatchFilterCascade(unsigned int linearThreadIdx, unsigned int imagePairIdx, unsigned int numMatches,
+	int* d_currNumFilteredMatchesPerImagePair, const float4x4* d_currFilteredTransforms,
+	const SIFTKeyPoint* d_keyPoints, const uint2* d_currFilteredMatchKeyPointIndices, const float4x4& siftIntrinsicsInv, const MatchFilterCascade& cascade,
+	int* d_matchFilterCounts)
+{
+	__shared__ int decision;
+	const float maxRes2 = computeMaxKabschResidual2(linearThreadIdx, d_keyPoints, d_currFilteredMatchKeyPointIndices + imagePairIdx * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED,
+		numMatches, d_currFilteredTransforms[imagePairIdx], siftIntrinsicsInv);
+	if (linearThreadIdx == 0) {
+		decision = decideMatchFilterCascade(cascade, numMatches, maxRes2);
+		if (decision > 0) atomicAdd(&d_matchFilterCounts[MATCH_FILTER_ACCEPTED_CASCADE], 1);
+		else if (decision < 0) {
+			d_currNumFilteredMatchesPerImagePair[imagePairIdx] = 0;
+			atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_CASCADE], 1);
+		}
+	}
+	__syncthreads();
+	return decision;
+}
+
+
+#define FILTER_DENSE_VERIFY_PYRAMID_THREADS 128
+
+//! err (x) and corr (y) of the dense verify of an image pair at a cache pyramid level (1D block striding over the pixels); the result is in all threads
+__device__ float2 computeDenseVerifyLevel(unsigned int level, unsigned int imageWidth, unsigned int imageHeight, const float4x4& intrinsics,
+	const float4x4& transform, const CUDACachedFrame& input, const CUDACachedFrame& model,
+	float distThresh, float normalThresh, float colorThresh, float sensorDepthMin, float sensorDepthMax)
+{
+	const float*  d_inputDepth = input.d_depthPyramid[level];
+	const float4* d_inputCamPos = input.d_cameraposPyramid[level];
+	const float*  d_modelDepth = model.d_depthPyramid[level];
+	const float4* d_modelCamPos = model.d_cameraposPyramid[level];
+#ifdef CUDACACHE_FLOAT_NORMALS
+	const float4* d_inputNormal = input.d_normalsPyramid[level];
+	const float4* d_modelNormal = model.d_normalsPyramid[level];
+#else
+	const uchar4* d_inputNormal = input.d_normalsPyramidUCHAR4[level];
+	const uchar4* d_modelNormal = model.d_normalsPyramidUCHAR4[level];
+#endif
+	const float4x4 transformInv = transform.getInverse();
+
+	float local_sumResidual = 0.0f;
+	float local_sumWeight = 0.0f;
+	float local_numCorr = 0.0f;
+
+	const unsigned int numPixels = imageWidth * imageHeight;
+	for (unsigned int idx = threadIdx.x; idx < numPixels; idx += blockDim.x) {
+		float3 inputToModel = computeProjError(idx, imageWidth, imageHeight, distThresh, normalThresh, colorThresh, transform, intrinsics,
+			d_inputDepth, d_inputCamPos, d_inputNormal, NULL,
+			d_modelDepth, d_modelCamPos, d_modelNormal, NULL, sensorDepthMin, sensorDepthMax);
+		float3 modelToInput = computeProjError(idx, imageWidth, imageHeight, distThresh, normalThresh, colorThresh, transformInv, intrinsics,
+			d_modelDepth, d_modelCamPos, d_modelNormal, NULL,
+			d_inputDepth, d_inputCamPos, d_inputNormal, NULL, sensorDepthMin, sensorDepthMax);
+
+		local_sumResidual += inputToModel.x + modelToInput.x;	//residual
+		local_sumWeight += inputToModel.y + modelToInput.y;		//corr weight
+		local_numCorr += inputToModel.z + modelToInput.z;		//corr number
+	}
+
+	__shared__ float sumResidual;
+	__shared__ float sumWeight;
+	__shared__ float numCorr;
+
+	if (threadIdx.x == 0) {
+		sumResidual = 0.0f;
+		sumWeight = 0.0f;
+		numCorr = 0;
+	}
+	__syncthreads();
+
+	local_sumResidual = warpReduceSum(local_sumResidual);
+	local_sumWeight = warpReduceSum(local_sumWeight);
+	local_numCorr = warpReduceSum(local_numCorr);
+
+	if (threadIdx.x % warpSize == 0) {
+		atomicAdd(&sumResidual, local_sumResidual);
+		atomicAdd(&sumWeight, local_sumWeight);
+		atomicAdd(&numCorr, local_numCorr);
+	}
+	__syncthreads();
+
+	return make_float2(sumResidual / sumWeight, 0.5f * numCorr / (float)numPixels);
+}
+
+//! 1: valid, -1: invalid, 0: err/corr within margin (relative) of the thresholds, needs the next finer level; margin 0 always decides
+__device__ int decideDenseVerify(float err, float corr, float errThresh, float corrThresh, float margin)
+{
+	if (corr < corrThresh * (1.0f - margin) || err > errThresh * (1.0f + margin) || isnan(err)) return -1;
+	if (corr >= corrThresh * (1.0f + margin) && err <= errThresh * (1.0f - margin)) return 1;
+	return 0;
+}
+
 
 //we launch 1 thread for two array entries
 void __global__ FilterMatchesByDenseVerifyCU_Kernel(unsigned int curImageIdx, unsigned int startFrame, unsigned int imageWidth, unsigned int imageHeight, const float4x4 intrinsics,
 	int* d_currNumFilteredMatchesPerImagePair, const float4x4* d_currFilteredTransforms, const float4x4* d_currFilteredTransformsInv, const CUDACachedFrame* d_cachedFrames,
-	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax)
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+	const SIFTKeyPoint* d_keyPoints, const uint2* d_currFilteredMatchKeyPointIndices, const float4x4 siftIntrinsicsInv, const MatchFilterCascade cascade,
+	int* d_matchFilterCounts)
 {
 	const unsigned int imagePairIdx = blockIdx.x + startFrame; // prev image idx
 	if (imagePairIdx == curImageIdx) return;
@@ -500,6 +624,11 @@ void __global__ FilterMatchesByDenseVerifyCU_Kernel(unsigned int curImageIdx, un
 		return;
 	}
 
+	// cheap kabsch statistics first
+	if (cascade.minNumMatches > 0 && applyMatchFilterCascade(threadIdx.y * blockDim.x + threadIdx.x, imagePairIdx, numMatches,
+		d_currNumFilteredMatchesPerImagePair, d_currFilteredTransforms, d_keyPoints, d_currFilteredMatchKeyPointIndices, siftIntrinsicsInv, cascade,
+		d_matchFilterCounts) != 0) return;
+
 	const float*  d_inputDepth = d_cachedFrames[imagePairIdx].d_depthDownsampled;
 	const float4* d_inputCamPos = d_cachedFrames[imagePairIdx].d_cameraposDownsampled;
 	const float* d_inputColor = d_cachedFrames[imagePairIdx].d_intensityDownsampled;
@@ -579,27 +708,334 @@ void __global__ FilterMatchesByDenseVerifyCU_Kernel(unsigned int curImageIdx, un
 		if (corr < corrThresh || err > errThresh || isnan(err)) { // invalid!
 			//if (debugPrint) printf("[%d-%d]: %f %f INVALID\n", imagePairIdx, curImageIdx, err, corr);
 			d_currNumFilteredMatchesPerImagePair[imagePairIdx] = 0;
+			atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_DENSE_VERIFY], 1);
 		}
 		//else if (debugPrint) printf("[%d-%d]: %f %f\n", imagePairIdx, curImageIdx, err, corr);
 	}
 }
 
-void SIFTImageManager::FilterMatchesByDenseVerifyCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int imageWidth, unsigned int imageHeight,
-	const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
-	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax)
+//one block per image pair at one pyramid level, from the coarsest level on only the pairs left undecided by the coarser levels
+void __global__ FilterMatchesByDenseVerifyLevelCU_Kernel(unsigned int curImageIdx, unsigned int startFrame,
+	unsigned int level, unsigned int imageWidth, unsigned int imageHeight, const float4x4 intrinsics, bool coarsest, float margin, int* d_undecided,
+	int* d_currNumFilteredMatchesPerImagePair, const float4x4* d_currFilteredTransforms, const CUDACachedFrame* d_cachedFrames,
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+	const SIFTKeyPoint* d_keyPoints, const uint2* d_currFilteredMatchKeyPointIndices, const float4x4 siftIntrinsicsInv, const MatchFilterCascade cascade,
+	int* d_matchFilterCounts)
+{
+	const unsigned int imagePairIdx = blockIdx.x + startFrame; // prev image idx
+	if (coarsest) {
+		if (threadIdx.x == 0) d_undecided[imagePairIdx] = 0;
+	}
+	else if (d_undecided[imagePairIdx] == 0) return;
+	if (imagePairIdx == curImageIdx) return;
+	const unsigned int numMatches = d_currNumFilteredMatchesPerImagePair[imagePairIdx];
+	if (numMatches == 0) return;
+
+	if (coarsest && cascade.minNumMatches > 0 && applyMatchFilterCascade(threadIdx.x, imagePairIdx, numMatches,
+		d_currNumFilteredMatchesPerImagePair, d_currFilteredTransforms, d_keyPoints, d_currFilteredMatchKeyPointIndices, siftIntrinsicsInv, cascade,
+		d_matchFilterCounts) != 0) return;
+
+	const float2 errCorr = computeDenseVerifyLevel(level, imageWidth, imageHeight, intrinsics, d_currFilteredTransforms[imagePairIdx],
+		d_cachedFrames[imagePairIdx], d_cachedFrames[curImageIdx], distThresh, normalThresh, colorThresh, sensorDepthMin, sensorDepthMax);
+
+	if (threadIdx.x == 0) {
+		const int decision = decideDenseVerify(errCorr.x, errCorr.y, errThresh, corrThresh, margin);
+		if (decision < 0) { // invalid!
+			d_currNumFilteredMatchesPerImagePair[imagePairIdx] = 0;
+			atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_DENSE_VERIFY], 1);
+		}
+		d_undecided[imagePairIdx] = (decision == 0);
+	}
+}
+
+void SIFTImageManager::FilterMatchesByDenseVerifyCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+	const DenseVerifyPyramid& pyramid, const CUDACachedFrame* d_cachedFrames,
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+	const float4x4& siftIntrinsicsInv, const MatchFilterCascade& cascade)
+{
+	if (numFrames == 0) return;
+
+	dim3 grid(numFrames - startFrame);
+
+	if (m_timer) m_timer->startEvent(__FUNCTION__);
+
+	if (pyramid.numLevels <= 1) {
+		const unsigned int imageWidth = pyramid.width[0];
+		const unsigned int imageHeight = pyramid.height[0];
+		dim3 block(imageWidth, (imageHeight + FILTER_DENSE_VERIFY_THREAD_SPLIT - 1) / FILTER_DENSE_VERIFY_THREAD_SPLIT);
+
+		FilterMatchesByDenseVerifyCU_Kernel << <grid, block >> >(
+			curFrame, startFrame, imageWidth, imageHeight, pyramid.intrinsics[0],
+			d_currNumFilteredMatchesPerImagePair, d_currFilteredTransforms, d_currFilteredTransformsInv, d_cachedFrames,
+			distThresh, normalThresh, colorThresh, errThresh, corrThresh,
+			sensorDepthMin, sensorDepthMax,
+			d_keyPoints, d_currFilteredMatchKeyPointIndices, siftIntrinsicsInv, cascade,
+			d_currMatchFilterCounts);
+	}
+	else {
+		dim3 block(FILTER_DENSE_VERIFY_PYRAMID_THREADS);
+		for (int level = (int)pyramid.numLevels - 1; level >= 0; level--) {
+			FilterMatchesByDenseVerifyLevelCU_Kernel << <grid, block >> >(
+				curFrame, startFrame, level, pyramid.width[level], pyramid.height[level], pyramid.intrinsics[level],
+				level == (int)pyramid.numLevels - 1, level > 0 ? pyramid.margin : 0.0f, d_denseVerifyUndecided,
+				d_currNumFilteredMatchesPerImagePair, d_currFilteredTransforms, d_cachedFrames,
+				distThresh, normalThresh, colorThresh, errThresh, corrThresh,
+				sensorDepthMin, sensorDepthMax,
+				d_keyPoints, d_currFilteredMatchKeyPointIndices, siftIntrinsicsInv, cascade,
+				d_currMatchFilterCounts);
+		}
+	}
+
+	if (m_timer) m_timer->endEvent();
+
+	CheckErrorCUDA(__FUNCTION__);
+}
+
+
+#define FUSED_FILTER_NUM_BLOCK_THREADS_X MAX_MATCHES_PER_IMAGE_PAIR_RAW
+
+//one block per image pair: sort, kabsch filter, surface area and dense verify on the match list in shared memory
+void __global__ FilterMatchesFusedCU_Kernel(
+	unsigned int curFrame,
+	unsigned int startFrame,
+	const SIFTKeyPoint* d_keyPointsGlobal,
+	const int* d_numMatchesPerImagePair,
+	const float* d_matchDistancesGlobal,
+	const uint2* d_matchKeyPointIndicesGlobal,
+	int* d_numFilteredMatchesPerImagePair,
+	float* d_filteredMatchDistancesGlobal,
+	uint2* d_filteredMatchKeyPointIndicesGlobal,
+	float4x4* d_filteredTransforms,
+	float4x4* d_filteredTransformsInv,
+	float4x4 siftIntrinsicsInv,
+	unsigned int minNumMatches,
+	float maxKabschRes2,
+	float areaThresh,
+	unsigned int imageWidth,
+	unsigned int imageHeight,
+	const float4x4 intrinsics,
+	const CUDACachedFrame* d_cachedFrames,
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+	const MatchFilterCascade cascade,
+	int* d_matchFilterCounts)
+{
+	const unsigned int imagePairIdx = blockIdx.x + startFrame;
+	if (imagePairIdx == curFrame) return;
+
+	const unsigned int tidx = threadIdx.x;
+
+	const float* d_matchDistances = &d_matchDistancesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_RAW];
+	const uint2* d_matchKeyPointIndices = &d_matchKeyPointIndicesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_RAW];
+	const unsigned int numMatches = min(MAX_MATCHES_PER_IMAGE_PAIR_RAW, d_numMatchesPerImagePair[imagePairIdx]);
+
+	if (numMatches == 0) {
+		if (tidx == 0) {
+			d_numFilteredMatchesPerImagePair[imagePairIdx] = 0;
+		}
+		return;
+	}
+
+	__shared__ float matchDistances[MAX_MATCHES_PER_IMAGE_PAIR_RAW];
+	__shared__ uint2 matchKeyPointIndices[MAX_MATCHES_PER_IMAGE_PAIR_RAW];
+
+	if (tidx < numMatches) {
+		matchDistances[tidx] = d_matchDistances[tidx];
+		matchKeyPointIndices[tidx] = d_matchKeyPointIndices[tidx];
+	}
+	else {
+		matchDistances[tidx] = 999.0f;
+		matchKeyPointIndices[tidx] = make_uint2((unsigned int)-1, (unsigned int)-1);
+	}
+	__syncthreads();
+
+	// --- sort (odd-even transposition until neither phase swaps)
+	bool swappedPrev = true;
+	for (unsigned int run = 0;; run++) {
+		bool res = false;
+		if (tidx < MAX_MATCHES_PER_IMAGE_PAIR_RAW / 2) {
+			const unsigned int idx0 = 2 * tidx + (run & 0x1);
+			const unsigned int idx1 = idx0 + 1;
+			if (idx1 < numMatches) {
+				res = cmpAndSawp(&matchDistances[idx0], &matchKeyPointIndices[idx0], &matchDistances[idx1], &matchKeyPointIndices[idx1]);
+			}
+		}
+		const bool swapped = __syncthreads_or(res) != 0;
+		if (!swapped && !swappedPrev) break;
+		swappedPrev = swapped;
+	}
+
+	// --- kabsch filter
+	__shared__ unsigned int numFilteredMatches;
+	__shared__ float4x4 transform;
+	if (tidx == 0) {
+		numFilteredMatches = filterKeyPointMatches(d_keyPointsGlobal, matchKeyPointIndices, matchDistances, numMatches,
+			transform, siftIntrinsicsInv, minNumMatches, maxKabschRes2);
+		if (numFilteredMatches == 0) atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_KEY_POINT], 1);
+	}
+	__syncthreads();
+
+	// --- surface area filter (numFilteredMatches is uniform over the block)
+	if (numFilteredMatches > 0) {
+		__shared__ float2 pointsProj[FUSED_FILTER_NUM_BLOCK_THREADS_X];
+		float area0 = 0.0f;
+		float area1 = 0.0f;
+		float3 evs, ev0, ev1, ev2;
+		bool res;
+
+		computeKeyPointMatchesCovariance(d_keyPointsGlobal, matchKeyPointIndices, numFilteredMatches, siftIntrinsicsInv, 0);
+		res = MYEIGEN::eigenSystem(V, evs, ev0, ev1, ev2);
+		if (res) {
+			projectKeysToPlane(pointsProj, d_keyPointsGlobal, matchKeyPointIndices, numFilteredMatches, siftIntrinsicsInv, 0, ev0, ev1, ev2, mean);
+			area0 = computeAreaOrientedBoundingBox2(pointsProj, numFilteredMatches);
+		}
+		computeKeyPointMatchesCovariance(d_keyPointsGlobal, matchKeyPointIndices, numFilteredMatches, siftIntrinsicsInv, 1);
+		res = MYEIGEN::eigenSystem(V, evs, ev0, ev1, ev2);
+		if (res) {
+			projectKeysToPlane(pointsProj, d_keyPointsGlobal, matchKeyPointIndices, numFilteredMatches, siftIntrinsicsInv, 1, ev0, ev1, ev2, mean);
+			area1 = computeAreaOrientedBoundingBox2(pointsProj, numFilteredMatches);
+		}
+		__syncthreads();
+		if (tidx == 0 && area0 < areaThresh && area1 < areaThresh) {
+			numFilteredMatches = 0;
+			atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_SURFACE_AREA], 1);
+		}
+		__syncthreads();
+	}
+
+	// --- kabsch statistics
+	__shared__ int decision;
+	if (tidx == 0) decision = 0;
+	if (cascade.minNumMatches > 0 && numFilteredMatches > 0) {
+		const float maxRes2 = computeMaxKabschResidual2(tidx, d_keyPointsGlobal, matchKeyPointIndices, numFilteredMatches, transform, siftIntrinsicsInv);
+		if (tidx == 0) {
+			decision = decideMatchFilterCascade(cascade, numFilteredMatches, maxRes2);
+			if (decision > 0) atomicAdd(&d_matchFilterCounts[MATCH_FILTER_ACCEPTED_CASCADE], 1);
+			else if (decision < 0) {
+				numFilteredMatches = 0;
+				atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_CASCADE], 1);
+			}
+		}
+	}
+	__syncthreads();
+
+	// --- dense verify
+	if (numFilteredMatches > 0 && decision == 0) {
+		const float*  d_inputDepth = d_cachedFrames[imagePairIdx].d_depthDownsampled;
+		const float4* d_inputCamPos = d_cachedFrames[imagePairIdx].d_cameraposDownsampled;
+		const float* d_inputColor = d_cachedFrames[imagePairIdx].d_intensityDownsampled;
+
+		const float*  d_modelDepth = d_cachedFrames[curFrame].d_depthDownsampled;
+		const float4* d_modelCamPos = d_cachedFrames[curFrame].d_cameraposDownsampled;
+		const float* d_modelColor = d_cachedFrames[curFrame].d_intensityDownsampled;
+#ifdef CUDACACHE_FLOAT_NORMALS
+		const float4* d_inputNormal = d_cachedFrames[imagePairIdx].d_normalsDownsampled;
+		const float4* d_modelNormal = d_cachedFrames[curFrame].d_normalsDownsampled;
+#elif defined(CUDACACHE_UCHAR_NORMALS)
+		const uchar4* d_inputNormal = d_cachedFrames[imagePairIdx].d_normalsDownsampledUCHAR4;
+		const uchar4* d_modelNormal = d_cachedFrames[curFrame].d_normalsDownsampledUCHAR4;
+#endif
+		const float4x4 transformInv = transform.getInverse();
+
+		float local_sumResidual = 0.0f;
+		float local_sumWeight = 0.0f;
+		float local_numCorr = 0.0f;
+
+		const unsigned int numPixels = imageWidth * imageHeight;
+		for (unsigned int idx = tidx; idx < numPixels; idx += FUSED_FILTER_NUM_BLOCK_THREADS_X) {
+			float3 inputToModel = computeProjError(idx, imageWidth, imageHeight, distThresh, normalThresh, colorThresh, transform, intrinsics,
+				d_inputDepth, d_inputCamPos, d_inputNormal, d_inputColor,
+				d_modelDepth, d_modelCamPos, d_modelNormal, d_modelColor, sensorDepthMin, sensorDepthMax);
+			float3 modelToInput = computeProjError(idx, imageWidth, imageHeight, distThresh, normalThresh, colorThresh, transformInv, intrinsics,
+				d_modelDepth, d_modelCamPos, d_modelNormal, d_modelColor,
+				d_inputDepth, d_inputCamPos, d_inputNormal, d_inputColor, sensorDepthMin, sensorDepthMax);
+
+			local_sumResidual += inputToModel.x + modelToInput.x;	//residual
+			local_sumWeight += inputToModel.y + modelToInput.y;		//corr weight
+			local_numCorr += inputToModel.z + modelToInput.z;		//corr number
+		}
+
+		__shared__ float sumResidual;
+		__shared__ float sumWeight;
+		__shared__ float numCorr;
+		if (tidx == 0) {
+			sumResidual = 0.0f;
+			sumWeight = 0.0f;
+			numCorr = 0.0f;
+		}
+		__syncthreads();
+
+		local_sumResidual = warpReduceSum(local_sumResidual);
+		local_sumWeight = warpReduceSum(local_sumWeight);
+		local_numCorr = warpReduceSum(local_numCorr);
+		if (tidx % warpSize == 0) {
+			atomicAdd(&sumResidual, local_sumResidual);
+			atomicAdd(&sumWeight, local_sumWeight);
+			atomicAdd(&numCorr, local_numCorr);
+		}
+		__syncthreads();
+
+		if (tidx == 0) {
+			float err = sumResidual / sumWeight;
+			float corr = 0.5f * numCorr / (float)numPixels;
+			if (corr < corrThresh || err > errThresh || isnan(err)) {
+				numFilteredMatches = 0;
+				atomicAdd(&d_matchFilterCounts[MATCH_FILTER_REJECTED_DENSE_VERIFY], 1);
+			}
+		}
+		__syncthreads();
+	}
+
+	//write results back
+	if (tidx == 0) {
+		d_numFilteredMatchesPerImagePair[imagePairIdx] = numFilteredMatches;
+		d_filteredTransforms[imagePairIdx] = transform;
+		d_filteredTransformsInv[imagePairIdx] = transform.getInverse();
+	}
+
+	if (tidx < numFilteredMatches) {
+		d_filteredMatchDistancesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + tidx] = matchDistances[tidx];
+		d_filteredMatchKeyPointIndicesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + tidx] = matchKeyPointIndices[tidx];
+	}
+	else if (tidx < MAX_MATCHES_PER_IMAGE_PAIR_FILTERED) {
+		d_filteredMatchDistancesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + tidx] = 999.0f;
+		d_filteredMatchKeyPointIndicesGlobal[imagePairIdx*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED + tidx] = make_uint2((unsigned int)-1, (unsigned int)-1);
+	}
+}
+
+void SIFTImageManager::FilterMatchesFusedCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+	const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2, float areaThresh,
+	unsigned int imageWidth, unsigned int imageHeight, const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+	const MatchFilterCascade& cascade)
 {
 	if (numFrames == 0) return;
 
 	dim3 grid(numFrames - startFrame);
-	dim3 block(imageWidth, (imageHeight + FILTER_DENSE_VERIFY_THREAD_SPLIT - 1) / FILTER_DENSE_VERIFY_THREAD_SPLIT);
+	dim3 block(FUSED_FILTER_NUM_BLOCK_THREADS_X);
 
 	if (m_timer) m_timer->startEvent(__FUNCTION__);
 
-	FilterMatchesByDenseVerifyCU_Kernel << <grid, block >> >(
-		curFrame, startFrame, imageWidth, imageHeight, intrinsics,
-		d_currNumFilteredMatchesPerImagePair, d_currFilteredTransforms, d_currFilteredTransformsInv, d_cachedFrames,
+	FilterMatchesFusedCU_Kernel << <grid, block >> >(
+		curFrame,
+		startFrame,
+		d_keyPoints,
+		d_currNumMatchesPerImagePair,
+		d_currMatchDistances,
+		d_currMatchKeyPointIndices,
+		d_currNumFilteredMatchesPerImagePair,
+		d_currFilteredMatchDistances,
+		d_currFilteredMatchKeyPointIndices,
+		d_currFilteredTransforms,
+		d_currFilteredTransformsInv,
+		siftIntrinsicsInv,
+		minNumMatches,
+		maxKabschRes2,
+		areaThresh,
+		imageWidth, imageHeight, intrinsics, d_cachedFrames,
 		distThresh, normalThresh, colorThresh, errThresh, corrThresh,
-		sensorDepthMin, sensorDepthMax);
+		sensorDepthMin, sensorDepthMax,
+		cascade,
+		d_currMatchFilterCounts);
 
 	if (m_timer) m_timer->endEvent();
 
@@ -1126,9 +1562,37 @@ void __global__ VerifyTrajectoryCU_Kernel(unsigned int numImages, int* d_validIm
 	}
 }
 
+//one block per image pair at one pyramid level, as FilterMatchesByDenseVerifyLevelCU_Kernel
+void __global__ VerifyTrajectoryLevelCU_Kernel(unsigned int numImages, const int* d_validImages, const float4x4* d_trajectory,
+	unsigned int level, unsigned int imageWidth, unsigned int imageHeight, const float4x4 intrinsics, bool coarsest, float margin, int* d_undecided,
+	const CUDACachedFrame* d_cachedFrames,
+	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh,
+	int* d_validOpt, float sensorDepthMin, float sensorDepthMax)
+{
+	if (coarsest) {
+		if (threadIdx.x == 0) d_undecided[blockIdx.x] = 0;
+	}
+	else if (d_undecided[blockIdx.x] == 0) return;
+
+	const unsigned int img0 = blockIdx.x / numImages;
+	const unsigned int img1 = blockIdx.x % numImages;
+
+	if (img0 >= img1) return;
+	if (d_validImages[img0] == 0 || d_validImages[img1] == 0) return; // invalid image
+
+	const float4x4 transform = d_trajectory[img1].getInverse() * d_trajectory[img0];
+	const float2 errCorr = computeDenseVerifyLevel(level, imageWidth, imageHeight, intrinsics, transform,
+		d_cachedFrames[img0], d_cachedFrames[img1], distThresh, normalThresh, colorThresh, sensorDepthMin, sensorDepthMax);
+
+	if (threadIdx.x == 0) {
+		const int decision = decideDenseVerify(errCorr.x, errCorr.y, errThresh, corrThresh, margin);
+		if (decision < 0) d_validOpt[0] = 0; // invalid!
+		d_undecided[blockIdx.x] = (decision == 0);
+	}
+}
+
 int SIFTImageManager::VerifyTrajectoryCU(unsigned int numImages, float4x4* d_trajectory,
-	unsigned int imageWidth, unsigned int imageHeight,
-	const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
+	const DenseVerifyPyramid& pyramid, const CUDACachedFrame* d_cachedFrames,
 	float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh,
 	float sensorDepthMin, float sensorDepthMax)
 {
@@ -1136,7 +1600,6 @@ int SIFTImageManager::VerifyTrajectoryCU(unsigned int numImages, float4x4* d_tra
 	const unsigned int numPairs = (numImages * (numImages - 1)) / 2;
 
 	dim3 grid(numPairs);
-	dim3 block(imageWidth, (imageHeight + FILTER_DENSE_VERIFY_THREAD_SPLIT - 1) / FILTER_DENSE_VERIFY_THREAD_SPLIT);
 
 	if (m_timer) m_timer->startEvent(__FUNCTION__);
 
@@ -1144,12 +1607,30 @@ int SIFTImageManager::VerifyTrajectoryCU(unsigned int numImages, float4x4* d_tra
 	cutilSafeCall(cudaMemcpy(d_validOpt, &valid, sizeof(int), cudaMemcpyHostToDevice));
 	cutilSafeCall(cudaMemcpy(d_validImages, m_validImages.data(), sizeof(int)*numImages, cudaMemcpyHostToDevice));
 
-	VerifyTrajectoryCU_Kernel << <grid, block >> >(
-		numImages, d_validImages, d_trajectory, imageWidth, imageHeight, intrinsics,
-		d_cachedFrames, distThresh, normalThresh, colorThresh, errThresh, corrThresh,
-		d_validOpt, sensorDepthMin, sensorDepthMax);
+	if (pyramid.numLevels <= 1) {
+		const unsigned int imageWidth = pyramid.width[0];
+		const unsigned int imageHeight = pyramid.height[0];
+		dim3 block(imageWidth, (imageHeight + FILTER_DENSE_VERIFY_THREAD_SPLIT - 1) / FILTER_DENSE_VERIFY_THREAD_SPLIT);
 
-	cutilSafeCall(cudaMemcpy(&valid, d_validOpt, sizeof(int), cudaMemcpyDeviceToHost));
+		VerifyTrajectoryCU_Kernel << <grid, block >> >(
+			numImages, d_validImages, d_trajectory, imageWidth, imageHeight, pyramid.intrinsics[0],
+			d_cachedFrames, distThresh, normalThresh, colorThresh, errThresh, corrThresh,
+			d_validOpt, sensorDepthMin, sensorDepthMax);
+
+		cutilSafeCall(cudaMemcpy(&valid, d_validOpt, sizeof(int), cudaMemcpyDeviceToHost));
+	}
+	else {
+		dim3 block(FILTER_DENSE_VERIFY_PYRAMID_THREADS);
+		for (int level = (int)pyramid.numLevels - 1; level >= 0 && valid; level--) { // a single invalid pair decides
+			VerifyTrajectoryLevelCU_Kernel << <grid, block >> >(
+				numImages, d_validImages, d_trajectory, level, pyramid.width[level], pyramid.height[level], pyramid.intrinsics[level],
+				level == (int)pyramid.numLevels - 1, level > 0 ? pyramid.margin : 0.0f, d_denseVerifyUndecided,
+				d_cachedFrames, distThresh, normalThresh, colorThresh, errThresh, corrThresh,
+				d_validOpt, sensorDepthMin, sensorDepthMax);
+
+			cutilSafeCall(cudaMemcpy(&valid, d_validOpt, sizeof(int), cudaMemcpyDeviceToHost));
+		}
+	}
 
 	if (m_timer) m_timer->endEvent();
 
@@ -41,6 +41,33 @@ struct ImagePairMatch {
 	uint2*		d_keyPointIndices;	//array of index pair (one per match)	
 };
 
+//per frame counters of the match filter cascade (image pairs)
+enum MatchFilterCount {
+	MATCH_FILTER_REJECTED_KEY_POINT,
+	MATCH_FILTER_REJECTED_SURFACE_AREA,
+	MATCH_FILTER_REJECTED_CASCADE,		//by the kabsch statistics, without dense verify
+	MATCH_FILTER_ACCEPTED_CASCADE,		//by the kabsch statistics, without dense verify
+	MATCH_FILTER_REJECTED_DENSE_VERIFY,
+	MATCH_FILTER_NUM_COUNTS
+};
+
+//early decision before the dense verify of an image pair from its kabsch statistics (max squared residual of the filtered matches)
+struct MatchFilterCascade {
+	unsigned int minNumMatches;	//pairs with at least this many filtered matches are well supported; 0: no cascade
+	float acceptRes2;			//well supported pairs below are accepted
+	float rejectRes2;			//poorly supported pairs above are rejected; well supported ones always get the dense verify
+};
+
+//cache pyramid for the dense verify (level 0: the cache resolution); image pairs are verified from the coarsest level on and only
+//refined while err/corr are within margin (relative) of the thresholds, level 0 decides as the single resolution verify
+struct DenseVerifyPyramid {
+	unsigned int numLevels;		//1: single resolution
+	unsigned int width[CUDACACHE_PYRAMID_LEVELS];
+	unsigned int height[CUDACACHE_PYRAMID_LEVELS];
+	float4x4 intrinsics[CUDACACHE_PYRAMID_LEVELS];
+	float margin;
+};
+
 //correspondence_idx -> image_Idx_i,j
 struct EntryJ {
 	unsigned int imgIdx_i;
@@ -64,6 +91,7 @@ struct EntryJ {
 class SIFTImageManager {
 public:
 	friend class SIFTMatchFilter;
+	friend class SIFTMatchFilterCPU;
 	friend class TestMatching;
 
 	SIFTImageManager(unsigned int maxImages = 500,
@@ -130,13 +158,39 @@ public:
 
 	void FilterMatchesBySurfaceAreaCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, const float4x4& colorIntrinsicsInv, float areaThresh);
 
-	void FilterMatchesByDenseVerifyCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames, unsigned int imageWidth, unsigned int imageHeight,
-		const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
-		float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax);
+	//! pairs decided by the cascade (from the kabsch transform and siftIntrinsicsInv) skip the dense verify
+	void FilterMatchesByDenseVerifyCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+		const DenseVerifyPyramid& pyramid, const CUDACachedFrame* d_cachedFrames,
+		float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+		const float4x4& siftIntrinsicsInv, const MatchFilterCascade& cascade);
+
+	//! SortKeyPointMatchesCU, FilterKeyPointMatchesCU, FilterMatchesBySurfaceAreaCU and FilterMatchesByDenseVerifyCU in one kernel (one block per image pair);
+	//! only the filtered matches and transforms are written, the raw matches are left unsorted
+	void FilterMatchesFusedCU(unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+		const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2, float areaThresh,
+		unsigned int imageWidth, unsigned int imageHeight, const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
+		float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh, float sensorDepthMin, float sensorDepthMax,
+		const MatchFilterCascade& cascade);
+
+	//! MatchFilterCount counters, accumulated by the filter stages until reset
+	void resetMatchFilterCountsCU() {
+		MLIB_CUDA_SAFE_CALL(cudaMemset(d_currMatchFilterCounts, 0, sizeof(int)*MATCH_FILTER_NUM_COUNTS));
+	}
+	void getMatchFilterCounts(std::vector<int>& counts) const {
+		counts.resize(MATCH_FILTER_NUM_COUNTS);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(counts.data(), d_currMatchFilterCounts, sizeof(int)*MATCH_FILTER_NUM_COUNTS, cudaMemcpyDeviceToHost));
+	}
+	//! for the host filters
+	void addMatchFilterCount(MatchFilterCount c, int num) {
+		if (num == 0) return;
+		int count;
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(&count, d_currMatchFilterCounts + c, sizeof(int), cudaMemcpyDeviceToHost));
+		count += num;
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_currMatchFilterCounts + c, &count, sizeof(int), cudaMemcpyHostToDevice));
+	}
 
 	int VerifyTrajectoryCU(unsigned int numImages, float4x4* d_trajectory,
-		unsigned int imageWidth, unsigned int imageHeight,
-		const float4x4& intrinsics, const CUDACachedFrame* d_cachedFrames,
+		const DenseVerifyPyramid& pyramid, const CUDACachedFrame* d_cachedFrames,
 		float distThresh, float normalThresh, float colorThresh, float errThresh, float corrThresh,
 		float sensorDepthMin, float sensorDepthMax);
 
@@ -330,6 +384,8 @@ private:
 	uint2*			d_currFilteredMatchKeyPointIndices;		// array of indices to d_keyPoints
 	float4x4*		d_currFilteredTransforms;				// array of transforms estimated in the first filter stage, prev to cur
 	float4x4*		d_currFilteredTransformsInv;			// array of transforms estimated in the first filter stage, cur to prev
+	int*			d_currMatchFilterCounts;				// MatchFilterCount counters
+	int*			d_denseVerifyUndecided;					// per image pair: not decided at the coarser pyramid levels (dense verify)
 
 	std::vector<int> m_validImages;
 	int*			 d_validImages; // for check invalid frames kernel only (from residual invalidation) //TODO some way to not have both?
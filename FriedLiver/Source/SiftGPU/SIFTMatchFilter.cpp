@@ -5,8 +5,12 @@
 //#include "cuda_kabsch.h"
 #include "../GlobalBundlingState.h"
 
+#include <random>
+
 std::vector<std::vector<unsigned int>> SIFTMatchFilter::s_combinations;
 bool SIFTMatchFilter::s_bInit;
+std::vector<unsigned int> SIFTMatchFilter::s_numRansacHypotheses;
+std::vector<uint2> SIFTMatchFilter::s_numRansacMatches;
 
 // debug variables
 DepthImage32 SIFTMatchFilter::s_debugCorr;
@@ -359,12 +363,13 @@ void SIFTMatchFilter::computeCorrespondences(unsigned int width, unsigned int he
 
 }
 
-void SIFTMatchFilter::ransacKeyPointMatches(SIFTImageManager* siftManager, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool debugPrint)
+void SIFTMatchFilter::ransacKeyPointMatches(SIFTImageManager* siftManager, unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+	const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool debugPrint)
 {
-	const unsigned int numImages = siftManager->getNumImages();
-	if (numImages <= 1) return;
+	if (numFrames <= startFrame) return;
 
-	if (!s_bInit) {
+	const float confidence = GlobalBundlingState::get().s_ransacConfidence;
+	if (confidence <= 0.0f && !s_bInit) {
 		std::cout << "warning: initializing combinations" << std::endl;
 		Timer t;
 		init();
@@ -372,23 +377,38 @@ void SIFTMatchFilter::ransacKeyPointMatches(SIFTImageManager* siftManager, const
 	}
 
 	// current data
-	const unsigned int curFrame = numImages - 1;
 	std::vector<SIFTKeyPoint> keyPoints;
 	siftManager->getSIFTKeyPointsDEBUG(keyPoints);
-	std::vector<float4x4> transforms(curFrame);
-	std::vector<float4x4> transformsInv(curFrame);
-
-	for (unsigned int i = 0; i < curFrame; i++) { // previous frames
+	std::vector<float4x4> transforms(numFrames);
+	std::vector<float4x4> transformsInv(numFrames);
+	s_numRansacHypotheses.assign(numFrames - startFrame, 0);
+	s_numRansacMatches.assign(numFrames - startFrame, make_uint2(0, 0));
+	int numRejected = 0;
+
+	for (unsigned int i = startFrame; i < numFrames; i++) { // previous frames
+		if (i == curFrame) {
+			transforms[i].setValue(0.0f);
+			transformsInv[i].setValue(0.0f);
+			continue;
+		}
 
 		std::vector<uint2> keyPointIndices;
 		std::vector<float> matchDistances;
 		siftManager->getRawKeyPointIndicesAndMatchDistancesDEBUG(i, keyPointIndices, matchDistances);
+		s_numRansacMatches[i - startFrame].x = (unsigned int)keyPointIndices.size();
 
 		if (debugPrint) std::cout << "(" << i << ", " << curFrame << ")" << std::endl;
 		float4x4 transform;
-		unsigned int newNumMatches =
-			filterImagePairKeyPointMatchesRANSAC(keyPoints, keyPointIndices, matchDistances, transform, siftIntrinsicsInv, minNumMatches,
-			maxResThresh2, (unsigned int)s_combinations[0].size(), s_combinations, debugPrint);
+		unsigned int newNumMatches;
+		if (confidence > 0.0f) {
+			newNumMatches = filterImagePairKeyPointMatchesRANSAC(keyPoints, keyPointIndices, matchDistances, transform, siftIntrinsicsInv, minNumMatches,
+				maxResThresh2, RANSAC_SAMPLE_SIZE, NULL, confidence, GlobalBundlingState::get().s_ransacMaxHypotheses, s_numRansacHypotheses[i - startFrame], debugPrint);
+		}
+		else {
+			newNumMatches = filterImagePairKeyPointMatchesRANSAC(keyPoints, keyPointIndices, matchDistances, transform, siftIntrinsicsInv, minNumMatches,
+				maxResThresh2, (unsigned int)s_combinations[0].size(), &s_combinations, 0.0f, 0, s_numRansacHypotheses[i - startFrame], debugPrint);
+		}
+		s_numRansacMatches[i - startFrame].y = newNumMatches;
 
 		if (newNumMatches > 0) {
 			transforms[i] = transform;
@@ -397,6 +417,7 @@ void SIFTMatchFilter::ransacKeyPointMatches(SIFTImageManager* siftManager, const
 		else {
 			transforms[i].setValue(0.0f);
 			transformsInv[i].setValue(0.0f);
+			if (!keyPointIndices.empty()) numRejected++;
 		}
 
 		// copy back
@@ -406,17 +427,57 @@ void SIFTMatchFilter::ransacKeyPointMatches(SIFTImageManager* siftManager, const
 			cutilSafeCall(cudaMemcpy(siftManager->d_currFilteredMatchDistances + i * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED, matchDistances.data(), sizeof(float) * newNumMatches, cudaMemcpyHostToDevice));
 		}
 	}
-	cutilSafeCall(cudaMemcpy(siftManager->d_currFilteredTransforms, transforms.data(), sizeof(float4x4) * curFrame, cudaMemcpyHostToDevice));
-	cutilSafeCall(cudaMemcpy(siftManager->d_currFilteredTransformsInv, transformsInv.data(), sizeof(float4x4) * curFrame, cudaMemcpyHostToDevice));
+	cutilSafeCall(cudaMemcpy(siftManager->d_currFilteredTransforms + startFrame, transforms.data() + startFrame, sizeof(float4x4) * (numFrames - startFrame), cudaMemcpyHostToDevice));
+	cutilSafeCall(cudaMemcpy(siftManager->d_currFilteredTransformsInv + startFrame, transformsInv.data() + startFrame, sizeof(float4x4) * (numFrames - startFrame), cudaMemcpyHostToDevice));
+	siftManager->addMatchFilterCount(MATCH_FILTER_REJECTED_KEY_POINT, numRejected);
 }
 
+//! PROSAC sampling (Chum and Matas 2005): the t-th sample is drawn from the n best matches, n grows with t as the
+//! expected number of samples of the n best matches among maxNumSamples uniform samples of all matches
+class ProsacSampler {
+public:
+	ProsacSampler(unsigned int numMatches, unsigned int k, unsigned int maxNumSamples) : m_numMatches(numMatches), m_k(k), m_n(k), m_tnPrime(1), m_rng(0) {
+		m_tn = (double)maxNumSamples;
+		for (unsigned int i = 0; i < k; i++) m_tn *= (double)(k - i) / (double)(numMatches - i);
+	}
+
+	//! t-th sample (t >= 1), k indices into the matches
+	void sample(unsigned int t, std::vector<unsigned int>& indices) {
+		while (t > m_tnPrime && m_n < m_numMatches) {
+			const double tn1 = m_tn * (double)(m_n + 1) / (double)(m_n + 1 - m_k);
+			m_tnPrime += (unsigned int)std::ceil(tn1 - m_tn);
+			m_tn = tn1;
+			m_n++;
+		}
+		indices.clear();
+		unsigned int range = m_n;
+		if (t <= m_tnPrime) {	// the n-th best match and k - 1 of the better ones
+			indices.push_back(m_n - 1);
+			range = m_n - 1;
+		}
+		while (indices.size() < m_k) {
+			const unsigned int idx = std::uniform_int_distribution<unsigned int>(0, range - 1)(m_rng);
+			if (std::find(indices.begin(), indices.end(), idx) == indices.end()) indices.push_back(idx);
+		}
+	}
+
+private:
+	unsigned int m_numMatches;
+	unsigned int m_k;
+	unsigned int m_n;
+	double m_tn;
+	unsigned int m_tnPrime;
+	std::mt19937 m_rng;
+};
+
 #define REFINE_RANSAC
 unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::vector<SIFTKeyPoint>& keys, std::vector<uint2>& keyPointIndices, std::vector<float>& matchDistances,
 	float4x4& transform, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2,
-	unsigned int k, const std::vector<std::vector<unsigned int>>& combinations, bool debugPrint)
+	unsigned int k, const std::vector<std::vector<unsigned int>>* combinations, float confidence, unsigned int maxNumHypotheses, unsigned int& numHypotheses, bool debugPrint)
 {
+	numHypotheses = 0;
 	unsigned int numRawMatches = (unsigned int)keyPointIndices.size();
-	if (numRawMatches < minNumMatches) return 0;
+	if (numRawMatches < minNumMatches || numRawMatches < k) return 0;
 
 	//const unsigned int ransacMax = 100;
 	//std::vector<float> errors(ransacMax);
@@ -433,9 +494,15 @@ unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::ve
 	// RANSAC TEST
 	unsigned int maxNumInliers = 0;
 	float bestMaxResidual = std::numeric_limits<float>::infinity();
+	float bestInlierRatio = 0.0f;
 	std::vector<unsigned int> bestCombinationIndices;
-	for (unsigned int c = 0; c < combinations.size(); c++) {
-		std::vector<unsigned int> indices = combinations[c];
+	const bool adaptive = combinations == NULL;
+	const unsigned int numCombinations = adaptive ? maxNumHypotheses : (unsigned int)combinations->size();
+	ProsacSampler prosac(numRawMatches, k, maxNumHypotheses);
+	for (unsigned int c = 0; c < numCombinations; c++) {
+		std::vector<unsigned int> indices;
+		if (adaptive) prosac.sample(c + 1, indices);
+		else indices = (*combinations)[c];
 
 		bool _DEBUGCOMB = debugPrint && indices[0] == 0 && indices[1] == 2 && indices[2] == 4 && indices[3] == 5;
 		if (_DEBUGCOMB) std::cout << "combination at " << c << std::endl;
@@ -469,6 +536,7 @@ unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::ve
 
 		std::vector<bool> marker(numRawMatches, false);
 		for (unsigned int i = 0; i < indices.size(); i++) marker[indices[i]] = true;
+		unsigned int numTested = k;
 		// collect inliers
 		for (unsigned int m = 0; m < numRawMatches; m++) {
 			if (curNumMatches == MAX_MATCHES_PER_IMAGE_PAIR_FILTERED) break;
@@ -491,6 +559,7 @@ unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::ve
 			}
 
 			getKeySourceAndTargetPointsForIndex(keys.data(), keyPointIndices.data(), m, srcPts.data() + curNumMatches, tgtPts.data() + curNumMatches, siftIntrinsicsInv);
+			numTested++;
 #ifdef REFINE_RANSAC
 			// refine transform
 			float curRes2 = computeKabschReprojError(srcPts.data(), tgtPts.data(), curNumMatches + 1, eigenvalues, transformEstimate);
@@ -531,6 +600,7 @@ unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::ve
 			maxNumInliers = curNumMatches;
 			bestCombinationIndices = indices;
 			bestMaxResidual = curMaxResidual;
+			bestInlierRatio = (float)curNumMatches / (float)numTested;
 
 			if (_DEBUGCOMB) std::cout << "POTENTIAL MATCH" << std::endl;
 			if (debugPrint) {
@@ -540,7 +610,15 @@ unsigned int SIFTMatchFilter::filterImagePairKeyPointMatchesRANSAC(const std::ve
 				std::cout << std::endl;
 			}
 		}
+
+		// stop once an all inlier sample of the best inlier ratio was drawn with the given confidence
+		if (adaptive && maxNumInliers > 0) {
+			if (bestInlierRatio >= 1.0f) break;
+			const double numRequired = std::log(1.0 - (double)confidence) / std::log(1.0 - std::pow((double)bestInlierRatio, (double)k));
+			if ((double)(c + 1) >= numRequired) break;
+		}
 	}
+	numHypotheses = numValidCombs;
 
 	if (debugPrint) {
 		std::cout << "#valid com = " << numValidCombs << ", #valid starts = " << numValidStarts << std::endl;
@@ -639,9 +717,10 @@ void SIFTMatchFilter::ransacKeyPointMatchesDEBUG(unsigned int curFrame, SIFTImag
 		//!!!DEBUGGING
 		if (debugPrint) std::cout << "(" << i << ", " << curFrame << ")" << std::endl;
 		float4x4 transform;
+		unsigned int numHypotheses;
 		unsigned int newNumMatches =
 			filterImagePairKeyPointMatchesRANSAC(keyPoints, keyPointIndices, matchDistances, transform, siftIntrinsicsInv,
-			minNumMatches, maxResThresh2, (unsigned int)s_combinations[0].size(), s_combinations, debugPrint);
+			minNumMatches, maxResThresh2, (unsigned int)s_combinations[0].size(), &s_combinations, 0.0f, 0, numHypotheses, debugPrint);
 
 		if (newNumMatches > 0) {
 			transforms[i] = transform;
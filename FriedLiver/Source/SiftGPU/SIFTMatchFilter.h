@@ -5,6 +5,8 @@
 #include "SIFTImageManager.h"
 #include "../CUDACache.h"
 
+#define RANSAC_SAMPLE_SIZE 4	//matches per hypothesis
+
 class SIFTMatchFilter
 {
 public:
@@ -14,7 +16,17 @@ public:
 	static void filterKeyPointMatchesDEBUG(unsigned int curFrame, SIFTImageManager* siftManager, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool printDebug);
 	static void ransacKeyPointMatchesDEBUG(unsigned int curFrame, SIFTImageManager* siftManager, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool debugPrint);
 
-	static void ransacKeyPointMatches(SIFTImageManager* siftManager, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool debugPrint);
+	//! ransac on the (sorted) raw matches of curFrame to [startFrame, numFrames); s_ransacConfidence > 0: adaptive PROSAC hypotheses, otherwise the fixed combinations
+	static void ransacKeyPointMatches(SIFTImageManager* siftManager, unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+		const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool debugPrint);
+	//! hypotheses of the last ransacKeyPointMatches per image pair (relative to startFrame)
+	static const std::vector<unsigned int>& getNumRansacHypotheses() {
+		return s_numRansacHypotheses;
+	}
+	//! raw (x) and filtered (y) matches of the last ransacKeyPointMatches per image pair (relative to startFrame)
+	static const std::vector<uint2>& getNumRansacMatches() {
+		return s_numRansacMatches;
+	}
 	static void filterKeyPointMatches(SIFTImageManager* siftManager, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches);
 
 	static void filterBySurfaceArea(SIFTImageManager* siftManager, const std::vector<CUDACachedFrame>& cachedFrames, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches);
@@ -28,7 +40,7 @@ public:
 
 	static void init() {
 		if (s_bInit) return;
-		generateKCombinations(20, 4, s_combinations);
+		generateKCombinations(20, RANSAC_SAMPLE_SIZE, s_combinations);
 		//generateRandKCombinations(16, 4, 128, s_combinations);
 		//generateKCombinations(20, 4, s_combinations, 128);
 		s_bInit = true;
@@ -38,6 +50,8 @@ public:
 private:
 	static bool s_bInit;
 	static std::vector<std::vector<unsigned int>> s_combinations;
+	static std::vector<unsigned int> s_numRansacHypotheses;
+	static std::vector<uint2> s_numRansacMatches;
 
 	static void generateRandKCombinations(unsigned int n, unsigned int k, unsigned int numGen, std::vector<std::vector<unsigned int>>& combinations) {
 		MLIB_ASSERT(k <= n);
@@ -73,8 +87,9 @@ private:
 		}
 	}
 
+	//! combinations == NULL: PROSAC samples of k matches (by match distance) until the best hypothesis reaches confidence, at most maxNumHypotheses
 	static unsigned int filterImagePairKeyPointMatchesRANSAC(const std::vector<SIFTKeyPoint>& keys, std::vector<uint2>& keyPointIndices, std::vector<float>& matchDistances, float4x4& transform, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2,
-		unsigned int k, const std::vector<std::vector<unsigned int>>& combinations, bool debugPrint);
+		unsigned int k, const std::vector<std::vector<unsigned int>>* combinations, float confidence, unsigned int maxNumHypotheses, unsigned int& numHypotheses, bool debugPrint);
 
 	static unsigned int filterImagePairKeyPointMatches(const std::vector<SIFTKeyPoint>& keys, std::vector<uint2>& keyPointIndices, std::vector<float>& matchDistances, float4x4& transform, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxResThresh2, bool printDebug);
 	static bool filterImagePairBySurfaceArea(const std::vector<SIFTKeyPoint>& keys, float* depth0, float* depth1, const std::vector<uint2>& keyPointIndices, const float4x4& siftIntrinsicsInv, unsigned int minNumMatches);
@@ -0,0 +1,619 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "SIFTMatchFilterCPU.h"
+#include "cuda_EigenValue.h"
+#include "../CPUParallel.h"
+#include "../CPUSimd.h"
+#include "mLibCuda.h"
+
+//as cuda_kabsch.h
+#define MATCH_FILTER_CPU_PIXEL_DIST_THRESH 5.0f
+#define MATCH_FILTER_CPU_CONDITION_THRESH 100.0f
+
+//as cuda_svd3.h
+#define SVD3_GAMMA 5.828427124f		// FOUR_GAMMA_SQUARED = sqrt(8)+3;
+#define SVD3_CSTAR 0.923879532f		// cos(pi/8)
+#define SVD3_SSTAR 0.3826834323f	// sin(p/8)
+#define SVD3_EPSILON 1e-6f
+
+/************************************************************************/
+/* svd of cuda_svd3.h on vfloat: one 3x3 matrix per lane                */
+/************************************************************************/
+
+//! exact (the gpu rsqrt is exact to a few ulp)
+static inline vfloat vrsqrt(const vfloat& x) { return vset1(1.0f) / vsqrt(x); }
+
+static inline void condSwap(const vmask& c, vfloat& x, vfloat& y)
+{
+	const vfloat z = x;
+	x = vselect(c, y, x);
+	y = vselect(c, z, y);
+}
+
+static inline void condNegSwap(const vmask& c, vfloat& x, vfloat& y)
+{
+	const vfloat z = vzero() - x;
+	x = vselect(c, y, x);
+	y = vselect(c, z, y);
+}
+
+static inline void approximateGivensQuaternion(const vfloat& a11, const vfloat& a12, const vfloat& a22, vfloat& ch, vfloat& sh)
+{
+	ch = vset1(2.0f) * (a11 - a22);
+	sh = a12;
+	const vmask b = vcmplt(vset1(SVD3_GAMMA) * sh * sh, ch * ch);
+	const vfloat w = vrsqrt(ch * ch + sh * sh);
+	ch = vselect(b, w * ch, vset1(SVD3_CSTAR));
+	sh = vselect(b, w * sh, vset1(SVD3_SSTAR));
+}
+
+//! s: lower triangle of the symmetric matrix; qV: cumulative rotation (x, y, z, w)
+static inline void jacobiConjugation(int x, int y, int z, vfloat& s11, vfloat& s21, vfloat& s22, vfloat& s31, vfloat& s32, vfloat& s33, vfloat* qV)
+{
+	vfloat ch, sh;
+	approximateGivensQuaternion(s11, s21, s22, ch, sh);
+
+	const vfloat scale = ch * ch + sh * sh;
+	const vfloat a = (ch * ch - sh * sh) / scale;
+	const vfloat b = (vset1(2.0f) * sh * ch) / scale;
+	const vfloat nb = vzero() - b;
+
+	// perform conjugation S = Q'*S*Q
+	const vfloat _s11 = s11;
+	const vfloat _s21 = s21, _s22 = s22;
+	const vfloat _s31 = s31, _s32 = s32, _s33 = s33;
+	s11 = a * (a * _s11 + b * _s21) + b * (a * _s21 + b * _s22);
+	s21 = a * (nb * _s11 + a * _s21) + b * (nb * _s21 + a * _s22);
+	s22 = nb * (nb * _s11 + a * _s21) + a * (nb * _s21 + a * _s22);
+	s31 = a * _s31 + b * _s32;
+	s32 = nb * _s31 + a * _s32;
+	s33 = _s33;
+
+	// update cumulative rotation qV
+	const vfloat tmp[3] = { qV[0] * sh, qV[1] * sh, qV[2] * sh };
+	sh = sh * qV[3];
+	for (unsigned int i = 0; i < 4; i++) qV[i] = qV[i] * ch;
+	qV[z] = qV[z] + sh;
+	qV[3] = qV[3] - tmp[z];
+	qV[x] = qV[x] + tmp[y];
+	qV[y] = qV[y] - tmp[x];
+
+	// re-arrange matrix for next iteration
+	const vfloat r11 = s22;
+	const vfloat r21 = s32, r22 = s33;
+	const vfloat r31 = s21, r32 = s31, r33 = s11;
+	s11 = r11;
+	s21 = r21; s22 = r22;
+	s31 = r31; s32 = r32; s33 = r33;
+}
+
+static inline void QRGivensQuaternion(const vfloat& a1, const vfloat& a2, vfloat& ch, vfloat& sh)
+{
+	const vfloat epsilon = vset1(SVD3_EPSILON);
+	const vfloat rho = vsqrt(a1 * a1 + a2 * a2);
+
+	sh = vand(vcmpgt(rho, epsilon), a2);
+	ch = vabs(a1) + vmax(rho, epsilon);
+	condSwap(vcmplt(a1, vzero()), sh, ch);
+	const vfloat w = vrsqrt(ch * ch + sh * sh);
+	ch = ch * w;
+	sh = sh * w;
+}
+
+//! a = u * diag(s) * v^T with s >= 0 (svd and svdAbsEV of cuda_svd3.h)
+static void svd3(const vfloat a[3][3], vfloat u[3][3], vfloat s[3], vfloat v[3][3])
+{
+	const vfloat one = vset1(1.0f), two = vset1(2.0f), four = vset1(4.0f);
+
+	// normal equations matrix
+	vfloat ata[3][3];
+	for (unsigned int i = 0; i < 3; i++) {
+		for (unsigned int j = 0; j < 3; j++) {
+			ata[i][j] = a[0][i] * a[0][j] + a[1][i] * a[1][j] + a[2][i] * a[2][j];
+		}
+	}
+
+	// symmetric eigenanalysis
+	vfloat qV[4] = { vzero(), vzero(), vzero(), one };
+	vfloat s11 = ata[0][0];
+	vfloat s21 = ata[1][0], s22 = ata[1][1];
+	vfloat s31 = ata[2][0], s32 = ata[2][1], s33 = ata[2][2];
+	for (unsigned int i = 0; i < 4; i++) {
+		jacobiConjugation(0, 1, 2, s11, s21, s22, s31, s32, s33, qV);
+		jacobiConjugation(1, 2, 0, s11, s21, s22, s31, s32, s33, qV);
+		jacobiConjugation(2, 0, 1, s11, s21, s22, s31, s32, s33, qV);
+	}
+	{
+		const vfloat x = qV[0], y = qV[1], z = qV[2], w = qV[3];
+		const vfloat qxx = x * x, qyy = y * y, qzz = z * z;
+		const vfloat qxz = x * z, qxy = x * y, qyz = y * z;
+		const vfloat qwx = w * x, qwy = w * y, qwz = w * z;
+		v[0][0] = one - two * (qyy + qzz); v[0][1] = two * (qxy - qwz); v[0][2] = two * (qxz + qwy);
+		v[1][0] = two * (qxy + qwz); v[1][1] = one - two * (qxx + qzz); v[1][2] = two * (qyz - qwx);
+		v[2][0] = two * (qxz - qwy); v[2][1] = two * (qyz + qwx); v[2][2] = one - two * (qxx + qyy);
+	}
+
+	vfloat b[3][3];
+	for (unsigned int i = 0; i < 3; i++) {
+		for (unsigned int j = 0; j < 3; j++) {
+			b[i][j] = a[i][0] * v[0][j] + a[i][1] * v[1][j] + a[i][2] * v[2][j];
+		}
+	}
+
+	// sort singular values (rho2 uses b23 as cuda_svd3.h)
+	vfloat rho1 = b[0][0] * b[0][0] + b[1][0] * b[1][0] + b[2][0] * b[2][0];
+	vfloat rho2 = b[0][1] * b[0][1] + b[1][1] * b[1][1] + b[1][2] * b[1][2];
+	vfloat rho3 = b[0][2] * b[0][2] + b[1][2] * b[1][2] + b[2][2] * b[2][2];
+	vmask c = vcmplt(rho1, rho2);
+	for (unsigned int i = 0; i < 3; i++) { condNegSwap(c, b[i][0], b[i][1]); condNegSwap(c, v[i][0], v[i][1]); }
+	condSwap(c, rho1, rho2);
+	c = vcmplt(rho1, rho3);
+	for (unsigned int i = 0; i < 3; i++) { condNegSwap(c, b[i][0], b[i][2]); condNegSwap(c, v[i][0], v[i][2]); }
+	condSwap(c, rho1, rho3);
+	c = vcmplt(rho2, rho3);
+	for (unsigned int i = 0; i < 3; i++) { condNegSwap(c, b[i][1], b[i][2]); condNegSwap(c, v[i][1], v[i][2]); }
+
+	// QR decomposition by three givens rotations
+	vfloat r[3][3];
+	vfloat ch1, sh1, ch2, sh2, ch3, sh3;
+	QRGivensQuaternion(b[0][0], b[1][0], ch1, sh1);
+	vfloat ga = one - two * sh1 * sh1;
+	vfloat gb = two * ch1 * sh1;
+	for (unsigned int j = 0; j < 3; j++) {
+		r[0][j] = ga * b[0][j] + gb * b[1][j];
+		r[1][j] = (vzero() - gb) * b[0][j] + ga * b[1][j];
+		r[2][j] = b[2][j];
+	}
+	QRGivensQuaternion(r[0][0], r[2][0], ch2, sh2);
+	ga = one - two * sh2 * sh2;
+	gb = two * ch2 * sh2;
+	for (unsigned int j = 0; j < 3; j++) {
+		b[0][j] = ga * r[0][j] + gb * r[2][j];
+		b[1][j] = r[1][j];
+		b[2][j] = (vzero() - gb) * r[0][j] + ga * r[2][j];
+	}
+	QRGivensQuaternion(b[1][1], b[2][1], ch3, sh3);
+	ga = one - two * sh3 * sh3;
+	gb = two * ch3 * sh3;
+	s[0] = b[0][0];
+	s[1] = ga * b[1][1] + gb * b[2][1];
+	s[2] = (vzero() - gb) * b[1][2] + ga * b[2][2];
+
+	// cumulative rotation Q = Q1 * Q2 * Q3
+	const vfloat m1 = vset1(-1.0f), m2 = vset1(-2.0f), m8 = vset1(-8.0f);
+	const vfloat sh12 = sh1 * sh1, sh22 = sh2 * sh2, sh32 = sh3 * sh3;
+	u[0][0] = (m1 + two * sh12) * (m1 + two * sh22);
+	u[0][1] = four * ch2 * ch3 * (m1 + two * sh12) * sh2 * sh3 + two * ch1 * sh1 * (m1 + two * sh32);
+	u[0][2] = four * ch1 * ch3 * sh1 * sh3 - two * ch2 * (m1 + two * sh12) * sh2 * (m1 + two * sh32);
+	u[1][0] = two * ch1 * sh1 * (one - two * sh22);
+	u[1][1] = m8 * ch1 * ch2 * ch3 * sh1 * sh2 * sh3 + (m1 + two * sh12) * (m1 + two * sh32);
+	u[1][2] = m2 * ch3 * sh3 + four * sh1 * (ch3 * sh1 * sh3 + ch1 * ch2 * sh2 * (m1 + two * sh32));
+	u[2][0] = two * ch2 * sh2;
+	u[2][1] = two * ch3 * (one - two * sh22) * sh3;
+	u[2][2] = (m1 + two * sh22) * (m1 + two * sh32);
+
+	// positive singular values
+	for (unsigned int i = 0; i < 3; i++) {
+		const vmask neg = vcmplt(s[i], vzero());
+		s[i] = vselect(neg, vzero() - s[i], s[i]);
+		for (unsigned int j = 0; j < 3; j++) u[j][i] = vselect(neg, vzero() - u[j][i], u[j][i]);
+	}
+}
+
+/************************************************************************/
+/* greedy filter of cuda_kabsch.h as a state machine per lane           */
+/************************************************************************/
+
+enum FilterLaneState {
+	LANE_IDLE,			//no pair
+	LANE_ADDING,		//adding raw matches
+	LANE_ADDED,			//needs kabsch after an added match
+	LANE_REMOVING,		//needs kabsch after removing the worst match
+	LANE_DONE			//result not written yet
+};
+
+struct FilterLane {
+	FilterLaneState state;
+	unsigned int pair;
+	unsigned int numRawMatches;
+	unsigned int idx;						//next raw match
+
+	uint2 keyPointIndices[MAX_MATCHES_PER_IMAGE_PAIR_FILTERED];
+	float matchDistances[MAX_MATCHES_PER_IMAGE_PAIR_FILTERED];
+	float3 srcPts[MAX_MATCHES_PER_IMAGE_PAIR_FILTERED];
+	float3 tgtPts[MAX_MATCHES_PER_IMAGE_PAIR_FILTERED];
+	float residuals[MAX_MATCHES_PER_IMAGE_PAIR_FILTERED];
+	unsigned int numMatches;
+	float maxResidual;
+	bool validTransform;
+	float4x4 transform;
+
+	//state before removing matches
+	bool addedValid;
+	float4x4 addedTransform;
+	float lastResidual;
+
+	float3 p0, q0;							//centroids of the kabsch in flight
+};
+
+struct FilterParams {
+	const SIFTKeyPoint* keyPoints;
+	unsigned int keyPointOffset;
+	const int* numRawMatches;
+	const uint2* rawKeyPointIndices;
+	const float* rawMatchDistances;
+	float4x4 siftIntrinsicsInv;
+	unsigned int minNumMatches;
+	float maxKabschRes2;
+
+	int* numFilteredMatches;
+	uint2* filteredKeyPointIndices;
+	float* filteredMatchDistances;
+	float4x4* transforms;
+	float4x4* transformsInv;
+};
+
+static inline float pixelDist(const float2& a, const float2& b)
+{
+	const float dx = a.x - b.x, dy = a.y - b.y;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static inline float3 toCamera(const SIFTKeyPoint& key, const float4x4& siftIntrinsicsInv)
+{
+	return siftIntrinsicsInv * (key.depth * make_float3(key.pos.x, key.pos.y, 1.0f));
+}
+
+//! ratio of the two largest eigenvalues of the covariance of the points (covarianceSVD of cuda_kabsch.h)
+static float covarianceCondition(const float3* pts, unsigned int numPoints)
+{
+	float3 p0 = make_float3(0.0f, 0.0f, 0.0f);
+	for (unsigned int i = 0; i < numPoints; i++) {
+		p0.x += pts[i].x; p0.y += pts[i].y; p0.z += pts[i].z;
+	}
+	p0.x /= (float)numPoints; p0.y /= (float)numPoints; p0.z /= (float)numPoints;
+
+	float v[9] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (unsigned int i = 0; i < numPoints; i++) {
+		const float d[3] = { pts[i].x - p0.x, pts[i].y - p0.y, pts[i].z - p0.z };
+		for (unsigned int r = 0; r < 3; r++) {
+			for (unsigned int c = 0; c < 3; c++) v[r * 3 + c] += d[r] * d[c];
+		}
+	}
+	for (unsigned int k = 0; k < 9; k++) v[k] /= (float)numPoints;
+
+	const float3 evs = computeEigenValues(float3x3(v));
+	return evs.x / evs.y;
+}
+
+static void startLane(FilterLane& l, unsigned int pair, const FilterParams& p)
+{
+	l.pair = pair;
+	l.numRawMatches = std::min((unsigned int)MAX_MATCHES_PER_IMAGE_PAIR_RAW, (unsigned int)std::max(p.numRawMatches[pair], 0));
+	l.idx = 0;
+	l.numMatches = 0;
+	l.maxResidual = 100.0f;
+	l.validTransform = false;
+	l.transform.setIdentity();
+	l.state = l.numRawMatches > 0 ? LANE_ADDING : LANE_DONE;
+}
+
+static void writeLane(const FilterLane& l, const FilterParams& p)
+{
+	p.numFilteredMatches[l.pair] = (int)l.numMatches;
+	uint2* keyPointIndices = p.filteredKeyPointIndices + l.pair * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED;
+	float* matchDistances = p.filteredMatchDistances + l.pair * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED;
+	for (unsigned int i = 0; i < MAX_MATCHES_PER_IMAGE_PAIR_FILTERED; i++) {
+		if (i < l.numMatches) {
+			keyPointIndices[i] = l.keyPointIndices[i];
+			matchDistances[i] = l.matchDistances[i];
+		}
+		else {
+			keyPointIndices[i] = make_uint2((unsigned int)-1, (unsigned int)-1);
+			matchDistances[i] = 999.0f;
+		}
+	}
+	p.transforms[l.pair] = l.transform;
+	p.transformsInv[l.pair] = l.transform.getInverse();
+}
+
+//! adds raw matches until the lane needs a kabsch estimate or is done
+static void advanceLane(FilterLane& l, const FilterParams& p)
+{
+	while (true) {
+		if (l.idx == l.numRawMatches || l.numMatches >= MAX_MATCHES_PER_IMAGE_PAIR_FILTERED) {
+			if (l.numMatches < p.minNumMatches || l.maxResidual >= p.maxKabschRes2 || !l.validTransform) l.numMatches = 0;
+			l.state = LANE_DONE;
+			return;
+		}
+		if (l.numMatches + (l.numRawMatches - l.idx) < p.minNumMatches) { //can't become valid anymore
+			l.numMatches = 0;
+			l.state = LANE_DONE;
+			return;
+		}
+
+		const uint2 add = p.rawKeyPointIndices[l.pair * MAX_MATCHES_PER_IMAGE_PAIR_RAW + l.idx];
+		const float addDist = p.rawMatchDistances[l.pair * MAX_MATCHES_PER_IMAGE_PAIR_RAW + l.idx];
+		l.idx++;
+
+		const SIFTKeyPoint& ai = p.keyPoints[add.x - p.keyPointOffset];
+		const SIFTKeyPoint& aj = p.keyPoints[add.y - p.keyPointOffset];
+		bool accept = true;
+		for (unsigned int i = 0; i < l.numMatches; i++) {
+			const float2 ki = p.keyPoints[l.keyPointIndices[i].x - p.keyPointOffset].pos;
+			const float2 kj = p.keyPoints[l.keyPointIndices[i].y - p.keyPointOffset].pos;
+			if (pixelDist(ai.pos, ki) <= MATCH_FILTER_CPU_PIXEL_DIST_THRESH || pixelDist(aj.pos, kj) <= MATCH_FILTER_CPU_PIXEL_DIST_THRESH) {
+				accept = false;
+				break;
+			}
+		}
+		if (!accept) continue;
+
+		l.keyPointIndices[l.numMatches] = add;
+		l.matchDistances[l.numMatches] = addDist;
+		l.srcPts[l.numMatches] = toCamera(ai, p.siftIntrinsicsInv);
+		l.tgtPts[l.numMatches] = toCamera(aj, p.siftIntrinsicsInv);
+		l.numMatches++;
+		if (l.numMatches >= 3) {
+			l.state = LANE_ADDED;
+			return;
+		}
+	}
+}
+
+//! centroids and cross covariance of the first numMatches matches (as kabsch of cuda_kabsch.h)
+static void laneCovariance(FilterLane& l, float* cov)
+{
+	const unsigned int n = l.numMatches;
+	float3 p0 = make_float3(0.0f, 0.0f, 0.0f), q0 = make_float3(0.0f, 0.0f, 0.0f);
+	for (unsigned int i = 0; i < n; i++) {
+		p0.x += l.srcPts[i].x; p0.y += l.srcPts[i].y; p0.z += l.srcPts[i].z;
+		q0.x += l.tgtPts[i].x; q0.y += l.tgtPts[i].y; q0.z += l.tgtPts[i].z;
+	}
+	p0.x /= (float)n; p0.y /= (float)n; p0.z /= (float)n;
+	q0.x /= (float)n; q0.y /= (float)n; q0.z /= (float)n;
+	l.p0 = p0;
+	l.q0 = q0;
+
+	for (unsigned int k = 0; k < 9; k++) cov[k] = 0.0f;
+	for (unsigned int i = 0; i < n; i++) {
+		const float dp[3] = { l.srcPts[i].x - p0.x, l.srcPts[i].y - p0.y, l.srcPts[i].z - p0.z };
+		const float dq[3] = { l.tgtPts[i].x - q0.x, l.tgtPts[i].y - q0.y, l.tgtPts[i].z - q0.z };
+		for (unsigned int r = 0; r < 3; r++) {
+			for (unsigned int c = 0; c < 3; c++) cov[r * 3 + c] += dp[r] * dq[c];
+		}
+	}
+	for (unsigned int k = 0; k < 9; k++) cov[k] /= (float)n;
+}
+
+//! ComputeReprojection of cuda_kabsch.h for the rotation and singular values of the lane's kabsch, then the next greedy step
+static void finishLane(FilterLane& l, const float* rot, float3 evs, const FilterParams& p)
+{
+	// kabsch transform
+	float4x4& t = l.transform;
+	for (unsigned int r = 0; r < 3; r++) {
+		for (unsigned int c = 0; c < 3; c++) t(r, c) = rot[r * 3 + c];
+	}
+	t(0, 3) = l.q0.x - (t(0, 0) * l.p0.x + t(0, 1) * l.p0.y + t(0, 2) * l.p0.z);
+	t(1, 3) = l.q0.y - (t(1, 0) * l.p0.x + t(1, 1) * l.p0.y + t(1, 2) * l.p0.z);
+	t(2, 3) = l.q0.z - (t(2, 0) * l.p0.x + t(2, 1) * l.p0.y + t(2, 2) * l.p0.z);
+	t(3, 0) = t(3, 1) = t(3, 2) = 0.0f;	t(3, 3) = 1.0f;
+	if (evs.x < evs.y) std::swap(evs.x, evs.y);
+	if (evs.y < evs.z) std::swap(evs.y, evs.z);
+	if (evs.x < evs.y) std::swap(evs.x, evs.y);
+
+	// residuals, sorted with their matches
+	const unsigned int n = l.numMatches;
+	for (unsigned int i = 0; i < n; i++) {
+		const float3 s = t * l.srcPts[i];
+		const float dx = s.x - l.tgtPts[i].x, dy = s.y - l.tgtPts[i].y, dz = s.z - l.tgtPts[i].z;
+		l.residuals[i] = dx * dx + dy * dy + dz * dz;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = i; j < n; j++) {
+			if (l.residuals[i] > l.residuals[j]) {
+				std::swap(l.residuals[i], l.residuals[j]);
+				std::swap(l.srcPts[i], l.srcPts[j]);
+				std::swap(l.tgtPts[i], l.tgtPts[j]);
+				std::swap(l.keyPointIndices[i], l.keyPointIndices[j]);
+				std::swap(l.matchDistances[i], l.matchDistances[j]);
+			}
+		}
+	}
+
+	const float c1 = evs.x / evs.y;
+	const float cp = covarianceCondition(l.srcPts, n);
+	const float cq = covarianceCondition(l.tgtPts, n);
+	l.validTransform = !(std::isnan(c1) || std::isnan(cp) || std::isnan(cq) ||
+		std::fabs(c1) > MATCH_FILTER_CPU_CONDITION_THRESH || std::fabs(cp) > MATCH_FILTER_CPU_CONDITION_THRESH || std::fabs(cq) > MATCH_FILTER_CPU_CONDITION_THRESH);
+	l.maxResidual = l.residuals[n - 1];
+
+	if (l.state == LANE_ADDED) {
+		l.addedValid = l.validTransform;
+		l.addedTransform = l.transform;
+		if (l.maxResidual > p.maxKabschRes2 && n > 3) { // some bad matches: remove until max < maxKabschRes2
+			l.lastResidual = l.residuals[n - 1];
+			l.numMatches--;
+			l.state = LANE_REMOVING;
+			return;
+		}
+	}
+	else if (n == 3 && (l.maxResidual > p.maxKabschRes2 || (l.addedValid && !l.validTransform))) { // removing made it worse
+		l.numMatches++;
+		l.maxResidual = l.lastResidual;
+		l.validTransform = l.addedValid;
+		l.transform = l.addedTransform;
+	}
+	else if (!(l.maxResidual < p.maxKabschRes2) && n > 3) {
+		l.lastResidual = l.residuals[n - 1];
+		l.numMatches--;
+		return;
+	}
+	l.state = LANE_ADDING;
+}
+
+//! the pairs [begin, end) on vfloat::Width lanes
+static void filterImagePairs(unsigned int begin, unsigned int end, const FilterParams& p)
+{
+	const unsigned int W = vfloat::Width;
+	FilterLane lanes[vfloat::Width];
+	for (unsigned int l = 0; l < W; l++) lanes[l].state = LANE_IDLE;
+	unsigned int next = begin;
+
+	float cov[9][vfloat::Width];
+	float rot[9][vfloat::Width];
+	float sv[3][vfloat::Width];
+	while (true) {
+		// run every lane up to its next kabsch, refill finished lanes
+		bool pending = false;
+		for (unsigned int l = 0; l < W; l++) {
+			FilterLane& lane = lanes[l];
+			while (lane.state != LANE_ADDED && lane.state != LANE_REMOVING) {
+				if (lane.state == LANE_ADDING) {
+					advanceLane(lane, p);
+					continue;
+				}
+				if (lane.state == LANE_DONE) {
+					writeLane(lane, p);
+					lane.state = LANE_IDLE;
+				}
+				if (next == end) break;
+				startLane(lane, next++, p);
+			}
+			if (lane.state == LANE_IDLE) {
+				for (unsigned int k = 0; k < 9; k++) cov[k][l] = (k % 4 == 0) ? 1.0f : 0.0f;
+			}
+			else {
+				float c[9];
+				laneCovariance(lane, c);
+				for (unsigned int k = 0; k < 9; k++) cov[k][l] = c[k];
+				pending = true;
+			}
+		}
+		if (!pending) break;
+
+		// kabsch of all lanes: R = V * diag(1, 1, det(U * V^T) < 0 ? -1 : 1) * U^T
+		vfloat a[3][3], u[3][3], s[3], v[3][3];
+		for (unsigned int k = 0; k < 9; k++) a[k / 3][k % 3] = vload(cov[k]);
+		svd3(a, u, s, v);
+
+		vfloat m[3][3];
+		for (unsigned int i = 0; i < 3; i++) {
+			for (unsigned int j = 0; j < 3; j++) m[i][j] = u[i][0] * v[j][0] + u[i][1] * v[j][1] + u[i][2] * v[j][2];
+		}
+		const vfloat det = m[0][0] * m[1][1] * m[2][2] + m[0][1] * m[1][2] * m[2][0] + m[0][2] * m[1][0] * m[2][1]
+			- m[2][0] * m[1][1] * m[0][2] - m[2][1] * m[1][2] * m[0][0] - m[2][2] * m[1][0] * m[0][1];
+		const vfloat d = vselect(vcmplt(det, vzero()), vset1(-1.0f), vset1(1.0f));
+		for (unsigned int i = 0; i < 3; i++) {
+			for (unsigned int j = 0; j < 3; j++) {
+				vstore(rot[i * 3 + j], v[i][0] * u[j][0] + v[i][1] * u[j][1] + (v[i][2] * d) * u[j][2]);
+			}
+			vstore(sv[i], s[i]);
+		}
+
+		for (unsigned int l = 0; l < W; l++) {
+			if (lanes[l].state == LANE_IDLE) continue;
+			float r[9];
+			for (unsigned int k = 0; k < 9; k++) r[k] = rot[k][l];
+			finishLane(lanes[l], r, make_float3(sv[0][l], sv[1][l], sv[2][l]), p);
+		}
+	}
+}
+
+SIFTMatchFilterCPU::SIFTMatchFilterCPU()
+{
+}
+
+SIFTMatchFilterCPU::~SIFTMatchFilterCPU()
+{
+}
+
+void SIFTMatchFilterCPU::filterKeyPointMatches(const SIFTKeyPoint* keyPoints, unsigned int keyPointOffset, unsigned int numImagePairs,
+	const int* numRawMatches, const uint2* rawKeyPointIndices, const float* rawMatchDistances,
+	const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2,
+	int* numFilteredMatches, uint2* filteredKeyPointIndices, float* filteredMatchDistances, float4x4* transforms, float4x4* transformsInv)
+{
+	FilterParams p;
+	p.keyPoints = keyPoints;
+	p.keyPointOffset = keyPointOffset;
+	p.numRawMatches = numRawMatches;
+	p.rawKeyPointIndices = rawKeyPointIndices;
+	p.rawMatchDistances = rawMatchDistances;
+	p.siftIntrinsicsInv = siftIntrinsicsInv;
+	p.minNumMatches = minNumMatches;
+	p.maxKabschRes2 = maxKabschRes2;
+	p.numFilteredMatches = numFilteredMatches;
+	p.filteredKeyPointIndices = filteredKeyPointIndices;
+	p.filteredMatchDistances = filteredMatchDistances;
+	p.transforms = transforms;
+	p.transformsInv = transformsInv;
+
+	CPUParallel::parallelFor(0, numImagePairs, [&](unsigned int b, unsigned int e) {
+		filterImagePairs(b, e, p);
+	}, SIFT_MATCH_FILTER_CPU_CHUNK_PAIRS);
+}
+
+void SIFTMatchFilterCPU::filterKeyPointMatchesCUDA(SIFTImageManager* siftManager, unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+	const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2)
+{
+	if (numFrames <= startFrame) return;
+	const unsigned int numImagePairs = numFrames - startFrame;
+
+	// key points of the images [min(startFrame, curFrame), ...)
+	const unsigned int keyPointOffset = siftManager->m_numKeyPointsPerImagePrefixSum[std::min(startFrame, curFrame)];
+	m_keyPoints.resize(siftManager->m_numKeyPoints - keyPointOffset);
+	if (!m_keyPoints.empty()) {
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_keyPoints.data(), siftManager->d_keyPoints + keyPointOffset, sizeof(SIFTKeyPoint)*m_keyPoints.size(), cudaMemcpyDeviceToHost));
+	}
+
+	m_numRawMatches.resize(numImagePairs);
+	m_rawKeyPointIndices.resize(numImagePairs * MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+	m_rawMatchDistances.resize(numImagePairs * MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_numRawMatches.data(), siftManager->d_currNumMatchesPerImagePair + startFrame, sizeof(int)*numImagePairs, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_rawKeyPointIndices.data(), siftManager->d_currMatchKeyPointIndices + startFrame * MAX_MATCHES_PER_IMAGE_PAIR_RAW,
+		sizeof(uint2)*m_rawKeyPointIndices.size(), cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_rawMatchDistances.data(), siftManager->d_currMatchDistances + startFrame * MAX_MATCHES_PER_IMAGE_PAIR_RAW,
+		sizeof(float)*m_rawMatchDistances.size(), cudaMemcpyDeviceToHost));
+	const bool curInRange = curFrame >= startFrame && curFrame < numFrames;
+	if (curInRange) m_numRawMatches[curFrame - startFrame] = 0;
+
+	m_numFilteredMatches.resize(numImagePairs);
+	m_filteredKeyPointIndices.resize(numImagePairs * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED);
+	m_filteredMatchDistances.resize(numImagePairs * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED);
+	m_transforms.resize(numImagePairs);
+	m_transformsInv.resize(numImagePairs);
+	filterKeyPointMatches(m_keyPoints.data(), keyPointOffset, numImagePairs, m_numRawMatches.data(), m_rawKeyPointIndices.data(), m_rawMatchDistances.data(),
+		siftIntrinsicsInv, minNumMatches, maxKabschRes2,
+		m_numFilteredMatches.data(), m_filteredKeyPointIndices.data(), m_filteredMatchDistances.data(), m_transforms.data(), m_transformsInv.data());
+	int numRejected = 0;
+	for (unsigned int i = 0; i < numImagePairs; i++) {
+		if (m_numRawMatches[i] > 0 && m_numFilteredMatches[i] == 0) numRejected++;
+	}
+	siftManager->addMatchFilterCount(MATCH_FILTER_REJECTED_KEY_POINT, numRejected);
+
+	// the gpu kernel doesn't touch the pair of curFrame
+	if (curInRange) {
+		uploadResults(siftManager, startFrame, 0, curFrame - startFrame);
+		uploadResults(siftManager, startFrame, curFrame - startFrame + 1, numImagePairs);
+	}
+	else {
+		uploadResults(siftManager, startFrame, 0, numImagePairs);
+	}
+}
+
+void SIFTMatchFilterCPU::uploadResults(SIFTImageManager* siftManager, unsigned int startFrame, unsigned int begin, unsigned int end)
+{
+	if (begin >= end) return;
+	const unsigned int num = end - begin;
+	const unsigned int pairIdx = startFrame + begin;
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftManager->d_currNumFilteredMatchesPerImagePair + pairIdx, m_numFilteredMatches.data() + begin, sizeof(int)*num, cudaMemcpyHostToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftManager->d_currFilteredMatchKeyPointIndices + pairIdx * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED, m_filteredKeyPointIndices.data() + begin * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED,
+		sizeof(uint2)*num*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED, cudaMemcpyHostToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftManager->d_currFilteredMatchDistances + pairIdx * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED, m_filteredMatchDistances.data() + begin * MAX_MATCHES_PER_IMAGE_PAIR_FILTERED,
+		sizeof(float)*num*MAX_MATCHES_PER_IMAGE_PAIR_FILTERED, cudaMemcpyHostToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftManager->d_currFilteredTransforms + pairIdx, m_transforms.data() + begin, sizeof(float4x4)*num, cudaMemcpyHostToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftManager->d_currFilteredTransformsInv + pairIdx, m_transformsInv.data() + begin, sizeof(float4x4)*num, cudaMemcpyHostToDevice));
+}
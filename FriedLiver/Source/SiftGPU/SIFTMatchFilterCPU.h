@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef SIFT_MATCH_FILTER_CPU_H
+#define SIFT_MATCH_FILTER_CPU_H
+
+#include "SIFTImageManager.h"
+
+#include <vector>
+
+//! image pairs per CPUParallel chunk; the simd lanes of a chunk take its next pair as soon as their pair is done
+#define SIFT_MATCH_FILTER_CPU_CHUNK_PAIRS 16
+
+////////////////////////////////////////////////////////////////
+//class SIFTMatchFilterCPU
+//description: host implementation of SIFTImageManager::FilterKeyPointMatchesCU (the greedy kabsch filter of
+//             cuda_kabsch.h); chunks of image pairs run on CPUParallel, within a chunk one pair per simd lane
+//             and the 3x3 svds (cuda_svd3.h) of all lanes are computed together; pairs which can no longer
+//             reach minNumMatches are stopped early
+////////////////////////////////////////////////////////////////
+class SIFTMatchFilterCPU
+{
+public:
+	SIFTMatchFilterCPU();
+	~SIFTMatchFilterCPU();
+
+	//! same results as SIFTImageManager::FilterKeyPointMatchesCU (on the sorted raw matches of curFrame to [startFrame, numFrames))
+	void filterKeyPointMatchesCUDA(SIFTImageManager* siftManager, unsigned int curFrame, unsigned int startFrame, unsigned int numFrames,
+		const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2);
+
+	//! numImagePairs pairs with MAX_MATCHES_PER_IMAGE_PAIR_RAW raw and MAX_MATCHES_PER_IMAGE_PAIR_FILTERED filtered entries each;
+	//! raw matches sorted by distance; key point index i refers to keyPoints[i - keyPointOffset]
+	static void filterKeyPointMatches(const SIFTKeyPoint* keyPoints, unsigned int keyPointOffset, unsigned int numImagePairs,
+		const int* numRawMatches, const uint2* rawKeyPointIndices, const float* rawMatchDistances,
+		const float4x4& siftIntrinsicsInv, unsigned int minNumMatches, float maxKabschRes2,
+		int* numFilteredMatches, uint2* filteredKeyPointIndices, float* filteredMatchDistances, float4x4* transforms, float4x4* transformsInv);
+
+private:
+	//! uploads the results of the pairs [begin, end) (relative to startFrame)
+	void uploadResults(SIFTImageManager* siftManager, unsigned int startFrame, unsigned int begin, unsigned int end);
+
+	//host copies
+	std::vector<SIFTKeyPoint>	m_keyPoints;
+	std::vector<int>			m_numRawMatches;
+	std::vector<uint2>			m_rawKeyPointIndices;
+	std::vector<float>			m_rawMatchDistances;
+	std::vector<int>			m_numFilteredMatches;
+	std::vector<uint2>			m_filteredKeyPointIndices;
+	std::vector<float>			m_filteredMatchDistances;
+	std::vector<float4x4>		m_transforms;
+	std::vector<float4x4>		m_transformsInv;
+};
+
+#endif
@@ -0,0 +1,263 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "SIFTVocabularyTree.h"
+#include "ProgramCU.h"
+#include "../CPUParallel.h"
+#include "../CPUSimd.h"
+
+//! dim is a multiple of vfloat::Width (descriptors and SIFTDescriptorIndex sub vectors)
+static inline float squaredDistance(const float* a, const float* b, unsigned int dim)
+{
+	vfloat acc = vzero();
+	for (unsigned int i = 0; i < dim; i += vfloat::Width) {
+		const vfloat v = vload(a + i) - vload(b + i);
+		acc = acc + v * v;
+	}
+	float lanes[vfloat::Width];
+	vstore(lanes, acc);
+	float d = 0.0f;
+	for (unsigned int i = 0; i < vfloat::Width; i++) d += lanes[i];
+	return d;
+}
+
+unsigned int SIFTVocabularyTree::nearestCenter(const float* x, const float* centers, unsigned int numCenters, unsigned int dim)
+{
+	unsigned int best = 0;
+	float bestDist = std::numeric_limits<float>::max();
+	for (unsigned int c = 0; c < numCenters; c++) {
+		const float d = squaredDistance(x, centers + c * dim, dim);
+		if (d < bestDist) {
+			bestDist = d;
+			best = c;
+		}
+	}
+	return best;
+}
+
+void SIFTVocabularyTree::kmeans(const std::vector<float>& samples, unsigned int dim, const std::vector<unsigned int>& indices, unsigned int numCenters,
+	unsigned int numIterations, std::vector<float>& centers, std::vector<unsigned int>& assignment)
+{
+	const unsigned int n = (unsigned int)indices.size();
+	centers.resize(numCenters * dim);
+	for (unsigned int c = 0; c < numCenters; c++) {
+		std::copy(samples.begin() + indices[(size_t)c * n / numCenters] * dim, samples.begin() + (indices[(size_t)c * n / numCenters] + 1) * dim, centers.begin() + c * dim);
+	}
+	assignment.resize(n);
+	std::vector<double> sums(numCenters * dim);
+	std::vector<unsigned int> counts(numCenters);
+	for (unsigned int it = 0; it <= numIterations; it++) {
+		CPUParallel::parallelFor(0, n, [&](unsigned int b, unsigned int e) {
+			for (unsigned int i = b; i < e; i++) assignment[i] = nearestCenter(samples.data() + indices[i] * dim, centers.data(), numCenters, dim);
+		}, 256);
+		if (it == numIterations) break;
+
+		std::fill(sums.begin(), sums.end(), 0.0);
+		std::fill(counts.begin(), counts.end(), 0);
+		for (unsigned int i = 0; i < n; i++) {
+			const float* x = samples.data() + indices[i] * dim;
+			double* sum = sums.data() + assignment[i] * dim;
+			for (unsigned int d = 0; d < dim; d++) sum[d] += x[d];
+			counts[assignment[i]]++;
+		}
+		for (unsigned int c = 0; c < numCenters; c++) {
+			if (counts[c] == 0) continue; //keep the old center
+			for (unsigned int d = 0; d < dim; d++) centers[c * dim + d] = (float)(sums[c * dim + d] / counts[c]);
+		}
+	}
+}
+
+SIFTVocabularyTree::SIFTVocabularyTree(unsigned int numTrainImages, bool binaryDescriptors)
+{
+	m_numTrainImages = std::max(numTrainImages, 1u);
+	m_binaryDescriptors = binaryDescriptors;
+	m_dim = binaryDescriptors ? SIFT_BINARY_DESCRIPTOR_BITS : 128;
+}
+
+SIFTVocabularyTree::~SIFTVocabularyTree()
+{
+}
+
+void SIFTVocabularyTree::reset()
+{
+	for (unsigned int w = 0; w < m_invertedFile.size(); w++) m_invertedFile[w].clear();
+	m_imageAdded.clear();
+	m_pendingImages.clear();
+	m_pendingDescriptors.clear();
+}
+
+void SIFTVocabularyTree::toFloat(const unsigned char* descriptor, bool binaryDescriptors, float* out)
+{
+	if (binaryDescriptors) {
+		for (unsigned int i = 0; i < SIFT_BINARY_DESCRIPTOR_BITS; i++) out[i] = (float)((descriptor[i / 8] >> (i % 8)) & 1);
+	}
+	else {
+		for (unsigned int i = 0; i < 128; i++) out[i] = (float)descriptor[i];
+	}
+}
+
+unsigned int SIFTVocabularyTree::quantize(const float* descriptor) const
+{
+	unsigned int node = 0;
+	while (m_nodeNumChildren[node] > 0) {
+		const unsigned int first = m_nodeFirstChild[node];
+		node = first + nearestCenter(descriptor, m_nodeCenters.data() + first * m_dim, m_nodeNumChildren[node], m_dim);
+	}
+	return m_nodeWord[node];
+}
+
+void SIFTVocabularyTree::computeWordVector(const unsigned char* descriptors, unsigned int numKeys, WordVector& words) const
+{
+	std::vector<unsigned int> keyWords(numKeys);
+	std::vector<float> x(m_dim);
+	for (unsigned int k = 0; k < numKeys; k++) {
+		toFloat(descriptors + k * 128, m_binaryDescriptors, x.data());
+		keyWords[k] = quantize(x.data());
+	}
+	std::sort(keyWords.begin(), keyWords.end());
+
+	words.clear();
+	float sum = 0.0f;
+	for (unsigned int k = 0; k < numKeys;) {
+		unsigned int e = k;
+		while (e < numKeys && keyWords[e] == keyWords[k]) e++;
+		const float w = (float)(e - k) * m_idf[keyWords[k]];
+		if (w > 0.0f) {
+			words.push_back(std::make_pair(keyWords[k], w));
+			sum += w;
+		}
+		k = e;
+	}
+	for (unsigned int i = 0; i < words.size(); i++) words[i].second /= sum;
+}
+
+void SIFTVocabularyTree::train()
+{
+	//evenly spaced sample of the pending descriptors
+	size_t numDescriptors = 0;
+	for (unsigned int i = 0; i < m_pendingDescriptors.size(); i++) numDescriptors += m_pendingDescriptors[i].size() / 128;
+	const size_t stride = std::max(numDescriptors / SIFT_VOCABULARY_MAX_TRAIN_DESCRIPTORS, (size_t)1);
+	std::vector<float> samples;
+	size_t idx = 0;
+	for (unsigned int i = 0; i < m_pendingDescriptors.size(); i++) {
+		for (size_t k = 0; k < m_pendingDescriptors[i].size() / 128; k++, idx++) {
+			if (idx % stride != 0) continue;
+			samples.resize(samples.size() + m_dim);
+			toFloat(m_pendingDescriptors[i].data() + k * 128, m_binaryDescriptors, samples.data() + samples.size() - m_dim);
+		}
+	}
+	const unsigned int numSamples = (unsigned int)(samples.size() / m_dim);
+	if (numSamples == 0) return; //try again with the next image
+
+	//breadth first: split every node with more than SIFT_VOCABULARY_BRANCHING samples up to SIFT_VOCABULARY_DEPTH
+	m_nodeCenters.assign(m_dim, 0.0f);
+	m_nodeFirstChild.assign(1, 0);
+	m_nodeNumChildren.assign(1, 0);
+	std::vector< std::vector<unsigned int> > nodeSamples(1);
+	std::vector<unsigned int> nodeDepth(1, 0);
+	for (unsigned int i = 0; i < numSamples; i++) nodeSamples[0].push_back(i);
+
+	std::vector<float> centers;
+	std::vector<unsigned int> assignment;
+	for (unsigned int node = 0; node < nodeSamples.size(); node++) {
+		if (nodeDepth[node] >= SIFT_VOCABULARY_DEPTH || nodeSamples[node].size() <= SIFT_VOCABULARY_BRANCHING) continue;
+		kmeans(samples, m_dim, nodeSamples[node], SIFT_VOCABULARY_BRANCHING, SIFT_VOCABULARY_KMEANS_ITERATIONS, centers, assignment);
+
+		std::vector< std::vector<unsigned int> > clusters(SIFT_VOCABULARY_BRANCHING);
+		for (unsigned int i = 0; i < assignment.size(); i++) clusters[assignment[i]].push_back(nodeSamples[node][i]);
+		m_nodeFirstChild[node] = (unsigned int)nodeSamples.size();
+		for (unsigned int c = 0; c < SIFT_VOCABULARY_BRANCHING; c++) {
+			if (clusters[c].empty()) continue;
+			m_nodeCenters.insert(m_nodeCenters.end(), centers.begin() + c * m_dim, centers.begin() + (c + 1) * m_dim);
+			m_nodeFirstChild.push_back(0);
+			m_nodeNumChildren.push_back(0);
+			nodeDepth.push_back(nodeDepth[node] + 1);
+			nodeSamples.push_back(std::vector<unsigned int>());
+			nodeSamples.back().swap(clusters[c]);
+			m_nodeNumChildren[node]++;
+		}
+		std::vector<unsigned int>().swap(nodeSamples[node]);
+	}
+
+	//leaves are words
+	unsigned int numWords = 0;
+	m_nodeWord.assign(m_nodeNumChildren.size(), 0);
+	for (unsigned int node = 0; node < m_nodeNumChildren.size(); node++) {
+		if (m_nodeNumChildren[node] == 0) m_nodeWord[node] = numWords++;
+	}
+
+	//idf of the training images
+	const float numImages = (float)m_pendingImages.size();
+	std::vector<unsigned int> numImagesPerWord(numWords, 0);
+	m_idf.assign(numWords, 1.0f); //placeholder for computeWordVector
+	WordVector words;
+	for (unsigned int i = 0; i < m_pendingDescriptors.size(); i++) {
+		computeWordVector(m_pendingDescriptors[i].data(), (unsigned int)(m_pendingDescriptors[i].size() / 128), words);
+		for (unsigned int w = 0; w < words.size(); w++) numImagesPerWord[words[w].first]++;
+	}
+	for (unsigned int w = 0; w < numWords; w++) m_idf[w] = std::log(numImages / std::max(numImagesPerWord[w], 1u));
+
+	m_invertedFile.clear();
+	m_invertedFile.resize(numWords);
+	for (unsigned int i = 0; i < m_pendingImages.size(); i++) {
+		insert(m_pendingImages[i], m_pendingDescriptors[i].data(), (unsigned int)(m_pendingDescriptors[i].size() / 128));
+	}
+	m_pendingImages.clear();
+	m_pendingDescriptors.clear();
+}
+
+void SIFTVocabularyTree::insert(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys)
+{
+	WordVector words;
+	computeWordVector(descriptors, numKeys, words);
+	for (unsigned int w = 0; w < words.size(); w++) m_invertedFile[words[w].first].push_back(std::make_pair(imageIdx, words[w].second));
+}
+
+void SIFTVocabularyTree::addImage(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys)
+{
+	if (imageIdx >= m_imageAdded.size()) m_imageAdded.resize(imageIdx + 1, false);
+	if (m_imageAdded[imageIdx]) return;
+	m_imageAdded[imageIdx] = true;
+
+	if (isTrained()) {
+		insert(imageIdx, descriptors, numKeys);
+	}
+	else {
+		m_pendingImages.push_back(imageIdx);
+		m_pendingDescriptors.push_back(std::vector<unsigned char>(descriptors, descriptors + 128 * numKeys));
+		if (m_pendingImages.size() >= m_numTrainImages) train();
+	}
+}
+
+void SIFTVocabularyTree::query(const unsigned char* descriptors, unsigned int numKeys, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx,
+	unsigned int maxNumResults, std::vector<unsigned int>& imageIndices) const
+{
+	imageIndices.clear();
+	if (!isTrained() || numKeys == 0 || imageBegin >= imageEnd) return;
+
+	WordVector words;
+	computeWordVector(descriptors, numKeys, words);
+
+	//l1 score 1 - |q - d|_1 / 2 of the normalized vectors, i.e., the sum of the smaller weight over the common words
+	std::vector<float> scores(imageEnd - imageBegin, 0.0f);
+	for (unsigned int w = 0; w < words.size(); w++) {
+		const WordVector& entries = m_invertedFile[words[w].first];
+		for (unsigned int i = 0; i < entries.size(); i++) {
+			const unsigned int image = entries[i].first;
+			if (image < imageBegin || image >= imageEnd || image == excludeIdx) continue;
+			scores[image - imageBegin] += std::min(words[w].second, entries[i].second);
+		}
+	}
+
+	for (unsigned int i = 0; i < scores.size(); i++) {
+		if (scores[i] > 0.0f) imageIndices.push_back(imageBegin + i);
+	}
+	const unsigned int numResults = std::min(maxNumResults, (unsigned int)imageIndices.size());
+	std::partial_sort(imageIndices.begin(), imageIndices.begin() + numResults, imageIndices.end(), [&](unsigned int a, unsigned int b) {
+		return scores[a - imageBegin] > scores[b - imageBegin] || (scores[a - imageBegin] == scores[b - imageBegin] && a < b);
+	});
+	imageIndices.resize(numResults);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef SIFT_VOCABULARY_TREE_H
+#define SIFT_VOCABULARY_TREE_H
+
+#include <vector>
+#include <utility>
+
+#define SIFT_VOCABULARY_BRANCHING 10
+#define SIFT_VOCABULARY_DEPTH 3						//up to 1000 words
+#define SIFT_VOCABULARY_KMEANS_ITERATIONS 10
+#define SIFT_VOCABULARY_MAX_TRAIN_DESCRIPTORS 50000
+
+////////////////////////////////////////////////////////////////
+//class SIFTVocabularyTree
+//description: bag of words place recognition over the keyframe descriptors; a hierarchical k-means vocabulary is
+//             trained on the first images, images are tf-idf weighted word histograms in an inverted file and
+//             queries return the images with the best l1 score
+////////////////////////////////////////////////////////////////
+class SIFTVocabularyTree
+{
+public:
+	//! the vocabulary is trained once numTrainImages images have been added; binaryDescriptors: as SiftMatchGPU
+	SIFTVocabularyTree(unsigned int numTrainImages, bool binaryDescriptors);
+	~SIFTVocabularyTree();
+
+	//! removes all images (a trained vocabulary is kept)
+	void reset();
+
+	bool isTrained() const {
+		return !m_nodeCenters.empty();
+	}
+
+	//! numKeys descriptors of 128 bytes (SIFTKeyPointDesc) of the image imageIdx (SIFTImageManager index)
+	void addImage(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys);
+
+	//! the (at most) maxNumResults added images in [imageBegin, imageEnd) except excludeIdx with the best score, best first
+	void query(const unsigned char* descriptors, unsigned int numKeys, unsigned int imageBegin, unsigned int imageEnd, unsigned int excludeIdx,
+		unsigned int maxNumResults, std::vector<unsigned int>& imageIndices) const;
+
+	//! 128 bytes -> 128 floats (sift bytes) or SIFT_BINARY_DESCRIPTOR_BITS floats (binary bits)
+	static void toFloat(const unsigned char* descriptor, bool binaryDescriptors, float* out);
+	static unsigned int nearestCenter(const float* x, const float* centers, unsigned int numCenters, unsigned int dim);
+	//! lloyd iterations on the samples of indices (dim floats each), initialized with evenly spaced samples (deterministic)
+	static void kmeans(const std::vector<float>& samples, unsigned int dim, const std::vector<unsigned int>& indices, unsigned int numCenters,
+		unsigned int numIterations, std::vector<float>& centers, std::vector<unsigned int>& assignment);
+
+private:
+	typedef std::vector< std::pair<unsigned int, float> > WordVector;	//(word, weight) sorted by word
+
+	void train();
+	void insert(unsigned int imageIdx, const unsigned char* descriptors, unsigned int numKeys);
+	unsigned int quantize(const float* descriptor) const;
+	//! l1 normalized tf-idf histogram
+	void computeWordVector(const unsigned char* descriptors, unsigned int numKeys, WordVector& words) const;
+
+	unsigned int m_numTrainImages;
+	bool m_binaryDescriptors;
+	unsigned int m_dim;
+
+	//tree: children of a node are consecutive, leaves are words
+	std::vector<float> m_nodeCenters;				//m_dim per node (the root has none)
+	std::vector<unsigned int> m_nodeFirstChild;
+	std::vector<unsigned int> m_nodeNumChildren;	//0 for leaves
+	std::vector<unsigned int> m_nodeWord;
+	std::vector<float> m_idf;						//per word
+
+	std::vector<WordVector> m_invertedFile;			//per word: (image, weight)
+	std::vector<bool> m_imageAdded;
+
+	//images added before training
+	std::vector<unsigned int> m_pendingImages;
+	std::vector< std::vector<unsigned char> > m_pendingDescriptors;
+};
+
+#endif
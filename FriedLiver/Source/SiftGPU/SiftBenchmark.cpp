@@ -0,0 +1,281 @@
+#include "stdafx.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+#include "GlobalUtil.h"
+#include "SiftGPU.h"
+#include "SiftCPU.h"
+#include "SiftMatch.h"
+#include "SiftMatchCPU.h"
+#include "SIFTImageManager.h"
+#include "SiftCameraParams.h"
+#include "../GlobalAppState.h"
+#include "../GlobalBundlingState.h"
+#include "../CPUParallel.h"
+
+extern "C" void updateConstantSiftCameraParams(const SiftCameraParams& params);
+
+#define SIFT_BENCHMARK_WARMUP 3
+#define SIFT_BENCHMARK_RUNS 20
+#define SIFT_BENCHMARK_BATCH_IMAGES 16
+
+//! smooth background with gaussian blobs of varying size and contrast (deterministic)
+static void createBenchmarkImage(std::vector<float>& intensity, unsigned int width, unsigned int height)
+{
+	intensity.resize(width * height);
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			intensity[y * width + x] = 0.5f + 0.1f * std::sin(x * 0.013f) * std::cos(y * 0.017f);
+		}
+	}
+	const unsigned int numBlobs = width * height / 1000;
+	unsigned int seed = 12345;
+	auto rnd = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / float(1 << 24); };
+	for (unsigned int i = 0; i < numBlobs; i++) {
+		const float cx = rnd() * width, cy = rnd() * height;
+		const float s = 1.5f + 8.0f * rnd();
+		const float a = rnd() - 0.5f;
+		const int r = (int)(3.0f * s);
+		for (int y = std::max((int)cy - r, 0); y <= std::min((int)cy + r, (int)height - 1); y++) {
+			for (int x = std::max((int)cx - r, 0); x <= std::min((int)cx + r, (int)width - 1); x++) {
+				const float dx = x - cx, dy = y - cy;
+				intensity[y * width + x] += a * std::exp(-(dx*dx + dy*dy) / (2.0f * s*s));
+			}
+		}
+	}
+}
+
+static void setBenchmarkCameraParams(unsigned int width, unsigned int height)
+{
+	SiftCameraParams siftCameraParams;
+	siftCameraParams.m_depthWidth = width;
+	siftCameraParams.m_depthHeight = height;
+	siftCameraParams.m_intensityWidth = width;
+	siftCameraParams.m_intensityHeight = height;
+	siftCameraParams.m_siftIntrinsics.setIdentity();
+	siftCameraParams.m_siftIntrinsicsInv.setIdentity();
+	siftCameraParams.m_downSampIntrinsics.setIdentity();
+	siftCameraParams.m_downSampIntrinsicsInv.setIdentity();
+	siftCameraParams.m_minKeyScale = 0.0f;
+	updateConstantSiftCameraParams(siftCameraParams);
+}
+
+//! average RunSIFT time in ms (after warmup)
+static double timeSiftGPU(float* d_intensity, const float* d_depth, unsigned int width, unsigned int height, unsigned int workers, int& numFeatures)
+{
+	SiftGPU sift;
+	sift.SetParams(width, height, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, workers);
+	sift.InitSiftGPU();
+	for (unsigned int i = 0; i < SIFT_BENCHMARK_WARMUP; i++) sift.RunSIFT(d_intensity, d_depth);
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+
+	Timer timer;
+	for (unsigned int i = 0; i < SIFT_BENCHMARK_RUNS; i++) sift.RunSIFT(d_intensity, d_depth);
+	MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+	timer.stop();
+	numFeatures = sift.GetFeatureNum();
+	return timer.getElapsedTimeMS() / SIFT_BENCHMARK_RUNS;
+}
+
+static double timeSiftCPU(const float* intensity, const float* depth, unsigned int width, unsigned int height, unsigned int workers, bool tiled, int& numFeatures)
+{
+	CPUParallel::destroy();
+	CPUParallel::init(workers);
+
+	SiftCPU sift;
+	sift.SetParams(width, height, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, tiled ? std::max(workers, 2u) : 1);
+	sift.SetCameraParams(width, height, 0.0f);
+	sift.InitSiftCPU();
+	for (unsigned int i = 0; i < SIFT_BENCHMARK_WARMUP; i++) sift.RunSIFT(intensity, depth);
+
+	Timer timer;
+	for (unsigned int i = 0; i < SIFT_BENCHMARK_RUNS; i++) sift.RunSIFT(intensity, depth);
+	timer.stop();
+	numFeatures = sift.GetFeatureNum();
+	return timer.getElapsedTimeMS() / SIFT_BENCHMARK_RUNS;
+}
+
+//! descriptors of the window (offsetX, offsetY, width, height) of the benchmark image, at most maxNumKeys
+static void detectBenchmarkDescriptors(const std::vector<float>& image, unsigned int imageWidth, unsigned int offsetX, unsigned int offsetY,
+	unsigned int width, unsigned int height, unsigned int maxNumKeys, std::vector<SIFTKeyPointDesc>& descriptors)
+{
+	std::vector<float> intensity(width * height);
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) intensity[y * width + x] = image[(y + offsetY) * imageWidth + x + offsetX];
+	}
+	const float depthValue = 0.5f * (GlobalAppState::get().s_sensorDepthMin + GlobalAppState::get().s_sensorDepthMax);
+	std::vector<float> depth(width * height, depthValue);
+
+	SiftCPU sift;
+	sift.SetParams(width, height, false, 150, GlobalAppState::get().s_sensorDepthMin, GlobalAppState::get().s_sensorDepthMax, 1, GlobalBundlingState::get().s_useBinaryDescriptors);
+	sift.SetCameraParams(width, height, 0.0f);
+	sift.InitSiftCPU();
+	sift.RunSIFT(intensity.data(), depth.data());
+	std::vector<SIFTKeyPoint> keyPoints(sift.GetFeatureNum());
+	descriptors.resize(sift.GetFeatureNum());
+	descriptors.resize(sift.GetKeyPointsAndDescriptors(keyPoints.data(), descriptors.data(), maxNumKeys));
+}
+
+void runSiftPyramidBenchmark()
+{
+	const unsigned int sizes[][2] = { { 640, 480 }, { 1280, 960 } };
+	const unsigned int workers[] = { 1, 2, 4, 8 };
+	const float depthValue = 0.5f * (GlobalAppState::get().s_sensorDepthMin + GlobalAppState::get().s_sensorDepthMax);
+
+	std::cout << "sift detection latency [ms] (" << SIFT_BENCHMARK_RUNS << " runs)" << std::endl;
+	std::cout << std::setw(10) << "size" << std::setw(9) << "workers"
+		<< std::setw(14) << "gpu streams" << std::setw(14) << "cpu seq" << std::setw(14) << "cpu tiled" << std::setw(10) << "#keys" << std::endl;
+	for (const auto& size : sizes) {
+		const unsigned int width = size[0], height = size[1];
+		std::vector<float> intensity, depth(width * height, depthValue);
+		createBenchmarkImage(intensity, width, height);
+
+		float* d_intensity = NULL; float* d_depth = NULL;
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_intensity, sizeof(float) * width * height));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_depth, sizeof(float) * width * height));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_intensity, intensity.data(), sizeof(float) * width * height, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_depth, depth.data(), sizeof(float) * width * height, cudaMemcpyHostToDevice));
+		setBenchmarkCameraParams(width, height);
+
+		for (unsigned int w : workers) {
+			int numGPU = 0, numSeq = 0, numTiled = 0;
+			const double msGPU = timeSiftGPU(d_intensity, d_depth, width, height, w, numGPU);
+			const double msSeq = timeSiftCPU(intensity.data(), depth.data(), width, height, w, false, numSeq);
+			const double msTiled = timeSiftCPU(intensity.data(), depth.data(), width, height, w, true, numTiled);
+			if (numSeq != numTiled) std::cout << "warning: tiled cpu pyramid found " << numTiled << " instead of " << numSeq << " keys" << std::endl;
+			std::cout << std::setw(10) << (std::to_string(width) + "x" + std::to_string(height)) << std::setw(9) << w
+				<< std::fixed << std::setprecision(2) << std::setw(14) << msGPU << std::setw(14) << msSeq << std::setw(14) << msTiled
+				<< std::setw(10) << numGPU << std::endl;
+		}
+
+		MLIB_CUDA_SAFE_FREE(d_intensity);
+		MLIB_CUDA_SAFE_FREE(d_depth);
+	}
+
+	CPUParallel::destroy();
+	CPUParallel::init(GlobalAppState::get().s_cpuNumThreads);
+}
+
+void runSiftMatchBenchmark()
+{
+	const unsigned int sizes[][2] = { { 640, 480 }, { 1280, 960 } };
+	const unsigned int threads[] = { 1, 2, 4, 8 };
+	const unsigned int maxNumKeys = GlobalBundlingState::get().s_maxNumKeysPerImage;
+	const bool binary = GlobalBundlingState::get().s_useBinaryDescriptors;
+	const float distMax = binary ? SiftMatchGPU::HammingToDistance(GlobalBundlingState::get().s_binaryMatchMaxHamming) : GlobalBundlingState::get().s_siftMatchThresh;
+	const float ratioMax = GlobalBundlingState::get().s_siftMatchRatioMaxGlobal;
+	const unsigned int shiftX = 9, shiftY = 5;	//second view of the same image
+
+	std::cout << "sift matching throughput (" << SIFT_BENCHMARK_RUNS << " runs, " << (binary ? "binary" : "sift") << " descriptors)" << std::endl;
+	std::cout << std::setw(10) << "size" << std::setw(12) << "#keys" << std::setw(9) << "threads"
+		<< std::setw(12) << "gpu [ms]" << std::setw(12) << "cpu [ms]" << std::setw(16) << "gpu [Mdesc/s]" << std::setw(16) << "cpu [Mdesc/s]"
+		<< std::setw(14) << "gpu [pair/s]" << std::setw(14) << "cpu [pair/s]" << std::setw(10) << "#matches" << std::endl;
+	for (const auto& size : sizes) {
+		const unsigned int width = size[0], height = size[1];
+		std::vector<float> image;
+		createBenchmarkImage(image, width + shiftX, height + shiftY);
+		std::vector<SIFTKeyPointDesc> des1, des2;
+		detectBenchmarkDescriptors(image, width + shiftX, 0, 0, width, height, maxNumKeys, des1);
+		detectBenchmarkDescriptors(image, width + shiftX, shiftX, shiftY, width, height, maxNumKeys, des2);
+		const int num1 = (int)des1.size(), num2 = (int)des2.size();
+		if (num1 == 0 || num2 == 0) continue;
+		const double numDescriptorPairs = (double)num1 * (double)num2;
+
+		//gpu
+		unsigned char* d_des1 = NULL; unsigned char* d_des2 = NULL;
+		ImagePairMatch imagePairMatch;
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_des1, sizeof(SIFTKeyPointDesc) * num1));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_des2, sizeof(SIFTKeyPointDesc) * num2));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&imagePairMatch.d_numMatches, sizeof(int)));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&imagePairMatch.d_distances, sizeof(float) * MAX_MATCHES_PER_IMAGE_PAIR_RAW));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&imagePairMatch.d_keyPointIndices, sizeof(uint2) * MAX_MATCHES_PER_IMAGE_PAIR_RAW));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_des1, des1.data(), sizeof(SIFTKeyPointDesc) * num1, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_des2, des2.data(), sizeof(SIFTKeyPointDesc) * num2, cudaMemcpyHostToDevice));
+
+		SiftMatchGPU matcherGPU(maxNumKeys, binary);
+		matcherGPU.InitSiftMatch();
+		matcherGPU.SetDescriptors(0, num1, d_des1);
+		matcherGPU.SetDescriptors(1, num2, d_des2);
+		for (unsigned int i = 0; i < SIFT_BENCHMARK_WARMUP; i++) matcherGPU.GetSiftMatch(num1, imagePairMatch, make_uint2(0, 0), distMax, ratioMax);
+		MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+		Timer timer;
+		for (unsigned int i = 0; i < SIFT_BENCHMARK_RUNS; i++) matcherGPU.GetSiftMatch(num1, imagePairMatch, make_uint2(0, 0), distMax, ratioMax);
+		MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+		timer.stop();
+		const double msGPU = timer.getElapsedTimeMS() / SIFT_BENCHMARK_RUNS;
+		int numMatchesGPU = 0;
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(&numMatchesGPU, imagePairMatch.d_numMatches, sizeof(int), cudaMemcpyDeviceToHost));
+
+		//gpu, des2 against SIFT_BENCHMARK_BATCH_IMAGES copies of des1 in one GetSiftMatchBatch
+		unsigned char* d_batchDes = NULL;
+		ImagePairMatch batchPairMatch;
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_batchDes, sizeof(SIFTKeyPointDesc) * num1 * SIFT_BENCHMARK_BATCH_IMAGES));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&batchPairMatch.d_numMatches, sizeof(int) * SIFT_BENCHMARK_BATCH_IMAGES));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&batchPairMatch.d_distances, sizeof(float) * MAX_MATCHES_PER_IMAGE_PAIR_RAW * SIFT_BENCHMARK_BATCH_IMAGES));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&batchPairMatch.d_keyPointIndices, sizeof(uint2) * MAX_MATCHES_PER_IMAGE_PAIR_RAW * SIFT_BENCHMARK_BATCH_IMAGES));
+		for (unsigned int i = 0; i < SIFT_BENCHMARK_BATCH_IMAGES; i++) {
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_batchDes + sizeof(SIFTKeyPointDesc) * num1 * i, des1.data(), sizeof(SIFTKeyPointDesc) * num1, cudaMemcpyHostToDevice));
+		}
+		const std::vector<unsigned int> batchNumKeys(SIFT_BENCHMARK_BATCH_IMAGES, num1);
+		const std::vector<int> batchValid(SIFT_BENCHMARK_BATCH_IMAGES, 1);
+		for (unsigned int i = 0; i < SIFT_BENCHMARK_WARMUP; i++) {
+			matcherGPU.GetSiftMatchBatch(SIFT_BENCHMARK_BATCH_IMAGES, batchNumKeys.data(), batchValid.data(), d_batchDes, batchPairMatch, make_uint2(0, 0), distMax, ratioMax);
+		}
+		MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+		timer.start();
+		for (unsigned int i = 0; i < SIFT_BENCHMARK_RUNS; i++) {
+			matcherGPU.GetSiftMatchBatch(SIFT_BENCHMARK_BATCH_IMAGES, batchNumKeys.data(), batchValid.data(), d_batchDes, batchPairMatch, make_uint2(0, 0), distMax, ratioMax);
+		}
+		MLIB_CUDA_SAFE_CALL(cudaDeviceSynchronize());
+		timer.stop();
+		const double msGPUBatch = timer.getElapsedTimeMS() / (SIFT_BENCHMARK_RUNS * SIFT_BENCHMARK_BATCH_IMAGES);
+		std::cout << std::setw(10) << (std::to_string(width) + "x" + std::to_string(height)) << " gpu per pair " << std::fixed << std::setprecision(3) << msGPU
+			<< " ms, batched (" << SIFT_BENCHMARK_BATCH_IMAGES << " images per pass) " << msGPUBatch << " ms per pair" << std::endl;
+		MLIB_CUDA_SAFE_FREE(d_batchDes);
+		MLIB_CUDA_SAFE_FREE(batchPairMatch.d_numMatches);
+		MLIB_CUDA_SAFE_FREE(batchPairMatch.d_distances);
+		MLIB_CUDA_SAFE_FREE(batchPairMatch.d_keyPointIndices);
+
+		//cpu
+		std::vector<uint2> keyPointIndices(MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+		std::vector<float> matchDistances(MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+		for (unsigned int t : threads) {
+			CPUParallel::destroy();
+			CPUParallel::init(t);
+
+			SiftMatchCPU matcherCPU(maxNumKeys, binary);
+			matcherCPU.SetDescriptors(0, num1, (const unsigned char*)des1.data());
+			matcherCPU.SetDescriptors(1, num2, (const unsigned char*)des2.data());
+			int numMatchesCPU = 0;
+			for (unsigned int i = 0; i < SIFT_BENCHMARK_WARMUP; i++) {
+				numMatchesCPU = matcherCPU.GetSiftMatch(MAX_MATCHES_PER_IMAGE_PAIR_RAW, keyPointIndices.data(), matchDistances.data(), make_uint2(0, 0), distMax, ratioMax);
+			}
+			timer.start();
+			for (unsigned int i = 0; i < SIFT_BENCHMARK_RUNS; i++) {
+				matcherCPU.GetSiftMatch(MAX_MATCHES_PER_IMAGE_PAIR_RAW, keyPointIndices.data(), matchDistances.data(), make_uint2(0, 0), distMax, ratioMax);
+			}
+			timer.stop();
+			const double msCPU = timer.getElapsedTimeMS() / SIFT_BENCHMARK_RUNS;
+			if (std::min(numMatchesGPU, MAX_MATCHES_PER_IMAGE_PAIR_RAW) != numMatchesCPU) {
+				std::cout << "warning: cpu matcher found " << numMatchesCPU << " instead of " << numMatchesGPU << " matches" << std::endl;
+			}
+			std::cout << std::setw(10) << (std::to_string(width) + "x" + std::to_string(height))
+				<< std::setw(12) << (std::to_string(num1) + "x" + std::to_string(num2)) << std::setw(9) << t
+				<< std::fixed << std::setprecision(3) << std::setw(12) << msGPU << std::setw(12) << msCPU
+				<< std::setprecision(1) << std::setw(16) << numDescriptorPairs / msGPU / 1000.0 << std::setw(16) << numDescriptorPairs / msCPU / 1000.0
+				<< std::setprecision(0) << std::setw(14) << 1000.0 / msGPU << std::setw(14) << 1000.0 / msCPU
+				<< std::setw(10) << numMatchesCPU << std::endl;
+		}
+
+		MLIB_CUDA_SAFE_FREE(d_des1);
+		MLIB_CUDA_SAFE_FREE(d_des2);
+		MLIB_CUDA_SAFE_FREE(imagePairMatch.d_numMatches);
+		MLIB_CUDA_SAFE_FREE(imagePairMatch.d_distances);
+		MLIB_CUDA_SAFE_FREE(imagePairMatch.d_keyPointIndices);
+	}
+
+	CPUParallel::destroy();
+	CPUParallel::init(GlobalAppState::get().s_cpuNumThreads);
+}
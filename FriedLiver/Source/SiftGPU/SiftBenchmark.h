@@ -0,0 +1,15 @@
+#pragma once
+
+#ifndef SIFT_BENCHMARK_H
+#define SIFT_BENCHMARK_H
+
+//! s_siftBenchmark: sift detection latency (RunSIFT) of SiftGPU and SiftCPU at 640x480 and 1280x960 for 1, 2, 4 and 8
+//! pyramid workers (GlobalUtil::_PyramidWorkers: cuda streams / CPUParallel threads), printed to std::cout;
+//! expects CPUParallel and the bundling device to be set up, leaves CPUParallel with s_cpuNumThreads threads
+void runSiftPyramidBenchmark();
+//! s_siftBenchmark: descriptor matching throughput (GetSiftMatch) of SiftMatchGPU and SiftMatchCPU for 1, 2, 4 and 8
+//! CPUParallel threads on SiftCPU descriptors of two overlapping views, and of SiftMatchGPU::GetSiftMatchBatch per image pair,
+//! printed to std::cout; same setup as above
+void runSiftMatchBenchmark();
+
+#endif
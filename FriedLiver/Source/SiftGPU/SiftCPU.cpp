@@ -0,0 +1,892 @@
+#include "stdafx.h"
+
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "GlobalUtil.h"
+#include "SiftCPU.h"
+#include "ProgramCU.h"
+#include "../CPUParallel.h"
+#include "../CPUSimd.h"
+#include "mLibCuda.h"
+
+//same constants as ProgramCU.cu
+#define SIFT_CPU_KERNEL_MAX_WIDTH 33
+#define SIFT_CPU_ORIENTATION_WINDOW_FACTOR 2.0f
+#define SIFT_CPU_ORIENTATION_GAUSSIAN_FACTOR 1.5f
+#define SIFT_CPU_DESCRIPTOR_WINDOW_FACTOR 3.0f
+#define SIFT_CPU_ROWS_PER_TASK 4		//rows per CPUParallel chunk
+#define SIFT_CPU_KEYS_PER_TASK 8		//keypoints per CPUParallel chunk
+#define SIFT_CPU_TILE_ROWS 64			//rows per tile of the concurrent pyramid schedule (GlobalUtil::_PyramidWorkers > 1)
+
+#define SIFT_CPU_MINF (-std::numeric_limits<float>::infinity())
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pyramid kernels (FilterH/FilterV, DownsampleKernel, ComputeDOG_Kernel)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//! FilterH: borders clamp to the row, accumulation in kernel order
+static void filterRowH(float* out, const float* in, int width, const std::vector<float>& kernel)
+{
+	const int fw = (int)kernel.size();
+	const int half = fw >> 1;
+	const int W = (int)vfloat::Width;
+	int x = 0;
+	for (; x < std::min(half, width); x++) {
+		float value = 0.0f;
+		for (int i = 0; i < fw; i++) value += in[std::min(std::max(x - half + i, 0), width - 1)] * kernel[i];
+		out[x] = value;
+	}
+	for (; x + W <= width - half; x += W) {
+		vfloat value = vzero();
+		for (int i = 0; i < fw; i++) value = value + vload(in + x - half + i) * vset1(kernel[i]);
+		vstore(out + x, value);
+	}
+	for (; x < width; x++) {
+		float value = 0.0f;
+		for (int i = 0; i < fw; i++) value += in[std::min(std::max(x - half + i, 0), width - 1)] * kernel[i];
+		out[x] = value;
+	}
+}
+
+//! FilterV: rows[i] is the (clamped) input row under kernel tap i
+static void filterRowV(float* out, const float* const* rows, int width, const std::vector<float>& kernel)
+{
+	const int fw = (int)kernel.size();
+	const int W = (int)vfloat::Width;
+	int x = 0;
+	for (; x + W <= width; x += W) {
+		vfloat value = vzero();
+		for (int i = 0; i < fw; i++) value = value + vload(rows[i] + x) * vset1(kernel[i]);
+		vstore(out + x, value);
+	}
+	for (; x < width; x++) {
+		float value = 0.0f;
+		for (int i = 0; i < fw; i++) value += rows[i][x] * kernel[i];
+		out[x] = value;
+	}
+}
+
+static void filterImage(float* output, const float* input, float* buffer, int width, int height, const std::vector<float>& kernel)
+{
+	const int half = (int)kernel.size() >> 1;
+	CPUParallel::parallelFor(0, height, [&](unsigned int b, unsigned int e) {
+		for (unsigned int y = b; y < e; y++) filterRowH(buffer + y*width, input + y*width, width, kernel);
+	}, SIFT_CPU_ROWS_PER_TASK);
+	CPUParallel::parallelFor(0, height, [&](unsigned int b, unsigned int e) {
+		const float* rows[SIFT_CPU_KERNEL_MAX_WIDTH];
+		for (unsigned int y = b; y < e; y++) {
+			for (int i = 0; i < (int)kernel.size(); i++) rows[i] = buffer + std::min(std::max((int)y - half + i, 0), height - 1)*width;
+			filterRowV(output + y*width, rows, width, kernel);
+		}
+	}, SIFT_CPU_ROWS_PER_TASK);
+}
+
+//! filterImage for the rows [rowBegin, rowEnd) only: the horizontal pass covers the tile plus a halo of half the
+//! kernel width into tileBuffer (same arithmetic, so the result matches filterImage)
+static void filterTile(float* output, const float* input, std::vector<float>& tileBuffer, int width, int height, int rowBegin, int rowEnd, const std::vector<float>& kernel)
+{
+	const int half = (int)kernel.size() >> 1;
+	const int haloBegin = std::max(rowBegin - half, 0);
+	const int haloEnd = std::min(rowEnd + half, height);
+	if (tileBuffer.size() < (size_t)((haloEnd - haloBegin) * width)) tileBuffer.resize((haloEnd - haloBegin) * width);
+	for (int y = haloBegin; y < haloEnd; y++) filterRowH(tileBuffer.data() + (y - haloBegin)*width, input + y*width, width, kernel);
+
+	const float* rows[SIFT_CPU_KERNEL_MAX_WIDTH];
+	for (int y = rowBegin; y < rowEnd; y++) {
+		for (int i = 0; i < (int)kernel.size(); i++) rows[i] = tileBuffer.data() + (std::min(std::max(y - half + i, 0), height - 1) - haloBegin)*width;
+		filterRowV(output + y*width, rows, width, kernel);
+	}
+}
+
+//! DownsampleKernel with log_scale 1
+static void downsampleRows(float* output, int outputWidth, const float* input, int inputWidth, unsigned int rowBegin, unsigned int rowEnd)
+{
+	for (unsigned int y = rowBegin; y < rowEnd; y++) {
+		const float* in = input + (2 * y)*inputWidth;
+		float* out = output + y*outputWidth;
+		for (int x = 0; x < outputWidth; x++) out[x] = in[std::min(2 * x, inputWidth - 1)];
+	}
+}
+
+static void downsampleImage(float* output, int outputWidth, int outputHeight, const float* input, int inputWidth)
+{
+	CPUParallel::parallelFor(0, outputHeight, [&](unsigned int b, unsigned int e) {
+		downsampleRows(output, outputWidth, input, inputWidth, b, e);
+	}, SIFT_CPU_ROWS_PER_TASK);
+}
+
+//! ComputeDOG_Kernel; gradients (magnitude, rotation) only where gradMag is given and only off the border
+//! (orientations and descriptors sample pixels 1..width-2, 1..height-2)
+static void computeDOGRows(float* dog, float* gradMag, float* gradRot, const float* gus, const float* gusPrev, int width, int height, unsigned int rowBegin, unsigned int rowEnd)
+{
+	const int W = (int)vfloat::Width;
+	for (unsigned int y = rowBegin; y < rowEnd; y++) {
+		const unsigned int row = y*width;
+		int x = 0;
+		for (; x + W <= width; x += W) vstore(dog + row + x, vload(gus + row + x) - vload(gusPrev + row + x));
+		for (; x < width; x++) dog[row + x] = gus[row + x] - gusPrev[row + x];
+
+		if (!gradMag) continue;
+		if (y == 0 || y == (unsigned int)height - 1) {
+			std::fill(gradMag + row, gradMag + row + width, 0.0f);
+			std::fill(gradRot + row, gradRot + row + width, 0.0f);
+			continue;
+		}
+		gradMag[row] = gradRot[row] = 0.0f;
+		gradMag[row + width - 1] = gradRot[row + width - 1] = 0.0f;
+		x = 1;
+		for (; x + W <= width - 1; x += W) {
+			const unsigned int idx = row + x;
+			const vfloat dx = vload(gus + idx + 1) - vload(gus + idx - 1);
+			const vfloat dy = vload(gus + idx + width) - vload(gus + idx - width);
+			const vfloat grd = vset1(0.5f) * vsqrt(dx*dx + dy*dy);
+			vstore(gradMag + idx, grd);
+			vstore(gradRot + idx, vselect(vcmpeq(grd, vzero()), vzero(), vatan2(dy, dx)));
+		}
+		for (; x < width - 1; x++) {
+			const unsigned int idx = row + x;
+			const float dx = gus[idx + 1] - gus[idx - 1];
+			const float dy = gus[idx + width] - gus[idx - width];
+			const float grd = 0.5f * std::sqrt(dx*dx + dy*dy);
+			gradMag[idx] = grd;
+			gradRot[idx] = grd == 0.0f ? 0.0f : std::atan2(dy, dx);
+		}
+	}
+}
+
+//! sampleLevelBilinear (ProgramCU.cu): texture coordinates, clamped to the level
+static inline float sampleLevelBilinear(const float* gus, int width, int height, float x, float y)
+{
+	x = std::min(std::max(x - 0.5f, 0.0f), width - 1.0f);
+	y = std::min(std::max(y - 0.5f, 0.0f), height - 1.0f);
+	const int x0 = std::min((int)x, width - 2);
+	const int y0 = std::min((int)y, height - 2);
+	const float fx = x - x0, fy = y - y0;
+	const float* p = gus + y0 * width + x0;
+	return (1.0f - fy) * ((1.0f - fx) * p[0] + fx * p[1]) + fy * ((1.0f - fx) * p[width] + fx * p[width + 1]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Keypoint test (ComputeKEY_Kernel without subpixel localization)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//! READ_CMP_DOG_DATA; the comparison direction depends on the running nmax/nmin exactly as on the gpu
+static inline bool readCmpDOG(const float* p, float v, float& nmax, float& nmin)
+{
+	if (v > nmax) {
+		nmax = std::max(nmax, p[-1]);
+		nmax = std::max(nmax, p[0]);
+		nmax = std::max(nmax, p[1]);
+		return !(v < nmax);
+	}
+	else {
+		nmin = std::min(nmin, p[-1]);
+		nmin = std::min(nmin, p[0]);
+		nmin = std::min(nmin, p[1]);
+		return !(v > nmin);
+	}
+}
+
+//! remaining tests at a pixel that passed the threshold and the left/right comparison
+static inline bool isKeypoint(const float* dogC, const float* dogP, const float* dogN, int index, int width, float edgeThreshold)
+{
+	const float v = dogC[index];
+	float nmax = std::max(dogC[index - 1], dogC[index + 1]);
+	float nmin = std::min(dogC[index - 1], dogC[index + 1]);
+	if (!readCmpDOG(dogC + index - width, v, nmax, nmin)) return false;
+	if (!readCmpDOG(dogC + index + width, v, nmax, nmin)) return false;
+
+	//edge supression
+	const float vx2 = v * 2.0f;
+	const float fxx = dogC[index - 1] + dogC[index + 1] - vx2;
+	const float fyy = dogC[index - width] + dogC[index + width] - vx2;
+	const float fxy = 0.25f * (dogC[index + width + 1] + dogC[index - width - 1] - dogC[index + width - 1] - dogC[index - width + 1]);
+	const float temp1 = fxx * fyy - fxy * fxy;
+	const float temp2 = (fxx + fyy) * (fxx + fyy);
+	if (temp1 <= 0 || temp2 > edgeThreshold * temp1) return false;
+
+	for (int r = -1; r <= 1; r++) {
+		if (!readCmpDOG(dogP + index + r*width, v, nmax, nmin)) return false;
+	}
+	for (int r = -1; r <= 1; r++) {
+		if (!readCmpDOG(dogN + index + r*width, v, nmax, nmin)) return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SiftCPU
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SiftCPU::SiftCPU()
+{
+	m_initialized = false;
+	m_octaveNum = 0;
+	m_featureNum = 0;
+	m_depthWidth = 0;
+	m_depthHeight = 0;
+	m_minKeyScale = 0.0f;
+	m_numTimedFrames = 0;
+}
+
+SiftCPU::~SiftCPU()
+{
+}
+
+void SiftCPU::InitSiftCPU()
+{
+	if (m_initialized) return;
+	if (GlobalUtil::_octave_min_default != 0) throw MLIB_EXCEPTION("SiftCPU only supports a first octave of 0");
+	if (GlobalUtil::_InitPyramidWidth <= 0 || GlobalUtil::_InitPyramidHeight <= 0 || (GlobalUtil::_InitPyramidWidth & 3) != 0)
+		throw MLIB_EXCEPTION("invalid sift pyramid size (width must be a multiple of 4)");
+
+	ComputeSiftParam();
+	m_filterKernels.resize(m_filterSigmas.size());
+	m_filterWidths.resize(m_filterSigmas.size());
+	for (unsigned int i = 0; i < m_filterSigmas.size(); i++) {
+		float kernel[SIFT_CPU_KERNEL_MAX_WIDTH];
+		int width;
+		ProgramCU::CreateFilterKernel(m_filterSigmas[i], kernel, width);
+		m_filterKernels[i].assign(kernel, kernel + width);
+		m_filterWidths[i] = width;
+	}
+	m_binaryPattern.resize(SIFT_BINARY_DESCRIPTOR_BITS);
+	ProgramCU::CreateBinaryPattern(m_binaryPattern.data());
+
+	//same layout as SiftPyramid::ResizePyramid
+	int w = GlobalUtil::_InitPyramidWidth;
+	int h = GlobalUtil::_InitPyramidHeight;
+	m_octaveNum = GlobalUtil::_octave_num_default;
+	if (m_octaveNum < 1) {
+		m_octaveNum = (int)floor(log(double(std::min(w, h))) / log(2.0)) - 3;
+		if (m_octaveNum < 1) m_octaveNum = 1;
+	}
+
+	m_octaveWidth.resize(m_octaveNum);
+	m_octaveHeight.resize(m_octaveNum);
+	m_gaussian.resize(m_octaveNum * _level_num);
+	m_dog.resize(m_octaveNum * _level_num);
+	m_gradMag.resize(m_octaveNum * _level_num);
+	m_gradRot.resize(m_octaveNum * _level_num);
+	m_levelCapacity.resize(m_octaveNum * _dog_level_num);
+	for (int i = 0; i < m_octaveNum; i++) {
+		const unsigned int wa = ((w + 3) / 4) * 4;
+		m_octaveWidth[i] = wa;
+		m_octaveHeight[i] = h;
+		for (int j = 0; j < _level_num; j++) {
+			const unsigned int idx = i * _level_num + j;
+			m_gaussian[idx].resize(wa * h);
+			if (j == 0) continue;
+			m_dog[idx].resize(wa * h);
+			if (j < 1 + _dog_level_num) {
+				m_gradMag[idx].resize(wa * h);
+				m_gradRot[idx].resize(wa * h);
+			}
+		}
+
+		int fmax = int(wa * h * GlobalUtil::_MaxFeaturePercent);
+		if (fmax > GlobalUtil::_MaxLevelFeatureNum) fmax = GlobalUtil::_MaxLevelFeatureNum;
+		else if (fmax < 32) fmax = 32;
+		for (int j = 0; j < _dog_level_num; j++) m_levelCapacity[i * _dog_level_num + j] = fmax;
+
+		w >>= 1;
+		h >>= 1;
+	}
+	m_filterBuffer.resize(m_octaveWidth[0] * m_octaveHeight[0]);
+
+	const unsigned int numLevels = m_octaveNum * _dog_level_num;
+	m_rawKeys.resize(numLevels);
+	m_rawOrientations.resize(numLevels);
+	m_keys.resize(numLevels);
+	m_descriptors.resize(numLevels);
+	m_binaryDescriptors.resize(numLevels);
+	m_levelFeatureNum.resize(numLevels, 0);
+	for (unsigned int i = 0; i < numLevels; i++) {
+		m_rawKeys[i].reserve(m_levelCapacity[i]);
+		m_keys[i].reserve(m_levelCapacity[i]);
+	}
+
+	m_initialized = true;
+}
+
+void SiftCPU::SetCameraParams(unsigned int depthWidth, unsigned int depthHeight, float minKeyScale)
+{
+	m_depthWidth = depthWidth;
+	m_depthHeight = depthHeight;
+	m_minKeyScale = minKeyScale;
+}
+
+int SiftCPU::RunSIFT(const float* colorData, const float* depthData)
+{
+	if (!m_initialized || colorData == NULL) return 0;
+	if (m_depthWidth == 0 || m_depthHeight == 0) throw MLIB_EXCEPTION("SiftCPU camera params not set");
+
+	//keep the depth for GetKeyPointsAndDescriptors (RunSIFTCUDA already downloaded into it)
+	if (depthData != m_depthDownload.data()) m_depthDownload.assign(depthData, depthData + m_depthWidth * m_depthHeight);
+
+	StartTiming();
+	BuildPyramid(colorData);
+	EndTiming("BuildPyramid");
+
+	StartTiming();
+	DetectKeypoints(m_depthDownload.data());
+	EndTiming("DetectKeypoints");
+
+	StartTiming();
+	LimitFeatureCount();
+	EndTiming("LimitFeatureCount");
+
+	StartTiming();
+	GetFeatureOrientations();
+	EndTiming("GetFeatureOrientations");
+
+	StartTiming();
+	//ReshapeFeatureList: final keys per orientation, min key scale
+	const float factor = (float)(2.0*3.14159265358979323846 / 65535.0);
+	m_featureNum = 0;
+	for (int i = 0; i < (int)m_levelFeatureNum.size(); i++) {
+		std::vector<KeyPoint>& keys = m_keys[i];
+		keys.clear();
+		if (m_levelFeatureNum[i] == 0) continue;
+		const float keyLocScale = GetOctaveScale(i / _dog_level_num);
+		const float sigma = GetLevelSigma(i % _dog_level_num + _level_min + 1);
+		if (sigma * keyLocScale < m_minKeyScale) {
+			m_levelFeatureNum[i] = 0;
+			continue;
+		}
+		for (int k = 0; k < m_levelFeatureNum[i] && keys.size() < m_levelCapacity[i]; k++) {
+			const unsigned short us0 = (unsigned short)(m_rawOrientations[i][k] & 0xffff);
+			const unsigned short us1 = (unsigned short)(m_rawOrientations[i][k] >> 16);
+			if (us0 == 65535) continue;
+			KeyPoint key;
+			key.x = m_rawKeys[i][k].x + 0.5f;
+			key.y = m_rawKeys[i][k].y + 0.5f;
+			key.s = sigma;
+			key.o = factor * us0;
+			keys.push_back(key);
+			if (us1 != 65535 && us1 != us0 && keys.size() < m_levelCapacity[i]) {
+				key.o = factor * us1;
+				keys.push_back(key);
+			}
+		}
+		m_levelFeatureNum[i] = (int)keys.size();
+		m_featureNum += m_levelFeatureNum[i];
+	}
+	LimitFeatureCount();
+	EndTiming("ReshapeFeatureList");
+
+	StartTiming();
+	if (GlobalUtil::_BinaryDescriptor) GetFeatureBinaryDescriptors();
+	else GetFeatureDescriptors();
+	EndTiming("GetFeatureDescriptors");
+
+	if (GlobalUtil::_EnableDetailedTimings) m_numTimedFrames++;
+	return 1;
+}
+
+int SiftCPU::RunSIFTCUDA(const float* d_colorData, const float* d_depthData)
+{
+	if (!m_initialized || d_colorData == NULL) return 0;
+	m_colorDownload.resize(m_octaveWidth[0] * m_octaveHeight[0]);
+	m_depthDownload.resize(m_depthWidth * m_depthHeight);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_colorDownload.data(), d_colorData, sizeof(float)*m_colorDownload.size(), cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_depthDownload.data(), d_depthData, sizeof(float)*m_depthDownload.size(), cudaMemcpyDeviceToHost));
+	return RunSIFT(m_colorDownload.data(), m_depthDownload.data());
+}
+
+void SiftCPU::BuildPyramid(const float* colorData)
+{
+	if (GlobalUtil::_PyramidWorkers > 1 && m_octaveNum > 1) {
+		BuildPyramidTiled(colorData);
+		return;
+	}
+
+	//SiftPyramid::BuildPyramid for octave_min 0 (no _sigma_skip1)
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		if (i == 0) {
+			filterImage(Gaussian(i, 0), colorData, m_filterBuffer.data(), width, height, m_filterKernels[0]);
+		}
+		else {
+			downsampleImage(Gaussian(i, 0), width, height, Gaussian(i - 1, _level_ds - _level_min), m_octaveWidth[i - 1]);
+		}
+		for (int j = 0; j < _level_num - 1; j++) {
+			filterImage(Gaussian(i, j + 1), Gaussian(i, j), m_filterBuffer.data(), width, height, m_filterKernels[j + 1]);
+		}
+	}
+}
+
+void SiftCPU::BuildPyramidTiled(const float* colorData)
+{
+	//level (o, l) needs (o, l-1), level 0 of octave o needs level _level_ds - _level_min of octave o-1:
+	//level l of octave o runs in step o*octaveOffset + l, together with the levels of the other octaves in that step
+	const int octaveOffset = _level_ds - _level_min + 1;
+	const int numSteps = (m_octaveNum - 1) * octaveOffset + _level_num;
+
+	std::vector<int2> tasks;					//(octave, level)
+	std::vector<unsigned int> taskTileOffset;	//prefix sum of the tiles per task
+	for (int t = 0; t < numSteps; t++) {
+		tasks.clear();
+		taskTileOffset.clear();
+		taskTileOffset.push_back(0);
+		for (int o = 0; o < m_octaveNum; o++) {
+			const int l = t - o * octaveOffset;
+			if (l < 0 || l >= _level_num) continue;
+			tasks.push_back(make_int2(o, l));
+			taskTileOffset.push_back(taskTileOffset.back() + (m_octaveHeight[o] + SIFT_CPU_TILE_ROWS - 1) / SIFT_CPU_TILE_ROWS);
+		}
+
+		CPUParallel::parallelFor(0, taskTileOffset.back(), [&](unsigned int b, unsigned int e) {
+			std::vector<float> tileBuffer;
+			for (unsigned int u = b; u < e; u++) {
+				const unsigned int k = (unsigned int)(std::upper_bound(taskTileOffset.begin(), taskTileOffset.end(), u) - taskTileOffset.begin()) - 1;
+				const int o = tasks[k].x;
+				const int l = tasks[k].y;
+				const int width = m_octaveWidth[o];
+				const int height = m_octaveHeight[o];
+				const int rowBegin = (u - taskTileOffset[k]) * SIFT_CPU_TILE_ROWS;
+				const int rowEnd = std::min(rowBegin + SIFT_CPU_TILE_ROWS, height);
+				if (l > 0) {
+					filterTile(Gaussian(o, l), Gaussian(o, l - 1), tileBuffer, width, height, rowBegin, rowEnd, m_filterKernels[l]);
+				}
+				else if (o == 0) {
+					filterTile(Gaussian(0, 0), colorData, tileBuffer, width, height, rowBegin, rowEnd, m_filterKernels[0]);
+				}
+				else {
+					downsampleRows(Gaussian(o, 0), width, Gaussian(o - 1, _level_ds - _level_min), m_octaveWidth[o - 1], rowBegin, rowEnd);
+				}
+			}
+		});
+	}
+}
+
+void SiftCPU::DetectKeypoints(const float* depthData)
+{
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		for (int j = 1; j < _level_num; j++) {
+			const unsigned int idx = i * _level_num + j;
+			float* gradMag = m_gradMag[idx].empty() ? NULL : m_gradMag[idx].data();
+			float* gradRot = m_gradRot[idx].empty() ? NULL : m_gradRot[idx].data();
+			const float* gus = Gaussian(i, j);
+			const float* gusPrev = Gaussian(i, j - 1);
+			float* dog = DOG(i, j);
+			CPUParallel::parallelFor(0, height, [&](unsigned int b, unsigned int e) {
+				computeDOGRows(dog, gradMag, gradRot, gus, gusPrev, width, height, b, e);
+			}, SIFT_CPU_ROWS_PER_TASK);
+		}
+	}
+
+	const float keyLocOffset = GlobalUtil::_LoweOrigin ? 0 : 0.5f;
+	const float dogThreshold = (GlobalUtil::_SubpixelLocalization ? 0.8f : 1.0f) * _dog_threshold;
+	const float edgeThreshold = (_edge_threshold + 1)*(_edge_threshold + 1) / _edge_threshold;
+	const float intensityWidth = (float)(m_octaveWidth[0] - 1);
+	const float intensityHeight = (float)(m_octaveHeight[0] - 1);
+	const int W = (int)vfloat::Width;
+
+	m_featureNum = 0;
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		const float keyLocScale = GetOctaveScale(i);
+		for (int j = 2; j < _level_num - 1; j++) {
+			const int levelIdx = i * _dog_level_num + j - 2;
+			const float* dogC = DOG(i, j);
+			const float* dogP = DOG(i, j - 1);
+			const float* dogN = DOG(i, j + 1);
+
+			//rows 1..height-3 and columns 1..width-3 as ComputeKEY_Kernel; keys are kept in row order
+			const int rowBegin = 1, rowEnd = std::max(height - 2, 1);
+			const int colBegin = 1, colEnd = std::max(width - 2, 1);
+			std::vector< std::vector<int2> > rowKeys(rowEnd - rowBegin);
+			CPUParallel::parallelFor(rowBegin, rowEnd, [&](unsigned int b, unsigned int e) {
+				for (unsigned int row = b; row < e; row++) {
+					const int depthy = (int)std::round((keyLocScale * (float)row + keyLocOffset) * (float)(m_depthHeight - 1) / intensityHeight);
+					if (depthy < 0 || depthy >= (int)m_depthHeight) continue;
+					const float* depthRow = depthData + depthy * m_depthWidth;
+					std::vector<int2>& keys = rowKeys[row - rowBegin];
+
+					auto testPixel = [&](int col) {
+						const int index = row * width + col;
+						const float v = dogC[index];
+						if (std::abs(v) <= dogThreshold) return;
+						const float nmax = std::max(dogC[index - 1], dogC[index + 1]);
+						const float nmin = std::min(dogC[index - 1], dogC[index + 1]);
+						if (v <= nmax && v >= nmin) return;
+
+						const int depthx = (int)std::round((keyLocScale * (float)col + keyLocOffset) * (float)(m_depthWidth - 1) / intensityWidth);
+						if (depthx < 0 || depthx >= (int)m_depthWidth) return;
+						const float depth = depthRow[depthx];
+						if (depth == SIFT_CPU_MINF || depth < GlobalUtil::_SiftDepthMin || depth > GlobalUtil::_SiftDepthMax) return;
+
+						if (isKeypoint(dogC, dogP, dogN, index, width, edgeThreshold)) keys.push_back(make_int2(col, row));
+					};
+
+					//vector pretest: threshold and left/right extremum
+					const float* rowC = dogC + row * width;
+					int col = colBegin;
+					for (; col + W <= colEnd; col += W) {
+						const vfloat v = vload(rowC + col);
+						const vfloat l = vload(rowC + col - 1);
+						const vfloat r = vload(rowC + col + 1);
+						const vmask candidate = vcmpgt(vabs(v), vset1(dogThreshold)) & (vcmpgt(v, vmax(l, r)) | vcmplt(v, vmin(l, r)));
+						if (!vany(candidate)) continue;
+						for (int k = 0; k < W; k++) testPixel(col + k);
+					}
+					for (; col < colEnd; col++) testPixel(col);
+				}
+			}, SIFT_CPU_ROWS_PER_TASK);
+
+			std::vector<int2>& keys = m_rawKeys[levelIdx];
+			keys.clear();
+			for (size_t r = 0; r < rowKeys.size() && keys.size() < m_levelCapacity[levelIdx]; r++) {
+				const size_t n = std::min(rowKeys[r].size(), m_levelCapacity[levelIdx] - keys.size());
+				keys.insert(keys.end(), rowKeys[r].begin(), rowKeys[r].begin() + n);
+			}
+			m_levelFeatureNum[levelIdx] = (int)keys.size();
+			m_featureNum += m_levelFeatureNum[levelIdx];
+		}
+	}
+}
+
+void SiftCPU::LimitFeatureCount()
+{
+	//SiftPyramid::LimitFeatureCount: skip the lowest levels to reduce number of features
+	if (GlobalUtil::_FeatureCountThreshold <= 0) return;
+
+	const int levelNum = (int)m_levelFeatureNum.size();
+	if (GlobalUtil::_TruncateMethod == 2) {
+		int i = 0, newFeatureNum = 0;
+		for (; newFeatureNum < GlobalUtil::_FeatureCountThreshold && i < levelNum; ++i) newFeatureNum += m_levelFeatureNum[i];
+		for (; i < levelNum; ++i) m_levelFeatureNum[i] = 0;
+		if (newFeatureNum < m_featureNum) m_featureNum = newFeatureNum;
+	}
+	else {
+		int i = 0;
+		while (i < levelNum && m_featureNum - m_levelFeatureNum[i] > GlobalUtil::_FeatureCountThreshold) {
+			m_featureNum -= m_levelFeatureNum[i];
+			m_levelFeatureNum[i++] = 0;
+		}
+	}
+}
+
+void SiftCPU::GetFeatureOrientations()
+{
+	const float tenDegreePerRadius = 5.7295779513082320876798154814105f;
+	const int numOrientation = GlobalUtil::_FixedOrientation ? 0 : GlobalUtil::_MaxOrientation;
+
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		for (int j = 0; j < _dog_level_num; j++) {
+			const int levelIdx = i * _dog_level_num + j;
+			const int num = m_levelFeatureNum[levelIdx];
+			m_rawOrientations[levelIdx].resize(num);
+			if (num <= 0) continue;
+
+			const float* gradMag = m_gradMag[i * _level_num + 1 + j].data();
+			const float* gradRot = m_gradRot[i * _level_num + 1 + j].data();
+			const std::vector<int2>& rawKeys = m_rawKeys[levelIdx];
+			unsigned int* orientations = m_rawOrientations[levelIdx].data();
+			const float sigma = GetLevelSigma(j + _level_min + 1);
+
+			//ComputeOrientation_Kernel
+			CPUParallel::parallelFor(0, num, [&](unsigned int b, unsigned int e) {
+				for (unsigned int k = b; k < e; k++) {
+					if (numOrientation == 0) {
+						orientations[k] = 0;
+						continue;
+					}
+					const float keyX = rawKeys[k].x + 0.5f;
+					const float keyY = rawKeys[k].y + 0.5f;
+					const float gsigma = sigma * SIFT_CPU_ORIENTATION_GAUSSIAN_FACTOR;
+					const float win = std::abs(sigma) * SIFT_CPU_ORIENTATION_GAUSSIAN_FACTOR * SIFT_CPU_ORIENTATION_WINDOW_FACTOR;
+					const float distThreshold = win * win + 0.5f;
+					const float factor = -0.5f / (gsigma * gsigma);
+					const float xmin = std::max(1.5f, std::floor(keyX - win) + 0.5f);
+					const float ymin = std::max(1.5f, std::floor(keyY - win) + 0.5f);
+					const float xmax = std::min(width - 1.5f, std::floor(keyX + win) + 0.5f);
+					const float ymax = std::min(height - 1.5f, std::floor(keyY + win) + 0.5f);
+
+					float vote[36];
+					for (int o = 0; o < 36; o++) vote[o] = 0.0f;
+					for (float y = ymin; y <= ymax; y += 1.0f) {
+						for (float x = xmin; x <= xmax; x += 1.0f) {
+							const float dx = x - keyX;
+							const float dy = y - keyY;
+							const float sqDist = dx * dx + dy * dy;
+							if (sqDist >= distThreshold) continue;
+							const int pidx = (int)y * width + (int)x;
+							const float weight = gradMag[pidx] * std::exp(sqDist * factor);
+							int oidx = (int)std::floor(gradRot[pidx] * tenDegreePerRadius);
+							if (oidx < 0) oidx += 36;
+							vote[std::min(oidx, 35)] += weight;
+						}
+					}
+
+					//filter the vote
+					const float oneThird = (float)(1.0 / 3.0);
+					for (int it = 0; it < 6; it++) {
+						float tmp[36];
+						for (int o = 0; o < 36; o++) tmp[o] = (vote[(o + 35) % 36] + vote[o] + vote[(o + 1) % 36]) * oneThird;
+						for (int o = 0; o < 36; o++) vote[o] = tmp[o];
+					}
+
+					float maxVote = 0.0f;
+					for (int o = 0; o < 36; o++) maxVote = std::max(maxVote, vote[o]);
+					const float voteThreshold = maxVote * 0.8f;
+
+					//first and second highest peak (the lowest bin wins ties, as the gpu reduction)
+					int peak[2] = { -1, -1 };
+					for (int p = 0; p < 2; p++) {
+						float best = -1.0f;
+						for (int o = 0; o < 36; o++) {
+							if (o == peak[0]) continue;
+							const float c = vote[o];
+							if (c > voteThreshold && c > vote[(o + 35) % 36] && c > vote[(o + 1) % 36] && best < c) {
+								best = c;
+								peak[p] = o;
+							}
+						}
+						if (peak[p] < 0) break;
+					}
+
+					unsigned short us[2] = { 65535, 65535 };
+					for (int p = 0; p < 2; p++) {
+						if (peak[p] < 0) break;
+						const int c = peak[p], m = (c + 35) % 36, n = (c + 1) % 36;
+						const float di = 0.5f * (vote[n] - vote[m]) / (2.0f * vote[c] - vote[n] - vote[m]);
+						float fr = (c + di + 0.5f) / 36.0f;
+						if (fr < 0) fr += 1.0f;
+						us[p] = (unsigned short)std::floor(fr * 65535.0f);
+					}
+					orientations[k] = ((unsigned int)us[1] << 16) | us[0];
+				}
+			}, SIFT_CPU_KEYS_PER_TASK);
+		}
+	}
+}
+
+void SiftCPU::GetFeatureDescriptors()
+{
+	const float rpi = (float)(4.0 / 3.14159265358979323846);
+	const float pi = 3.14159265358979323846f;
+
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		for (int j = 0; j < _dog_level_num; j++) {
+			const int levelIdx = i * _dog_level_num + j;
+			const int num = m_levelFeatureNum[levelIdx];
+			m_descriptors[levelIdx].resize(num * 128);
+			if (num <= 0) continue;
+
+			const float* gradMag = m_gradMag[i * _level_num + 1 + j].data();
+			const float* gradRot = m_gradRot[i * _level_num + 1 + j].data();
+			const std::vector<KeyPoint>& keys = m_keys[levelIdx];
+			float* descriptors = m_descriptors[levelIdx].data();
+
+			//ComputeDescriptor_Kernel (one 8 bin histogram per cell) and NormalizeDescriptor_Kernel
+			CPUParallel::parallelFor(0, num, [&](unsigned int b, unsigned int e) {
+				for (unsigned int k = b; k < e; k++) {
+					const KeyPoint& key = keys[k];
+					float* des = descriptors + k * 128;
+					const float spt = std::abs(key.s * SIFT_CPU_DESCRIPTOR_WINDOW_FACTOR);
+					const float s = std::sin(key.o), c = std::cos(key.o);
+					const float anglef = key.o > pi ? key.o - 2.0f * pi : key.o;
+					const float cspt = c * spt, sspt = s * spt;
+					const float crspt = c / spt, srspt = s / spt;
+					const float bsz = std::abs(cspt) + std::abs(sspt);
+
+					for (int bidx = 0; bidx < 16; bidx++) {
+						float* cell = des + bidx * 8;
+						for (int o = 0; o < 8; o++) cell[o] = 0.0f;
+						const float offsetX = (bidx & 0x3) - 1.5f;
+						const float offsetY = (bidx >> 2) - 1.5f;
+						const float ptX = cspt * offsetX - sspt * offsetY + key.x;
+						const float ptY = cspt * offsetY + sspt * offsetX + key.y;
+						const float xmin = std::max(1.5f, std::floor(ptX - bsz) + 0.5f);
+						const float ymin = std::max(1.5f, std::floor(ptY - bsz) + 0.5f);
+						const float xmax = std::min(width - 1.5f, std::floor(ptX + bsz) + 0.5f);
+						const float ymax = std::min(height - 1.5f, std::floor(ptY + bsz) + 0.5f);
+						for (float y = ymin; y <= ymax; y += 1.0f) {
+							for (float x = xmin; x <= xmax; x += 1.0f) {
+								const float dx = x - ptX;
+								const float dy = y - ptY;
+								const float nx = crspt * dx + srspt * dy;
+								const float ny = crspt * dy - srspt * dx;
+								const float nxn = std::abs(nx);
+								const float nyn = std::abs(ny);
+								if (nxn >= 1.0f || nyn >= 1.0f) continue;
+
+								const int pidx = (int)y * width + (int)x;
+								const float dnx = nx + offsetX;
+								const float dny = ny + offsetY;
+								const float ww = std::exp(-0.125f * (dnx * dnx + dny * dny));
+								const float weight = ww * (1.0f - nxn) * (1.0f - nyn) * gradMag[pidx];
+								float theta = (anglef - gradRot[pidx]) * rpi;
+								if (theta < 0) theta += 8.0f;
+								const float fo = std::floor(theta);
+								const int fidx = (int)fo & 7;
+								cell[fidx] += (fo + 1.0f - theta) * weight;
+								cell[(fidx + 1) % 8] += (theta - fo) * weight;
+							}
+						}
+					}
+
+					if (GlobalUtil::_NormalizedSIFT) {
+						float norm1 = 0.0f;
+						for (int d = 0; d < 128; d++) norm1 += des[d] * des[d];
+						if (norm1 == 0.0f) continue;
+						norm1 = 1.0f / std::sqrt(norm1);
+						float norm2 = 0.0f;
+						for (int d = 0; d < 128; d++) {
+							des[d] = std::min(0.2f, des[d] * norm1);
+							norm2 += des[d] * des[d];
+						}
+						norm2 = 1.0f / std::sqrt(norm2);
+						for (int d = 0; d < 128; d++) des[d] *= norm2;
+					}
+				}
+			}, SIFT_CPU_KEYS_PER_TASK);
+		}
+	}
+}
+
+void SiftCPU::GetFeatureBinaryDescriptors()
+{
+	const int numWords = SIFT_BINARY_DESCRIPTOR_BITS / 32;
+	for (int i = 0; i < m_octaveNum; i++) {
+		const int width = m_octaveWidth[i];
+		const int height = m_octaveHeight[i];
+		for (int j = 0; j < _dog_level_num; j++) {
+			const int levelIdx = i * _dog_level_num + j;
+			const int num = m_levelFeatureNum[levelIdx];
+			m_binaryDescriptors[levelIdx].resize(num * numWords);
+			if (num <= 0) continue;
+
+			//the level the descriptor gradients are computed on
+			const float* gus = Gaussian(i, 1 + j);
+			const std::vector<KeyPoint>& keys = m_keys[levelIdx];
+			unsigned int* descriptors = m_binaryDescriptors[levelIdx].data();
+
+			//ComputeBinaryDescriptor_Kernel
+			CPUParallel::parallelFor(0, num, [&](unsigned int b, unsigned int e) {
+				for (unsigned int k = b; k < e; k++) {
+					const KeyPoint& key = keys[k];
+					const float r = std::abs(key.s * SIFT_BINARY_DESCRIPTOR_WINDOW_FACTOR);
+					const float cr = std::cos(key.o) * r, sr = std::sin(key.o) * r;
+					for (int w = 0; w < numWords; w++) {
+						unsigned int bits = 0;
+						for (int t = 0; t < 32; t++) {
+							const float4& p = m_binaryPattern[w * 32 + t];
+							const float v1 = sampleLevelBilinear(gus, width, height, cr * p.x - sr * p.y + key.x, cr * p.y + sr * p.x + key.y);
+							const float v2 = sampleLevelBilinear(gus, width, height, cr * p.z - sr * p.w + key.x, cr * p.w + sr * p.z + key.y);
+							if (v1 < v2) bits |= 1u << t;
+						}
+						descriptors[k * numWords + w] = bits;
+					}
+				}
+			}, SIFT_CPU_KEYS_PER_TASK);
+		}
+	}
+}
+
+void SiftCPU::GetLevelsToOutput(unsigned int maxNumKeyPoints, std::vector<int>& numKeysPerLevel) const
+{
+	//eliminate lower level keypoints first; unlike SiftPyramid (whose descriptors are cut from the front of the list)
+	//keys and descriptors are truncated the same way
+	const int n = (int)m_levelFeatureNum.size();
+	numKeysPerLevel.assign(n, 0);
+	unsigned int cur = 0;
+	for (int i = n - 1; i >= 0 && cur < maxNumKeyPoints; i--) {
+		const unsigned int num = std::min((unsigned int)m_levelFeatureNum[i], maxNumKeyPoints - cur);
+		numKeysPerLevel[i] = (int)num;
+		cur += num;
+	}
+}
+
+unsigned int SiftCPU::GetKeyPointsAndDescriptors(SIFTKeyPoint* keyPoints, SIFTKeyPointDesc* descriptors, unsigned int maxNumKeyPoints /*= (unsigned int)-1*/) const
+{
+	std::vector<int> numKeysPerLevel;
+	GetLevelsToOutput(maxNumKeyPoints, numKeysPerLevel);
+
+	//CreateGlobalKeyPointList_Kernel and ConvertDescriptorToUChar_Kernel
+	const float keyLocOffset = GlobalUtil::_LoweOrigin ? 0 : 0.5f;
+	unsigned int numKeys = 0;
+	for (int i = 0; i < (int)numKeysPerLevel.size(); i++) {
+		const float keyLocScale = GetOctaveScale(i / _dog_level_num);
+		for (int k = 0; k < numKeysPerLevel[i]; k++, numKeys++) {
+			const KeyPoint& key = m_keys[i][k];
+			SIFTKeyPoint& out = keyPoints[numKeys];
+			out.pos.x = keyLocScale * (key.x - 0.5f) + keyLocOffset;
+			out.pos.y = keyLocScale * (key.y - 0.5f) + keyLocOffset;
+			out.scale = keyLocScale * key.s;
+			const int depthX = (int)std::round(out.pos.x * (float)(m_depthWidth - 1) / (float)(m_octaveWidth[0] - 1));
+			const int depthY = (int)std::round(out.pos.y * (float)(m_depthHeight - 1) / (float)(m_octaveHeight[0] - 1));
+			const bool inside = depthX >= 0 && depthX < (int)m_depthWidth && depthY >= 0 && depthY < (int)m_depthHeight;
+			out.depth = inside ? m_depthDownload[depthY * m_depthWidth + depthX] : SIFT_CPU_MINF;
+
+			if (GlobalUtil::_BinaryDescriptor) {
+				//ConvertBinaryDescriptorToUChar_Kernel (words in little endian byte order)
+				const unsigned int* bits = m_binaryDescriptors[i].data() + k * (SIFT_BINARY_DESCRIPTOR_BITS / 32);
+				unsigned char* feature = descriptors[numKeys].feature;
+				for (int d = 0; d < SIFT_BINARY_DESCRIPTOR_BITS / 8; d++) feature[d] = (unsigned char)(bits[d / 4] >> (8 * (d % 4)));
+				std::fill(feature + SIFT_BINARY_DESCRIPTOR_BITS / 8, feature + 128, (unsigned char)0);
+				continue;
+			}
+			const float* des = m_descriptors[i].data() + k * 128;
+			for (int d = 0; d < 128; d++) descriptors[numKeys].feature[d] = (unsigned char)int(512 * des[d] + 0.5);
+		}
+	}
+	return numKeys;
+}
+
+unsigned int SiftCPU::GetKeyPointsAndDescriptorsCUDA(SIFTImageGPU& siftImage, unsigned int maxNumKeyPoints /*= (unsigned int)-1*/)
+{
+	const unsigned int maxNum = std::min(maxNumKeyPoints, (unsigned int)m_featureNum);
+	m_keyPointUpload.resize(maxNum);
+	m_descriptorUpload.resize(maxNum);
+	const unsigned int numKeys = GetKeyPointsAndDescriptors(m_keyPointUpload.data(), m_descriptorUpload.data(), maxNumKeyPoints);
+	if (numKeys > 0) {
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftImage.d_keyPoints, m_keyPointUpload.data(), sizeof(SIFTKeyPoint)*numKeys, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(siftImage.d_keyPointDescs, m_descriptorUpload.data(), sizeof(SIFTKeyPointDesc)*numKeys, cudaMemcpyHostToDevice));
+	}
+	return m_featureNum;
+}
+
+void SiftCPU::StartTiming()
+{
+	if (GlobalUtil::_EnableDetailedTimings) m_timer.start();
+}
+
+void SiftCPU::EndTiming(const std::string& name)
+{
+	if (!GlobalUtil::_EnableDetailedTimings) return;
+	m_timer.stop();
+	unsigned int i = 0;
+	while (i < m_timingNames.size() && m_timingNames[i] != name) i++;
+	if (i == m_timingNames.size()) {
+		m_timingNames.push_back(name);
+		m_timingsMS.push_back(0.0);
+	}
+	m_timingsMS[i] += m_timer.getElapsedTimeMS();
+}
+
+void SiftCPU::EvaluateTimings()
+{
+	if (!GlobalUtil::_EnableDetailedTimings) {
+		std::cout << "Error timings not enabled" << std::endl;
+		return;
+	}
+	if (m_numTimedFrames == 0) return;
+	std::cout << "SiftCPU timings (" << CPUParallel::getNumThreads() << " threads, " << m_numTimedFrames << " frames):" << std::endl;
+	for (unsigned int i = 0; i < m_timingNames.size(); i++) {
+		std::cout << "\t" << m_timingNames[i] << ": " << m_timingsMS[i] / m_numTimedFrames << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef SIFT_CPU_H
+#define SIFT_CPU_H
+
+#include "SiftGPU.h"
+
+#include <vector>
+#include <string>
+
+////////////////////////////////////////////////////////////////
+//class SiftCPU
+//description: host implementation of SiftPyramid::RunSIFT (same pyramid, keypoint tests, orientations and
+//             descriptors as the ProgramCU kernels); levels are processed in row bands on CPUParallel with
+//             CPUSimd, orientations and descriptors per keypoint
+////////////////////////////////////////////////////////////////
+class SiftCPU : public SiftParam
+{
+public:
+	SiftCPU();
+	~SiftCPU();
+
+	//! after SetParams; allocates the pyramid for GlobalUtil::_InitPyramidWidth x _InitPyramidHeight
+	void InitSiftCPU();
+	//! what the gpu reads from c_siftCameraParams (the intensity size is the pyramid size)
+	void SetCameraParams(unsigned int depthWidth, unsigned int depthHeight, float minKeyScale);
+
+	//! host intensity image (pyramid size) and depth map (depthWidth x depthHeight)
+	int RunSIFT(const float* colorData, const float* depthData);
+	//! downloads the gpu input and runs RunSIFT
+	int RunSIFTCUDA(const float* d_colorData, const float* d_depthData);
+
+	int GetFeatureNum() const {
+		return m_featureNum;
+	}
+
+	//! keypoints and descriptors as written by SiftGPU; above maxNumKeyPoints the lowest levels are dropped (from both)
+	unsigned int GetKeyPointsAndDescriptors(SIFTKeyPoint* keyPoints, SIFTKeyPointDesc* descriptors, unsigned int maxNumKeyPoints = (unsigned int)-1) const;
+	//! GetKeyPointsAndDescriptors into the gpu arrays of siftImage
+	unsigned int GetKeyPointsAndDescriptorsCUDA(SIFTImageGPU& siftImage, unsigned int maxNumKeyPoints = (unsigned int)-1);
+
+	//! average time per stage (GlobalUtil::_EnableDetailedTimings)
+	void EvaluateTimings();
+
+private:
+	//! final keypoint of a level: level coordinates (pixel centers at +0.5), level sigma, orientation
+	struct KeyPoint {
+		float x, y, s, o;
+	};
+
+	void BuildPyramid(const float* colorData);
+	//! GlobalUtil::_PyramidWorkers > 1: octaves overlap in a wavefront, each level split into row tiles with a filter halo
+	void BuildPyramidTiled(const float* colorData);
+	void DetectKeypoints(const float* depthData);
+	void LimitFeatureCount();
+	void GetFeatureOrientations();
+	void GetFeatureDescriptors();
+	//! GlobalUtil::_BinaryDescriptor: steered brief as ComputeBinaryDescriptor_Kernel
+	void GetFeatureBinaryDescriptors();
+	void GetLevelsToOutput(unsigned int maxNumKeyPoints, std::vector<int>& numKeysPerLevel) const;
+
+	float GetOctaveScale(int octave) const {
+		return float(1 << octave);
+	}
+	float* Gaussian(int octave, int level) {
+		return m_gaussian[octave * _level_num + level].data();
+	}
+	float* DOG(int octave, int level) {
+		return m_dog[octave * _level_num + level].data();
+	}
+
+	void StartTiming();
+	void EndTiming(const std::string& name);
+
+	bool m_initialized;
+
+	int m_octaveNum;
+	std::vector<unsigned int> m_octaveWidth;
+	std::vector<unsigned int> m_octaveHeight;
+	std::vector< std::vector<float> > m_filterKernels;
+	std::vector<float4> m_binaryPattern;				//ProgramCU::CreateBinaryPattern
+
+	//per octave, level_num levels (DoG and gradients only where the gpu has them)
+	std::vector< std::vector<float> > m_gaussian;
+	std::vector< std::vector<float> > m_dog;
+	std::vector< std::vector<float> > m_gradMag;
+	std::vector< std::vector<float> > m_gradRot;
+	std::vector<float> m_filterBuffer;
+
+	//per octave * dog_level_num
+	std::vector<unsigned int> m_levelCapacity;
+	std::vector< std::vector<int2> > m_rawKeys;				//detected (col, row)
+	std::vector< std::vector<unsigned int> > m_rawOrientations;	//two orientations packed as in ComputeOrientation_Kernel
+	std::vector< std::vector<KeyPoint> > m_keys;
+	std::vector< std::vector<float> > m_descriptors;		//128 per key
+	std::vector< std::vector<unsigned int> > m_binaryDescriptors;	//SIFT_BINARY_DESCRIPTOR_BITS / 32 words per key
+	std::vector<int> m_levelFeatureNum;
+	int m_featureNum;
+
+	//c_siftCameraParams
+	unsigned int m_depthWidth;
+	unsigned int m_depthHeight;
+	float m_minKeyScale;
+
+	//input download for RunSIFTCUDA
+	std::vector<float> m_colorDownload;
+	std::vector<float> m_depthDownload;
+	std::vector<SIFTKeyPoint> m_keyPointUpload;
+	std::vector<SIFTKeyPointDesc> m_descriptorUpload;
+
+	Timer m_timer;
+	std::vector<std::string> m_timingNames;
+	std::vector<double> m_timingsMS;
+	unsigned int m_numTimedFrames;
+};
+
+#endif
@@ -125,6 +125,13 @@ float SiftParam::GetInitialSmoothSigma(int octave_min)
 }
 
 void SiftParam::ParseSiftParam()
+{
+	ComputeSiftParam();
+	ProgramCU::InitFilterKernels(m_filterSigmas, m_filterWidths);
+	ProgramCU::InitBinaryPattern();
+}
+
+void SiftParam::ComputeSiftParam()
 {
 
 	if (_dog_level_num == 0) _dog_level_num = 3;
@@ -165,12 +172,11 @@ void SiftParam::ParseSiftParam()
 	if (_dog_threshold == 0)	_dog_threshold = 0.02f / _dog_level_num;
 	if (_edge_threshold == 0) _edge_threshold = 10.0f;
 
-	std::vector<float> sigmas;
-	sigmas.push_back(GetInitialSmoothSigma(GlobalUtil::_octave_min_default));
+	m_filterSigmas.clear();
+	m_filterSigmas.push_back(GetInitialSmoothSigma(GlobalUtil::_octave_min_default));
 	for (int i = _level_min + 1; i <= _level_max; i++) {
-		sigmas.push_back(_sigma[i]);
+		m_filterSigmas.push_back(_sigma[i]);
 	}
-	ProgramCU::InitFilterKernels(sigmas, m_filterWidths);
 }
 
 void SiftGPU::PrintUsage()
@@ -221,7 +227,8 @@ void SiftGPU::PrintUsage()
 		<< "\n";
 }
 
-void SiftGPU::SetParams(unsigned int siftWidth, unsigned int siftHeight, bool enableTiming, unsigned int featureCountThreshold, float siftDepthMin, float siftDepthMax)
+void SiftParam::SetParams(unsigned int siftWidth, unsigned int siftHeight, bool enableTiming, unsigned int featureCountThreshold, float siftDepthMin, float siftDepthMax,
+	unsigned int pyramidWorkers /*= 1*/, bool binaryDescriptors /*= false*/)
 {
 	GlobalUtil::_SiftDepthMin = siftDepthMin;
 	GlobalUtil::_SiftDepthMax = siftDepthMax;
@@ -244,6 +251,12 @@ void SiftGPU::SetParams(unsigned int siftWidth, unsigned int siftHeight, bool en
 	// use 4 octaves
 	GlobalUtil::_octave_num_default = 4;
 
+	// octaves built concurrently
+	GlobalUtil::_PyramidWorkers = std::max(1, (int)pyramidWorkers);
+
+	// binary descriptors (hamming matching in SiftMatchGPU)
+	GlobalUtil::_BinaryDescriptor = binaryDescriptors ? 1 : 0;
+
 	if (GlobalUtil::_MaxOrientation < 2) {
 		std::cout << "MAX ORIENTATION != 2 not supported" << std::endl;
 		while (1);
@@ -43,11 +43,18 @@ public:
 		SAFE_DELETE_ARRAY(_sigma);
 	}
 
+	//! derives the level sigmas and uploads the filter kernels (ProgramCU::InitFilterKernels)
 	void		 ParseSiftParam();
+	//! ParseSiftParam without the upload; fills m_filterSigmas but not m_filterWidths
+	void		 ComputeSiftParam();
+	//parse SiftGPU parameters (shared by the gpu and cpu implementation through GlobalUtil)
+	void		 SetParams(unsigned int siftWidth, unsigned int siftHeight, bool enableTiming, unsigned int featureCountThreshold, float siftDepthMin, float siftDepthMax,
+		unsigned int pyramidWorkers = 1, bool binaryDescriptors = false);
 
 	float GetLevelSigma(int lev);
 	float GetInitialSmoothSigma(int octave_min);
 
+	std::vector<float> m_filterSigmas;
 	std::vector<unsigned int> m_filterWidths;
 
 	float*		_sigma;
@@ -108,9 +115,6 @@ public:
 
 	//Copy the SIFT result to two vectors
 	// void CopyFeatureVectorToCPU(SiftKeypoint * keys, float * descriptors);
-	//parse SiftGPU parameters
-	 void SetParams(unsigned int siftWidth, unsigned int siftHeight, bool enableTiming, unsigned int featureCountThreshold, float siftDepthMin, float siftDepthMax);
-
 	int RunSIFT(float* d_colorData, const float* d_depthData);
 	//set the active pyramid...dropped function
      void SetActivePyramid(int index) {}
@@ -25,6 +25,7 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 using namespace std;
 #include <string.h>
 
@@ -39,8 +40,9 @@ using namespace std;
 #include "CUDATimer.h"
 
 
-SiftMatchGPU::SiftMatchGPU(int max_sift)
+SiftMatchGPU::SiftMatchGPU(int max_sift, bool binaryDescriptors)
 {
+	_binary_descriptors = binaryDescriptors;
 	_num_sift[0] = _num_sift[1] = 0;
 	_id_sift[0] = _id_sift[1] = 0;
 	_have_loc[0] = _have_loc[1] = 0;
@@ -48,6 +50,10 @@ SiftMatchGPU::SiftMatchGPU(int max_sift)
 	_initialized = 0;
 
 	d_rowMatchDistances = NULL;
+	d_batchRowMatchDistances = NULL;
+	d_batchImageRows = NULL;
+	_batch_row_capacity = 0;
+	_batch_image_capacity = 0;
 
 	_timer = new CUDATimer();
 }
@@ -55,6 +61,8 @@ SiftMatchGPU::SiftMatchGPU(int max_sift)
 SiftMatchGPU::~SiftMatchGPU()
 {
 	if (d_rowMatchDistances) cutilSafeCall(cudaFree(d_rowMatchDistances));
+	if (d_batchRowMatchDistances) cutilSafeCall(cudaFree(d_batchRowMatchDistances));
+	if (d_batchImageRows) cutilSafeCall(cudaFree(d_batchImageRows));
 
 	if (_timer) delete _timer;
 }
@@ -166,7 +174,8 @@ void SiftMatchGPU::GetSiftMatch(int max_match, ImagePairMatch& imagePairMatch, u
 	if (GlobalUtil::_EnableDetailedTimings) {
 		_timer->startEvent("MultiplyDescriptor");
 	}
-	ProgramCU::MultiplyDescriptor(_texDes, _texDes + 1, &_texDot, (mutual_best_match ? &_texCRT : NULL));
+	if (_binary_descriptors)	ProgramCU::MultiplyDescriptorBinary(_texDes, _texDes + 1, &_texDot, (mutual_best_match ? &_texCRT : NULL));
+	else						ProgramCU::MultiplyDescriptor(_texDes, _texDes + 1, &_texDot, (mutual_best_match ? &_texCRT : NULL));
 	if (GlobalUtil::_EnableDetailedTimings) {
 		_timer->endEvent();
 	}
@@ -195,6 +204,65 @@ void SiftMatchGPU::GetBestMatch(int max_match, ImagePairMatch& imagePairMatch,
 	}
 }
 
+void SiftMatchGPU::GetSiftMatchBatch(int numImages, const unsigned int* numKeysPerImage, const int* imageValid, unsigned char* d_descriptors,
+	ImagePairMatch& imagePairMatch, uint2 keyPointOffset, float distmax, float ratiomax)
+{
+	if (_initialized == 0 || numImages <= 0) return;
+	if (GlobalUtil::_EnableDetailedTimings) {
+		_timer->startEvent("GetSiftMatchBatch");
+	}
+	const int num2 = _num_sift[1];
+	//texDes[0] is replaced by the passes
+	_num_sift[0] = 0;
+	_id_sift[0] = -1;
+
+	int first = 0, rowOffset = 0;
+	while (first < numImages) {
+		//as many images as the dot product matrix allows
+		_batch_image_rows.clear();
+		int numRows = 0, last = first;
+		while (last < numImages) {
+			const int n = (int)numKeysPerImage[last];
+			if (last > first && (numRows + n > SIFT_MATCH_BATCH_MAX_ROWS || (numRows + n) * num2 > SIFT_MATCH_BATCH_MAX_DOTS)) break;
+			_batch_image_rows.push_back(make_int2(numRows, imageValid[last] ? n : 0));
+			numRows += n;
+			last++;
+		}
+		const int numPassImages = last - first;
+
+		if (numRows == 0 || num2 <= 0) {
+			cutilSafeCall(cudaMemset(imagePairMatch.d_numMatches + first, 0, sizeof(int) * numPassImages));
+		}
+		else {
+			if (numRows > _batch_row_capacity) {
+				if (d_batchRowMatchDistances) cutilSafeCall(cudaFree(d_batchRowMatchDistances));
+				cutilSafeCall(cudaMalloc(&d_batchRowMatchDistances, sizeof(float) * numRows));
+				_batch_row_capacity = numRows;
+			}
+			if (numPassImages > _batch_image_capacity) {
+				if (d_batchImageRows) cutilSafeCall(cudaFree(d_batchImageRows));
+				cutilSafeCall(cudaMalloc(&d_batchImageRows, sizeof(int2) * numPassImages));
+				_batch_image_capacity = numPassImages;
+			}
+			cutilSafeCall(cudaMemcpy(d_batchImageRows, _batch_image_rows.data(), sizeof(int2) * numPassImages, cudaMemcpyHostToDevice));
+
+			_texDes[0].setImageData(8 * numRows, 1, 4, d_descriptors + 128 * rowOffset);
+			if (_binary_descriptors)	ProgramCU::MultiplyDescriptorBinary(_texDes, _texDes + 1, &_texDot, NULL);
+			else						ProgramCU::MultiplyDescriptor(_texDes, _texDes + 1, &_texDot, NULL);
+			_texMatch[0].InitTexture(numRows, 1);
+			ProgramCU::GetRowMatch(&_texDot, _texMatch, d_batchRowMatchDistances, distmax, ratiomax);
+			ProgramCU::GetColMatchBatch(&_texDot, d_batchImageRows, numPassImages, distmax, ratiomax, _texMatch, d_batchRowMatchDistances,
+				imagePairMatch.d_keyPointIndices + first * MAX_MATCHES_PER_IMAGE_PAIR_RAW, imagePairMatch.d_distances + first * MAX_MATCHES_PER_IMAGE_PAIR_RAW,
+				imagePairMatch.d_numMatches + first, make_uint2(keyPointOffset.x + rowOffset, keyPointOffset.y));
+		}
+		rowOffset += numRows;
+		first = last;
+	}
+	if (GlobalUtil::_EnableDetailedTimings) {
+		_timer->endEvent();
+	}
+}
+
 void SiftMatchGPU::EvaluateTimings()
 {
 	if (!GlobalUtil::_EnableDetailedTimings) {
@@ -206,6 +274,12 @@ void SiftMatchGPU::EvaluateTimings()
 	}
 }
 
+float SiftMatchGPU::HammingToDistance(unsigned int hamming)
+{
+	const float cosAngle = 1.0f - 2.0f * std::min((float)hamming / SIFT_BINARY_DESCRIPTOR_BITS, 1.0f);
+	return acosf(std::max(cosAngle, 0.0f));
+}
+
 SiftMatchGPU* CreateNewSiftMatchGPU(int max_sift)
 {
 	return new SiftMatchGPU(max_sift);
@@ -8,6 +8,10 @@
 
 class CUDATimer;
 
+//limits of one pass of GetSiftMatchBatch
+#define SIFT_MATCH_BATCH_MAX_ROWS 65535			//grid height of GetRowMatch
+#define SIFT_MATCH_BATCH_MAX_DOTS (1 << 24)		//dot product matrix (64mb)
+
 ///matcher export
 //This is a gpu-based sift match implementation. 
 class SiftMatchGPU
@@ -15,7 +19,8 @@ class SiftMatchGPU
 public:
 
 	//Consructor, the argument specifies the maximum number of features to match
-	SiftMatchGPU(int max_sift = 4096);
+	//binaryDescriptors: descriptors are SIFT_BINARY_DESCRIPTOR_BITS bit strings (SiftParam::SetParams) matched by hamming distance
+	SiftMatchGPU(int max_sift = 4096, bool binaryDescriptors = false);
 	//desctructor
 	 ~SiftMatchGPU();
 
@@ -46,8 +51,18 @@ public:
 		float ratiomax = 0.8f,	//maximum distance ratio
 		int mutual_best_match = 1); //mutual best match or one way
 
+	//match the descriptors of index 1 against numImages images whose descriptors are stored back to back at d_descriptors
+	//(SIFTImageManager layout), in as few passes as the batch limits allow; invalid images (imageValid[i] == 0) get no matches.
+	//imagePairMatch and keyPointOffset are those of the first image, the results of image i are written at d_numMatches + i and
+	//MAX_MATCHES_PER_IMAGE_PAIR_RAW * i (as SIFTImageManager::getImagePairMatch)
+	void GetSiftMatchBatch(int numImages, const unsigned int* numKeysPerImage, const int* imageValid, unsigned char* d_descriptors,
+		ImagePairMatch& imagePairMatch, uint2 keyPointOffset, float distmax = 0.7f, float ratiomax = 0.8f);
+
 	void EvaluateTimings();
 
+	//match distance (angle between the +-1 bit vectors) of a hamming distance; distmax for binary descriptors
+	static float HammingToDistance(unsigned int hamming);
+
 	//two functions for guded matching, two constraints can be used 
 	//one homography and one fundamental matrix, the use is as follows
 	//1. for each image, first call SetDescriptor then call SetFeatureLocation
@@ -76,9 +91,17 @@ private:
 	// hack to store match distances
 	float* d_rowMatchDistances;
 
+	//GetSiftMatchBatch
+	float* d_batchRowMatchDistances;
+	int2* d_batchImageRows;				//first row, #rows per image of a pass
+	std::vector<int2> _batch_image_rows;
+	int _batch_row_capacity;
+	int _batch_image_capacity;
+
 	//programs
 	//
 	int _max_sift;
+	bool _binary_descriptors;
 	int _num_sift[2];
 	int _id_sift[2];
 	int _have_loc[2];
@@ -0,0 +1,352 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "GlobalUtil.h"
+#include "SiftMatchCPU.h"
+#include "SIFTImageManager.h"
+#include "ProgramCU.h"
+#include "../CPUParallel.h"
+#include "../CPUSimd.h"
+#include "mLibCuda.h"
+
+//! as RowMatch_Kernel / ColMatch_Kernel: only a strictly larger dot product replaces the best (lowest index wins ties)
+static inline void updateBestMatch(int& best, int& idx, int& second, int v, int i)
+{
+	if (v > best) {
+		second = best;
+		best = v;
+		idx = i;
+	}
+	else if (v > second) {
+		second = v;
+	}
+}
+
+//! dot product of the +-1 bit vectors as MultiplyDescriptorBinary_Kernel
+static inline int binaryDot(const unsigned long long* a, const unsigned long long* b)
+{
+	return std::max(SIFT_BINARY_DESCRIPTOR_BITS - 2 * vhamming256(a, b), 0) * (262144 / SIFT_BINARY_DESCRIPTOR_BITS);
+}
+
+static inline float dotToDistance(int dot)
+{
+	return acosf(std::min(dot * 0.000003814697265625f, 1.0f));
+}
+
+SiftMatchCPU::SiftMatchCPU(int max_sift, bool binaryDescriptors)
+{
+	_binary_descriptors = binaryDescriptors;
+	_num_sift[0] = _num_sift[1] = 0;
+	_id_sift[0] = _id_sift[1] = -1;
+	_max_sift = max_sift <= 0 ? 4096 : max_sift;
+}
+
+SiftMatchCPU::~SiftMatchCPU()
+{
+}
+
+void SiftMatchCPU::SetDescriptors(int index, int num, const unsigned char* descriptors, int id)
+{
+	if (index > 1) index = 1;
+	if (index < 0) index = 0;
+	//the same feature is already set
+	if (id != -1 && id == _id_sift[index]) return;
+	_id_sift[index] = id;
+	if (num > _max_sift) num = _max_sift;
+	_num_sift[index] = num;
+
+	if (_binary_descriptors) {
+		const unsigned int numWords = SIFT_BINARY_DESCRIPTOR_BITS / 64;
+		m_binaryDescriptors[index].resize(num * numWords);
+		for (int i = 0; i < num; i++) memcpy(m_binaryDescriptors[index].data() + i * numWords, descriptors + i * 128, SIFT_BINARY_DESCRIPTOR_BITS / 8);
+	}
+	else {
+		m_descriptors[index].resize(num * 128);
+		for (int i = 0; i < num; i++) vwidenDescriptor(descriptors + i * 128, m_descriptors[index].data() + i * 128);
+	}
+}
+
+void SiftMatchCPU::SetDescriptorsCUDA(int index, int num, const unsigned char* d_descriptors, int id)
+{
+	if (index > 1) index = 1;
+	if (index < 0) index = 0;
+	if (id != -1 && id == _id_sift[index]) return;
+	if (num > _max_sift) num = _max_sift;
+
+	m_download.resize(num * 128);
+	if (num > 0) MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_download.data(), d_descriptors, sizeof(unsigned char) * 128 * num, cudaMemcpyDeviceToHost));
+	SetDescriptors(index, num, m_download.data(), id);
+}
+
+void SiftMatchCPU::SetKeyPoints(int index, int num, const SIFTKeyPoint* keyPoints)
+{
+	if (index > 1) index = 1;
+	if (index < 0) index = 0;
+	if (num > _max_sift) num = _max_sift;
+	m_keyPoints[index].assign(keyPoints, keyPoints + num);
+}
+
+void SiftMatchCPU::SetKeyPointsCUDA(int index, int num, const SIFTKeyPoint* d_keyPoints)
+{
+	if (index > 1) index = 1;
+	if (index < 0) index = 0;
+	if (num > _max_sift) num = _max_sift;
+	m_keyPoints[index].resize(num);
+	if (num > 0) MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_keyPoints[index].data(), d_keyPoints, sizeof(SIFTKeyPoint) * num, cudaMemcpyDeviceToHost));
+}
+
+void SiftMatchCPU::MultiplyDescriptorTiled(int mutual_best_match)
+{
+	const int num1 = _num_sift[0];
+	const int num2 = _num_sift[1];
+	const int numBlocks = (num1 + SIFT_MATCH_CPU_ROW_BLOCK - 1) / SIFT_MATCH_CPU_ROW_BLOCK;
+
+	m_rowBest.resize(num1);
+	if (mutual_best_match) m_colBest.resize(numBlocks * num2);
+
+	CPUParallel::parallelFor(0, numBlocks, [&](unsigned int b, unsigned int e) {
+		for (unsigned int blk = b; blk < e; blk++) {
+			const int rowBegin = blk * SIFT_MATCH_CPU_ROW_BLOCK;
+			const int rowEnd = std::min(rowBegin + SIFT_MATCH_CPU_ROW_BLOCK, num1);
+			BestMatch* col = mutual_best_match ? m_colBest.data() + blk * num2 : NULL;
+			for (int r = rowBegin; r < rowEnd; r++) {
+				m_rowBest[r].best = 0; m_rowBest[r].idx = -1; m_rowBest[r].second = 0;
+			}
+			if (col) {
+				for (int c = 0; c < num2; c++) {
+					col[c].best = 0; col[c].idx = -1; col[c].second = 0;
+				}
+			}
+
+			for (int colBegin = 0; colBegin < num2; colBegin += SIFT_MATCH_CPU_COL_TILE) {
+				const int colEnd = std::min(colBegin + SIFT_MATCH_CPU_COL_TILE, num2);
+				for (int r = rowBegin; r < rowEnd; r++) {
+					BestMatch row = m_rowBest[r];		//local, the column writes below cannot alias it
+					int dots[4];
+					for (int c = colBegin; c < colEnd; c += 4) {
+						const int n = std::min(4, colEnd - c);
+						if (_binary_descriptors) {
+							const unsigned long long* a = m_binaryDescriptors[0].data() + r * (SIFT_BINARY_DESCRIPTOR_BITS / 64);
+							for (int k = 0; k < n; k++) dots[k] = binaryDot(a, m_binaryDescriptors[1].data() + (c + k) * (SIFT_BINARY_DESCRIPTOR_BITS / 64));
+						}
+						else {
+							//the tail repeats the last column
+							const short* des2[4];
+							for (int k = 0; k < 4; k++) des2[k] = m_descriptors[1].data() + (c + std::min(k, n - 1)) * 128;
+							vdotDescriptor4(m_descriptors[0].data() + r * 128, des2, dots);
+						}
+						for (int k = 0; k < n; k++) {
+							updateBestMatch(row.best, row.idx, row.second, dots[k], c + k);
+							if (col) updateBestMatch(col[c + k].best, col[c + k].idx, col[c + k].second, dots[k], r);
+						}
+					}
+					m_rowBest[r] = row;
+				}
+			}
+		}
+	}, 1);
+}
+
+void SiftMatchCPU::MultiplyDescriptorGuided(int mutual_best_match, const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius)
+{
+	const int num1 = _num_sift[0];
+	const int num2 = _num_sift[1];
+	const int numBlocks = (num1 + SIFT_MATCH_CPU_ROW_BLOCK - 1) / SIFT_MATCH_CPU_ROW_BLOCK;
+	if ((int)m_keyPoints[0].size() < num1 || (int)m_keyPoints[1].size() < num2) throw MLIB_EXCEPTION("guided matching requires the key points of both images");
+
+	//grid over the bounding box of des2 (counting sort by cell)
+	const SIFTKeyPoint* keys2 = m_keyPoints[1].data();
+	float2 gridMin = keys2[0].pos, gridMax = keys2[0].pos;
+	for (int c = 1; c < num2; c++) {
+		gridMin = make_float2(std::min(gridMin.x, keys2[c].pos.x), std::min(gridMin.y, keys2[c].pos.y));
+		gridMax = make_float2(std::max(gridMax.x, keys2[c].pos.x), std::max(gridMax.y, keys2[c].pos.y));
+	}
+	const int gridWidth = (int)((gridMax.x - gridMin.x) / searchRadius) + 1;
+	const int gridHeight = (int)((gridMax.y - gridMin.y) / searchRadius) + 1;
+	m_gridCellStart.assign(gridWidth * gridHeight + 1, 0);
+	m_gridKeys.resize(num2);
+	for (int c = 0; c < num2; c++) {
+		m_gridKeys[c] = (int)((keys2[c].pos.y - gridMin.y) / searchRadius) * gridWidth + (int)((keys2[c].pos.x - gridMin.x) / searchRadius);
+		m_gridCellStart[m_gridKeys[c] + 1]++;
+	}
+	for (int i = 0; i < gridWidth * gridHeight; i++) m_gridCellStart[i + 1] += m_gridCellStart[i];
+	std::vector<int> cellCursor(m_gridCellStart.begin(), m_gridCellStart.end() - 1);
+	std::vector<int> cellOfKey(m_gridKeys);
+	for (int c = 0; c < num2; c++) m_gridKeys[cellCursor[cellOfKey[c]]++] = c;	//ascending key order per cell
+
+	m_rowBest.resize(num1);
+	if (mutual_best_match) m_colBest.resize(numBlocks * num2);
+
+	const float radius2 = searchRadius * searchRadius;
+	CPUParallel::parallelFor(0, numBlocks, [&](unsigned int b, unsigned int e) {
+		std::vector<int> candidates;
+		for (unsigned int blk = b; blk < e; blk++) {
+			const int rowBegin = blk * SIFT_MATCH_CPU_ROW_BLOCK;
+			const int rowEnd = std::min(rowBegin + SIFT_MATCH_CPU_ROW_BLOCK, num1);
+			BestMatch* col = mutual_best_match ? m_colBest.data() + blk * num2 : NULL;
+			if (col) {
+				for (int c = 0; c < num2; c++) {
+					col[c].best = 0; col[c].idx = -1; col[c].second = 0;
+				}
+			}
+
+			for (int r = rowBegin; r < rowEnd; r++) {
+				BestMatch row; row.best = 0; row.idx = -1; row.second = 0;
+				const SIFTKeyPoint& key = m_keyPoints[0][r];
+				const float3 camPos = transform * (intrinsicsInv * (key.depth * make_float3(key.pos.x, key.pos.y, 1.0f)));
+				const float3 proj = intrinsics * camPos;
+				const float2 loc = make_float2(proj.x / proj.z, proj.y / proj.z);
+				//behind the camera / invalid depth, or no des2 feature can be within the search radius (also keeps the int casts below in range)
+				if (!(camPos.z > 1e-4f) || !std::isfinite(loc.x) || !std::isfinite(loc.y) ||
+					loc.x < gridMin.x - searchRadius || loc.x > gridMax.x + searchRadius || loc.y < gridMin.y - searchRadius || loc.y > gridMax.y + searchRadius) {
+					m_rowBest[r] = row;
+					continue;
+				}
+
+				//features of des2 within the search radius, in index order (as the full search, the lowest index wins ties)
+				candidates.clear();
+				const int cx0 = std::max((int)std::floor((loc.x - searchRadius - gridMin.x) / searchRadius), 0);
+				const int cx1 = std::min((int)std::floor((loc.x + searchRadius - gridMin.x) / searchRadius), gridWidth - 1);
+				const int cy0 = std::max((int)std::floor((loc.y - searchRadius - gridMin.y) / searchRadius), 0);
+				const int cy1 = std::min((int)std::floor((loc.y + searchRadius - gridMin.y) / searchRadius), gridHeight - 1);
+				for (int cy = cy0; cy <= cy1; cy++) {
+					for (int cx = cx0; cx <= cx1; cx++) {
+						const int cell = cy * gridWidth + cx;
+						for (int i = m_gridCellStart[cell]; i < m_gridCellStart[cell + 1]; i++) {
+							const float dx = keys2[m_gridKeys[i]].pos.x - loc.x;
+							const float dy = keys2[m_gridKeys[i]].pos.y - loc.y;
+							if (dx * dx + dy * dy <= radius2) candidates.push_back(m_gridKeys[i]);
+						}
+					}
+				}
+				std::sort(candidates.begin(), candidates.end());
+
+				int dots[4];
+				for (int i = 0; i < (int)candidates.size(); i += 4) {
+					const int n = std::min(4, (int)candidates.size() - i);
+					if (_binary_descriptors) {
+						const unsigned long long* a = m_binaryDescriptors[0].data() + r * (SIFT_BINARY_DESCRIPTOR_BITS / 64);
+						for (int k = 0; k < n; k++) dots[k] = binaryDot(a, m_binaryDescriptors[1].data() + candidates[i + k] * (SIFT_BINARY_DESCRIPTOR_BITS / 64));
+					}
+					else {
+						const short* des2[4];
+						for (int k = 0; k < 4; k++) des2[k] = m_descriptors[1].data() + candidates[i + std::min(k, n - 1)] * 128;
+						vdotDescriptor4(m_descriptors[0].data() + r * 128, des2, dots);
+					}
+					for (int k = 0; k < n; k++) {
+						const int c = candidates[i + k];
+						updateBestMatch(row.best, row.idx, row.second, dots[k], c);
+						if (col) updateBestMatch(col[c].best, col[c].idx, col[c].second, dots[k], r);
+					}
+				}
+				m_rowBest[r] = row;
+			}
+		}
+	}, 1);
+}
+
+int SiftMatchCPU::GetSiftMatch(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset, float distmax, float ratiomax, int mutual_best_match)
+{
+	const int num1 = _num_sift[0];
+	const int num2 = _num_sift[1];
+	if (num1 <= 0 || num2 <= 0) return 0;
+
+	MultiplyDescriptorTiled(mutual_best_match);
+	return ExtractMatches(max_match, keyPointIndices, matchDistances, keyPointOffset, distmax, ratiomax, mutual_best_match);
+}
+
+int SiftMatchCPU::GetSiftMatchGuided(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset,
+	const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius, float distmax, float ratiomax, int mutual_best_match)
+{
+	const int num1 = _num_sift[0];
+	const int num2 = _num_sift[1];
+	if (num1 <= 0 || num2 <= 0) return 0;
+
+	MultiplyDescriptorGuided(mutual_best_match, transform, intrinsics, intrinsicsInv, searchRadius);
+	return ExtractMatches(max_match, keyPointIndices, matchDistances, keyPointOffset, distmax, ratiomax, mutual_best_match);
+}
+
+int SiftMatchCPU::ExtractMatches(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset, float distmax, float ratiomax, int mutual_best_match)
+{
+	const int num1 = _num_sift[0];
+	const int num2 = _num_sift[1];
+
+	//RowMatch_Kernel
+	m_rowResult.resize(num1);
+	m_rowDistances.resize(num1);
+	for (int r = 0; r < num1; r++) {
+		const float dist = dotToDistance(m_rowBest[r].best);
+		const float distn = dotToDistance(m_rowBest[r].second);
+		m_rowResult[r] = (dist < distmax) && (dist < distn * ratiomax) ? m_rowBest[r].idx : -1;
+		m_rowDistances[r] = dist;
+	}
+
+	int numMatches = 0;
+	if (!mutual_best_match) {
+		for (int r = 0; r < num1 && numMatches < max_match; r++) {
+			if (m_rowResult[r] < 0) continue;
+			keyPointIndices[numMatches] = make_uint2(r + keyPointOffset.x, m_rowResult[r] + keyPointOffset.y);
+			matchDistances[numMatches] = m_rowDistances[r];
+			numMatches++;
+		}
+		return numMatches;
+	}
+
+	//ColMatch_Kernel: merge the row blocks of each column, keep mutual best matches
+	const int numBlocks = (num1 + SIFT_MATCH_CPU_ROW_BLOCK - 1) / SIFT_MATCH_CPU_ROW_BLOCK;
+	for (int c = 0; c < num2 && numMatches < max_match; c++) {
+		BestMatch res = m_colBest[c];
+		for (int blk = 1; blk < numBlocks; blk++) {
+			const BestMatch& other = m_colBest[blk * num2 + c];
+			if (res.best < other.best) {
+				res.second = std::max(res.best, other.second);
+				res.best = other.best;
+				res.idx = other.idx;
+			}
+			else {
+				res.second = std::max(res.second, other.best);
+			}
+		}
+		const float dist = dotToDistance(res.best);
+		const float distn = dotToDistance(res.second);
+		const int f1 = (dist < distmax) && (dist < distn * ratiomax) ? res.idx : -1;
+		if (f1 >= 0 && m_rowResult[f1] == c) {
+			keyPointIndices[numMatches] = make_uint2(f1 + keyPointOffset.x, c + keyPointOffset.y);
+			matchDistances[numMatches] = m_rowDistances[f1];
+			numMatches++;
+		}
+	}
+	return numMatches;
+}
+
+void SiftMatchCPU::GetSiftMatchCUDA(int max_match, ImagePairMatch& imagePairMatch, uint2 keyPointOffset, float distmax, float ratiomax, int mutual_best_match)
+{
+	max_match = std::min(max_match, MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+	m_keyPointIndices.resize(max_match);
+	m_matchDistances.resize(max_match);
+	const int numMatches = GetSiftMatch(max_match, m_keyPointIndices.data(), m_matchDistances.data(), keyPointOffset, distmax, ratiomax, mutual_best_match);
+	UploadMatches(imagePairMatch, numMatches);
+}
+
+void SiftMatchCPU::GetSiftMatchGuidedCUDA(int max_match, ImagePairMatch& imagePairMatch, uint2 keyPointOffset,
+	const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius, float distmax, float ratiomax, int mutual_best_match)
+{
+	max_match = std::min(max_match, MAX_MATCHES_PER_IMAGE_PAIR_RAW);
+	m_keyPointIndices.resize(max_match);
+	m_matchDistances.resize(max_match);
+	const int numMatches = GetSiftMatchGuided(max_match, m_keyPointIndices.data(), m_matchDistances.data(), keyPointOffset,
+		transform, intrinsics, intrinsicsInv, searchRadius, distmax, ratiomax, mutual_best_match);
+	UploadMatches(imagePairMatch, numMatches);
+}
+
+void SiftMatchCPU::UploadMatches(ImagePairMatch& imagePairMatch, int numMatches)
+{
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_numMatches, &numMatches, sizeof(int), cudaMemcpyHostToDevice));
+	if (numMatches > 0) {
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_keyPointIndices, m_keyPointIndices.data(), sizeof(uint2) * numMatches, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(imagePairMatch.d_distances, m_matchDistances.data(), sizeof(float) * numMatches, cudaMemcpyHostToDevice));
+	}
+}
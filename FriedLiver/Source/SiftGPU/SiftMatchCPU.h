@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef SIFT_MATCH_CPU_H
+#define SIFT_MATCH_CPU_H
+
+#include "SiftGPU.h"
+
+#include <vector>
+
+struct ImagePairMatch;
+
+//! features of des1 per row block and of des2 per column tile; a row block and a column tile of widened
+//! descriptors (256 bytes each) stay in L1 while all their dot products are taken
+#define SIFT_MATCH_CPU_ROW_BLOCK 64
+#define SIFT_MATCH_CPU_COL_TILE 64
+
+////////////////////////////////////////////////////////////////
+//class SiftMatchCPU
+//description: host implementation of SiftMatchGPU::GetSiftMatch (MultiplyDescriptor, RowMatch and ColMatch);
+//             row blocks run on CPUParallel, the best / second best of rows and columns are tracked inside the
+//             tile loop so the dot product matrix is never stored
+////////////////////////////////////////////////////////////////
+class SiftMatchCPU
+{
+public:
+	//binaryDescriptors: as SiftMatchGPU
+	SiftMatchCPU(int max_sift = 4096, bool binaryDescriptors = false);
+	~SiftMatchCPU();
+
+	//! index = [0/1]; unsigned char descriptors normalized to 512 (or SIFT_BINARY_DESCRIPTOR_BITS bits); the same id is not set again
+	void SetDescriptors(int index, int num, const unsigned char* descriptors, int id = -1);
+	//! downloads the gpu descriptors and runs SetDescriptors
+	void SetDescriptorsCUDA(int index, int num, const unsigned char* d_descriptors, int id = -1);
+	//! key points of the descriptors (only for guided matching)
+	void SetKeyPoints(int index, int num, const SIFTKeyPoint* keyPoints);
+	void SetKeyPointsCUDA(int index, int num, const SIFTKeyPoint* d_keyPoints);
+
+	//! same matches as SiftMatchGPU::GetSiftMatch (in des2 order), at most max_match; returns the number of matches
+	int GetSiftMatch(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset,
+		float distmax = 0.7f, float ratiomax = 0.8f, int mutual_best_match = 1);
+	//! GetSiftMatch into the gpu arrays of imagePairMatch (at most MAX_MATCHES_PER_IMAGE_PAIR_RAW)
+	void GetSiftMatchCUDA(int max_match, ImagePairMatch& imagePairMatch, uint2 keyPointOffset,
+		float distmax = 0.7f, float ratiomax = 0.8f, int mutual_best_match = 1);
+
+	//! GetSiftMatch restricted to the features of des2 within searchRadius pixels of the prediction of each feature of des1:
+	//! key points of des1 are back projected with their depth, transformed (camera of des1 to camera of des2) and projected
+	int GetSiftMatchGuided(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset,
+		const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius,
+		float distmax = 0.7f, float ratiomax = 0.8f, int mutual_best_match = 1);
+	void GetSiftMatchGuidedCUDA(int max_match, ImagePairMatch& imagePairMatch, uint2 keyPointOffset,
+		const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius,
+		float distmax = 0.7f, float ratiomax = 0.8f, int mutual_best_match = 1);
+
+	int GetNumDescriptors(int index) const {
+		return _num_sift[index];
+	}
+
+private:
+	//! best, best index and second best dot product
+	struct BestMatch {
+		int best, idx, second;
+	};
+
+	void MultiplyDescriptorTiled(int mutual_best_match);
+	//! best matches over the grid cells of des2 around the predicted positions
+	void MultiplyDescriptorGuided(int mutual_best_match, const float4x4& transform, const float4x4& intrinsics, const float4x4& intrinsicsInv, float searchRadius);
+	//! RowMatch and ColMatch of m_rowBest / m_colBest
+	int ExtractMatches(int max_match, uint2* keyPointIndices, float* matchDistances, uint2 keyPointOffset, float distmax, float ratiomax, int mutual_best_match);
+	void UploadMatches(ImagePairMatch& imagePairMatch, int numMatches);
+
+	int _max_sift;
+	bool _binary_descriptors;
+	int _num_sift[2];
+	int _id_sift[2];
+
+	std::vector<short> m_descriptors[2];					//128 per feature (widened once for the 16 bit multiply-add)
+	std::vector<unsigned long long> m_binaryDescriptors[2];	//SIFT_BINARY_DESCRIPTOR_BITS / 64 per feature
+	std::vector<unsigned char> m_download;
+	std::vector<SIFTKeyPoint> m_keyPoints[2];
+
+	//grid bucket index of the key points of des2 (cells of the search radius)
+	std::vector<int> m_gridCellStart;
+	std::vector<int> m_gridKeys;
+
+	std::vector<BestMatch> m_rowBest;		//per feature of des1
+	std::vector<BestMatch> m_colBest;		//per row block and feature of des2 (as texCRT)
+	std::vector<int> m_rowResult;
+	std::vector<float> m_rowDistances;
+
+	std::vector<uint2> m_keyPointIndices;
+	std::vector<float> m_matchDistances;
+};
+
+#endif
@@ -73,16 +73,47 @@ SiftPyramid::~SiftPyramid()
 	DestroyPyramidData();
 	if (_inputTex) delete _inputTex;
 	if (_timer) delete _timer;
+	DestroyOctaveStreams();
 
 	if (d_featureCount) cutilSafeCall(cudaFree(d_featureCount));
 	if (d_outDescriptorList) cutilSafeCall(cudaFree(d_outDescriptorList));
 }
 
 
+void SiftPyramid::PrepareOctaveStreams()
+{
+	const unsigned int numStreams = (unsigned int)std::max(1, std::min(GlobalUtil::_PyramidWorkers, _octave_num));
+	if (numStreams == 1) {
+		DestroyOctaveStreams();
+		return;
+	}
+	if (_octaveStreams.size() == numStreams && _octaveEvents.size() == (size_t)_octave_num) return;
+
+	DestroyOctaveStreams();
+	//blocking streams: they wait for earlier work on the default stream and later default stream work waits for them
+	_octaveStreams.resize(numStreams);
+	for (unsigned int i = 0; i < numStreams; i++) cutilSafeCall(cudaStreamCreate(&_octaveStreams[i]));
+	_octaveEvents.resize(_octave_num);
+	for (int i = 0; i < _octave_num; i++) cutilSafeCall(cudaEventCreateWithFlags(&_octaveEvents[i], cudaEventDisableTiming));
+}
+
+void SiftPyramid::DestroyOctaveStreams()
+{
+	for (unsigned int i = 0; i < _octaveStreams.size(); i++) cutilSafeCall(cudaStreamDestroy(_octaveStreams[i]));
+	for (unsigned int i = 0; i < _octaveEvents.size(); i++) cutilSafeCall(cudaEventDestroy(_octaveEvents[i]));
+	_octaveStreams.clear();
+	_octaveEvents.clear();
+}
+
 void SiftPyramid::BuildPyramid(float* d_data)
 {
 	int i, j;
 
+	//an octave only depends on level _level_ds of the previous one, so octave i + 1 starts while the upper levels
+	//of octave i are still filtered
+	PrepareOctaveStreams();
+	const bool useStreams = !_octaveStreams.empty();
+
 	for (i = _octave_min; i < _octave_min + _octave_num; i++)
 	{
 
@@ -90,6 +121,7 @@ void SiftPyramid::BuildPyramid(float* d_data)
 		CuTexImage *tex = GetBaseLevel(i);
 		CuTexImage *buf = GetBaseLevel(i, DATA_KEYPOINT) + 2;
 		j = param._level_min + 1;
+		cudaStream_t stream = useStreams ? _octaveStreams[(i - _octave_min) % _octaveStreams.size()] : 0;
 
 		if (i == _octave_min)
 		{
@@ -99,20 +131,21 @@ void SiftPyramid::BuildPyramid(float* d_data)
 			if (i == 0)
 			{
 				ProgramCU::FilterImage(tex, _inputTex, buf,
-					param.m_filterWidths[0], 0);
+					param.m_filterWidths[0], 0, stream);
 			}
 			else
 			{
 				if (i < 0)	ProgramCU::SampleImageU(tex, _inputTex, -i);
-				else		ProgramCU::SampleImageD(tex, _inputTex, i);
+				else		ProgramCU::SampleImageD(tex, _inputTex, i, stream);
 
 				ProgramCU::FilterImage(tex, tex, buf,
-					param.m_filterWidths[0], 0);
+					param.m_filterWidths[0], 0, stream);
 			}
 		}
 		else
 		{
-			ProgramCU::SampleImageD(tex, GetBaseLevel(i - 1) + param._level_ds - param._level_min);
+			if (useStreams) cutilSafeCall(cudaStreamWaitEvent(stream, _octaveEvents[i - 1 - _octave_min], 0));
+			ProgramCU::SampleImageD(tex, GetBaseLevel(i - 1) + param._level_ds - param._level_min, 1, stream);
 			if (param._sigma_skip1 > 0)
 			{
 				std::cout << "ERROR" << std::endl;
@@ -122,7 +155,8 @@ void SiftPyramid::BuildPyramid(float* d_data)
 		for (; j <= param._level_max; j++, tex++, filter_sigma++)
 		{
 			// filtering
-			ProgramCU::FilterImage(tex + 1, tex, buf, param.m_filterWidths[j + 1], j + 1);
+			ProgramCU::FilterImage(tex + 1, tex, buf, param.m_filterWidths[j + 1], j + 1, stream);
+			if (useStreams && j == param._level_ds) cutilSafeCall(cudaEventRecord(_octaveEvents[i - _octave_min], stream));
 		}
 	}
 
@@ -284,7 +318,8 @@ void SiftPyramid::GetFeatureDescriptors()
 		for (int j = 0; j < param._dog_level_num; j++, ftex++, idx++, got++)
 		{
 			if (_levelFeatureNum[idx] == 0) continue;
-			ProgramCU::ComputeDescriptor(ftex, got, d_outDescriptorList + descOffset, IsUsingRectDescription());//process
+			if (GlobalUtil::_BinaryDescriptor)	ProgramCU::ComputeBinaryDescriptor(ftex, GetBaseLevel(i + _octave_min) + 1 + j, d_outDescriptorList + descOffset);
+			else								ProgramCU::ComputeDescriptor(ftex, got, d_outDescriptorList + descOffset, IsUsingRectDescription());//process
 
 			descOffset += 128 * _levelFeatureNum[idx];
 		}
@@ -773,7 +808,8 @@ void SiftPyramid::GetFeatureVectorCUDA(unsigned char* d_descriptor, unsigned int
 		_timer->startEvent("ConvertDescriptorToUChar");
 	}
 	int numDescriptors = (maxNumKeyPoints == (unsigned int)-1) ? _featureNum : std::min(_featureNum, (int)maxNumKeyPoints);
-	if (numDescriptors > 0) ProgramCU::ConvertDescriptorToUChar(d_outDescriptorList, numDescriptors * 128, d_descriptor);
+	if (numDescriptors > 0 && GlobalUtil::_BinaryDescriptor) ProgramCU::ConvertBinaryDescriptorToUChar(d_outDescriptorList, numDescriptors, d_descriptor);
+	else if (numDescriptors > 0) ProgramCU::ConvertDescriptorToUChar(d_outDescriptorList, numDescriptors * 128, d_descriptor);
 	//if (_featureNum > 0) ProgramCU::ConvertDescriptorToUChar(d_outDescriptorList, _featureNum * 128, d_descriptor);
 	if (GlobalUtil::_EnableDetailedTimings) {
 		_timer->endEvent();
@@ -24,6 +24,7 @@
 #define _SIFT_PYRAMID_H
 
 #include <cuda_runtime.h>
+#include <vector>
 class CuTexImage;
 class SiftParam;
 class GlobalUtil;
@@ -105,6 +106,9 @@ public:
 protected:
 	inline  void PrepareBuffer();
 	inline  void LimitFeatureCount(int have_keylist = 0);
+	//! one stream per concurrently built octave (GlobalUtil::_PyramidWorkers > 1)
+	void PrepareOctaveStreams();
+	void DestroyOctaveStreams();
 
 	void CreateGlobalKeyPointList(float4* d_keypoints, const float* d_depthData, unsigned int maxNumKeyPoints);
 
@@ -135,6 +139,9 @@ protected:
 	float* d_outDescriptorList;
 
 	CUDATimer* _timer;
+
+	std::vector<cudaStream_t> _octaveStreams;
+	std::vector<cudaEvent_t> _octaveEvents;	//per octave: the level the next octave is sampled from is done
 };
 
 #define SIFTGPU_ENABLE_REVERSE_ORDER
@@ -0,0 +1,825 @@
+
+#include "stdafx.h"
+
+#include <cmath>
+#include <limits>
+
+#include "CPUSolverBundling.h"
+#include "../GlobalBundlingState.h"
+#include "../CUDACache.h"
+#include "../CPUParallel.h"
+#include "../PoseHelper.h"
+#include "../SiftGPU/MatrixConversion.h"
+
+//as SolverUtil.h / GlobalDefines.h (the __int_as_float MINF is device only)
+#define CPU_SOLVER_EPSILON 0.000001f
+#define CPU_SOLVER_MINF (-std::numeric_limits<float>::infinity())
+
+//as SolverBundling.cu
+#define CPU_SOLVER_OVERLAP_SAMPLES 512
+#define CPU_SOLVER_CORR_CHUNK 1024
+
+/************************************************************************/
+/* host versions of the dense helpers (CUDACameraUtil.h, ICPUtil.h,     */
+/* LieDerivUtil.h, SolverBundlingDenseUtil.h)                           */
+/************************************************************************/
+
+static inline float2 cameraToDepth(const float4& intrinsics, const float3& pos)
+{
+	return make_float2(pos.x*intrinsics.x / pos.z + intrinsics.z, pos.y*intrinsics.y / pos.z + intrinsics.w);
+}
+
+static inline float3 depthToCamera(const float4& intrinsics, int x, int y, float depth)
+{
+	const float cx = ((float)x - intrinsics.z) / intrinsics.x;
+	const float cy = ((float)y - intrinsics.w) / intrinsics.y;
+	return make_float3(depth*cx, depth*cy, depth);
+}
+
+static inline float3 uchar4ToNormal(const uchar4& n)
+{
+	return make_float3(n.x / 255.0f * 2.0f - 1.0f, n.y / 255.0f * 2.0f - 1.0f, n.z / 255.0f * 2.0f - 1.0f);
+}
+
+static inline bool isValidSample(float v) { return v != CPU_SOLVER_MINF; }
+static inline bool isValidSample(const float2& v) { return v.x != CPU_SOLVER_MINF; }
+static inline bool isValidSample(const float4& v) { return v.x != CPU_SOLVER_MINF; }
+
+//! as bilinearInterpolationFloat/Float2/Float4; invalid samples are skipped, returns invalid if there are none
+template<class T>
+static T bilinearInterpolation(float x, float y, const T* input, unsigned int width, unsigned int height, const T& invalid)
+{
+	const int x0 = (int)std::floor(x);
+	const int y0 = (int)std::floor(y);
+	const float alpha = x - x0;
+	const float beta = y - y0;
+
+	T s0 = T(); float w0 = 0.0f;
+	if ((unsigned int)x0 < width && (unsigned int)y0 < height) { const T& v = input[y0*width + x0]; if (isValidSample(v)) { s0 += (1.0f - alpha)*v; w0 += (1.0f - alpha); } }
+	if ((unsigned int)(x0 + 1) < width && (unsigned int)y0 < height) { const T& v = input[y0*width + x0 + 1]; if (isValidSample(v)) { s0 += alpha*v; w0 += alpha; } }
+
+	T s1 = T(); float w1 = 0.0f;
+	if ((unsigned int)x0 < width && (unsigned int)(y0 + 1) < height) { const T& v = input[(y0 + 1)*width + x0]; if (isValidSample(v)) { s1 += (1.0f - alpha)*v; w1 += (1.0f - alpha); } }
+	if ((unsigned int)(x0 + 1) < width && (unsigned int)(y0 + 1) < height) { const T& v = input[(y0 + 1)*width + x0 + 1]; if (isValidSample(v)) { s1 += alpha*v; w1 += alpha; } }
+
+	T ss = T(); float ww = 0.0f;
+	if (w0 > 0.0f) { ss += (1.0f - beta)*(s0 / w0); ww += (1.0f - beta); }
+	if (w1 > 0.0f) { ss += beta*(s1 / w1); ww += beta; }
+
+	if (ww > 0.0f) return ss / ww;
+	return invalid;
+}
+
+static inline mat2x3 dCameraToScreen(const float3& p, float fx, float fy)
+{
+	mat2x3 res; res.setZero();
+	const float wSquared = p.z*p.z;
+	res(0, 0) = fx / p.z;
+	res(1, 1) = fy / p.z;
+	res(0, 2) = -fx * p.x / wSquared;
+	res(1, 2) = -fy * p.y / wSquared;
+	return res;
+}
+
+static inline bool computeAngleDiff(const float4x4& transform, float angleThresh)
+{
+	const float s = 1.0f / std::sqrt(3.0f);
+	const float3 x = make_float3(s, s, s);
+	const float3 v = transform.getFloat3x3() * x;
+	const float angle = std::acos(std::min(1.0f, std::max(-1.0f, dot(x, v))));
+	return std::fabs(angle) < angleThresh;
+}
+
+//! deriv for Ti: (A * e^e * D)^{-1} * p; A = Tj^{-1}; D = Ti (evalLie_derivI)
+static matNxM<3, 6> evalLieDerivI(const float4x4& A, const float4x4& D, const float3& p)
+{
+	matNxM<3, 12> j0; matNxM<12, 6> j1;
+	const float4x4 transform = A * D;
+	const float3 pt = p - transform.getTranslation();
+	j0.setZero();	j1.setZero();
+	for (unsigned int r = 0; r < 3; r++) {
+		j0(r, 3 * r + 0) = pt.x;	j0(r, 3 * r + 1) = pt.y;	j0(r, 3 * r + 2) = pt.z;
+	}
+	for (unsigned int r = 0; r < 3; r++) {
+		for (unsigned int c = 0; c < 3; c++) {
+			j0(r, c + 9) = -transform(c, r); //-R(AD)^T
+			j1(r + 9, c) = A(r, c);	 // R(A)
+		}
+	}
+	const float3x3 RA = A.getFloat3x3();
+	for (unsigned int k = 0; k < 4; k++) {
+		const float3 d = make_float3(D(0, k), D(1, k), D(2, k));
+		const float skewValues[9] = { 0.0f, -d.z, d.y, d.z, 0.0f, -d.x, -d.y, d.x, 0.0f };
+		const float3x3 skew(skewValues);
+		const float3x3 m = RA * skew * -1.0f; //RA * col k of D
+		for (unsigned int r = 0; r < 3; r++) {
+			for (unsigned int c = 0; c < 3; c++)
+				j1(3 * k + r, 3 + c) = m(r, c);
+		}
+	}
+	return j0 * j1;
+}
+
+//! deriv for Tj: (A * e^e * D) * p; A = Ti^{-1}; D = Tj (evalLie_derivJ)
+static matNxM<3, 6> evalLieDerivJ(const float4x4& A, const float4x4& D, const float3& p)
+{
+	const float3 dp = make_float3(
+		dot(p, make_float3(D(0, 0), D(0, 1), D(0, 2))) + D(0, 3),
+		dot(p, make_float3(D(1, 0), D(1, 1), D(1, 2))) + D(1, 3),
+		dot(p, make_float3(D(2, 0), D(2, 1), D(2, 2))) + D(2, 3));
+	matNxM<3, 6> jac; jac.setZero();
+	jac(0, 0) = 1.0f;	jac(1, 1) = 1.0f;	jac(2, 2) = 1.0f;
+	jac(0, 4) = dp.z;	jac(0, 5) = -dp.y;
+	jac(1, 3) = -dp.z;	jac(1, 5) = dp.x;
+	jac(2, 3) = dp.y;	jac(2, 4) = -dp.x;
+	return mat3x3(A.getFloat3x3()) * jac;
+}
+
+//! columns of d(T*p)/d(trans, rot) of the lie update of T, at worldP = T*p (see evalLie_dAlpha/dBeta/dGamma)
+static void computeSparseJacobian(const float3& worldP, double sign, double jac[SPARSE_BLOCK_DIM][3])
+{
+	const double x = worldP.x, y = worldP.y, z = worldP.z;
+	const double columns[SPARSE_BLOCK_DIM][3] = {
+		{ 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 },
+		{ 0.0, -z, y }, { z, 0.0, -x }, { -y, x, 0.0 } };
+	for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) {
+		for (unsigned int d = 0; d < 3; d++) jac[c][d] = sign * columns[c][d];
+	}
+}
+
+//! block += weight * a^T b
+static inline void addOuterProduct(double* block, const matNxM<1, 6>& a, const matNxM<1, 6>& b, double weight)
+{
+	for (unsigned int row = 0; row < SPARSE_BLOCK_DIM; row++) {
+		const double wa = weight * a(row);
+		for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) block[row * SPARSE_BLOCK_DIM + col] += wa * b(col);
+	}
+}
+
+static inline float4x4 poseToMatrix(const float3& rot, const float3& trans)
+{
+	return MatrixConversion::toCUDA(PoseHelper::PoseToMatrix(Pose(trans.x, trans.y, trans.z, rot.x, rot.y, rot.z)));
+}
+
+/************************************************************************/
+/* BundlingBlockSystem                                                  */
+/************************************************************************/
+
+void BundlingBlockSystem::init(unsigned int numBlocks, const std::vector<unsigned long long>* pattern)
+{
+	this->numBlocks = numBlocks;
+	this->pattern = pattern;
+	diagonal.assign((size_t)numBlocks * SPARSE_BLOCK_SIZE, 0.0);
+	offDiagonal.assign(pattern->size() * SPARSE_BLOCK_SIZE, 0.0);
+	rhs.assign((size_t)numBlocks * SPARSE_BLOCK_DIM, 0.0);
+}
+
+void BundlingBlockSystem::add(const BundlingBlockSystem& other)
+{
+	std::vector<double>* dst[3] = { &diagonal, &offDiagonal, &rhs };
+	const std::vector<double>* src[3] = { &other.diagonal, &other.offDiagonal, &other.rhs };
+	for (unsigned int a = 0; a < 3; a++) {
+		double* d = dst[a]->data();
+		const double* s = src[a]->data();
+		CPUParallel::parallelFor(0, (unsigned int)dst[a]->size(), [&](unsigned int b, unsigned int e) {
+			for (unsigned int k = b; k < e; k++) d[k] += s[k];
+		}, 4096);
+	}
+}
+
+/************************************************************************/
+/* CPUSolverBundling                                                    */
+/************************************************************************/
+
+CPUSolverBundling::CPUSolverBundling(unsigned int maxNumberOfImages, unsigned int maxNumResiduals)
+	: m_maxNumberOfImages(maxNumberOfImages)
+{
+	m_bRecordConvergence = GlobalBundlingState::get().s_recordSolverConvergence;
+
+	m_correspondences.reserve(maxNumResiduals);
+	m_cacheWidth = 0;
+	m_cacheHeight = 0;
+	m_intrinsics = make_float4(CPU_SOLVER_MINF);
+
+	m_defaultParams.verifyOptDistThresh = 0.02f;
+	m_defaultParams.verifyOptPercentThresh = 0.05f;
+	m_defaultParams.highResidualThresh = std::numeric_limits<float>::infinity();
+	m_defaultParams.denseDistThresh = GlobalBundlingState::get().s_denseDistThresh;
+	m_defaultParams.denseNormalThresh = GlobalBundlingState::get().s_denseNormalThresh;
+	m_defaultParams.denseColorThresh = GlobalBundlingState::get().s_denseColorThresh;
+	m_defaultParams.denseColorGradientMin = GlobalBundlingState::get().s_denseColorGradientMin;
+	m_defaultParams.denseDepthMin = GlobalBundlingState::get().s_denseDepthMin;
+	m_defaultParams.denseDepthMax = GlobalBundlingState::get().s_denseDepthMax;
+	m_defaultParams.denseOverlapCheckSubsampleFactor = GlobalBundlingState::get().s_denseOverlapCheckSubsampleFactor;
+
+	m_maxResidual = 0.0f;
+	m_maxResidualIndex = 0;
+}
+
+CPUSolverBundling::~CPUSolverBundling()
+{
+}
+
+void CPUSolverBundling::solve(EntryJ* d_correspondences, unsigned int numberOfCorrespondences, const int* d_validImages, unsigned int numberOfImages,
+	unsigned int nNonLinearIterations, unsigned int nLinearIterations, const CUDACache* cudaCache,
+	const std::vector<float>& weightsSparse, const std::vector<float>& weightsDenseDepth, const std::vector<float>& weightsDenseColor, bool usePairwiseDense,
+	float3* d_rotationAnglesUnknowns, float3* d_translationUnknowns,
+	bool rebuildJT, bool findMaxResidual, unsigned int revalidateIdx)
+{
+#ifdef USE_LIE_SPACE
+	nNonLinearIterations = std::min(nNonLinearIterations, (unsigned int)weightsSparse.size());
+	MLIB_ASSERT(numberOfImages > 1 && numberOfImages <= m_maxNumberOfImages && nNonLinearIterations > 0);
+	const unsigned int N = numberOfImages;
+
+	m_correspondences.resize(numberOfCorrespondences);
+	if (numberOfCorrespondences > 0)
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_correspondences.data(), d_correspondences, sizeof(EntryJ)*numberOfCorrespondences, cudaMemcpyDeviceToHost));
+	m_validImages.resize(N);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_validImages.data(), d_validImages, sizeof(int)*N, cudaMemcpyDeviceToHost));
+	m_rot.resize(N);
+	m_trans.resize(N);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_rot.data(), d_rotationAnglesUnknowns, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_trans.data(), d_translationUnknowns, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+
+	SolverParameters parameters = m_defaultParams;
+	parameters.nNonLinearIterations = nNonLinearIterations;
+	parameters.nLinIterations = nLinearIterations;
+	parameters.useDenseDepthAllPairwise = usePairwiseDense;
+
+	bool useDense = false;
+	for (unsigned int nIter = 0; nIter < nNonLinearIterations; nIter++) {
+		if (weightsDenseDepth[nIter] > 0.0f || weightsDenseColor[nIter] > 0.0f) useDense = true;
+	}
+	if (useDense) {
+		MLIB_ASSERT(cudaCache && cudaCache->getWidth() / parameters.denseOverlapCheckSubsampleFactor > 8);
+		downloadCache(cudaCache, N);
+	}
+
+	if (m_bRecordConvergence) {
+		m_convergence.assign(nNonLinearIterations + 1, -1.0f);
+		m_linConvergence.clear();
+	}
+
+	//the sparse blocks do not change over the non-linear iterations
+	m_sparsePattern.clear();
+	for (const EntryJ& corr : m_correspondences) {
+		if (corr.isValid() && corr.imgIdx_i > 0 && corr.imgIdx_j > 0 && corr.imgIdx_i != corr.imgIdx_j)
+			m_sparsePattern.push_back(SparseBlockCholesky::getPatternKey(std::min(corr.imgIdx_i, corr.imgIdx_j) - 1, std::max(corr.imgIdx_i, corr.imgIdx_j) - 1));
+	}
+	std::sort(m_sparsePattern.begin(), m_sparsePattern.end());
+	m_sparsePattern.erase(std::unique(m_sparsePattern.begin(), m_sparsePattern.end()), m_sparsePattern.end());
+
+	const unsigned int directSolverMinNumImages = GlobalBundlingState::get().s_directSolverMinNumImages;
+	const bool useDirect = directSolverMinNumImages > 0 && N >= directSolverMinNumImages;
+
+	parameters.weightSparse = weightsSparse.front();
+	computeTransforms();
+	if (m_bRecordConvergence) m_convergence[0] = evalSparseResidual(parameters.weightSparse);
+
+	std::vector<double> delta;
+	for (unsigned int nIter = 0; nIter < nNonLinearIterations; nIter++)
+	{
+		parameters.weightSparse = weightsSparse[nIter];
+		parameters.weightDenseDepth = weightsDenseDepth[nIter];
+		parameters.weightDenseColor = weightsDenseColor[nIter];
+		parameters.useDense = (parameters.weightDenseDepth > 0 || parameters.weightDenseColor > 0);
+		if (parameters.useDense) parameters.useDense = buildDenseSystem(parameters); //don't solve dense if no overlapping frames found
+
+		//block pattern: sparse pairs + weighted dense pairs
+		m_pattern = m_sparsePattern;
+		if (parameters.useDense) {
+			for (const DensePair& pair : m_densePairs) {
+				if (pair.weight > 0.0f && pair.i > 0) m_pattern.push_back(SparseBlockCholesky::getPatternKey(pair.i - 1, pair.j - 1));
+			}
+			std::sort(m_pattern.begin(), m_pattern.end());
+			m_pattern.erase(std::unique(m_pattern.begin(), m_pattern.end()), m_pattern.end());
+		}
+
+		m_system.init(N - 1, &m_pattern);
+		addSparseTerms(m_correspondences, m_transforms, parameters.weightSparse, m_chunkSystems, m_system);
+		if (parameters.useDense) {
+			for (const DensePair& pair : m_densePairs) {
+				if (pair.weight == 0.0f) continue;
+				if (pair.i > 0) {
+					double* ii = m_system.getDiagonal(pair.i);
+					double* ij = m_system.getOffDiagonal(pair.i, pair.j);
+					double* bi = m_system.getRhs(pair.i);
+					for (unsigned int k = 0; k < SPARSE_BLOCK_SIZE; k++) { ii[k] += pair.jtjii[k]; ij[k] += pair.jtjij[k]; }
+					for (unsigned int k = 0; k < SPARSE_BLOCK_DIM; k++) bi[k] -= pair.jtri[k]; //minus since -Jtf
+				}
+				double* jj = m_system.getDiagonal(pair.j);
+				double* bj = m_system.getRhs(pair.j);
+				for (unsigned int k = 0; k < SPARSE_BLOCK_SIZE; k++) jj[k] += pair.jtjjj[k];
+				for (unsigned int k = 0; k < SPARSE_BLOCK_DIM; k++) bj[k] -= pair.jtrj[k];
+			}
+		}
+
+		if (useDirect) {
+			m_directSolver.analyze(N - 1, m_pattern); //reuses the ordering if the pattern is unchanged
+			if (!solveBlockSystem(m_system, m_directSolver, delta)) {
+				std::cout << "warning: direct bundling solve failed to factorize (" << N << " images)" << std::endl;
+				break;
+			}
+		}
+		else {
+			solveLinear(m_system, parameters.nLinIterations, delta);
+		}
+
+		//lie update (computeLieUpdate), max delta for the early out (EvalGNConvergence)
+		float maxDelta = 0.0f;
+		for (unsigned int x = 1; x < N; x++) {
+			const double* d = delta.data() + (size_t)(x - 1) * SPARSE_BLOCK_DIM;
+			const float3 deltaTrans = make_float3((float)d[0], (float)d[1], (float)d[2]);
+			const float3 deltaRot = make_float3((float)d[3], (float)d[4], (float)d[5]);
+			const mat4f update = PoseHelper::PoseToMatrix(Pose(deltaTrans.x, deltaTrans.y, deltaTrans.z, deltaRot.x, deltaRot.y, deltaRot.z));
+			const Pose pose = PoseHelper::MatrixToPose(update * PoseHelper::PoseToMatrix(Pose(m_trans[x].x, m_trans[x].y, m_trans[x].z, m_rot[x].x, m_rot[x].y, m_rot[x].z)));
+			m_trans[x] = make_float3(pose[0], pose[1], pose[2]);
+			m_rot[x] = make_float3(pose[3], pose[4], pose[5]);
+			if (m_validImages[x] != 0) {
+				for (unsigned int k = 0; k < SPARSE_BLOCK_DIM; k++) maxDelta = std::max(maxDelta, std::fabs((float)d[k]));
+			}
+		}
+		computeTransforms();
+
+		if (m_bRecordConvergence) m_convergence[nIter + 1] = evalSparseResidual(parameters.weightSparse);
+		if (nIter < nNonLinearIterations - 1 && maxDelta < 0.005f) break; //same early out as solveBundlingStub
+	}
+
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_rotationAnglesUnknowns, m_rot.data(), sizeof(float3)*N, cudaMemcpyHostToDevice));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_translationUnknowns, m_trans.data(), sizeof(float3)*N, cudaMemcpyHostToDevice));
+
+	if (findMaxResidual) computeMaxResidual(parameters.weightSparse);
+#else
+	throw MLIB_EXCEPTION("cpu bundling solve requires USE_LIE_SPACE");
+#endif
+}
+
+void CPUSolverBundling::downloadCache(const CUDACache* cudaCache, unsigned int numberOfImages)
+{
+	m_cacheWidth = cudaCache->getWidth();
+	m_cacheHeight = cudaCache->getHeight();
+	const mat4f& intrinsics = cudaCache->getIntrinsics();
+	m_intrinsics = make_float4(intrinsics(0, 0), intrinsics(1, 1), intrinsics(0, 2), intrinsics(1, 2));
+
+	const size_t numPixels = (size_t)m_cacheWidth * m_cacheHeight;
+	const std::vector<CUDACachedFrame>& cacheFrames = cudaCache->getCacheFrames();
+	MLIB_ASSERT(cacheFrames.size() >= numberOfImages);
+	if (m_cacheFrames.size() < numberOfImages) m_cacheFrames.resize(numberOfImages);
+	for (unsigned int i = 0; i < numberOfImages; i++) {
+		const CUDACachedFrame& src = cacheFrames[i];
+		CachedFrame& dst = m_cacheFrames[i];
+		dst.depth.resize(numPixels);
+		dst.cameraPos.resize(numPixels);
+		dst.intensity.resize(numPixels);
+		dst.intensityDerivs.resize(numPixels);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.depth.data(), src.d_depthDownsampled, sizeof(float)*numPixels, cudaMemcpyDeviceToHost));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.cameraPos.data(), src.d_cameraposDownsampled, sizeof(float4)*numPixels, cudaMemcpyDeviceToHost));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.intensity.data(), src.d_intensityDownsampled, sizeof(float)*numPixels, cudaMemcpyDeviceToHost));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.intensityDerivs.data(), src.d_intensityDerivsDownsampled, sizeof(float2)*numPixels, cudaMemcpyDeviceToHost));
+#ifdef CUDACACHE_UCHAR_NORMALS
+		dst.normalsUCHAR4.resize(numPixels);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.normalsUCHAR4.data(), src.d_normalsDownsampledUCHAR4, sizeof(uchar4)*numPixels, cudaMemcpyDeviceToHost));
+#endif
+#ifdef CUDACACHE_FLOAT_NORMALS
+		dst.normals.resize(numPixels);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(dst.normals.data(), src.d_normalsDownsampled, sizeof(float4)*numPixels, cudaMemcpyDeviceToHost));
+#endif
+	}
+}
+
+void CPUSolverBundling::computeTransforms()
+{
+	const unsigned int N = (unsigned int)m_rot.size();
+	m_transforms.resize(N);
+	m_transformInverses.resize(N);
+	CPUParallel::parallelForEach(0, N, [&](unsigned int i) {
+		m_transforms[i] = poseToMatrix(m_rot[i], m_trans[i]);
+		m_transformInverses[i] = m_transforms[i].getInverse();
+	}, 64);
+}
+
+void CPUSolverBundling::addSparseTerms(const std::vector<EntryJ>& correspondences, const std::vector<float4x4>& transforms, float weightSparse,
+	std::vector<BundlingBlockSystem>& chunkSystems, BundlingBlockSystem& system)
+{
+	if (!(weightSparse > 0.0f) || correspondences.empty()) return;
+
+	const unsigned int numCorrChunks = std::max(1u, std::min(CPUParallel::getNumThreads(), ((unsigned int)correspondences.size() + CPU_SOLVER_CORR_CHUNK - 1) / CPU_SOLVER_CORR_CHUNK));
+	if (chunkSystems.size() < numCorrChunks - 1) chunkSystems.resize(numCorrChunks - 1);
+	const double w = weightSparse;
+
+	CPUParallel::parallelForEach(0, numCorrChunks, [&](unsigned int c) {
+		//the first chunk accumulates directly into system
+		BundlingBlockSystem& chunk = (c == 0) ? system : chunkSystems[c - 1];
+		if (c > 0) chunk.init(system.numBlocks, system.pattern);
+		const size_t begin = correspondences.size() * c / numCorrChunks;
+		const size_t end = correspondences.size() * (c + 1) / numCorrChunks;
+		for (size_t idx = begin; idx < end; idx++) {
+			const EntryJ& corr = correspondences[idx];
+			if (!corr.isValid() || corr.imgIdx_i == corr.imgIdx_j) continue;
+
+			const float3 worldPi = transforms[corr.imgIdx_i] * corr.pos_i;
+			const float3 worldPj = transforms[corr.imgIdx_j] * corr.pos_j;
+			const double r[3] = { worldPi.x - worldPj.x, worldPi.y - worldPj.y, worldPi.z - worldPj.z };
+			double jac[2][SPARSE_BLOCK_DIM][3];
+			computeSparseJacobian(worldPi, 1.0, jac[0]);
+			computeSparseJacobian(worldPj, -1.0, jac[1]);
+
+			const unsigned int images[2] = { corr.imgIdx_i, corr.imgIdx_j };
+			for (unsigned int a = 0; a < 2; a++) {
+				if (images[a] == 0) continue;
+				double* block = chunk.getDiagonal(images[a]);
+				double* b = chunk.getRhs(images[a]);
+				for (unsigned int row = 0; row < SPARSE_BLOCK_DIM; row++) {
+					const double* jr = jac[a][row];
+					for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) {
+						const double* jc = jac[a][col];
+						block[row * SPARSE_BLOCK_DIM + col] += w * (jr[0] * jc[0] + jr[1] * jc[1] + jr[2] * jc[2]);
+					}
+					b[row] -= w * (jr[0] * r[0] + jr[1] * r[1] + jr[2] * r[2]);
+				}
+			}
+			if (images[0] > 0 && images[1] > 0) {
+				const unsigned int lo = images[0] < images[1] ? 0 : 1;
+				double* block = chunk.getOffDiagonal(images[lo], images[1 - lo]);
+				for (unsigned int row = 0; row < SPARSE_BLOCK_DIM; row++) {
+					const double* jr = jac[lo][row];
+					for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) {
+						const double* jc = jac[1 - lo][col];
+						block[row * SPARSE_BLOCK_DIM + col] += w * (jr[0] * jc[0] + jr[1] * jc[1] + jr[2] * jc[2]);
+					}
+				}
+			}
+		}
+	});
+	for (unsigned int c = 1; c < numCorrChunks; c++) system.add(chunkSystems[c - 1]);
+}
+
+bool CPUSolverBundling::solveBlockSystem(BundlingBlockSystem& system, SparseBlockCholesky& solver, std::vector<double>& delta)
+{
+	const unsigned int numBlocks = system.numBlocks;
+
+	//images without residuals (e.g., invalidated) get an identity block and a zero update
+	for (unsigned int v = 0; v < numBlocks; v++) {
+		double* block = system.diagonal.data() + (size_t)v * SPARSE_BLOCK_SIZE;
+		double trace = 0.0;
+		for (unsigned int d = 0; d < SPARSE_BLOCK_DIM; d++) trace += block[d * (SPARSE_BLOCK_DIM + 1)];
+		if (!(trace > 0.0)) {
+			for (unsigned int d = 0; d < SPARSE_BLOCK_DIM; d++) block[d * (SPARSE_BLOCK_DIM + 1)] = 1.0;
+		}
+	}
+	//small levenberg-marquardt damping, increased if the factorization fails
+	std::vector<double> damped;
+	for (double lambda = 1e-6; lambda < 2.0; lambda *= 10.0) {
+		damped = system.diagonal;
+		for (unsigned int v = 0; v < numBlocks; v++) {
+			for (unsigned int d = 0; d < SPARSE_BLOCK_DIM; d++) {
+				double& a = damped[(size_t)v * SPARSE_BLOCK_SIZE + d * (SPARSE_BLOCK_DIM + 1)];
+				a += lambda * (a + 1.0);
+			}
+		}
+		if (solver.factorize(damped, system.offDiagonal)) {
+			solver.solve(system.rhs, delta);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CPUSolverBundling::findOverlap(unsigned int i, unsigned int j, const SolverParameters& parameters) const
+{
+	const float4x4 transform = m_transformInverses[i] * m_transforms[j];
+	if (!computeAngleDiff(transform, 0.52f)) return false; //~30 degrees
+
+	const unsigned int width = m_cacheWidth, height = m_cacheHeight;
+	const float* tgtDepth = m_cacheFrames[i].depth.data();
+	const float* srcDepth = m_cacheFrames[j].depth.data();
+	const unsigned int subWidth = width / parameters.denseOverlapCheckSubsampleFactor;
+	unsigned int count = 0;
+	for (unsigned int t = 0; t < CPU_SOLVER_OVERLAP_SAMPLES; t++) {
+		const unsigned int x = (t % subWidth) * parameters.denseOverlapCheckSubsampleFactor;
+		const unsigned int y = (t / subWidth) * parameters.denseOverlapCheckSubsampleFactor;
+		const unsigned int idx = y * width + x;
+		if (idx >= width * height) continue;
+
+		//findDenseCorr without normals (pre-filter)
+		const float3 cposj = depthToCamera(m_intrinsics, x, y, srcDepth[idx]);
+		if (!(cposj.z > parameters.denseDepthMin && cposj.z < parameters.denseDepthMax)) continue;
+		const float3 camPosSrcToTgt = transform * cposj;
+		const float2 tgtScreenPosf = cameraToDepth(m_intrinsics, camPosSrcToTgt);
+		const int tx = (int)roundf(tgtScreenPosf.x), ty = (int)roundf(tgtScreenPosf.y);
+		if (tx < 0 || ty < 0 || tx >= (int)width || ty >= (int)height) continue;
+		const float3 camPosTgt = depthToCamera(m_intrinsics, tx, ty, tgtDepth[ty * width + tx]);
+		if (!(camPosTgt.z > parameters.denseDepthMin && camPosTgt.z < parameters.denseDepthMax)) continue;
+		if (length(camPosSrcToTgt - camPosTgt) <= parameters.denseDistThresh) count++;
+	}
+	return count > 10;
+}
+
+unsigned int CPUSolverBundling::countDenseCorrespondences(unsigned int i, unsigned int j, const SolverParameters& parameters) const
+{
+	const float4x4 transform = m_transformInverses[i] * m_transforms[j];
+	const float3x3 rotation = transform.getFloat3x3();
+	const unsigned int width = m_cacheWidth, height = m_cacheHeight;
+	const CachedFrame& tgt = m_cacheFrames[i];
+	const CachedFrame& src = m_cacheFrames[j];
+
+	unsigned int count = 0;
+	for (unsigned int idx = 0; idx < width * height; idx++) {
+		const float3 cposj = depthToCamera(m_intrinsics, idx % width, idx / width, src.depth[idx]);
+		if (!(cposj.z > parameters.denseDepthMin && cposj.z < parameters.denseDepthMax)) continue;
+#ifdef CUDACACHE_UCHAR_NORMALS
+		const uchar4 nrmjUCHAR4 = src.normalsUCHAR4[idx];
+		if (*(const int*)(&nrmjUCHAR4) == 0) continue;
+		const float3 nrmj = rotation * uchar4ToNormal(nrmjUCHAR4);
+#elif defined(CUDACACHE_FLOAT_NORMALS)
+		const float4 nrmj4 = src.normals[idx];
+		if (nrmj4.x == CPU_SOLVER_MINF) continue;
+		const float3 nrmj = rotation * make_float3(nrmj4.x, nrmj4.y, nrmj4.z);
+#endif
+		const float3 camPosSrcToTgt = transform * cposj;
+		const float2 tgtScreenPosf = cameraToDepth(m_intrinsics, camPosSrcToTgt);
+		const int tx = (int)roundf(tgtScreenPosf.x), ty = (int)roundf(tgtScreenPosf.y);
+		if (tx < 0 || ty < 0 || tx >= (int)width || ty >= (int)height) continue;
+		const unsigned int tgtIdx = ty * width + tx;
+		const float3 camPosTgt = depthToCamera(m_intrinsics, tx, ty, tgt.depth[tgtIdx]);
+		if (!(camPosTgt.z > parameters.denseDepthMin && camPosTgt.z < parameters.denseDepthMax)) continue;
+#ifdef CUDACACHE_UCHAR_NORMALS
+		const uchar4 nrmTgtUCHAR4 = tgt.normalsUCHAR4[tgtIdx];
+		if (*(const int*)(&nrmTgtUCHAR4) == 0) continue;
+		const float3 normalTgt = uchar4ToNormal(nrmTgtUCHAR4);
+#elif defined(CUDACACHE_FLOAT_NORMALS)
+		const float4 normalTgt4 = tgt.normals[tgtIdx];
+		if (normalTgt4.x == CPU_SOLVER_MINF) continue;
+		const float3 normalTgt = make_float3(normalTgt4.x, normalTgt4.y, normalTgt4.z);
+#endif
+		if (dot(nrmj, normalTgt) >= parameters.denseNormalThresh && length(camPosSrcToTgt - camPosTgt) <= parameters.denseDistThresh) count++;
+	}
+	return count;
+}
+
+void CPUSolverBundling::buildDensePair(DensePair& pair, const SolverParameters& parameters, bool useDepth, bool useColor) const
+{
+	const unsigned int i = pair.i, j = pair.j;
+	const float4x4& transform_i = m_transforms[i];
+	const float4x4& transform_j = m_transforms[j];
+	const float4x4& invTransform_i = m_transformInverses[i];
+	const float4x4& invTransform_j = m_transformInverses[j];
+	const float4x4 transform = invTransform_i * transform_j;
+	const unsigned int width = m_cacheWidth, height = m_cacheHeight;
+	const CachedFrame& tgt = m_cacheFrames[i];
+	const CachedFrame& src = m_cacheFrames[j];
+
+	for (unsigned int srcIdx = 0; srcIdx < width * height; srcIdx++) {
+		//findDenseCorr on camera positions (i tgt, j src)
+		const float4 cposj = src.cameraPos[srcIdx];
+		if (!(cposj.z > parameters.denseDepthMin && cposj.z < parameters.denseDepthMax)) continue;
+		const float3 camPosSrc = make_float3(cposj.x, cposj.y, cposj.z);
+#ifdef CUDACACHE_FLOAT_NORMALS
+		float4 nrmj = src.normals[srcIdx];
+		if (nrmj.x == CPU_SOLVER_MINF) continue;
+		nrmj = transform * nrmj;
+#elif defined(CUDACACHE_UCHAR_NORMALS)
+		const uchar4 nrmjUCHAR4 = src.normalsUCHAR4[srcIdx];
+		if (*(const int*)(&nrmjUCHAR4) == 0) continue;
+		const float3 nrmj = transform * uchar4ToNormal(nrmjUCHAR4);
+#endif
+		const float3 camPosSrcToTgt = transform * camPosSrc;
+		const float2 tgtScreenPosf = cameraToDepth(m_intrinsics, camPosSrcToTgt);
+		const int tx = (int)roundf(tgtScreenPosf.x), ty = (int)roundf(tgtScreenPosf.y);
+		if (tx < 0 || ty < 0 || tx >= (int)width || ty >= (int)height) continue;
+		const float4 cposi = bilinearInterpolation(tgtScreenPosf.x, tgtScreenPosf.y, tgt.cameraPos.data(), width, height, make_float4(CPU_SOLVER_MINF));
+		if (!(cposi.z > parameters.denseDepthMin && cposi.z < parameters.denseDepthMax)) continue;
+		const float3 camPosTgt = make_float3(cposi.x, cposi.y, cposi.z);
+#ifdef CUDACACHE_FLOAT_NORMALS
+		const float4 nrmi = bilinearInterpolation(tgtScreenPosf.x, tgtScreenPosf.y, tgt.normals.data(), width, height, make_float4(CPU_SOLVER_MINF));
+		if (nrmi.x == CPU_SOLVER_MINF) continue;
+		const float3 normalTgt = make_float3(nrmi.x, nrmi.y, nrmi.z);
+		const float dNormal = dot(nrmj, nrmi);
+#elif defined(CUDACACHE_UCHAR_NORMALS)
+		const uchar4 nrmTgtUCHAR4 = tgt.normalsUCHAR4[ty * width + tx];
+		if (*(const int*)(&nrmTgtUCHAR4) == 0) continue;
+		const float3 normalTgt = uchar4ToNormal(nrmTgtUCHAR4);
+		const float dNormal = dot(nrmj, normalTgt);
+#endif
+		if (!(dNormal >= parameters.denseNormalThresh && length(camPosSrcToTgt - camPosTgt) <= parameters.denseDistThresh)) continue;
+
+		if (useDepth) {
+			//point-to-plane
+			const float depthRes = dot(camPosTgt - camPosSrcToTgt, normalTgt);
+			const float depthWeight = parameters.weightDenseDepth * pair.weight * std::pow(std::max(0.0f, 1.0f - camPosTgt.z / 2.0f), 2.5f);
+			matNxM<1, 6> jac_i, jac_j; jac_i.setZero(); jac_j.setZero();
+			if (i > 0) {
+				const matNxM<3, 6> jac = evalLieDerivI(invTransform_j, transform_i, camPosSrc);
+				for (unsigned int c = 0; c < 6; c++) jac_i(c) = -dot(make_float3(jac(0, c), jac(1, c), jac(2, c)), normalTgt);
+			}
+			if (j > 0) {
+				const matNxM<3, 6> jac = evalLieDerivJ(invTransform_i, transform_j, camPosSrc);
+				for (unsigned int c = 0; c < 6; c++) jac_j(c) = -dot(make_float3(jac(0, c), jac(1, c), jac(2, c)), normalTgt);
+			}
+			addOuterProduct(pair.jtjii, jac_i, jac_i, depthWeight);
+			addOuterProduct(pair.jtjjj, jac_j, jac_j, depthWeight);
+			addOuterProduct(pair.jtjij, jac_i, jac_j, depthWeight);
+			for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) {
+				pair.jtri[c] += (double)jac_i(c) * depthRes * depthWeight;
+				pair.jtrj[c] += (double)jac_j(c) * depthRes * depthWeight;
+			}
+		}
+		if (useColor) {
+			const float2 intensityDerivTgt = bilinearInterpolation(tgtScreenPosf.x, tgtScreenPosf.y, tgt.intensityDerivs.data(), width, height, make_float2(CPU_SOLVER_MINF));
+			const float intensityTgt = bilinearInterpolation(tgtScreenPosf.x, tgtScreenPosf.y, tgt.intensity.data(), width, height, CPU_SOLVER_MINF);
+			const float colorRes = intensityTgt - src.intensity[srcIdx];
+			if (!(intensityDerivTgt.x != CPU_SOLVER_MINF && std::fabs(colorRes) < parameters.denseColorThresh && length(intensityDerivTgt) > parameters.denseColorGradientMin)) continue;
+
+			const mat2x3 dProj = dCameraToScreen(camPosSrcToTgt, m_intrinsics.x, m_intrinsics.y);
+			const mat1x2 dColorB(intensityDerivTgt);
+			matNxM<1, 6> jac_i, jac_j; jac_i.setZero(); jac_j.setZero();
+			if (i > 0) jac_i = dColorB * (dProj * evalLieDerivI(invTransform_j, transform_i, camPosSrc));
+			if (j > 0) jac_j = dColorB * (dProj * evalLieDerivJ(invTransform_i, transform_j, camPosSrc));
+			const float colorWeight = parameters.weightDenseColor * pair.weight * std::max(0.0f, 1.0f - std::fabs(colorRes) / (1.15f*parameters.denseColorThresh));
+			addOuterProduct(pair.jtjii, jac_i, jac_i, colorWeight);
+			addOuterProduct(pair.jtjjj, jac_j, jac_j, colorWeight);
+			addOuterProduct(pair.jtjij, jac_i, jac_j, colorWeight);
+			for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) {
+				pair.jtri[c] += (double)jac_i(c) * colorRes * colorWeight;
+				pair.jtrj[c] += (double)jac_j(c) * colorRes * colorWeight;
+			}
+		}
+	}
+}
+
+bool CPUSolverBundling::buildDenseSystem(const SolverParameters& parameters)
+{
+	const unsigned int N = (unsigned int)m_validImages.size();
+
+	//overlapping image pairs (FindImageImageCorr_Kernel)
+	std::vector<uint2> candidates;
+	for (unsigned int i = 0; i + 1 < N; i++) {
+		if (m_validImages[i] == 0) continue;
+		const unsigned int jEnd = parameters.useDenseDepthAllPairwise ? N : i + 2;
+		for (unsigned int j = i + 1; j < jEnd; j++) {
+			if (m_validImages[j] != 0) candidates.push_back(make_uint2(i, j));
+		}
+	}
+	std::vector<unsigned char> overlaps(candidates.size());
+	CPUParallel::parallelForEach(0, (unsigned int)candidates.size(), [&](unsigned int p) {
+		overlaps[p] = findOverlap(candidates[p].x, candidates[p].y, parameters) ? 1 : 0;
+	}, 16);
+	m_densePairs.clear();
+	for (size_t p = 0; p < candidates.size(); p++) {
+		if (!overlaps[p]) continue;
+		m_densePairs.push_back(DensePair());
+		m_densePairs.back().i = candidates[p].x;
+		m_densePairs.back().j = candidates[p].y;
+	}
+	if (m_densePairs.empty()) {
+		std::cout << "warning: no overlapping images for dense solve" << std::endl;
+		return false;
+	}
+
+	//pair weights (FindDenseCorrespondences_Kernel, WeightDenseCorrespondences_Kernel) and jtj/jtr (BuildDenseSystem_Kernel)
+	const bool useDepth = parameters.weightDenseDepth > 0.0f;
+	const bool useColor = !useDepth || parameters.weightDenseColor > 0.0f;
+	CPUParallel::parallelForEach(0, (unsigned int)m_densePairs.size(), [&](unsigned int p) {
+		DensePair& pair = m_densePairs[p];
+		const float count = (float)countDenseCorrespondences(pair.i, pair.j, parameters);
+		pair.weight = (count < 800.0f) ? 0.0f : 1.0f / std::min(std::log(count), 9.0f); //don't consider too small #corr
+		std::fill(pair.jtjii, pair.jtjii + SPARSE_BLOCK_SIZE, 0.0);
+		std::fill(pair.jtjjj, pair.jtjjj + SPARSE_BLOCK_SIZE, 0.0);
+		std::fill(pair.jtjij, pair.jtjij + SPARSE_BLOCK_SIZE, 0.0);
+		std::fill(pair.jtri, pair.jtri + SPARSE_BLOCK_DIM, 0.0);
+		std::fill(pair.jtrj, pair.jtrj + SPARSE_BLOCK_DIM, 0.0);
+		if (pair.weight > 0.0f) buildDensePair(pair, parameters, useDepth, useColor);
+	});
+	return true;
+}
+
+void CPUSolverBundling::computePreconditioner()
+{
+	//1 / diag of the unweighted sparse J^T J (evalMinusJTFDevice)
+	const unsigned int numBlocks = (unsigned int)m_rot.size() - 1;
+	std::vector<double> diag((size_t)numBlocks * SPARSE_BLOCK_DIM, 0.0);
+	for (const EntryJ& corr : m_correspondences) {
+		if (!corr.isValid()) continue;
+		const unsigned int images[2] = { corr.imgIdx_i, corr.imgIdx_j };
+		const float3 positions[2] = { corr.pos_i, corr.pos_j };
+		for (unsigned int a = 0; a < 2; a++) {
+			if (images[a] == 0) continue;
+			const float3 worldP = m_transforms[images[a]] * positions[a];
+			double* d = diag.data() + (size_t)(images[a] - 1) * SPARSE_BLOCK_DIM;
+			d[0] += 1.0;	d[1] += 1.0;	d[2] += 1.0;
+			d[3] += (double)worldP.y * worldP.y + (double)worldP.z * worldP.z;
+			d[4] += (double)worldP.x * worldP.x + (double)worldP.z * worldP.z;
+			d[5] += (double)worldP.x * worldP.x + (double)worldP.y * worldP.y;
+		}
+	}
+	m_preconditioner.resize(diag.size());
+	for (size_t k = 0; k < diag.size(); k++) m_preconditioner[k] = (diag[k] > CPU_SOLVER_EPSILON) ? 1.0 / diag[k] : 1.0;
+}
+
+void CPUSolverBundling::solveLinear(BundlingBlockSystem& system, unsigned int nLinIterations, std::vector<double>& delta)
+{
+	const unsigned int numBlocks = system.numBlocks;
+	const size_t n = (size_t)numBlocks * SPARSE_BLOCK_DIM;
+	const std::vector<unsigned long long>& pattern = *system.pattern;
+	computePreconditioner();
+
+	//off-diagonal blocks per block row: pattern entry, column block, transposed
+	std::vector<unsigned int> rowStarts(numBlocks + 1, 0);
+	for (unsigned long long key : pattern) {
+		rowStarts[(unsigned int)(key >> 32) + 1]++;
+		rowStarts[(unsigned int)(key & 0xffffffff) + 1]++;
+	}
+	for (unsigned int v = 0; v < numBlocks; v++) rowStarts[v + 1] += rowStarts[v];
+	std::vector<uint3> rowEntries(rowStarts[numBlocks]);
+	std::vector<unsigned int> fill(rowStarts.begin(), rowStarts.end() - 1);
+	for (unsigned int e = 0; e < (unsigned int)pattern.size(); e++) {
+		const unsigned int bi = (unsigned int)(pattern[e] >> 32), bj = (unsigned int)(pattern[e] & 0xffffffff);
+		rowEntries[fill[bi]++] = make_uint3(e, bj, 0);
+		rowEntries[fill[bj]++] = make_uint3(e, bi, 1);
+	}
+
+	//Ap = (J^T J) p on the block rows
+	std::vector<double> r = system.rhs, z(n), p(n), Ap(n);
+	auto applySystem = [&]() {
+		CPUParallel::parallelFor(0, numBlocks, [&](unsigned int b, unsigned int e) {
+			for (unsigned int v = b; v < e; v++) {
+				double* y = Ap.data() + (size_t)v * SPARSE_BLOCK_DIM;
+				const double* D = system.diagonal.data() + (size_t)v * SPARSE_BLOCK_SIZE;
+				const double* pv = p.data() + (size_t)v * SPARSE_BLOCK_DIM;
+				for (unsigned int row = 0; row < SPARSE_BLOCK_DIM; row++) {
+					double sum = 0.0;
+					for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) sum += D[row * SPARSE_BLOCK_DIM + col] * pv[col];
+					y[row] = sum;
+				}
+				for (unsigned int k = rowStarts[v]; k < rowStarts[v + 1]; k++) {
+					const uint3& entry = rowEntries[k];
+					const double* B = system.offDiagonal.data() + (size_t)entry.x * SPARSE_BLOCK_SIZE;
+					const double* pw = p.data() + (size_t)entry.y * SPARSE_BLOCK_DIM;
+					for (unsigned int row = 0; row < SPARSE_BLOCK_DIM; row++) {
+						double sum = 0.0;
+						if (entry.z == 0) { for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) sum += B[row * SPARSE_BLOCK_DIM + col] * pw[col]; }
+						else			  { for (unsigned int col = 0; col < SPARSE_BLOCK_DIM; col++) sum += B[col * SPARSE_BLOCK_DIM + row] * pw[col]; }
+						y[row] += sum;
+					}
+				}
+			}
+		}, 16);
+	};
+
+	//same steps as Initialization / PCGIteration
+	delta.assign(n, 0.0);
+	double rDotzOld = 0.0;
+	for (size_t k = 0; k < n; k++) {
+		z[k] = m_preconditioner[k] * r[k];
+		p[k] = z[k];
+		rDotzOld += r[k] * z[k];
+	}
+	for (unsigned int linIter = 0; linIter < nLinIterations; linIter++) {
+		applySystem();
+		double dotProduct = 0.0;
+		for (size_t k = 0; k < n; k++) dotProduct += p[k] * Ap[k];
+
+		const double alpha = (dotProduct > CPU_SOLVER_EPSILON) ? rDotzOld / dotProduct : 0.0;
+		double rDotzNew = 0.0;
+		for (size_t k = 0; k < n; k++) {
+			delta[k] += alpha * p[k];
+			r[k] -= alpha * Ap[k];
+			z[k] = m_preconditioner[k] * r[k];
+			rDotzNew += z[k] * r[k];
+		}
+		if (m_bRecordConvergence) m_linConvergence.push_back((float)rDotzNew);
+		if (std::fabs(dotProduct) < 5e-7) break; //ENABLE_EARLY_OUT
+
+		const double beta = (rDotzOld > CPU_SOLVER_EPSILON) ? rDotzNew / rDotzOld : 0.0;
+		rDotzOld = rDotzNew;
+		for (size_t k = 0; k < n; k++) p[k] = z[k] + beta * p[k];
+	}
+}
+
+float CPUSolverBundling::evalSparseResidual(float weightSparse) const
+{
+	double sum = 0.0;
+	for (const EntryJ& corr : m_correspondences) {
+		if (!corr.isValid()) continue;
+		const float3 r = m_transforms[corr.imgIdx_i] * corr.pos_i - m_transforms[corr.imgIdx_j] * corr.pos_j;
+		sum += weightSparse * dot(r, r);
+	}
+	return (float)sum;
+}
+
+void CPUSolverBundling::computeMaxResidual(float weightSparse)
+{
+	m_maxResidual = 0.0f;
+	m_maxResidualIndex = 0;
+	if (!(weightSparse > 0.0f)) return;
+	for (unsigned int idx = 0; idx < (unsigned int)m_correspondences.size(); idx++) {
+		const EntryJ& corr = m_correspondences[idx];
+		if (!corr.isValid()) continue;
+		const float3 r = weightSparse * fabs(m_transforms[corr.imgIdx_i] * corr.pos_i - m_transforms[corr.imgIdx_j] * corr.pos_j);
+		const float res = std::max(r.z, std::max(r.x, r.y));
+		if (m_maxResidual < res) {
+			m_maxResidual = res;
+			m_maxResidualIndex = (int)idx;
+		}
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#ifndef CPU_SOLVER_BUNDLING_H
+#define CPU_SOLVER_BUNDLING_H
+
+#include "SolverBundlingParameters.h"
+#include "SparseBlockCholesky.h"
+#include "../CUDACacheUtil.h"
+#include "../SiftGPU/SIFTImageManager.h"
+#include "../SiftGPU/cuda_SimpleMatrixUtil.h"
+
+#include <vector>
+#include <algorithm>
+
+class CUDACache;
+
+////////////////////////////////////////////////////////////////
+//class BundlingBlockSystem
+//description: gauss-newton normal equations of the poses of images 1..N-1 (image 0 is fixed, block k is image k + 1)
+//             in 6x6 blocks [trans, rot]; the off-diagonal blocks are those of the pattern (see SparseBlockCholesky)
+////////////////////////////////////////////////////////////////
+struct BundlingBlockSystem
+{
+	//! zeroes the system; pattern must stay alive
+	void init(unsigned int numBlocks, const std::vector<unsigned long long>* pattern);
+	//! adds other (same pattern) to this system
+	void add(const BundlingBlockSystem& other);
+
+	double* getDiagonal(unsigned int image) {
+		return diagonal.data() + (size_t)(image - 1) * SPARSE_BLOCK_SIZE;
+	}
+	//! block (rows of image i, columns of image j), 0 < i < j
+	double* getOffDiagonal(unsigned int i, unsigned int j) {
+		const unsigned long long key = SparseBlockCholesky::getPatternKey(i - 1, j - 1);
+		return offDiagonal.data() + (size_t)(std::lower_bound(pattern->begin(), pattern->end(), key) - pattern->begin()) * SPARSE_BLOCK_SIZE;
+	}
+	double* getRhs(unsigned int image) {
+		return rhs.data() + (size_t)(image - 1) * SPARSE_BLOCK_DIM;
+	}
+
+	unsigned int numBlocks;
+	const std::vector<unsigned long long>* pattern;
+	std::vector<double> diagonal;		//SPARSE_BLOCK_SIZE per block, row-major
+	std::vector<double> offDiagonal;	//SPARSE_BLOCK_SIZE per pattern entry
+	std::vector<double> rhs;			//-J^T r, SPARSE_BLOCK_DIM per block
+};
+
+////////////////////////////////////////////////////////////////
+//class CPUSolverBundling
+//description: host implementation of CUDASolverBundling::solve (lie space gauss-newton on the sparse and dense
+//             depth/color terms); the residuals and the block jtj are evaluated on CPUParallel (correspondence
+//             chunks, dense image pairs), the system is kept in sparse 6x6 blocks and solved by the same
+//             preconditioned cg as the gpu, or by SparseBlockCholesky for s_directSolverMinNumImages
+////////////////////////////////////////////////////////////////
+class CPUSolverBundling
+{
+public:
+	CPUSolverBundling(unsigned int maxNumberOfImages, unsigned int maxNumResiduals);
+	~CPUSolverBundling();
+
+	//! same as CUDASolverBundling::solve: correspondences, valid images and unknowns in gpu memory; the cache frames are downloaded per solve
+	void solve(EntryJ* d_correspondences, unsigned int numberOfCorrespondences,
+		const int* d_validImages, unsigned int numberOfImages,
+		unsigned int nNonLinearIterations, unsigned int nLinearIterations, const CUDACache* cudaCache,
+		const std::vector<float>& weightsSparse, const std::vector<float>& weightsDenseDepth, const std::vector<float>& weightsDenseColor, bool usePairwiseDense,
+		float3* d_rotationAnglesUnknowns, float3* d_translationUnknowns,
+		bool rebuildJT, bool findMaxResidual, unsigned int revalidateIdx);
+	const std::vector<float>& getConvergenceAnalysis() const { return m_convergence; }
+	const std::vector<float>& getLinearConvergenceAnalysis() const { return m_linConvergence; }
+
+	//! as evalMaxResidual (weightSparse * max abs residual component), valid after a solve with findMaxResidual
+	void getMaxResidual(float& max, int& index) const {
+		max = m_maxResidual;
+		index = m_maxResidualIndex;
+	}
+
+	//! sparse term w * J^T J and -w * J^T r of the correspondences, accumulated in chunks on CPUParallel
+	static void addSparseTerms(const std::vector<EntryJ>& correspondences, const std::vector<float4x4>& transforms, float weightSparse,
+		std::vector<BundlingBlockSystem>& chunkSystems, BundlingBlockSystem& system);
+
+	//! solves system by SparseBlockCholesky (identity blocks for images without residuals, small levenberg-marquardt damping); returns false if the factorization fails
+	static bool solveBlockSystem(BundlingBlockSystem& system, SparseBlockCholesky& solver, std::vector<double>& delta);
+
+private:
+	//! host copy of the cache frame data used by the dense terms
+	struct CachedFrame {
+		std::vector<float>	depth;
+		std::vector<float4>	cameraPos;
+		std::vector<float>	intensity;
+		std::vector<float2>	intensityDerivs;
+#ifdef CUDACACHE_UCHAR_NORMALS
+		std::vector<uchar4>	normalsUCHAR4;
+#endif
+#ifdef CUDACACHE_FLOAT_NORMALS
+		std::vector<float4>	normals;
+#endif
+	};
+	//! per dense image pair (i < j)
+	struct DensePair {
+		unsigned int i, j;
+		float weight;
+		double jtjii[SPARSE_BLOCK_SIZE], jtjjj[SPARSE_BLOCK_SIZE], jtjij[SPARSE_BLOCK_SIZE];
+		double jtri[SPARSE_BLOCK_DIM], jtrj[SPARSE_BLOCK_DIM];
+	};
+
+	void downloadCache(const CUDACache* cudaCache, unsigned int numberOfImages);
+	void computeTransforms();
+
+	//! as BuildDenseSystem: overlapping image pairs, their weights and the dense depth/color blocks; returns false if no pairs overlap
+	bool buildDenseSystem(const SolverParameters& parameters);
+	bool findOverlap(unsigned int i, unsigned int j, const SolverParameters& parameters) const;
+	unsigned int countDenseCorrespondences(unsigned int i, unsigned int j, const SolverParameters& parameters) const;
+	void buildDensePair(DensePair& pair, const SolverParameters& parameters, bool useDepth, bool useColor) const;
+
+	//! 1 / diag of the unweighted sparse jtj (jacobi preconditioner of solveBundlingStub)
+	void computePreconditioner();
+	//! as solveBundlingStub's pcg on the block system (jacobi preconditioner of the unweighted sparse term)
+	void solveLinear(BundlingBlockSystem& system, unsigned int nLinIterations, std::vector<double>& delta);
+	//! weighted squared sparse residuals (EvalResidual)
+	float evalSparseResidual(float weightSparse) const;
+	void computeMaxResidual(float weightSparse);
+
+	unsigned int m_maxNumberOfImages;
+
+	//host copies of the solve input
+	std::vector<EntryJ>			m_correspondences;
+	std::vector<int>			m_validImages;
+	std::vector<float3>			m_rot;
+	std::vector<float3>			m_trans;
+	std::vector<float4x4>		m_transforms;
+	std::vector<float4x4>		m_transformInverses;
+
+	std::vector<CachedFrame>	m_cacheFrames;
+	unsigned int				m_cacheWidth;
+	unsigned int				m_cacheHeight;
+	float4						m_intrinsics;
+
+	std::vector<DensePair>		m_densePairs;
+
+	std::vector<unsigned long long>		m_sparsePattern;
+	std::vector<unsigned long long>		m_pattern;
+	std::vector<BundlingBlockSystem>	m_chunkSystems;
+	BundlingBlockSystem					m_system;
+	std::vector<double>					m_preconditioner;
+	SparseBlockCholesky					m_directSolver;
+
+	std::vector<float>	m_convergence;
+	std::vector<float>	m_linConvergence;
+	bool				m_bRecordConvergence;
+
+	SolverParameters	m_defaultParams;
+	float				m_maxResidual;
+	int					m_maxResidualIndex;
+};
+
+#endif
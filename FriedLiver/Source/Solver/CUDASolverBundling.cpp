@@ -16,10 +16,13 @@ extern "C" void convertLiePosesToMatricesCU(const float3* d_rot, const float3* d
 extern "C" void collectHighResiduals(SolverInput& input, SolverState& state, SolverStateAnalysis& analysis, SolverParameters& parameters, CUDATimer* timer);
 extern "C" void VisualizeCorrespondences(const uint2& imageIndices, const SolverInput& input, SolverState& state, SolverParameters& parameters, float3* d_corrImage);
 
-//#define DEBUG_PRINT_SPARSE_RESIDUALS
-#ifdef DEBUG_PRINT_SPARSE_RESIDUALS
 extern "C" float EvalResidual(SolverInput& input, SolverState& state, SolverParameters& parameters, CUDATimer* timer);
-#endif
+extern "C" bool buildDenseSystemCU(SolverInput& input, SolverState& state, SolverParameters& parameters, CUDATimer* timer);
+extern "C" float evalGNConvergenceCU(SolverInput& input, SolverState& state, SolverStateAnalysis& analysis, CUDATimer* timer);
+extern "C" void gatherDenseJtJBlocksCU(unsigned int numBlocks, const uint2* d_blockIndices, unsigned int numberOfImages, const float* d_denseJtJ, float* d_blocks);
+extern "C" void applyPoseUpdateCU(SolverInput& input, SolverState& state);
+
+//#define DEBUG_PRINT_SPARSE_RESIDUALS
 
 CUDASolverBundling::CUDASolverBundling(unsigned int maxNumberOfImages, unsigned int maxNumResiduals)
 	: m_maxNumberOfImages(maxNumberOfImages)
@@ -99,6 +102,23 @@ CUDASolverBundling::CUDASolverBundling(unsigned int maxNumberOfImages, unsigned
 	m_defaultParams.denseDepthMax = GlobalBundlingState::get().s_denseDepthMax;
 	m_defaultParams.denseOverlapCheckSubsampleFactor = GlobalBundlingState::get().s_denseOverlapCheckSubsampleFactor;
 
+	d_directBlockIndices = NULL;
+	d_directBlocks = NULL;
+	m_directMaxNumBlocks = 0;
+
+	m_cpuSolver = NULL;
+	m_bValidateCPUSolver = GlobalBundlingState::get().s_validateCPUSolver && !GlobalBundlingState::get().s_useCPUSolver;
+	if (GlobalBundlingState::get().s_useCPUSolver || m_bValidateCPUSolver) m_cpuSolver = new CPUSolverBundling(maxNumberOfImages, maxNumResiduals);
+	d_validateRot = NULL;
+	d_validateTrans = NULL;
+	if (m_bValidateCPUSolver) {
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_validateRot, sizeof(float3)*m_maxNumberOfImages));
+		MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_validateTrans, sizeof(float3)*m_maxNumberOfImages));
+	}
+	m_validateMaxRotDiff = 0.0f;
+	m_validateMaxTransDiff = 0.0f;
+	m_validateMaxResidualDiff = 0.0f;
+
 	//!!!DEBUGGING
 	MLIB_CUDA_SAFE_CALL(cudaMemset(m_solverState.d_deltaRot, -1, sizeof(float3)*numberOfVariables));
 	MLIB_CUDA_SAFE_CALL(cudaMemset(m_solverState.d_deltaTrans, -1, sizeof(float3)*numberOfVariables));
@@ -139,6 +159,9 @@ CUDASolverBundling::CUDASolverBundling(unsigned int maxNumberOfImages, unsigned
 CUDASolverBundling::~CUDASolverBundling()
 {
 	if (m_timer) delete m_timer;
+	SAFE_DELETE(m_cpuSolver);
+	MLIB_CUDA_SAFE_FREE(d_validateRot);
+	MLIB_CUDA_SAFE_FREE(d_validateTrans);
 
 	// State
 	MLIB_CUDA_SAFE_FREE(m_solverState.d_deltaRot);
@@ -179,6 +202,9 @@ CUDASolverBundling::~CUDASolverBundling()
 	MLIB_CUDA_SAFE_FREE(m_solverState.d_sumResidualColor);
 	MLIB_CUDA_SAFE_FREE(m_solverState.d_corrCountColor);
 
+	MLIB_CUDA_SAFE_FREE(d_directBlockIndices);
+	MLIB_CUDA_SAFE_FREE(d_directBlocks);
+
 #ifdef NEW_GUIDED_REMOVE
 	MLIB_CUDA_SAFE_FREE(d_transforms);
 #endif
@@ -270,7 +296,30 @@ void CUDASolverBundling::solve(EntryJ* d_correspondences, unsigned int numberOfC
 	//	cudaCache->printCacheImages("debug/cache/");
 	//	int a = 5;
 	//}
-	solveBundlingStub(solverInput, m_solverState, parameters, m_solverExtra, convergence, m_timer);
+	if (m_cpuSolver && !m_bValidateCPUSolver) {
+		m_cpuSolver->solve(d_correspondences, numberOfCorrespondences, d_validImages, numberOfImages, nNonLinearIterations, nLinearIterations, cudaCache,
+			weightsSparse, weightsDenseDepth, weightsDenseColor, usePairwiseDense, d_rotationAnglesUnknowns, d_translationUnknowns, rebuildJT, findMaxResidual, revalidateIdx);
+#ifdef USE_LIE_SPACE
+		convertLiePosesToMatricesCU(m_solverState.d_xRot, m_solverState.d_xTrans, numberOfImages, m_solverState.d_xTransforms, m_solverState.d_xTransformInverses); //for useVerification
+#endif
+		if (m_bRecordConvergence) {
+			m_convergence = m_cpuSolver->getConvergenceAnalysis();
+			m_linConvergence = m_cpuSolver->getLinearConvergenceAnalysis();
+		}
+		if (findMaxResidual) m_cpuSolver->getMaxResidual(m_solverExtra.h_maxResidual[0], m_solverExtra.h_maxResidualIndex[0]);
+		return;
+	}
+
+	if (m_bValidateCPUSolver) { //same initial poses for the cpu solve
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_validateRot, d_rotationAnglesUnknowns, sizeof(float3)*numberOfImages, cudaMemcpyDeviceToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_validateTrans, d_translationUnknowns, sizeof(float3)*numberOfImages, cudaMemcpyDeviceToDevice));
+	}
+
+	const unsigned int directSolverMinNumImages = GlobalBundlingState::get().s_directSolverMinNumImages;
+	if (directSolverMinNumImages > 0 && numberOfImages >= directSolverMinNumImages) //pcg convergence degrades with the size of the pose graph
+		solveDirect(solverInput, parameters, convergence);
+	else
+		solveBundlingStub(solverInput, m_solverState, parameters, m_solverExtra, convergence, m_timer);
 
 	if (findMaxResidual) {
 		computeMaxResidual(solverInput, parameters, revalidateIdx);
@@ -281,6 +330,53 @@ void CUDASolverBundling::solve(EntryJ* d_correspondences, unsigned int numberOfC
 		std::cout << "\tafter: (" << solverInput.numberOfImages << ") sumres = " << residualAfter << " / " << solverInput.numberOfCorrespondences << " = " << residualAfter / (float)solverInput.numberOfCorrespondences << " | maxres = " << afterMaxRes << " images (" << afterMaxImageIndices << ")" << std::endl;
 #endif
 	}
+	if (m_bValidateCPUSolver)
+		validateCPUSolver(solverInput, parameters, d_validImages, nNonLinearIterations, nLinearIterations, cudaCache, weightsSparse, weightsDenseDepth, weightsDenseColor, usePairwiseDense, revalidateIdx);
+}
+
+void CUDASolverBundling::validateCPUSolver(SolverInput& solverInput, SolverParameters& parameters, const int* d_validImages,
+	unsigned int nNonLinearIterations, unsigned int nLinearIterations, const CUDACache* cudaCache,
+	const std::vector<float>& weightsSparse, const std::vector<float>& weightsDenseDepth, const std::vector<float>& weightsDenseColor, bool usePairwiseDense,
+	unsigned int revalidateIdx)
+{
+	const unsigned int N = solverInput.numberOfImages;
+	m_cpuSolver->solve(solverInput.d_correspondences, solverInput.numberOfCorrespondences, d_validImages, N, nNonLinearIterations, nLinearIterations, cudaCache,
+		weightsSparse, weightsDenseDepth, weightsDenseColor, usePairwiseDense, d_validateRot, d_validateTrans, false, false, revalidateIdx);
+
+	std::vector<int> validImages(N);
+	std::vector<float3> gpuRot(N), gpuTrans(N), cpuRot(N), cpuTrans(N);
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(validImages.data(), d_validImages, sizeof(int)*N, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(gpuRot.data(), m_solverState.d_xRot, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(gpuTrans.data(), m_solverState.d_xTrans, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(cpuRot.data(), d_validateRot, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+	MLIB_CUDA_SAFE_CALL(cudaMemcpy(cpuTrans.data(), d_validateTrans, sizeof(float3)*N, cudaMemcpyDeviceToHost));
+	float maxRotDiff = 0.0f, maxTransDiff = 0.0f;
+	for (unsigned int i = 0; i < N; i++) {
+		if (validImages[i] == 0) continue;
+		maxRotDiff = std::max(maxRotDiff, length(gpuRot[i] - cpuRot[i]));
+		maxTransDiff = std::max(maxTransDiff, length(gpuTrans[i] - cpuTrans[i]));
+	}
+
+	//sparse energy of both results (EvalResidual reads the poses of the solver state)
+	float gpuResidual = 0.0f, cpuResidual = 0.0f;
+	if (solverInput.numberOfCorrespondences > 0) {
+		float3* d_xRot = m_solverState.d_xRot;
+		float3* d_xTrans = m_solverState.d_xTrans;
+		gpuResidual = EvalResidual(solverInput, m_solverState, parameters, NULL);
+		m_solverState.d_xRot = d_validateRot;
+		m_solverState.d_xTrans = d_validateTrans;
+		cpuResidual = EvalResidual(solverInput, m_solverState, parameters, NULL);
+		m_solverState.d_xRot = d_xRot;
+		m_solverState.d_xTrans = d_xTrans;
+	}
+	const float residualDiff = std::fabs(gpuResidual - cpuResidual) / std::max(gpuResidual, 1e-6f);
+
+	m_validateMaxRotDiff = std::max(m_validateMaxRotDiff, maxRotDiff);
+	m_validateMaxTransDiff = std::max(m_validateMaxTransDiff, maxTransDiff);
+	m_validateMaxResidualDiff = std::max(m_validateMaxResidualDiff, residualDiff);
+	std::cout << "cpu solver check (" << N << " images): max pose diff rot = " << maxRotDiff << ", trans = " << maxTransDiff
+		<< " | sparse res gpu = " << gpuResidual << ", cpu = " << cpuResidual << " (rel diff " << residualDiff << ")"
+		<< " | max so far: rot = " << m_validateMaxRotDiff << ", trans = " << m_validateMaxTransDiff << ", res = " << m_validateMaxResidualDiff << std::endl;
 }
 
 void CUDASolverBundling::buildVariablesToCorrespondencesTable(EntryJ* d_correspondences, unsigned int numberOfCorrespondences)
@@ -291,6 +387,124 @@ void CUDASolverBundling::buildVariablesToCorrespondencesTable(EntryJ* d_correspo
 		buildVariablesToCorrespondencesTableCUDA(d_correspondences, numberOfCorrespondences, m_maxCorrPerImage, d_variablesToCorrespondences, d_numEntriesPerRow, m_timer);
 }
 
+void CUDASolverBundling::solveDirect(SolverInput& solverInput, SolverParameters& parameters, float* convergenceAnalysis)
+{
+#ifdef USE_LIE_SPACE
+	if (m_timer) m_timer->startEvent(__FUNCTION__);
+
+	const unsigned int N = solverInput.numberOfImages;
+	const unsigned int numVars = N - 1; //image 0 is fixed, system block k is image k + 1
+
+	std::vector<EntryJ> correspondences(solverInput.numberOfCorrespondences);
+	if (!correspondences.empty())
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(correspondences.data(), solverInput.d_correspondences, sizeof(EntryJ)*correspondences.size(), cudaMemcpyDeviceToHost));
+
+	//the sparse blocks do not change over the non-linear iterations
+	std::vector<unsigned long long> sparsePattern;
+	for (const EntryJ& corr : correspondences) {
+		if (corr.isValid() && corr.imgIdx_i > 0 && corr.imgIdx_j > 0 && corr.imgIdx_i != corr.imgIdx_j)
+			sparsePattern.push_back(SparseBlockCholesky::getPatternKey(std::min(corr.imgIdx_i, corr.imgIdx_j) - 1, std::max(corr.imgIdx_i, corr.imgIdx_j) - 1));
+	}
+	std::sort(sparsePattern.begin(), sparsePattern.end());
+	sparsePattern.erase(std::unique(sparsePattern.begin(), sparsePattern.end()), sparsePattern.end());
+
+	if (convergenceAnalysis) convergenceAnalysis[0] = EvalResidual(solverInput, m_solverState, parameters, m_timer);
+
+	std::vector<BundlingBlockSystem> chunkSystems;
+	BundlingBlockSystem system;
+
+	std::vector<float4x4> transforms(N);
+	std::vector<float> denseJtr, denseBlocks;
+	std::vector<uint2> denseImages, blockIndices;
+	std::vector<unsigned long long> pattern;
+	std::vector<double> delta;
+	std::vector<float3> deltaRot(N), deltaTrans(N);
+
+	for (unsigned int nIter = 0; nIter < parameters.nNonLinearIterations; nIter++)
+	{
+		parameters.weightSparse = solverInput.weightsSparse[nIter];
+		parameters.weightDenseDepth = solverInput.weightsDenseDepth[nIter];
+		parameters.weightDenseColor = solverInput.weightsDenseColor[nIter];
+		parameters.useDense = (parameters.weightDenseDepth > 0 || parameters.weightDenseColor > 0);
+		convertLiePosesToMatricesCU(m_solverState.d_xRot, m_solverState.d_xTrans, N, m_solverState.d_xTransforms, m_solverState.d_xTransformInverses);
+		if (parameters.useDense) parameters.useDense = buildDenseSystemCU(solverInput, m_solverState, parameters, m_timer);
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(transforms.data(), m_solverState.d_xTransforms, sizeof(float4x4)*N, cudaMemcpyDeviceToHost));
+
+		//block pattern: sparse pairs + dense overlapping pairs
+		pattern = sparsePattern;
+		blockIndices.clear();
+		for (unsigned int i = 1; i < N; i++) blockIndices.push_back(make_uint2(i, i));
+		if (parameters.useDense) {
+			int numDenseImages;
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(&numDenseImages, m_solverState.d_numDenseOverlappingImages, sizeof(int), cudaMemcpyDeviceToHost));
+			denseImages.resize(numDenseImages);
+			if (numDenseImages > 0)
+				MLIB_CUDA_SAFE_CALL(cudaMemcpy(denseImages.data(), m_solverState.d_denseOverlappingImages, sizeof(uint2)*numDenseImages, cudaMemcpyDeviceToHost));
+			for (const uint2& ij : denseImages) {
+				if (ij.x == 0) continue; //i < j
+				blockIndices.push_back(ij);
+				pattern.push_back(SparseBlockCholesky::getPatternKey(ij.x - 1, ij.y - 1));
+			}
+			std::sort(pattern.begin(), pattern.end());
+			pattern.erase(std::unique(pattern.begin(), pattern.end()), pattern.end());
+		}
+		m_directSolver.analyze(numVars, pattern); //reuses the ordering if the pattern is unchanged
+
+		//sparse term: w * J^T J and -w * J^T r
+		system.init(numVars, &pattern);
+		CPUSolverBundling::addSparseTerms(correspondences, transforms, parameters.weightSparse, chunkSystems, system);
+
+		//dense term (weights already built in)
+		if (parameters.useDense) {
+			const unsigned int numBlocks = (unsigned int)blockIndices.size();
+			if (numBlocks > m_directMaxNumBlocks) {
+				if (d_directBlockIndices) MLIB_CUDA_SAFE_CALL(cudaFree(d_directBlockIndices));
+				if (d_directBlocks) MLIB_CUDA_SAFE_CALL(cudaFree(d_directBlocks));
+				m_directMaxNumBlocks = std::max(numBlocks, 2 * m_directMaxNumBlocks);
+				MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_directBlockIndices, sizeof(uint2)*m_directMaxNumBlocks));
+				MLIB_CUDA_SAFE_CALL(cudaMalloc(&d_directBlocks, sizeof(float)*SPARSE_BLOCK_SIZE*m_directMaxNumBlocks));
+			}
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(d_directBlockIndices, blockIndices.data(), sizeof(uint2)*numBlocks, cudaMemcpyHostToDevice));
+			gatherDenseJtJBlocksCU(numBlocks, d_directBlockIndices, N, m_solverState.d_denseJtJ, d_directBlocks);
+			denseBlocks.resize(numBlocks * SPARSE_BLOCK_SIZE);
+			denseJtr.resize(N * SPARSE_BLOCK_DIM);
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(denseBlocks.data(), d_directBlocks, sizeof(float)*denseBlocks.size(), cudaMemcpyDeviceToHost));
+			MLIB_CUDA_SAFE_CALL(cudaMemcpy(denseJtr.data(), m_solverState.d_denseJtr, sizeof(float)*denseJtr.size(), cudaMemcpyDeviceToHost));
+
+			for (unsigned int b = 0; b < numBlocks; b++) {
+				const uint2& ij = blockIndices[b];
+				double* block = (ij.x == ij.y) ? system.getDiagonal(ij.x) : system.getOffDiagonal(ij.x, ij.y);
+				for (unsigned int k = 0; k < SPARSE_BLOCK_SIZE; k++) block[k] += denseBlocks[b * SPARSE_BLOCK_SIZE + k];
+			}
+			for (unsigned int k = 0; k < numVars * SPARSE_BLOCK_DIM; k++) system.rhs[k] -= denseJtr[SPARSE_BLOCK_DIM + k];
+		}
+
+		if (!CPUSolverBundling::solveBlockSystem(system, m_directSolver, delta)) {
+			std::cout << "warning: direct bundling solve failed to factorize (" << N << " images)" << std::endl;
+			break;
+		}
+
+		deltaRot[0] = make_float3(0.0f, 0.0f, 0.0f);
+		deltaTrans[0] = make_float3(0.0f, 0.0f, 0.0f);
+		for (unsigned int v = 0; v < numVars; v++) {
+			const double* x = delta.data() + (size_t)v * SPARSE_BLOCK_DIM;
+			deltaTrans[v + 1] = make_float3((float)x[0], (float)x[1], (float)x[2]);
+			deltaRot[v + 1] = make_float3((float)x[3], (float)x[4], (float)x[5]);
+		}
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_solverState.d_deltaRot, deltaRot.data(), sizeof(float3)*N, cudaMemcpyHostToDevice));
+		MLIB_CUDA_SAFE_CALL(cudaMemcpy(m_solverState.d_deltaTrans, deltaTrans.data(), sizeof(float3)*N, cudaMemcpyHostToDevice));
+		applyPoseUpdateCU(solverInput, m_solverState);
+
+		if (convergenceAnalysis) convergenceAnalysis[nIter + 1] = EvalResidual(solverInput, m_solverState, parameters, m_timer);
+		if (nIter < parameters.nNonLinearIterations - 1 && evalGNConvergenceCU(solverInput, m_solverState, m_solverExtra, m_timer) < 0.005f) break; //same early out as solveBundlingStub
+	}
+
+	if (m_timer) m_timer->endEvent();
+#else
+	throw MLIB_EXCEPTION("direct bundling solve requires USE_LIE_SPACE");
+#endif
+}
+
 ////not squared (per axis component)
 ////#define MAX_RESIDUAL_THRESH 0.16f //sun3d
 //#define MAX_RESIDUAL_THRESH 0.08f //0.05f 
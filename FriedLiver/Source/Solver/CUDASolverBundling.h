@@ -6,6 +6,8 @@
 #include "../SiftGPU/cudaUtil.h"
 #include "SolverBundlingParameters.h"
 #include "SolverBundlingState.h"
+#include "SparseBlockCholesky.h"
+#include "CPUSolverBundling.h"
 
 #include "../SiftGPU/cuda_SimpleMatrixUtil.h"
 #include "../SiftGPU/CUDATimer.h"
@@ -103,7 +105,14 @@ private:
 	//}
 
 	void buildVariablesToCorrespondencesTable(EntryJ* d_correspondences, unsigned int numberOfCorrespondences);
+	//! gauss-newton with the sparse 6x6 block jtj (sparse terms assembled on the cpu, dense terms gathered from d_denseJtJ) solved by SparseBlockCholesky
+	void solveDirect(SolverInput& solverInput, SolverParameters& parameters, float* convergenceAnalysis);
 	void computeMaxResidual(SolverInput& solverInput, SolverParameters& parameters, unsigned int revalidateIdx);
+	//! s_validateCPUSolver: solves the same input on m_cpuSolver from the initial poses in d_validateRot/Trans and prints the max pose and sparse residual difference to the gpu result
+	void validateCPUSolver(SolverInput& solverInput, SolverParameters& parameters, const int* d_validImages,
+		unsigned int nNonLinearIterations, unsigned int nLinearIterations, const CUDACache* cudaCache,
+		const std::vector<float>& weightsSparse, const std::vector<float>& weightsDenseDepth, const std::vector<float>& weightsDenseColor, bool usePairwiseDense,
+		unsigned int revalidateIdx);
 
 	SolverState	m_solverState;
 	SolverStateAnalysis m_solverExtra;
@@ -129,6 +138,20 @@ private:
 	SolverParameters m_defaultParams;
 	float			 m_maxResidualThresh;
 
+	//direct solve (s_directSolverMinNumImages)
+	SparseBlockCholesky m_directSolver;
+	uint2*			d_directBlockIndices;
+	float*			d_directBlocks;
+	unsigned int	m_directMaxNumBlocks;
+
+	CPUSolverBundling* m_cpuSolver;	//replaces the gpu solve with s_useCPUSolver, runs next to it with s_validateCPUSolver
+	bool		m_bValidateCPUSolver;
+	float3*		d_validateRot;		//initial poses of the solve, then the cpu result
+	float3*		d_validateTrans;
+	float		m_validateMaxRotDiff;	//over all validated solves
+	float		m_validateMaxTransDiff;
+	float		m_validateMaxResidualDiff;	//relative
+
 #ifdef NEW_GUIDED_REMOVE
 	//for more than one im-pair removal
 	std::vector<vec2ui> m_maxResImPairs;
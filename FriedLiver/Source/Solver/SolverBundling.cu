@@ -1219,6 +1219,68 @@ extern "C" void solveBundlingStub(SolverInput& input, SolverState& state, Solver
 	//!!!debugging
 	}
 
+////////////////////////////////////////////////////////////////////
+// direct solve helpers (see CUDASolverBundling::solveDirect)
+////////////////////////////////////////////////////////////////////
+
+extern "C" bool buildDenseSystemCU(SolverInput& input, SolverState& state, SolverParameters& parameters, CUDATimer* timer)
+{
+	return BuildDenseSystem(input, state, parameters, timer);
+}
+
+extern "C" float evalGNConvergenceCU(SolverInput& input, SolverState& state, SolverStateAnalysis& analysis, CUDATimer* timer)
+{
+	return EvalGNConvergence(input, state, analysis, timer);
+}
+
+//one thread per entry of the 6x6 block (i, j) of the (flipped) dense jtj
+__global__ void GatherDenseJtJBlocks_Kernel(unsigned int numBlocks, const uint2* d_blockIndices, unsigned int dim, const float* d_denseJtJ, float* d_blocks)
+{
+	const unsigned int b = blockIdx.x;
+	const unsigned int t = threadIdx.x;
+	if (b < numBlocks && t < 36) {
+		const uint2 ij = d_blockIndices[b];
+		d_blocks[b * 36 + t] = d_denseJtJ[(ij.x * 6 + t / 6) * dim + ij.y * 6 + t % 6];
+	}
+}
+extern "C" void gatherDenseJtJBlocksCU(unsigned int numBlocks, const uint2* d_blockIndices, unsigned int numberOfImages, const float* d_denseJtJ, float* d_blocks)
+{
+	if (numBlocks == 0) return;
+	GatherDenseJtJBlocks_Kernel << <numBlocks, 36 >> >(numBlocks, d_blockIndices, numberOfImages * 6, d_denseJtJ, d_blocks);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+}
+
+//same as the update of PCGStep_Kernel3<true>
+__global__ void ApplyPoseUpdate_Kernel(SolverInput input, SolverState state)
+{
+	const unsigned int N = input.numberOfImages;
+	const unsigned int x = blockIdx.x * blockDim.x + threadIdx.x;
+
+	if (x > 0 && x < N) {
+#ifdef USE_LIE_SPACE
+		float3 rot, trans;
+		computeLieUpdate(state.d_deltaRot[x], state.d_deltaTrans[x], state.d_xRot[x], state.d_xTrans[x], rot, trans);
+		state.d_xRot[x] = rot;
+		state.d_xTrans[x] = trans;
+#else
+		state.d_xRot[x] = state.d_xRot[x] + state.d_deltaRot[x];
+		state.d_xTrans[x] = state.d_xTrans[x] + state.d_deltaTrans[x];
+#endif
+	}
+}
+extern "C" void applyPoseUpdateCU(SolverInput& input, SolverState& state)
+{
+	const unsigned int N = input.numberOfImages;
+	ApplyPoseUpdate_Kernel << <(N + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK, THREADS_PER_BLOCK >> >(input, state);
+#ifdef _DEBUG
+	cutilSafeCall(cudaDeviceSynchronize());
+	cutilCheckMsg(__FUNCTION__);
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////
 // build variables to correspondences lookup
 ////////////////////////////////////////////////////////////////////
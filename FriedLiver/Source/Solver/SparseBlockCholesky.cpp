@@ -0,0 +1,257 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+
+#include "SparseBlockCholesky.h"
+
+/************************************************************************/
+/* dense 6x6 block helpers (row-major)                                  */
+/************************************************************************/
+
+//! lower cholesky factor in place (the upper part is cleared); false if not positive definite
+static bool choleskyBlock(double* a)
+{
+	for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) {
+		double d = a[j * SPARSE_BLOCK_DIM + j];
+		for (unsigned int m = 0; m < j; m++) d -= a[j * SPARSE_BLOCK_DIM + m] * a[j * SPARSE_BLOCK_DIM + m];
+		if (!(d > 0.0)) return false; // also catches nan
+		d = std::sqrt(d);
+		a[j * SPARSE_BLOCK_DIM + j] = d;
+		for (unsigned int i = j + 1; i < SPARSE_BLOCK_DIM; i++) {
+			double v = a[i * SPARSE_BLOCK_DIM + j];
+			for (unsigned int m = 0; m < j; m++) v -= a[i * SPARSE_BLOCK_DIM + m] * a[j * SPARSE_BLOCK_DIM + m];
+			a[i * SPARSE_BLOCK_DIM + j] = v / d;
+		}
+		for (unsigned int i = 0; i < j; i++) a[i * SPARSE_BLOCK_DIM + j] = 0.0;
+	}
+	return true;
+}
+
+//! b := b * l^-T
+static void solveRightLowerTransposed(const double* l, double* b)
+{
+	for (unsigned int r = 0; r < SPARSE_BLOCK_DIM; r++) {
+		double* x = b + r * SPARSE_BLOCK_DIM;
+		for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) {
+			double v = x[j];
+			for (unsigned int m = 0; m < j; m++) v -= l[j * SPARSE_BLOCK_DIM + m] * x[m];
+			x[j] = v / l[j * SPARSE_BLOCK_DIM + j];
+		}
+	}
+}
+
+//! c -= a * b^T
+static void subtractOuter(double* c, const double* a, const double* b)
+{
+	for (unsigned int i = 0; i < SPARSE_BLOCK_DIM; i++) {
+		for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) {
+			double v = 0.0;
+			for (unsigned int m = 0; m < SPARSE_BLOCK_DIM; m++) v += a[i * SPARSE_BLOCK_DIM + m] * b[j * SPARSE_BLOCK_DIM + m];
+			c[i * SPARSE_BLOCK_DIM + j] -= v;
+		}
+	}
+}
+
+/************************************************************************/
+/* SparseBlockCholesky                                                  */
+/************************************************************************/
+
+SparseBlockCholesky::SparseBlockCholesky()
+{
+	m_numBlocks = 0;
+}
+
+bool SparseBlockCholesky::analyze(unsigned int numBlocks, const std::vector<unsigned long long>& pattern)
+{
+	if (numBlocks == m_numBlocks && pattern == m_pattern && m_perm.size() == numBlocks) return false;
+
+	m_numBlocks = numBlocks;
+	m_pattern = pattern;
+	computeOrdering();
+	computeSymbolic();
+	return true;
+}
+
+void SparseBlockCholesky::computeOrdering()
+{
+	const unsigned int n = m_numBlocks;
+	std::vector< std::vector<unsigned int> > adjacency(n);
+	for (unsigned long long key : m_pattern) {
+		const unsigned int i = (unsigned int)(key >> 32);
+		const unsigned int j = (unsigned int)(key & 0xffffffff);
+		adjacency[i].push_back(j);
+		adjacency[j].push_back(i);
+	}
+	for (std::vector<unsigned int>& a : adjacency) std::sort(a.begin(), a.end());
+
+	//minimum degree on the elimination graph (lowest index on ties)
+	std::vector<bool> eliminated(n, false);
+	std::vector<unsigned int> neighbors, merged;
+	m_perm.clear();
+	for (unsigned int k = 0; k < n; k++) {
+		unsigned int v = (unsigned int)-1; size_t minDegree = (size_t)-1;
+		for (unsigned int i = 0; i < n; i++) {
+			if (!eliminated[i] && adjacency[i].size() < minDegree) {
+				minDegree = adjacency[i].size();
+				v = i;
+			}
+		}
+		eliminated[v] = true;
+		m_perm.push_back(v);
+
+		//the neighbors of v become a clique
+		neighbors.swap(adjacency[v]);
+		for (unsigned int u : neighbors) {
+			merged.clear();
+			std::set_union(adjacency[u].begin(), adjacency[u].end(), neighbors.begin(), neighbors.end(), std::back_inserter(merged));
+			merged.erase(std::remove_if(merged.begin(), merged.end(), [u, v](unsigned int w) { return w == u || w == v; }), merged.end());
+			adjacency[u].swap(merged);
+		}
+		adjacency[v].clear();
+	}
+
+	m_permInv.resize(n);
+	for (unsigned int k = 0; k < n; k++) m_permInv[m_perm[k]] = k;
+}
+
+void SparseBlockCholesky::computeSymbolic()
+{
+	const unsigned int n = m_numBlocks;
+
+	//lower pattern in factor indices
+	std::vector< std::vector<unsigned int> > columns(n);
+	for (unsigned long long key : m_pattern) {
+		const unsigned int a = m_permInv[(unsigned int)(key >> 32)];
+		const unsigned int b = m_permInv[(unsigned int)(key & 0xffffffff)];
+		columns[std::min(a, b)].push_back(std::max(a, b));
+	}
+
+	//column structures along the elimination tree: struct(k) = A(k) + struct(children) - k
+	std::vector< std::vector<unsigned int> > children(n);
+	std::vector<unsigned int> structure, merged;
+	m_colStarts.resize(n + 1);
+	m_rowIndices.clear();
+	for (unsigned int k = 0; k < n; k++) {
+		m_colStarts[k] = (unsigned int)m_rowIndices.size(); //also closes column k - 1 for the child merge below
+		structure.swap(columns[k]);
+		std::sort(structure.begin(), structure.end());
+		for (unsigned int c : children[k]) {
+			merged.clear();
+			std::set_union(structure.begin(), structure.end(),
+				m_rowIndices.begin() + m_colStarts[c] + 1, m_rowIndices.begin() + m_colStarts[c + 1], std::back_inserter(merged)); //first row of a child is its parent k
+			structure.swap(merged);
+		}
+		m_rowIndices.insert(m_rowIndices.end(), structure.begin(), structure.end());
+		if (!structure.empty()) children[structure.front()].push_back(k);
+		structure.clear();
+	}
+	m_colStarts[n] = (unsigned int)m_rowIndices.size();
+
+	//where the pattern blocks go
+	m_patternSlots.resize(m_pattern.size());
+	m_patternTransposed.resize(m_pattern.size());
+	for (unsigned int e = 0; e < m_pattern.size(); e++) {
+		const unsigned int a = m_permInv[(unsigned int)(m_pattern[e] >> 32)];
+		const unsigned int b = m_permInv[(unsigned int)(m_pattern[e] & 0xffffffff)];
+		const unsigned int col = std::min(a, b), row = std::max(a, b);
+		const unsigned int* rows = m_rowIndices.data() + m_colStarts[col];
+		m_patternSlots[e] = m_colStarts[col] + (unsigned int)(std::lower_bound(rows, rows + (m_colStarts[col + 1] - m_colStarts[col]), row) - rows);
+		m_patternTransposed[e] = a < b; //(i, j) is stored in the column of i
+	}
+
+	m_diagonal.resize(n * SPARSE_BLOCK_SIZE);
+	m_blocks.resize(m_rowIndices.size() * SPARSE_BLOCK_SIZE);
+}
+
+bool SparseBlockCholesky::factorize(const std::vector<double>& diagonal, const std::vector<double>& offDiagonal)
+{
+	const unsigned int n = m_numBlocks;
+	for (unsigned int k = 0; k < n; k++) {
+		std::copy(diagonal.begin() + m_perm[k] * SPARSE_BLOCK_SIZE, diagonal.begin() + (m_perm[k] + 1) * SPARSE_BLOCK_SIZE, m_diagonal.begin() + k * SPARSE_BLOCK_SIZE);
+	}
+	std::fill(m_blocks.begin(), m_blocks.end(), 0.0);
+	for (unsigned int e = 0; e < m_pattern.size(); e++) {
+		const double* src = offDiagonal.data() + e * SPARSE_BLOCK_SIZE;
+		double* dst = m_blocks.data() + m_patternSlots[e] * SPARSE_BLOCK_SIZE;
+		if (m_patternTransposed[e]) {
+			for (unsigned int r = 0; r < SPARSE_BLOCK_DIM; r++)
+				for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) dst[r * SPARSE_BLOCK_DIM + c] = src[c * SPARSE_BLOCK_DIM + r];
+		}
+		else {
+			std::copy(src, src + SPARSE_BLOCK_SIZE, dst);
+		}
+	}
+
+	//right-looking over the block columns
+	for (unsigned int k = 0; k < n; k++) {
+		double* lkk = m_diagonal.data() + k * SPARSE_BLOCK_SIZE;
+		if (!choleskyBlock(lkk)) return false;
+
+		const unsigned int begin = m_colStarts[k], end = m_colStarts[k + 1];
+		for (unsigned int s = begin; s < end; s++) solveRightLowerTransposed(lkk, m_blocks.data() + s * SPARSE_BLOCK_SIZE);
+
+		for (unsigned int s1 = begin; s1 < end; s1++) {
+			const unsigned int r1 = m_rowIndices[s1];
+			const double* l1 = m_blocks.data() + s1 * SPARSE_BLOCK_SIZE;
+			subtractOuter(m_diagonal.data() + r1 * SPARSE_BLOCK_SIZE, l1, l1);
+
+			const unsigned int* rows = m_rowIndices.data() + m_colStarts[r1];
+			const unsigned int* rowsEnd = m_rowIndices.data() + m_colStarts[r1 + 1];
+			const unsigned int* it = rows;
+			for (unsigned int s2 = s1 + 1; s2 < end; s2++) {
+				it = std::lower_bound(it, rowsEnd, m_rowIndices[s2]); //struct(k) - r1 is contained in struct(r1)
+				subtractOuter(m_blocks.data() + (m_colStarts[r1] + (it - rows)) * SPARSE_BLOCK_SIZE, m_blocks.data() + s2 * SPARSE_BLOCK_SIZE, l1);
+			}
+		}
+	}
+	return true;
+}
+
+void SparseBlockCholesky::solve(const std::vector<double>& b, std::vector<double>& x) const
+{
+	const unsigned int n = m_numBlocks;
+	std::vector<double> y(n * SPARSE_BLOCK_DIM);
+	for (unsigned int k = 0; k < n; k++) {
+		for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) y[k * SPARSE_BLOCK_DIM + c] = b[m_perm[k] * SPARSE_BLOCK_DIM + c];
+	}
+
+	//L y = b
+	for (unsigned int k = 0; k < n; k++) {
+		const double* lkk = m_diagonal.data() + k * SPARSE_BLOCK_SIZE;
+		double* yk = y.data() + k * SPARSE_BLOCK_DIM;
+		for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) {
+			double v = yk[j];
+			for (unsigned int m = 0; m < j; m++) v -= lkk[j * SPARSE_BLOCK_DIM + m] * yk[m];
+			yk[j] = v / lkk[j * SPARSE_BLOCK_DIM + j];
+		}
+		for (unsigned int s = m_colStarts[k]; s < m_colStarts[k + 1]; s++) {
+			const double* l = m_blocks.data() + s * SPARSE_BLOCK_SIZE;
+			double* yr = y.data() + m_rowIndices[s] * SPARSE_BLOCK_DIM;
+			for (unsigned int i = 0; i < SPARSE_BLOCK_DIM; i++)
+				for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) yr[i] -= l[i * SPARSE_BLOCK_DIM + j] * yk[j];
+		}
+	}
+	//L^T x = y
+	for (int k = (int)n - 1; k >= 0; k--) {
+		double* yk = y.data() + k * SPARSE_BLOCK_DIM;
+		for (unsigned int s = m_colStarts[k]; s < m_colStarts[k + 1]; s++) {
+			const double* l = m_blocks.data() + s * SPARSE_BLOCK_SIZE;
+			const double* yr = y.data() + m_rowIndices[s] * SPARSE_BLOCK_DIM;
+			for (unsigned int i = 0; i < SPARSE_BLOCK_DIM; i++)
+				for (unsigned int j = 0; j < SPARSE_BLOCK_DIM; j++) yk[j] -= l[i * SPARSE_BLOCK_DIM + j] * yr[i];
+		}
+		const double* lkk = m_diagonal.data() + k * SPARSE_BLOCK_SIZE;
+		for (int j = SPARSE_BLOCK_DIM - 1; j >= 0; j--) {
+			double v = yk[j];
+			for (unsigned int m = j + 1; m < SPARSE_BLOCK_DIM; m++) v -= lkk[m * SPARSE_BLOCK_DIM + j] * yk[m];
+			yk[j] = v / lkk[j * SPARSE_BLOCK_DIM + j];
+		}
+	}
+
+	x.resize(n * SPARSE_BLOCK_DIM);
+	for (unsigned int k = 0; k < n; k++) {
+		for (unsigned int c = 0; c < SPARSE_BLOCK_DIM; c++) x[m_perm[k] * SPARSE_BLOCK_DIM + c] = y[k * SPARSE_BLOCK_DIM + c];
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef SPARSE_BLOCK_CHOLESKY_H
+#define SPARSE_BLOCK_CHOLESKY_H
+
+#include <vector>
+
+#define SPARSE_BLOCK_DIM 6
+#define SPARSE_BLOCK_SIZE (SPARSE_BLOCK_DIM * SPARSE_BLOCK_DIM)
+
+////////////////////////////////////////////////////////////////
+//class SparseBlockCholesky
+//description: cholesky factorization of symmetric positive definite systems of 6x6 blocks (the pose-only bundling
+//             normal equations); the fill reducing ordering (minimum degree on the block graph) and the symbolic
+//             factorization are kept as long as the block pattern does not change, e.g., over the non-linear
+//             iterations of a solve
+////////////////////////////////////////////////////////////////
+class SparseBlockCholesky
+{
+public:
+	SparseBlockCholesky();
+
+	//! numBlocks block variables, pattern: the off-diagonal blocks (i < j), sorted and unique; returns false if the previous analysis is reused
+	bool analyze(unsigned int numBlocks, const std::vector<unsigned long long>& pattern);
+
+	//! diagonal: numBlocks row-major blocks, offDiagonal: the blocks (i, j) in pattern order (rows of i, columns of j);
+	//! returns false if the matrix is not positive definite
+	bool factorize(const std::vector<double>& diagonal, const std::vector<double>& offDiagonal);
+
+	//! solves the factorized system for b (numBlocks * SPARSE_BLOCK_DIM entries)
+	void solve(const std::vector<double>& b, std::vector<double>& x) const;
+
+	//! pattern entry of the block (i, j), i < j
+	static unsigned long long getPatternKey(unsigned int i, unsigned int j) {
+		return ((unsigned long long)i << 32) | j;
+	}
+
+	//! off-diagonal blocks of the factor (fill-in included)
+	unsigned int getNumFactorBlocks() const {
+		return (unsigned int)m_rowIndices.size();
+	}
+
+private:
+	void computeOrdering();
+	void computeSymbolic();
+
+	unsigned int m_numBlocks;
+	std::vector<unsigned long long> m_pattern;
+
+	std::vector<unsigned int> m_perm;			//factor index -> variable
+	std::vector<unsigned int> m_permInv;		//variable -> factor index
+
+	//factor columns (lower): the rows below the diagonal of column k are m_rowIndices[m_colStarts[k], m_colStarts[k + 1]), sorted
+	std::vector<unsigned int> m_colStarts;
+	std::vector<unsigned int> m_rowIndices;
+	std::vector<unsigned int> m_patternSlots;	//pattern entry -> factor block
+	std::vector<bool> m_patternTransposed;		//pattern entry (i, j) is stored as block (j, i)
+
+	std::vector<double> m_diagonal;				//SPARSE_BLOCK_SIZE per column
+	std::vector<double> m_blocks;				//SPARSE_BLOCK_SIZE per factor block
+};
+
+#endif
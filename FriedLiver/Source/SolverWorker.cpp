@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "SolverWorker.h"
+
+#include <cuda_runtime.h>
+
+SolverWorker::SolverWorker()
+{
+	m_bBusy = false;
+	m_bExit = false;
+	m_numIdleJobs = 0;
+}
+
+SolverWorker::~SolverWorker()
+{
+	stop();
+}
+
+void SolverWorker::start()
+{
+	if (isRunning()) return;
+	//the solve runs on the same gpu as the caller (DualGPU::DEVICE_BUNDLING); bound once instead of per solve
+	int device = 0;
+	MLIB_CUDA_SAFE_CALL(cudaGetDevice(&device));
+	m_bExit = false;
+	m_thread = std::thread(&SolverWorker::workerFunc, this, device);
+}
+
+void SolverWorker::stop()
+{
+	if (!isRunning()) return;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_bExit = true;
+	}
+	m_cvJob.notify_all();
+	m_thread.join();
+}
+
+void SolverWorker::submit(JOB_TYPE type, const JobFunc& func)
+{
+	MLIB_ASSERT(isRunning());
+	Job job;
+	job.type = type;
+	job.func = func;
+	job.submitTime = Timer::getTime();
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobs.push_back(job);
+	}
+	m_cvJob.notify_one();
+}
+
+void SolverWorker::waitUntilIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cvIdle.wait(lock, [this] { return m_jobs.empty() && !m_bBusy; });
+}
+
+bool SolverWorker::isIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_jobs.empty() && !m_bBusy;
+}
+
+void SolverWorker::workerFunc(int device)
+{
+	MLIB_CUDA_SAFE_CALL(cudaSetDevice(device));
+
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cvJob.wait(lock, [this] { return m_bExit || !m_jobs.empty(); });
+			if (m_jobs.empty()) break; //exit once everything queued is done
+			job = m_jobs.front();
+			m_jobs.pop_front();
+			m_bBusy = true;
+		}
+
+		const double startTime = Timer::getTime();
+		const bool didWork = job.func();
+		const double endTime = Timer::getTime();
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (didWork) {
+				JobStats& s = m_stats[job.type];
+				s.numJobs++;
+				s.totalWaitMS += 1000.0 * (startTime - job.submitTime);
+				s.totalRunMS += 1000.0 * (endTime - startTime);
+				s.maxLatencyMS = std::max(s.maxLatencyMS, 1000.0 * (endTime - job.submitTime));
+			}
+			else {
+				m_numIdleJobs++;
+			}
+			m_bBusy = false;
+		}
+		m_cvIdle.notify_all();
+	}
+	m_cvIdle.notify_all();
+}
+
+const char* SolverWorker::getJobName(JOB_TYPE type)
+{
+	switch (type) {
+	case JOB_LOCAL_SOLVE:	return "local solve";
+	case JOB_GLOBAL_MATCH:	return "global match";
+	case JOB_REVALIDATION:	return "revalidation";
+	case JOB_GLOBAL_SOLVE:	return "global solve";
+	default:				return "unknown";
+	}
+}
+
+void SolverWorker::printStats(std::ostream& out /*= std::cout*/)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	out << "=============== SOLVER WORKER ===============" << std::endl;
+	for (unsigned int i = 0; i < NUM_JOB_TYPES; i++) {
+		const JobStats& s = m_stats[i];
+		out << getJobName((JOB_TYPE)i) << ": #jobs = " << s.numJobs;
+		if (s.numJobs > 0) {
+			out << "\tavg wait = " << s.totalWaitMS / s.numJobs << " ms"
+				<< "\tavg run = " << s.totalRunMS / s.numJobs << " ms"
+				<< "\tmax latency = " << s.maxLatencyMS << " ms";
+		}
+		out << std::endl;
+	}
+	out << "#jobs with nothing to do = " << m_numIdleJobs << std::endl;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <iostream>
+
+//! long-lived optimization thread fed by a job queue (see OnlineBundler::submitProcess);
+//! jobs run in submission order on the cuda device of the thread that called start()
+class SolverWorker
+{
+public:
+	enum JOB_TYPE {
+		JOB_LOCAL_SOLVE,
+		JOB_GLOBAL_MATCH,
+		JOB_REVALIDATION,
+		JOB_GLOBAL_SOLVE,
+		NUM_JOB_TYPES
+	};
+	//! returns false if there was nothing to do (not counted in the stats)
+	typedef std::function<bool()> JobFunc;
+
+	SolverWorker();
+	~SolverWorker();
+
+	void start();
+	//! finishes all queued jobs and joins the thread
+	void stop();
+	bool isRunning() const {
+		return m_thread.joinable();
+	}
+
+	void submit(JOB_TYPE type, const JobFunc& func);
+
+	//! blocks until all submitted jobs are done
+	void waitUntilIdle();
+	bool isIdle();
+
+	void printStats(std::ostream& out = std::cout);
+
+	static const char* getJobName(JOB_TYPE type);
+
+private:
+	struct Job {
+		JOB_TYPE	type;
+		JobFunc		func;
+		double		submitTime;		//seconds (Timer::getTime)
+	};
+	struct JobStats {
+		unsigned int	numJobs;
+		double			totalWaitMS;	//submit -> start
+		double			totalRunMS;		//start -> end
+		double			maxLatencyMS;	//submit -> end
+		JobStats() : numJobs(0), totalWaitMS(0.0), totalRunMS(0.0), maxLatencyMS(0.0) {}
+	};
+
+	void workerFunc(int device);
+
+	std::thread					m_thread;
+	std::mutex					m_mutex;
+	std::condition_variable		m_cvJob;
+	std::condition_variable		m_cvIdle;
+	std::deque<Job>				m_jobs;
+	bool						m_bBusy;
+	bool						m_bExit;
+
+	JobStats					m_stats[NUM_JOB_TYPES];
+	unsigned int				m_numIdleJobs;		//jobs that had nothing to do
+};
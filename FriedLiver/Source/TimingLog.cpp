@@ -3,6 +3,9 @@
 #include "TimingLog.h"
 
 
-std::vector<TimingLog::FrameTiming> TimingLog::m_localFrameTimings;
-std::vector<TimingLog::FrameTiming> TimingLog::m_globalFrameTimings;
+std::deque<TimingLog::FrameTiming> TimingLog::m_localFrameTimings;
+std::deque<TimingLog::FrameTiming> TimingLog::m_globalFrameTimings;
 std::vector<double> TimingLog::m_totalFrameTimings;
+std::mutex TimingLog::s_mutex;
+thread_local int TimingLog::s_currentLocalFrame = -1;
+thread_local int TimingLog::s_currentGlobalFrame = -1;
@@ -2,19 +2,38 @@
 
 #include <fstream>
 #include <iostream>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
 
 class TimingLog
 {
 public:
+	struct RansacImagePair {
+		unsigned int image;
+		unsigned int numRawMatches;
+		unsigned int numFilteredMatches;
+		unsigned int numHypotheses;
+	};
+
 	struct FrameTiming {
 		double timeSiftDetection; // fuse for global / sift detection for local
 		double timeSiftMatching;
-		double timeMatchFilterKeyPoint;
+		double timeMatchFilterKeyPoint; // all match filters with s_useFusedMatchFilter
 		double timeMatchFilterSurfaceArea;
 		double timeMatchFilterDenseVerify;
 		double timeMisc;
 		double timeSolve;
 		unsigned int numItersSolve;
+		unsigned int numRansacHypotheses; // over all image pairs of the frame
+		std::vector<RansacImagePair> ransacImagePairs; // per image pair with raw matches
+		// image pairs rejected per match filter stage (and decided by the cascade before the dense verify)
+		unsigned int numRejectedKeyPoint;
+		unsigned int numRejectedSurfaceArea;
+		unsigned int numRejectedCascade;
+		unsigned int numAcceptedCascade;
+		unsigned int numRejectedDenseVerify;
 
 		double timeSensorProcess; // copy to gpu/resize/etc with input
 		double timeReIntegrate;
@@ -30,6 +49,12 @@ public:
 			timeMisc = 0;
 			timeSolve = 0;
 			numItersSolve = 0;
+			numRansacHypotheses = 0;
+			numRejectedKeyPoint = 0;
+			numRejectedSurfaceArea = 0;
+			numRejectedCascade = 0;
+			numAcceptedCascade = 0;
+			numRejectedDenseVerify = 0;
 
 			timeSensorProcess = 0;
 			timeReIntegrate = 0;
@@ -46,6 +71,17 @@ public:
 			*out << "\tTime Misc: " << std::to_string(timeMisc) << "ms" << std::endl;
 			*out << "\tTime Solve: " << std::to_string(timeSolve) << "ms" << std::endl;
 			*out << "\t#iters solve: " << std::to_string(numItersSolve) << std::endl;
+			*out << "\t#ransac hypotheses: " << std::to_string(numRansacHypotheses) << std::endl;
+			if (!ransacImagePairs.empty()) {
+				*out << "\t#ransac per image pair (image: raw -> filtered matches, hypotheses):";
+				for (unsigned int i = 0; i < ransacImagePairs.size(); i++) {
+					const RansacImagePair& p = ransacImagePairs[i];
+					*out << " " << p.image << ": " << p.numRawMatches << " -> " << p.numFilteredMatches << ", " << p.numHypotheses << ";";
+				}
+				*out << std::endl;
+			}
+			*out << "\t#rejected key point / surface area / cascade / dense verify: " << std::to_string(numRejectedKeyPoint) << " / " << std::to_string(numRejectedSurfaceArea)
+				<< " / " << std::to_string(numRejectedCascade) << " / " << std::to_string(numRejectedDenseVerify) << " (#accepted cascade: " << std::to_string(numAcceptedCascade) << ")" << std::endl;
 			if (printDepthSensing) {
 				*out << "\tTime Process Input: " << std::to_string(timeSensorProcess) << "ms" << std::endl;
 				*out << "\tTime Re-Integrate: " << std::to_string(timeReIntegrate) << "ms" << std::endl;
@@ -67,6 +103,7 @@ public:
 
 	static void printAllTimings(const std::string& dir = "./timings/")
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		if (!util::directoryExists(dir)) util::makeDirectory(dir);
 		std::string read;
 		if (m_totalFrameTimings.empty())
@@ -117,7 +154,7 @@ public:
 		}
 	}
 
-	static void printExcelTimings(std::ofstream* out, const std::string& separator, std::vector<FrameTiming>& frameTimings, bool printDepthSensing)
+	static void printExcelTimings(std::ofstream* out, const std::string& separator, std::deque<FrameTiming>& frameTimings, bool printDepthSensing)
 	{
 		*out << "SIFT Detection";
 		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].timeSiftDetection;
@@ -143,6 +180,24 @@ public:
 		*out << "Solve #Iters";
 		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numItersSolve;
 		*out << std::endl;
+		*out << "Ransac #Hypotheses";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numRansacHypotheses;
+		*out << std::endl;
+		*out << "Key Point #Rejected";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numRejectedKeyPoint;
+		*out << std::endl;
+		*out << "Surface Area #Rejected";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numRejectedSurfaceArea;
+		*out << std::endl;
+		*out << "Cascade #Rejected";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numRejectedCascade;
+		*out << std::endl;
+		*out << "Cascade #Accepted";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numAcceptedCascade;
+		*out << std::endl;
+		*out << "Dense Verify #Rejected";
+		for (unsigned int i = 0; i < frameTimings.size(); i++) *out << separator << frameTimings[i].numRejectedDenseVerify;
+		*out << std::endl;
 
 		if (printDepthSensing) {
 			*out << "Process Input";
@@ -160,7 +215,7 @@ public:
 		}
 	}
 
-	static void printAverages(std::ofstream* out, const std::string& separator, std::vector<FrameTiming>& frameTimings, bool printDepthSensing)
+	static void printAverages(std::ofstream* out, const std::string& separator, std::deque<FrameTiming>& frameTimings, bool printDepthSensing)
 	{
 		double sum = 0.0f; unsigned int count = 0;
 		*out << "Average times:" << std::endl;
@@ -220,6 +275,7 @@ public:
 
 	static void printCurrentLocalFrame()
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		if (m_localFrameTimings.empty()) return;
 
 		std::ostream &out = std::cout;
@@ -229,6 +285,7 @@ public:
 
 	static void printCurrentGlobalFrame()
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		if (m_globalFrameTimings.empty()) return;
 
 		std::ostream &out = std::cout;
@@ -238,33 +295,52 @@ public:
 
 	static void resetTimings()
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		m_localFrameTimings.clear();
 		m_globalFrameTimings.clear();
 		m_totalFrameTimings.clear();
 	}
 
-	static void addLocalFrameTiming()
+	//! local timings are indexed by input frame: recon runs ahead of bundling, and the solver runs on its own thread,
+	//! so each thread records into the frame it is working on (set here, per thread)
+	static void setCurrentLocalFrame(unsigned int frameIdx)
+	{
+		s_currentLocalFrame = (int)frameIdx;
+	}
+	static void addLocalFrameTiming(unsigned int frameIdx)
 	{
-		m_localFrameTimings.push_back(FrameTiming());
+		setCurrentLocalFrame(frameIdx);
+		getFrameTiming(true);
 	}
 	static void addGlobalFrameTiming()
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		m_globalFrameTimings.push_back(FrameTiming());
+		s_currentGlobalFrame = (int)m_globalFrameTimings.size() - 1;
 	}
 
+	//! the returned reference stays valid while other threads add frames (deque)
 	static FrameTiming& getFrameTiming(bool local)
 	{
-		if (local) return m_localFrameTimings.back();
-		else return m_globalFrameTimings.back();
+		std::lock_guard<std::mutex> lock(s_mutex);
+		std::deque<FrameTiming>& frameTimings = local ? m_localFrameTimings : m_globalFrameTimings;
+		int frameIdx = local ? s_currentLocalFrame : s_currentGlobalFrame;
+		if (frameIdx < 0) frameIdx = std::max((int)frameTimings.size() - 1, 0); //no frame set on this thread: latest one
+		while ((int)frameTimings.size() <= frameIdx) frameTimings.push_back(FrameTiming());
+		return frameTimings[frameIdx];
 	}
 
 	static void addTotalFrameTime(double t)
 	{
+		std::lock_guard<std::mutex> lock(s_mutex);
 		m_totalFrameTimings.push_back(t);
 	}
 
 private:
-	static std::vector<FrameTiming> m_localFrameTimings;
-	static std::vector<FrameTiming> m_globalFrameTimings;
+	static std::deque<FrameTiming> m_localFrameTimings;
+	static std::deque<FrameTiming> m_globalFrameTimings;
 	static std::vector<double> m_totalFrameTimings;
+	static std::mutex s_mutex;
+	static thread_local int s_currentLocalFrame;
+	static thread_local int s_currentGlobalFrame;
 };
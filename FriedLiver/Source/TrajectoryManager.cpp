@@ -165,6 +165,18 @@ bool TrajectoryManager::getTopFromDeIntegrateList(mat4f& trans, unsigned int& fr
 	return true;
 }
 
+bool TrajectoryManager::getNextFrameIdx(unsigned int& frameIdx)
+{
+	m_mutexUpdateTransforms.lock();
+	const std::list<TrajectoryFrame*>* list = NULL;
+	if (!m_toDeIntegrateList.empty()) list = &m_toDeIntegrateList;
+	else if (!m_toIntegrateList.empty()) list = &m_toIntegrateList;
+	else if (!m_toReIntegrateList.empty()) list = &m_toReIntegrateList;
+	if (list) frameIdx = list->front()->frameIdx;
+	m_mutexUpdateTransforms.unlock();
+	return list != NULL;
+}
+
 const std::vector<TrajectoryManager::TrajectoryFrame>& TrajectoryManager::getFrames() const
 {
 	return m_frames;
@@ -39,6 +39,8 @@ public:
 	bool getTopFromReIntegrateList(mat4f& oldTransform, mat4f& newTransform, unsigned int& frameIdx);
 	bool getTopFromIntegrateList(mat4f& trans, unsigned int& frameIdx);
 	bool getTopFromDeIntegrateList(mat4f& trans, unsigned int& frameIdx);
+	//! frame of the next getTopFrom*List call (in the order reintegrate() asks); for prefetching its input
+	bool getNextFrameIdx(unsigned int& frameIdx);
 
 
 	const std::vector<TrajectoryFrame>& getFrames() const;